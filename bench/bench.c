@@ -0,0 +1,238 @@
+/**
+memreader_bench: starts bench/fixture.c, then runs bench/bench.lua against
+it with memreader linked in statically.
+
+Usage: memreader_bench [--format json|csv] [--output file] [--filter pattern]
+                       [--time seconds] [--fixture path] [--script path]
+*/
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "utils.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define FIXTURE_NAME "memreader_fixture.exe"
+#else
+#include <sys/wait.h>
+#include <unistd.h>
+#define FIXTURE_NAME "memreader_fixture"
+#endif
+
+#ifndef MEMREADER_BENCH_SCRIPT
+#define MEMREADER_BENCH_SCRIPT "bench.lua"
+#endif
+
+LUALIB_API int luaopen_memreader(lua_State *L);
+
+typedef struct {
+	FILE* output; // the fixture's stdout
+#ifdef _WIN32
+	HANDLE process;
+	HANDLE input;
+#else
+	pid_t pid;
+	int input;
+#endif
+} fixture_t;
+
+#ifdef _WIN32
+static BOOL fixture_start(fixture_t* fixture, const char* path)
+{
+	SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+	HANDLE inRead, inWrite, outRead, outWrite;
+	if (!CreatePipe(&inRead, &inWrite, &sa, 0))
+		return FALSE;
+	if (!CreatePipe(&outRead, &outWrite, &sa, 0))
+		return FALSE;
+	SetHandleInformation(inWrite, HANDLE_FLAG_INHERIT, 0);
+	SetHandleInformation(outRead, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFOA si;
+	PROCESS_INFORMATION pi;
+	memset(&si, 0, sizeof(si));
+	si.cb = sizeof(si);
+	si.dwFlags = STARTF_USESTDHANDLES;
+	si.hStdInput = inRead;
+	si.hStdOutput = outWrite;
+	si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+	char commandLine[MAX_PATH + 2];
+	_snprintf_s(commandLine, sizeof(commandLine), _TRUNCATE, "\"%s\"", path);
+	BOOL started = CreateProcessA(path, commandLine, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
+	CloseHandle(inRead);
+	CloseHandle(outWrite);
+	if (!started)
+		return FALSE;
+
+	CloseHandle(pi.hThread);
+	fixture->process = pi.hProcess;
+	fixture->input = inWrite;
+	fixture->output = _fdopen(_open_osfhandle((intptr_t)outRead, _O_RDONLY), "r");
+	return fixture->output != NULL;
+}
+
+static void fixture_stop(fixture_t* fixture)
+{
+	CloseHandle(fixture->input);
+	WaitForSingleObject(fixture->process, INFINITE);
+	CloseHandle(fixture->process);
+	fclose(fixture->output);
+}
+#else
+static BOOL fixture_start(fixture_t* fixture, const char* path)
+{
+	int in[2], out[2];
+	if (pipe(in) != 0)
+		return FALSE;
+	if (pipe(out) != 0)
+		return FALSE;
+
+	fixture->pid = fork();
+	if (fixture->pid < 0)
+		return FALSE;
+	if (fixture->pid == 0)
+	{
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		close(in[0]);
+		close(in[1]);
+		close(out[0]);
+		close(out[1]);
+		execl(path, path, (char*)NULL);
+		_exit(127);
+	}
+
+	close(in[0]);
+	close(out[1]);
+	fixture->input = in[1];
+	fixture->output = fdopen(out[0], "r");
+	return fixture->output != NULL;
+}
+
+static void fixture_stop(fixture_t* fixture)
+{
+	close(fixture->input);
+	waitpid(fixture->pid, NULL, 0);
+	fclose(fixture->output);
+}
+#endif
+
+// BENCH.now() is a monotonic clock in nanoseconds
+static int bench_now(lua_State *L)
+{
+	lua_pushnumber(L, (lua_Number)platform_time_ns());
+	return 1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: memreader_bench [--format json|csv] [--output file] [--filter pattern]\n"
+		"                       [--time seconds] [--fixture path] [--script path]\n");
+	exit(2);
+}
+
+// The fixture is expected next to memreader_bench, unless given
+static void default_fixture_path(const char* argv0, char* path, size_t size)
+{
+	const char* slash = NULL;
+	const char* c;
+	for (c = argv0; *c; c++)
+	{
+		if (*c == '/' || *c == '\\')
+			slash = c;
+	}
+	size_t dir = slash ? (size_t)(slash - argv0) + 1 : 0;
+	if (dir + sizeof(FIXTURE_NAME) > size)
+		dir = 0;
+	memcpy(path, argv0, dir);
+	memcpy(path + dir, FIXTURE_NAME, sizeof(FIXTURE_NAME));
+}
+
+int main(int argc, char** argv)
+{
+	const char* format = "json";
+	const char* output = NULL;
+	const char* filter = NULL;
+	const char* script = MEMREADER_BENCH_SCRIPT;
+	double time = 0.2;
+	char fixturePath[MAX_PATH];
+	int i;
+
+	default_fixture_path(argc > 0 ? argv[0] : "", fixturePath, sizeof(fixturePath));
+	for (i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+			usage();
+		if (strcmp(argv[i], "--format") == 0)
+			format = argv[++i];
+		else if (strcmp(argv[i], "--output") == 0)
+			output = argv[++i];
+		else if (strcmp(argv[i], "--filter") == 0)
+			filter = argv[++i];
+		else if (strcmp(argv[i], "--time") == 0)
+			time = atof(argv[++i]);
+		else if (strcmp(argv[i], "--fixture") == 0)
+			copy_string(fixturePath, sizeof(fixturePath), argv[++i]);
+		else if (strcmp(argv[i], "--script") == 0)
+			script = argv[++i];
+		else
+			usage();
+	}
+	if ((strcmp(format, "json") != 0 && strcmp(format, "csv") != 0) || time <= 0)
+		usage();
+
+	fixture_t fixture;
+	char line[1024];
+	if (!fixture_start(&fixture, fixturePath) || !fgets(line, sizeof(line), fixture.output))
+	{
+		fprintf(stderr, "memreader_bench: couldn't start the fixture (%s)\n", fixturePath);
+		return 1;
+	}
+
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+
+	// make require("memreader") find the statically linked module
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "preload");
+	lua_pushcfunction(L, luaopen_memreader);
+	lua_setfield(L, -2, "memreader");
+	lua_pop(L, 2);
+
+	lua_newtable(L);
+	lua_pushstring(L, line);
+	lua_setfield(L, -2, "fixture");
+	lua_pushstring(L, format);
+	lua_setfield(L, -2, "format");
+	if (output)
+	{
+		lua_pushstring(L, output);
+		lua_setfield(L, -2, "output");
+	}
+	if (filter)
+	{
+		lua_pushstring(L, filter);
+		lua_setfield(L, -2, "filter");
+	}
+	lua_pushnumber(L, time);
+	lua_setfield(L, -2, "time");
+	lua_pushcfunction(L, bench_now);
+	lua_setfield(L, -2, "now");
+	lua_setglobal(L, "BENCH");
+
+	int status = luaL_dofile(L, script);
+	if (status != 0)
+		fprintf(stderr, "memreader_bench: %s\n", lua_tostring(L, -1));
+
+	lua_close(L);
+	fixture_stop(&fixture);
+	return status == 0 ? 0 : 1;
+}
\ No newline at end of file
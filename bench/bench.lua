@@ -0,0 +1,226 @@
+-- The benchmarks of memreader_bench (see bench.c), reading from the fixture
+-- process (see fixture.c). Every benchmark is run with a growing number of
+-- iterations until one run takes at least BENCH.time seconds.
+
+local memreader = require("memreader")
+local now = BENCH.now
+
+local fixture = {}
+for key, value in BENCH.fixture:gmatch("(%w+)=(%S+)") do
+  fixture[key] = tonumber(value) or value
+end
+
+local process = assert(memreader.openprocess(fixture.pid))
+local results = {}
+
+-- Records the ns/op of fn(n) (which should do n operations), and the GB/s if each op transfers bytes
+local function bench(name, size, bytes, fn)
+  if BENCH.filter and not name:find(BENCH.filter) then
+    return
+  end
+
+  local target = BENCH.time * 1e9
+  local n, elapsed = 1, 0
+  fn(1)
+  while true do
+    local start = now()
+    fn(n)
+    elapsed = now() - start
+    if elapsed >= target or n >= 2^30 then
+      break
+    end
+    -- aim a bit past the target, but grow at most 100x at a time in case the first runs were noise
+    local scale = elapsed > 0 and target / elapsed * 1.2 or 100
+    n = math.floor(n * math.max(2, math.min(scale, 100)))
+  end
+
+  results[#results + 1] = {
+    name = name,
+    size = size,
+    ops = n,
+    ns = elapsed / n,
+    gbps = bytes > 0 and bytes * n / elapsed or nil,
+  }
+end
+
+local data, datasize = fixture.data, fixture.datasize
+
+-- Single reads
+
+for _, size in ipairs({8, 64, 4096, 65536, 1048576}) do
+  bench("read", size, size, function(n)
+    for _ = 1, n do
+      process:read(data, size)
+    end
+  end)
+end
+
+local buffer = memreader.buffer(1048576)
+for _, size in ipairs({8, 64, 4096, 65536, 1048576}) do
+  bench("readinto", size, size, function(n)
+    for _ = 1, n do
+      process:readinto(buffer, data, size)
+    end
+  end)
+end
+
+-- Batched reads: size is the number of 64-byte requests, each on its own page
+
+for _, count in ipairs({1, 16, 256, 1024}) do
+  local requests = {}
+  for i = 1, count do
+    requests[i] = {data + (i - 1) * 4096, 64}
+  end
+  bench("readv", count, count * 64, function(n)
+    for _ = 1, n do
+      process:readv(requests, true)
+    end
+  end)
+end
+
+-- Typed reads, with addresses returned as usertypes and then as numbers
+
+local typeSizes = {u8 = 1, u32 = 4, u64 = 8, f32 = 4, f64 = 8, ptr = process.pointersize}
+for _, type in ipairs({"u8", "u32", "u64", "f32", "f64", "ptr"}) do
+  local read = process["read" .. type]
+  bench("read" .. type, typeSizes[type], typeSizes[type], function(n)
+    for _ = 1, n do
+      read(process, data)
+    end
+  end)
+end
+
+local mode = memreader.addressmode("integer")
+bench("readptr (integer)", process.pointersize, process.pointersize, function(n)
+  for _ = 1, n do
+    process:readptr(data)
+  end
+end)
+memreader.addressmode(mode)
+
+-- Structs
+
+local Record = memreader.struct({
+  {"id", "u32", 0},
+  {"x", "f32", 4},
+  {"y", "f32", 8},
+  {"z", "f32", 12},
+  {"flags", "u64", 16},
+}, fixture.recordsize)
+
+local record = {}
+bench("readstruct", 1, fixture.recordsize, function(n)
+  for _ = 1, n do
+    process:readstruct(Record, fixture.records, record)
+  end
+end)
+
+for _, count in ipairs({64, fixture.recordcount}) do
+  local records = {}
+  bench("readstructs", count, count * fixture.recordsize, function(n)
+    for _ = 1, n do
+      process:readstructs(Record, fixture.records, count, records)
+    end
+  end)
+end
+
+-- Pointer chains, from an address and from the main module (which also looks it up by name)
+
+local offsets = {0}
+for i = 1, fixture.chaindepth - 1 do
+  offsets[#offsets + 1] = 0
+end
+offsets[#offsets + 1] = 8
+local _, value = process:readchain(fixture.root, offsets, "u32")
+assert(value == fixture.chainvalue, "the fixture's pointer chain couldn't be followed")
+
+bench("readchain", fixture.chaindepth, 0, function(n)
+  for _ = 1, n do
+    process:readchain(fixture.root, offsets, "u32")
+  end
+end)
+
+local module = assert(process:module(fixture.module))
+local moduleOffsets = {(fixture.root - module.base):tointeger()}
+for i = 2, #offsets do
+  moduleOffsets[i] = offsets[i]
+end
+bench("readchain (module)", fixture.chaindepth, 0, function(n)
+  for _ = 1, n do
+    process:readchain(fixture.module, moduleOffsets, "u32")
+  end
+end)
+
+-- Module lookups
+
+bench("module", 0, 0, function(n)
+  for _ = 1, n do
+    process:module(fixture.module)
+  end
+end)
+
+bench("moduleat", 0, 0, function(n)
+  for _ = 1, n do
+    process:moduleat(fixture.root)
+  end
+end)
+
+-- Pattern scans over the start of the data, on every CPU and on one thread
+
+local pattern = "4D 52 42 45 4E 43 48 21"
+local matches = assert(process:findpattern(pattern, {data, datasize}))
+assert(#matches == fixture.patterncount, "the fixture's patterns weren't all found")
+
+for _, size in ipairs({1048576, 16777216, datasize}) do
+  bench("findpattern", size, size, function(n)
+    for _ = 1, n do
+      process:findpattern(pattern, {data, size})
+    end
+  end)
+  bench("findpattern (1 thread)", size, size, function(n)
+    for _ = 1, n do
+      process:findpattern(pattern, {data, size}, nil, 1)
+    end
+  end)
+end
+
+-- Snapshots of the writable memory (mostly the data); size is the number of bytes captured
+
+local snapshotSize = assert(process:snapshot({writable = true})).size
+collectgarbage()
+bench("snapshot", snapshotSize, snapshotSize, function(n)
+  for _ = 1, n do
+    process:snapshot({writable = true})
+    collectgarbage()
+  end
+end)
+
+-- Output
+
+local out = BENCH.output and assert(io.open(BENCH.output, "w")) or io.stdout
+
+local function number(value)
+  return value and string.format("%.3f", value) or (BENCH.format == "json" and "null" or "")
+end
+
+if BENCH.format == "csv" then
+  out:write("name,size,ops,ns_per_op,gb_per_s\n")
+  for _, result in ipairs(results) do
+    out:write(string.format("%s,%.0f,%.0f,%s,%s\n", result.name, result.size, result.ops, number(result.ns), number(result.gbps)))
+  end
+else
+  out:write("{\n")
+  out:write(string.format('  "lua": "%s",\n', _VERSION))
+  out:write(string.format('  "pointersize": %.0f,\n', process.pointersize))
+  out:write(string.format('  "date": "%s",\n', os.date("!%Y-%m-%dT%H:%M:%SZ")))
+  out:write('  "results": [\n')
+  for i, result in ipairs(results) do
+    out:write(string.format('    {"name": "%s", "size": %.0f, "ops": %.0f, "ns_per_op": %s, "gb_per_s": %s}%s\n',
+      result.name, result.size, result.ops, number(result.ns), number(result.gbps), i < #results and "," or ""))
+  end
+  out:write("  ]\n}\n")
+end
+
+if out ~= io.stdout then
+  out:close()
+end
\ No newline at end of file
@@ -0,0 +1,125 @@
+/**
+The target process for memreader_bench: sets up known data at addresses it
+prints on stdout (as one line of key=value pairs, in decimal), then waits
+until its stdin is closed.
+
+- data: datasize bytes of pseudo-random data, with the 8-byte pattern
+  "MRBENCH!" at patternoffset + i * patternstride
+- root: a global pointer to the first node of a chain of chaindepth nodes,
+  each node's next pointer at offset 0 and the last node's value
+  (chainvalue, a u32) at offset 8
+- records: recordcount structs of recordsize bytes: {u32 id, f32 x, f32 y,
+  f32 z, u64 flags}
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define fixture_pid() ((unsigned long)GetCurrentProcessId())
+#else
+#include <unistd.h>
+#define fixture_pid() ((unsigned long)getpid())
+#endif
+
+#define DATA_SIZE (64 * 1024 * 1024)
+#define PATTERN_OFFSET 0x1234
+#define PATTERN_STRIDE (1024 * 1024)
+#define CHAIN_DEPTH 4
+#define CHAIN_VALUE 0xC0FFEE
+#define RECORD_COUNT 4096
+
+typedef struct node_t {
+	struct node_t* next;
+	uint32_t value;
+	float weight;
+} node_t;
+
+typedef struct {
+	uint32_t id;
+	float x, y, z;
+	uint64_t flags;
+} record_t;
+
+// built from characters so that the pattern itself isn't in the image
+static char pattern[9];
+
+static node_t nodes[CHAIN_DEPTH];
+node_t* root;
+
+static record_t records[RECORD_COUNT];
+
+// The last path component of argv[0], which is what memreader calls the main module
+static const char* module_name(const char* path)
+{
+	const char* name = path;
+	const char* c;
+	for (c = path; *c; c++)
+	{
+		if (*c == '/' || *c == '\\')
+			name = c + 1;
+	}
+	return name;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned char* data = (unsigned char*)malloc(DATA_SIZE);
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	size_t i;
+
+	if (!data)
+		return 1;
+
+	// xorshift64, so the data is incompressible and the same on every run
+	for (i = 0; i < DATA_SIZE; i += sizeof(uint64_t))
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		memcpy(data + i, &state, sizeof(uint64_t));
+	}
+
+	strcpy(pattern, "MRBENCH");
+	pattern[7] = '!';
+	size_t patterns = 0;
+	for (i = PATTERN_OFFSET; i + 8 <= DATA_SIZE; i += PATTERN_STRIDE)
+	{
+		memcpy(data + i, pattern, 8);
+		patterns++;
+	}
+
+	for (i = 0; i < CHAIN_DEPTH; i++)
+	{
+		nodes[i].next = i + 1 < CHAIN_DEPTH ? &nodes[i + 1] : NULL;
+		nodes[i].value = i + 1 < CHAIN_DEPTH ? 0 : CHAIN_VALUE;
+		nodes[i].weight = (float)i;
+	}
+	root = &nodes[0];
+
+	for (i = 0; i < RECORD_COUNT; i++)
+	{
+		records[i].id = (uint32_t)i;
+		records[i].x = (float)i;
+		records[i].y = (float)i * 2;
+		records[i].z = (float)i * 3;
+		records[i].flags = (uint64_t)i << 32 | 1;
+	}
+
+	printf("pid=%lu data=%llu datasize=%lu patternoffset=%d patternstride=%d patterncount=%lu"
+		" root=%llu chaindepth=%d chainvalue=%d records=%llu recordcount=%d recordsize=%lu module=%s\n",
+		fixture_pid(), (unsigned long long)(uintptr_t)data, (unsigned long)DATA_SIZE,
+		PATTERN_OFFSET, PATTERN_STRIDE, (unsigned long)patterns,
+		(unsigned long long)(uintptr_t)&root, CHAIN_DEPTH, CHAIN_VALUE,
+		(unsigned long long)(uintptr_t)records, RECORD_COUNT, (unsigned long)sizeof(record_t),
+		module_name(argc > 0 ? argv[0] : "memreader_fixture"));
+	fflush(stdout);
+
+	while (getchar() != EOF)
+		;
+
+	free(data);
+	return 0;
+}
\ No newline at end of file
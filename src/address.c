@@ -14,11 +14,64 @@ memaddress_t* push_memaddress(lua_State *L)
 	return addr;
 }
 
+// Whether the address survives being a Lua number (always, with 5.3's 64-bit integers)
+static BOOL address_fits_number(LONG_PTR value)
+{
+#if LUA_VERSION_NUM >= 503
+	return sizeof(lua_Integer) >= sizeof(LONG_PTR);
+#else
+	return value >= -((LONG_PTR)1 << 53) && value <= ((LONG_PTR)1 << 53);
+#endif
+}
+
+static void push_address_number(lua_State *L, LONG_PTR value)
+{
+#if LUA_VERSION_NUM >= 503
+	lua_pushinteger(L, (lua_Integer)value);
+#else
+	lua_pushnumber(L, (lua_Number)value);
+#endif
+}
+
+/**
+In userdata mode, ADDRESS_CACHE is a weak table of the live address
+userdata by value, so that the same address is always the same userdata:
+they can be used as table keys, and getting an address that is already
+around (like module.base) allocates nothing. In integer mode, it's false.
+*/
+void push_address(lua_State *L, LPCVOID ptr)
+{
+	LONG_PTR value = (LONG_PTR)ptr;
+	BOOL fits = address_fits_number(value);
+
+	lua_getfield(L, LUA_REGISTRYINDEX, ADDRESS_CACHE);
+	if (!fits || !lua_istable(L, -1))
+	{
+		lua_pop(L, 1);
+		if (fits)
+			push_address_number(L, value);
+		else
+			push_memaddress(L)->ptr = (LPVOID)ptr;
+		return;
+	}
+
+	push_address_number(L, value);
+	lua_rawget(L, -2);
+	if (lua_isnil(L, -1))
+	{
+		lua_pop(L, 1);
+		push_memaddress(L)->ptr = (LPVOID)ptr;
+		push_address_number(L, value);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, -4);
+	}
+	lua_remove(L, -2);
+}
+
 // for field access
 int udata_field_get_memaddress(lua_State *L, void *v)
 {
-	memaddress_t *memaddress = push_memaddress(L);
-	memaddress->ptr = *(LPVOID*)v;
+	push_address(L, *(LPVOID*)v);
 	return 1;
 }
 
@@ -47,8 +100,7 @@ static int memaddress_add(lua_State *L)
 {
 	LONG_PTR a = memaddress_checkptr(L, 1);
 	LONG_PTR b = memaddress_checkptr(L, 2);
-	memaddress_t* result = push_memaddress(L);
-	result->ptr = (LPVOID)(a + b);
+	push_address(L, (LPCVOID)(a + b));
 	return 1;
 }
 
@@ -56,8 +108,104 @@ static int memaddress_sub(lua_State *L)
 {
 	LONG_PTR a = memaddress_checkptr(L, 1);
 	LONG_PTR b = memaddress_checkptr(L, 2);
-	memaddress_t* result = push_memaddress(L);
-	result->ptr = (LPVOID)(a - b);
+	push_address(L, (LPCVOID)(a - b));
+	return 1;
+}
+
+static int memaddress_band(lua_State *L)
+{
+	LONG_PTR a = memaddress_checkptr(L, 1);
+	LONG_PTR b = memaddress_checkptr(L, 2);
+	push_address(L, (LPCVOID)(a & b));
+	return 1;
+}
+
+// Addresses compare as unsigned numbers
+static int memaddress_eq(lua_State *L)
+{
+	lua_pushboolean(L, memaddress_checkptr(L, 1) == memaddress_checkptr(L, 2));
+	return 1;
+}
+
+static int memaddress_lt(lua_State *L)
+{
+	lua_pushboolean(L, (uintptr_t)memaddress_checkptr(L, 1) < (uintptr_t)memaddress_checkptr(L, 2));
+	return 1;
+}
+
+static int memaddress_le(lua_State *L)
+{
+	lua_pushboolean(L, (uintptr_t)memaddress_checkptr(L, 1) <= (uintptr_t)memaddress_checkptr(L, 2));
+	return 1;
+}
+
+static uintptr_t check_alignment(lua_State *L, int index)
+{
+	lua_Integer alignment = luaL_checkinteger(L, index);
+	luaL_argcheck(L, alignment > 0, index, "alignment must be positive");
+	return (uintptr_t)alignment;
+}
+
+// address:align(n) rounds the address up to a multiple of n
+static int memaddress_align(lua_State *L)
+{
+	uintptr_t value = (uintptr_t)memaddress_checkptr(L, 1);
+	uintptr_t alignment = check_alignment(L, 2);
+	push_address(L, (LPCVOID)((value + alignment - 1) / alignment * alignment));
+	return 1;
+}
+
+static int memaddress_is_aligned(lua_State *L)
+{
+	uintptr_t value = (uintptr_t)memaddress_checkptr(L, 1);
+	uintptr_t alignment = check_alignment(L, 2);
+	lua_pushboolean(L, value % alignment == 0);
+	return 1;
+}
+
+static int memaddress_to_integer(lua_State *L)
+{
+	LONG_PTR value = memaddress_checkptr(L, 1);
+	if (!address_fits_number(value))
+		return push_error(L, "address doesn't fit in a number");
+	push_address_number(L, value);
+	return 1;
+}
+
+static void set_address_mode(lua_State *L, BOOL integers)
+{
+	if (integers)
+		lua_pushboolean(L, FALSE);
+	else
+	{
+		lua_newtable(L);
+		lua_createtable(L, 0, 1);
+		lua_pushliteral(L, "v");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+	}
+	lua_setfield(L, LUA_REGISTRYINDEX, ADDRESS_CACHE);
+}
+
+/**
+memreader.addressmode([mode])
+
+Sets how addresses are returned: "userdata" (memreader.address, the
+default) or "integer" (plain numbers). Returns the previous mode.
+*/
+int memreader_addressmode(lua_State *L)
+{
+	static const char* const modes[] = { "userdata", "integer", NULL };
+
+	lua_getfield(L, LUA_REGISTRYINDEX, ADDRESS_CACHE);
+	int previous = lua_istable(L, -1) ? 0 : 1;
+	lua_pop(L, 1);
+
+	int mode = luaL_checkoption(L, 1, modes[previous], modes);
+	if (mode != previous)
+		set_address_mode(L, mode == 1);
+
+	lua_pushstring(L, modes[previous]);
 	return 1;
 }
 
@@ -65,6 +213,16 @@ static const luaL_Reg memaddress_meta[] = {
 	{ "__tostring", memaddress_tostring },
 	{ "__add", memaddress_add },
 	{ "__sub", memaddress_sub },
+	{ "__band", memaddress_band },
+	{ "__eq", memaddress_eq },
+	{ "__lt", memaddress_lt },
+	{ "__le", memaddress_le },
+	{ NULL, NULL }
+};
+static const luaL_Reg memaddress_methods[] = {
+	{ "align", memaddress_align },
+	{ "isaligned", memaddress_is_aligned },
+	{ "tointeger", memaddress_to_integer },
 	{ NULL, NULL }
 };
 
@@ -72,6 +230,10 @@ int register_memaddress(lua_State *L)
 {
 	luaL_newmetatable(L, MEMORY_ADDRESS_T);
 	luaL_setfuncs(L, memaddress_meta, 0);
+	luaL_newlib(L, memaddress_methods);
+	lua_setfield(L, -2, "__index");
 	lua_pop(L, 1);
+
+	set_address_mode(L, FALSE);
 	return 0;
-}
\ No newline at end of file
+}
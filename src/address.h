@@ -4,6 +4,8 @@
 #include "memreader.h"
 
 #define MEMORY_ADDRESS_T MEMREADER_METATABLE(address)
+// Registry field with the address cache (or false in integer mode), see push_address
+#define ADDRESS_CACHE MEMREADER_METATABLE(addresscache)
 
 typedef struct {
 	LPVOID ptr;
@@ -11,10 +13,13 @@ typedef struct {
 
 memaddress_t* check_memaddress(lua_State *L, int index);
 memaddress_t* push_memaddress(lua_State *L);
+// Pushes an address the way memreader.addressmode() says to: as a (shared) memreader.address, or as a number
+void push_address(lua_State *L, LPCVOID ptr);
 int udata_field_get_memaddress(lua_State *L, void *v);
 
 LONG_PTR memaddress_checkptr(lua_State *L, int index);
 
+int memreader_addressmode(lua_State *L);
 int register_memaddress(lua_State *L);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,489 @@
+#include "async.h"
+#include "address.h"
+
+static async_request_t* check_request(lua_State *L, int index)
+{
+	async_request_t* request = (async_request_t*)luaL_checkudata(L, index, ASYNC_REQUEST_T);
+	return request;
+}
+
+static void queue_release(async_queue_t* queue)
+{
+	pool_mutex_lock(&queue->lock);
+	int refs = --queue->refs;
+	pool_mutex_unlock(&queue->lock);
+	if (refs > 0)
+		return;
+
+	if (queue->hasNotifier)
+		platform_notifier_close(&queue->notifier);
+	pool_cond_destroy(&queue->submitted);
+	pool_cond_destroy(&queue->finished);
+	pool_mutex_destroy(&queue->lock);
+	free(queue);
+}
+
+// Gets the completion queue of the Lua state, creating it on first use
+static async_queue_t* get_queue(lua_State *L)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, ASYNC_QUEUE);
+	async_queue_t** holder = (async_queue_t**)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	if (holder)
+		return *holder;
+
+	async_queue_t* queue = (async_queue_t*)calloc(1, sizeof(async_queue_t));
+	if (!queue)
+		return NULL;
+	pool_mutex_init(&queue->lock);
+	pool_cond_init(&queue->submitted);
+	pool_cond_init(&queue->finished);
+	queue->hasNotifier = platform_notifier_open(&queue->notifier);
+	queue->refs = 1;
+
+	holder = (async_queue_t**)lua_newuserdata(L, sizeof(async_queue_t*));
+	*holder = queue;
+	luaL_getmetatable(L, ASYNC_QUEUE_T);
+	lua_setmetatable(L, -2);
+	lua_setfield(L, LUA_REGISTRYINDEX, ASYNC_QUEUE);
+	return queue;
+}
+
+// The Lua state is being closed: requests that haven't started are left pending, and the workers are joined
+static int queue_gc(lua_State *L)
+{
+	async_queue_t** holder = (async_queue_t**)luaL_checkudata(L, 1, ASYNC_QUEUE_T);
+	async_queue_t* queue = *holder;
+	int i;
+	if (!queue)
+		return 0;
+
+	pool_mutex_lock(&queue->lock);
+	queue->stopping = TRUE;
+	pool_cond_broadcast(&queue->submitted);
+	pool_mutex_unlock(&queue->lock);
+	for (i = 0; i < queue->workerCount; i++)
+		pool_thread_join(&queue->workers[i]);
+	queue_release(queue);
+	*holder = NULL;
+	return 0;
+}
+
+static void request_run(async_request_t* request)
+{
+	if (request->kind == ASYNC_READ)
+		request->success = platform_read(request->process, request->address, request->buffer, request->size, &request->bytesRead);
+	else
+		request->success = pattern_search(request->process, request->pattern, request->start, request->end, request->max, request->workers, &request->matches);
+	if (!request->success)
+		request->error = platform_last_error();
+}
+
+// Takes the oldest pending request, or returns NULL once the queue is stopping; the lock is held
+static async_request_t* queue_take(async_queue_t* queue)
+{
+	while (!queue->pendingHead && !queue->stopping)
+	{
+		queue->idle++;
+		pool_cond_wait(&queue->submitted, &queue->lock);
+		queue->idle--;
+	}
+	if (queue->stopping)
+		return NULL;
+
+	async_request_t* request = queue->pendingHead;
+	queue->pendingHead = request->next;
+	if (!queue->pendingHead)
+		queue->pendingTail = NULL;
+	request->state = ASYNC_RUNNING;
+	return request;
+}
+
+static void worker_main(void* arg)
+{
+	async_queue_t* queue = (async_queue_t*)arg;
+	async_request_t* request;
+
+	pool_mutex_lock(&queue->lock);
+	while ((request = queue_take(queue)) != NULL)
+	{
+		pool_mutex_unlock(&queue->lock);
+		request_run(request);
+		POOL_STORE_RELEASE(&request->done, 1);
+		pool_mutex_lock(&queue->lock);
+
+		request->state = ASYNC_FINISHED;
+		request->next = NULL;
+		if (queue->tail)
+			queue->tail->next = request;
+		else
+			queue->head = request;
+		queue->tail = request;
+		request->queued = TRUE;
+		if (queue->hasNotifier)
+			platform_notifier_signal(&queue->notifier);
+		pool_cond_broadcast(&queue->finished);
+	}
+	pool_mutex_unlock(&queue->lock);
+}
+
+// Takes the request out of the pending list, if it's in it; the lock is held
+static void pending_remove(async_queue_t* queue, async_request_t* request)
+{
+	async_request_t* prev = NULL;
+	async_request_t* it = queue->pendingHead;
+	if (request->state != ASYNC_PENDING)
+		return;
+	while (it != request)
+	{
+		prev = it;
+		it = it->next;
+	}
+	if (prev)
+		prev->next = request->next;
+	else
+		queue->pendingHead = request->next;
+	if (queue->pendingTail == request)
+		queue->pendingTail = prev;
+	request->state = ASYNC_NEW;
+}
+
+// Waits for a request that's pending or running to finish
+static void request_join(async_request_t* request)
+{
+	async_queue_t* queue = request->queue;
+	pool_mutex_lock(&queue->lock);
+	while (request->state == ASYNC_PENDING || request->state == ASYNC_RUNNING)
+		pool_cond_wait(&queue->finished, &queue->lock);
+	pool_mutex_unlock(&queue->lock);
+}
+
+// Takes the request out of the completion queue, if it's in it
+static void queue_remove(async_queue_t* queue, async_request_t* request)
+{
+	pool_mutex_lock(&queue->lock);
+	if (request->queued)
+	{
+		async_request_t* prev = NULL;
+		async_request_t* it = queue->head;
+		while (it != request)
+		{
+			prev = it;
+			it = it->next;
+		}
+		if (prev)
+			prev->next = request->next;
+		else
+			queue->head = request->next;
+		if (queue->tail == request)
+			queue->tail = prev;
+		request->queued = FALSE;
+		if (!queue->head && queue->hasNotifier)
+			platform_notifier_clear(&queue->notifier);
+	}
+	pool_mutex_unlock(&queue->lock);
+}
+
+// Lets the request be collected once the caller has it, now that it's done
+static void request_release(lua_State *L, async_request_t* request)
+{
+	luaL_unref(L, LUA_REGISTRYINDEX, request->selfRef);
+	luaL_unref(L, LUA_REGISTRYINDEX, request->processRef);
+	request->selfRef = LUA_NOREF;
+	request->processRef = LUA_NOREF;
+}
+
+/**
+Creates the request userdata with everything but its work, keeping it at
+the top of the stack. The process is at index 1.
+*/
+static async_request_t* push_request(lua_State *L, process_t* process, async_kind kind)
+{
+	async_queue_t* queue = get_queue(L);
+	if (!queue)
+		return NULL;
+
+	async_request_t* request = (async_request_t*)lua_newuserdata(L, sizeof(async_request_t));
+	memset(request, 0, sizeof(async_request_t));
+	request->kind = kind;
+	request->process = process;
+	request->selfRef = LUA_NOREF;
+	request->processRef = LUA_NOREF;
+	luaL_getmetatable(L, ASYNC_REQUEST_T);
+	lua_setmetatable(L, -2);
+
+	pool_mutex_lock(&queue->lock);
+	queue->refs++;
+	pool_mutex_unlock(&queue->lock);
+	request->queue = queue;
+	return request;
+}
+
+/**
+Adds the request to the pending list, starting a worker for it if none is
+idle and there are fewer than pool_default_workers(). Only fails if there
+are no workers at all and none can be started.
+*/
+static int start_request(lua_State *L, async_request_t* request)
+{
+	async_queue_t* queue = request->queue;
+	BOOL started = TRUE;
+
+	lua_pushvalue(L, 1);
+	request->processRef = luaL_ref(L, LUA_REGISTRYINDEX);
+	lua_pushvalue(L, -1);
+	request->selfRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	pool_mutex_lock(&queue->lock);
+	request->state = ASYNC_PENDING;
+	request->next = NULL;
+	if (queue->pendingTail)
+		queue->pendingTail->next = request;
+	else
+		queue->pendingHead = request;
+	queue->pendingTail = request;
+	if (queue->idle == 0 && queue->workerCount < pool_default_workers())
+	{
+		if (pool_thread_start(&queue->workers[queue->workerCount], worker_main, queue))
+			queue->workerCount++;
+		else if (queue->workerCount == 0)
+		{
+			pending_remove(queue, request);
+			started = FALSE;
+		}
+	}
+	pool_cond_signal(&queue->submitted);
+	pool_mutex_unlock(&queue->lock);
+
+	if (!started)
+	{
+		request_release(L, request);
+		return push_error(L, "couldn't start a thread for the request");
+	}
+	return 1;
+}
+
+/**
+process:readasync(address, nbytes)
+
+Submits a read of nbytes at address to the async workers, and returns a request
+whose result is the data as a string.
+*/
+int process_read_async(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	LPCVOID address = (LPCVOID)memaddress_checkptr(L, 2);
+	lua_Integer size = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, size >= 0, 3, "size must not be negative");
+
+	async_request_t* request = push_request(L, process, ASYNC_READ);
+	if (!request)
+		return push_error(L, "not enough memory");
+	request->address = address;
+	request->size = (SIZE_T)size;
+	request->buffer = (char*)malloc(size ? (SIZE_T)size : 1);
+	if (!request->buffer)
+		return push_error(L, "not enough memory");
+
+	return start_request(L, request);
+}
+
+/**
+process:scanasync(pattern[, scope[, maxresults[, workers]]])
+
+Submits process:findpattern() to the async workers, and returns a request whose
+result is the array of matches.
+*/
+int process_scan_async(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	const char* source = luaL_checkstring(L, 2);
+	lua_Integer max = luaL_optinteger(L, 4, 0);
+	int workers = pool_check_workers(L, 5);
+	const char* start;
+	const char* end;
+
+	int results = pattern_check_scope(L, process, 3, &start, &end);
+	if (results)
+		return results;
+
+	async_request_t* request = push_request(L, process, ASYNC_SCAN);
+	if (!request)
+		return push_error(L, "not enough memory");
+	request->pattern = (pattern_t*)malloc(sizeof(pattern_t));
+	if (!request->pattern)
+		return push_error(L, "not enough memory");
+	const char* err = pattern_compile(request->pattern, source);
+	if (err)
+		return luaL_argerror(L, 2, err);
+	request->start = start;
+	request->end = end;
+	request->max = max > 0 ? (SIZE_T)max : 0;
+	request->workers = workers;
+
+	return start_request(L, request);
+}
+
+static int push_result(lua_State *L, async_request_t* request)
+{
+	if (!request->success)
+	{
+		if (request->kind == ASYNC_SCAN && request->matches.outOfMemory)
+			return push_error(L, "not enough memory");
+		platform_set_last_error(request->error);
+		return push_last_error(L);
+	}
+
+	if (request->kind == ASYNC_READ)
+	{
+		lua_pushlstring(L, request->buffer, request->bytesRead);
+		return 1;
+	}
+	return push_pattern_matches(L, &request->matches);
+}
+
+/**
+memreader.poll([timeout])
+
+Returns an array of the requests that have completed since the last call,
+waiting up to timeout milliseconds (default 0, negative for no limit) for
+one if there are none yet.
+*/
+int memreader_poll(lua_State *L)
+{
+	lua_Integer timeout = luaL_optinteger(L, 1, 0);
+	async_queue_t* queue = get_queue(L);
+	if (!queue)
+		return push_error(L, "not enough memory");
+
+	pool_mutex_lock(&queue->lock);
+	async_request_t* request = queue->head;
+	pool_mutex_unlock(&queue->lock);
+	if (!request && timeout != 0 && queue->hasNotifier)
+		platform_notifier_wait(&queue->notifier, timeout < 0 ? -1 : (int)timeout);
+
+	pool_mutex_lock(&queue->lock);
+	request = queue->head;
+	queue->head = NULL;
+	queue->tail = NULL;
+	if (queue->hasNotifier)
+		platform_notifier_clear(&queue->notifier);
+	pool_mutex_unlock(&queue->lock);
+
+	lua_newtable(L);
+	int count = 0;
+	while (request)
+	{
+		async_request_t* next = request->next;
+		request->queued = FALSE;
+		lua_rawgeti(L, LUA_REGISTRYINDEX, request->selfRef);
+		lua_rawseti(L, -2, ++count);
+		request_release(L, request);
+		request = next;
+	}
+	return 1;
+}
+
+// memreader.pollfd() returns the eventfd (or, on Windows, the event HANDLE) that's signaled while memreader.poll() has requests to return
+int memreader_pollfd(lua_State *L)
+{
+	async_queue_t* queue = get_queue(L);
+	if (!queue || !queue->hasNotifier)
+		return push_error(L, "no notifier is available");
+	lua_pushinteger(L, platform_notifier_handle(&queue->notifier));
+	return 1;
+}
+
+// request:done() returns whether the request has completed, without blocking
+static int request_done(lua_State *L)
+{
+	async_request_t* request = check_request(L, 1);
+	lua_pushboolean(L, POOL_LOAD_ACQUIRE(&request->done) != 0);
+	return 1;
+}
+
+// request:result() returns the result of a completed request, or nil, errmsg
+static int request_result(lua_State *L)
+{
+	async_request_t* request = check_request(L, 1);
+	if (!POOL_LOAD_ACQUIRE(&request->done))
+		return push_error(L, "the request hasn't completed");
+	return push_result(L, request);
+}
+
+/**
+request:wait()
+
+Blocks until the request completes (taking it out of the completion queue
+if needed) and returns its result.
+*/
+static int request_wait(lua_State *L)
+{
+	async_request_t* request = check_request(L, 1);
+	request_join(request);
+	queue_remove(request->queue, request);
+	if (request->selfRef != LUA_NOREF)
+		request_release(L, request);
+	return request_result(L);
+}
+
+static int request_gc(lua_State *L)
+{
+	async_request_t* request = check_request(L, 1);
+	// only when the Lua state is closed can a request be collected before it's been picked up
+	if (request->queue)
+	{
+		async_queue_t* queue = request->queue;
+		pool_mutex_lock(&queue->lock);
+		pending_remove(queue, request);
+		pool_mutex_unlock(&queue->lock);
+		request_join(request);
+		queue_remove(request->queue, request);
+		queue_release(request->queue);
+		request->queue = NULL;
+	}
+	free(request->buffer);
+	free(request->pattern);
+	pattern_matches_free(&request->matches);
+	request->buffer = NULL;
+	request->pattern = NULL;
+	return 0;
+}
+
+static int udata_field_get_kind(lua_State *L, void *v)
+{
+	lua_pushstring(L, *(async_kind*)v == ASYNC_READ ? "read" : "scan");
+	return 1;
+}
+
+static const luaL_Reg request_meta[] = {
+	{ "__gc", request_gc },
+	{ NULL, NULL }
+};
+static const luaL_Reg request_methods[] = {
+	{ "done", request_done },
+	{ "result", request_result },
+	{ "wait", request_wait },
+	{ NULL, NULL }
+};
+static udata_field_info request_getters[] = {
+	{ "kind", udata_field_get_kind, offsetof(async_request_t, kind) },
+	{ NULL, NULL }
+};
+static udata_field_info request_setters[] = {
+	{ NULL, NULL }
+};
+
+static int register_request(lua_State *L)
+{
+	UDATA_REGISTER_TYPE_WITH_FIELDS(request, ASYNC_REQUEST_T)
+}
+
+int register_async(lua_State *L)
+{
+	luaL_newmetatable(L, ASYNC_QUEUE_T);
+	lua_pushcfunction(L, queue_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	return register_request(L);
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#ifndef MEMREADER_ASYNC_H
+#define MEMREADER_ASYNC_H
+
+#include "memreader.h"
+#include "process.h"
+#include "platform.h"
+#include "pattern.h"
+#include "threadpool.h"
+
+#define ASYNC_REQUEST_T MEMREADER_METATABLE(request)
+#define ASYNC_QUEUE_T MEMREADER_METATABLE(completionqueue)
+// Registry field with the completion queue of the Lua state
+#define ASYNC_QUEUE MEMREADER_METATABLE(completions)
+
+/**
+The workers of a Lua state's requests, and where finished requests wait to
+be picked up by memreader.poll(). Workers are started as requests are
+submitted while none is idle, up to pool_default_workers() of them, and
+are stopped and joined when the Lua state is closed. It's shared by the
+Lua state (which holds it in the registry) and the requests, so it's freed
+by whichever lets go of it last. Everything but refs is guarded by lock.
+*/
+typedef struct async_queue_t {
+	pool_mutex_t lock;
+	// completed requests
+	struct async_request_t* head;
+	struct async_request_t* tail;
+	notifier_t notifier; // signaled while head isn't NULL
+	BOOL hasNotifier;
+	// submitted requests that no worker has taken yet
+	struct async_request_t* pendingHead;
+	struct async_request_t* pendingTail;
+	pool_cond_t submitted; // signaled when there's a pending request, broadcast when stopping
+	pool_cond_t finished; // broadcast when a request completes
+	pool_thread_t workers[POOL_MAX_WORKERS];
+	int workerCount;
+	int idle; // workers waiting for a request
+	BOOL stopping;
+	int refs;
+} async_queue_t;
+
+typedef enum {
+	ASYNC_READ,
+	ASYNC_SCAN
+} async_kind;
+
+typedef enum {
+	ASYNC_NEW, // not submitted
+	ASYNC_PENDING, // in the pending list
+	ASYNC_RUNNING, // on a worker
+	ASYNC_FINISHED
+} async_state;
+
+/**
+A read or a pattern scan run by one of the queue's workers. While it's
+pending or running (and until it's been picked up by memreader.poll() or
+request:wait()), the registry holds a reference to it and to its process,
+so neither can be collected from under the worker.
+*/
+typedef struct async_request_t {
+	async_kind kind;
+	process_t* process;
+	async_queue_t* queue;
+	async_state state; // guarded by the queue's lock
+	SIZE_T done; // set with POOL_STORE_RELEASE once the results below are in
+	BOOL success;
+	DWORD error; // the OS error, if it failed
+	// ASYNC_READ
+	LPCVOID address;
+	SIZE_T size;
+	char* buffer;
+	SIZE_T bytesRead;
+	// ASYNC_SCAN
+	pattern_t* pattern;
+	const char* start;
+	const char* end;
+	SIZE_T max;
+	int workers;
+	pattern_matches_t matches;
+
+	int selfRef;
+	int processRef;
+	BOOL queued; // in the completion queue
+	struct async_request_t* next; // in the pending list or the completion queue
+} async_request_t;
+
+int process_read_async(lua_State *L);
+int process_scan_async(lua_State *L);
+int memreader_poll(lua_State *L);
+int memreader_pollfd(lua_State *L);
+
+int register_async(lua_State *L);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include "buffer.h"
+#include "value.h"
+
+buffer_t* check_buffer(lua_State *L, int index)
+{
+	buffer_t* buffer = (buffer_t*)luaL_checkudata(L, index, BUFFER_T);
+	return buffer;
+}
+
+buffer_t* push_buffer(lua_State *L)
+{
+	buffer_t *buffer = (buffer_t*)lua_newuserdata(L, sizeof(buffer_t));
+	buffer->data = NULL;
+	buffer->size = 0;
+	buffer->capacity = 0;
+	luaL_getmetatable(L, BUFFER_T);
+	lua_setmetatable(L, -2);
+	return buffer;
+}
+
+BOOL buffer_resize(buffer_t* buffer, SIZE_T size)
+{
+	if (size > buffer->capacity)
+	{
+		char* data = (char*)realloc(buffer->data, size);
+		if (!data)
+			return FALSE;
+		buffer->data = data;
+		buffer->capacity = size;
+	}
+	buffer->size = size;
+	return TRUE;
+}
+
+static int buffer_resize_method(lua_State *L)
+{
+	buffer_t* buffer = check_buffer(L, 1);
+	lua_Integer size = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, size >= 0, 2, "size must not be negative");
+
+	if (!buffer_resize(buffer, (SIZE_T)size))
+		return push_error(L, "not enough memory");
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+// buffer:sub([i[, j]]) behaves exactly like string.sub on the buffer's contents
+static int buffer_sub(lua_State *L)
+{
+	buffer_t* buffer = check_buffer(L, 1);
+	lua_Integer len = (lua_Integer)buffer->size;
+	lua_Integer start = luaL_optinteger(L, 2, 1);
+	lua_Integer end = luaL_optinteger(L, 3, -1);
+
+	if (start < 0) start = len + start + 1 > 0 ? len + start + 1 : 1;
+	else if (start == 0) start = 1;
+	if (end < 0) end = len + end + 1;
+	else if (end > len) end = len;
+
+	if (start > end)
+		lua_pushliteral(L, "");
+	else
+		lua_pushlstring(L, buffer->data + start - 1, (size_t)(end - start + 1));
+	return 1;
+}
+
+static const char* buffer_check_offset(lua_State *L, buffer_t* buffer, int index, SIZE_T size)
+{
+	lua_Integer offset = luaL_checkinteger(L, index);
+	if (offset < 0 || (SIZE_T)offset > buffer->size || buffer->size - (SIZE_T)offset < size)
+		luaL_argerror(L, index, "offset out of range");
+	return buffer->data + offset;
+}
+
+/**
+Defines buffer_<name>(buffer, offset), which decodes a value_type at the
+given 0-based offset in the buffer
+*/
+#define BUFFER_TYPED_GET(name, type)										\
+	static int buffer_##name(lua_State *L)									\
+	{																		\
+		buffer_t* buffer = check_buffer(L, 1);								\
+		const char* data = buffer_check_offset(L, buffer, 2, value_types[type].size); \
+		return push_value(L, type, data);									\
+	}
+
+BUFFER_TYPED_GET(u8, VALUE_U8)
+BUFFER_TYPED_GET(i8, VALUE_I8)
+BUFFER_TYPED_GET(u16, VALUE_U16)
+BUFFER_TYPED_GET(i16, VALUE_I16)
+BUFFER_TYPED_GET(u32, VALUE_U32)
+BUFFER_TYPED_GET(i32, VALUE_I32)
+BUFFER_TYPED_GET(u64, VALUE_U64)
+BUFFER_TYPED_GET(i64, VALUE_I64)
+BUFFER_TYPED_GET(f32, VALUE_F32)
+BUFFER_TYPED_GET(f64, VALUE_F64)
+BUFFER_TYPED_GET(ptr, VALUE_PTR)
+
+static int buffer_len(lua_State *L)
+{
+	buffer_t* buffer = check_buffer(L, 1);
+	lua_pushinteger(L, (lua_Integer)buffer->size);
+	return 1;
+}
+
+static int buffer_tostring(lua_State *L)
+{
+	buffer_t* buffer = check_buffer(L, 1);
+	lua_pushfstring(L, "%s (%d bytes): %p", BUFFER_T, (int)buffer->size, (void*)buffer);
+	return 1;
+}
+
+static int buffer_gc(lua_State *L)
+{
+	buffer_t* buffer = check_buffer(L, 1);
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->size = buffer->capacity = 0;
+	return 0;
+}
+
+static const luaL_Reg buffer_meta[] = {
+	{ "__gc", buffer_gc },
+	{ "__len", buffer_len },
+	{ "__tostring", buffer_tostring },
+	{ NULL, NULL }
+};
+static const luaL_Reg buffer_methods[] = {
+	{ "resize", buffer_resize_method },
+	{ "sub", buffer_sub },
+	{ "u8", buffer_u8 },
+	{ "i8", buffer_i8 },
+	{ "u16", buffer_u16 },
+	{ "i16", buffer_i16 },
+	{ "u32", buffer_u32 },
+	{ "i32", buffer_i32 },
+	{ "u64", buffer_u64 },
+	{ "i64", buffer_i64 },
+	{ "f32", buffer_f32 },
+	{ "f64", buffer_f64 },
+	{ "ptr", buffer_ptr },
+	{ NULL, NULL }
+};
+static udata_field_info buffer_getters[] = {
+	{ "size", udata_field_get_size, offsetof(buffer_t, size) },
+	{ NULL, NULL }
+};
+static udata_field_info buffer_setters[] = {
+	{ NULL, NULL }
+};
+
+int register_buffer(lua_State *L)
+{
+	UDATA_REGISTER_TYPE_WITH_FIELDS(buffer, BUFFER_T)
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef MEMREADER_BUFFER_H
+#define MEMREADER_BUFFER_H
+
+#include "memreader.h"
+
+#define BUFFER_T MEMREADER_METATABLE(buffer)
+
+typedef struct {
+	char* data;
+	SIZE_T size;
+	SIZE_T capacity;
+} buffer_t;
+
+buffer_t* check_buffer(lua_State *L, int index);
+buffer_t* push_buffer(lua_State *L);
+// Sets the size of the buffer, only reallocating if it needs to grow past its capacity
+BOOL buffer_resize(buffer_t* buffer, SIZE_T size);
+
+int register_buffer(lua_State *L);
+
+#endif
\ No newline at end of file
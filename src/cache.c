@@ -0,0 +1,278 @@
+#include "cache.h"
+
+page_cache_t* page_cache_new(SIZE_T pages, uint64_t ttl)
+{
+	SIZE_T sets = CACHE_MIN_PAGES / CACHE_WAYS;
+	while (sets * CACHE_WAYS < pages)
+		sets *= 2;
+
+	page_cache_t* cache = (page_cache_t*)calloc(1, sizeof(page_cache_t));
+	if (!cache)
+		return NULL;
+
+	cache->sets = sets;
+	cache->entries = (cache_entry_t*)calloc(sets * CACHE_WAYS, sizeof(cache_entry_t));
+	cache->data = (unsigned char*)malloc(sets * CACHE_WAYS * CACHE_PAGE_SIZE);
+	cache->generation = 1; // entries start out with generation 0, i.e. stale
+	cache->ttl = ttl;
+	if (!cache->entries || !cache->data)
+	{
+		page_cache_free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+void page_cache_free(page_cache_t* cache)
+{
+	if (!cache)
+		return;
+	free(cache->entries);
+	free(cache->data);
+	free(cache);
+}
+
+void page_cache_invalidate(page_cache_t* cache)
+{
+	cache->generation++;
+}
+
+static unsigned char* entry_data(page_cache_t* cache, cache_entry_t* entry)
+{
+	return cache->data + (SIZE_T)(entry - cache->entries) * CACHE_PAGE_SIZE;
+}
+
+/**
+Finds the entry for a page, or picks the way of its set to load it into
+(marking it as used, so that other misses in the same batch pick another
+way). *hit tells which one it is.
+*/
+static cache_entry_t* cache_lookup(page_cache_t* cache, const char* page, uint64_t now, BOOL* hit)
+{
+	cache_entry_t* set = &cache->entries[(((uintptr_t)page / CACHE_PAGE_SIZE) & (cache->sets - 1)) * CACHE_WAYS];
+	cache_entry_t* victim = &set[0];
+	int way;
+
+	for (way = 0; way < CACHE_WAYS; way++)
+	{
+		cache_entry_t* entry = &set[way];
+		if (entry->page == page && entry->generation == cache->generation
+			&& (!cache->ttl || now - entry->fetched <= cache->ttl))
+		{
+			entry->used = ++cache->clock;
+			*hit = TRUE;
+			return entry;
+		}
+		if (entry->used < victim->used)
+			victim = entry;
+	}
+
+	victim->page = page;
+	victim->generation = 0;
+	victim->used = ++cache->clock;
+	*hit = FALSE;
+	return victim;
+}
+
+// Makes sure the pages are cached, fetching the missing ones with one platform_readv. Returns FALSE if any couldn't be read.
+static BOOL cache_load(process_t* process, page_cache_t* cache, const char** pages, SIZE_T count, cache_entry_t** entries)
+{
+	read_request_t requests[CACHE_BATCH_PAGES];
+	cache_entry_t* missing[CACHE_BATCH_PAGES];
+	uint64_t now = cache->ttl ? platform_time_us() : 0;
+	SIZE_T i, misses = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		BOOL hit;
+		cache_entry_t* entry = cache_lookup(cache, pages[i], now, &hit);
+		if (entries)
+			entries[i] = entry;
+		if (hit)
+		{
+			cache->hits++;
+			continue;
+		}
+
+		cache->misses++;
+		requests[misses].address = pages[i];
+		requests[misses].buffer = entry_data(cache, entry);
+		requests[misses].size = CACHE_PAGE_SIZE;
+		missing[misses++] = entry;
+	}
+
+	STATS_CACHE(process, count - misses, misses);
+	if (!misses)
+		return TRUE;
+
+	BOOL success = platform_readv(process, requests, misses) == misses;
+	if (cache->ttl)
+		now = platform_time_us();
+	for (i = 0; i < misses; i++)
+	{
+		// a way is picked twice when more pages than ways of a set are loaded at once; the last one
+		// wins, and since requests are read in order, its data is the one left in the entry
+		if (requests[i].bytesRead == CACHE_PAGE_SIZE && missing[i]->page == requests[i].address)
+		{
+			missing[i]->generation = cache->generation;
+			missing[i]->fetched = now;
+		}
+	}
+	return success;
+}
+
+// Lists the pages that [address, address + size) touches, returning how many there are
+static SIZE_T pages_of(LPCVOID address, SIZE_T size, const char** pages)
+{
+	const char* start = (const char*)address;
+	const char* first = start - (uintptr_t)start % CACHE_PAGE_SIZE;
+	SIZE_T i, count = (SIZE_T)(start + size - first + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+	for (i = 0; i < count; i++)
+		pages[i] = first + i * CACHE_PAGE_SIZE;
+	return count;
+}
+
+BOOL process_read_memory(process_t* process, LPCVOID address, LPVOID buffer, SIZE_T size, SIZE_T* bytesRead)
+{
+	page_cache_t* cache = process->cache;
+	const char* pages[CACHE_MAX_READ / CACHE_PAGE_SIZE + 1];
+	cache_entry_t* entries[CACHE_MAX_READ / CACHE_PAGE_SIZE + 1];
+
+	if (!cache || size == 0 || size > CACHE_MAX_READ)
+		return platform_read(process, address, buffer, size, bytesRead);
+
+	// the pages of one read map to different sets (there are at least CACHE_MIN_PAGES / CACHE_WAYS), so none of them evict each other
+	SIZE_T count = pages_of(address, size, pages);
+	if (!cache_load(process, cache, pages, count, entries))
+		return platform_read(process, address, buffer, size, bytesRead);
+
+	SIZE_T i, offset = (SIZE_T)((const char*)address - pages[0]), copied = 0;
+	for (i = 0; i < count; i++)
+	{
+		SIZE_T n = CACHE_PAGE_SIZE - offset;
+		if (n > size - copied)
+			n = size - copied;
+		memcpy((char*)buffer + copied, entry_data(cache, entries[i]) + offset, n);
+		copied += n;
+		offset = 0;
+	}
+	*bytesRead = size;
+	return TRUE;
+}
+
+SIZE_T process_readv_memory(process_t* process, read_request_t* requests, SIZE_T count)
+{
+	page_cache_t* cache = process->cache;
+	const char* batch[CACHE_BATCH_PAGES];
+	SIZE_T i, batched = 0, complete = 0;
+
+	if (!cache)
+		return platform_readv(process, requests, count);
+
+	// fetch the missing pages of all of the requests up front, a batch at a time, then serve the requests from the cache
+	SIZE_T budget = cache->sets * CACHE_WAYS / 2;
+	for (i = 0; i < count; i++)
+	{
+		const char* pages[CACHE_MAX_READ / CACHE_PAGE_SIZE + 1];
+		if (requests[i].size == 0 || requests[i].size > CACHE_MAX_READ)
+			continue;
+		SIZE_T n = pages_of(requests[i].address, requests[i].size, pages);
+		if (n > budget)
+			break;
+		if (batched + n > CACHE_BATCH_PAGES)
+		{
+			cache_load(process, cache, batch, batched, NULL);
+			batched = 0;
+		}
+		memcpy(&batch[batched], pages, n * sizeof(const char*));
+		batched += n;
+		budget -= n;
+	}
+	if (batched)
+		cache_load(process, cache, batch, batched, NULL);
+
+	for (i = 0; i < count; i++)
+	{
+		read_request_t* req = &requests[i];
+		if (process_read_memory(process, req->address, req->buffer, req->size, &req->bytesRead))
+			complete++;
+	}
+	return complete;
+}
+
+/**
+process:cache([options])
+
+Enables the page cache, or replaces it. options can contain pages (the
+maximum number of 4 KiB pages to keep) and ttl (in milliseconds). Passing
+false disables it.
+*/
+int process_cache(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	SIZE_T pages = CACHE_DEFAULT_PAGES;
+	uint64_t ttl = 0;
+
+	if (lua_isboolean(L, 2) && !lua_toboolean(L, 2))
+	{
+		page_cache_free(process->cache);
+		process->cache = NULL;
+		lua_pushboolean(L, TRUE);
+		return 1;
+	}
+
+	if (!lua_isnoneornil(L, 2))
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+		lua_getfield(L, 2, "pages");
+		lua_getfield(L, 2, "ttl");
+		lua_Integer n = luaL_optinteger(L, -2, CACHE_DEFAULT_PAGES);
+		lua_Number ms = luaL_optnumber(L, -1, 0);
+		luaL_argcheck(L, n > 0, 2, "pages must be positive");
+		luaL_argcheck(L, ms >= 0, 2, "ttl must not be negative");
+		pages = (SIZE_T)n;
+		ttl = (uint64_t)(ms * 1000);
+		lua_pop(L, 2);
+	}
+
+	page_cache_t* cache = page_cache_new(pages, ttl);
+	if (!cache)
+		return push_error(L, "not enough memory");
+
+	page_cache_free(process->cache);
+	process->cache = cache;
+	lua_pushboolean(L, TRUE);
+	return 1;
+}
+
+// process:invalidate() marks everything in the cache as stale
+int process_invalidate(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	if (process->cache)
+		page_cache_invalidate(process->cache);
+	return 0;
+}
+
+// process:cachestats() returns a table with the counters of the cache, or nil if it's disabled
+int process_cache_stats(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	page_cache_t* cache = process->cache;
+	if (!cache)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_createtable(L, 0, 4);
+	lua_pushnumber(L, (lua_Number)cache->hits);
+	lua_setfield(L, -2, "hits");
+	lua_pushnumber(L, (lua_Number)cache->misses);
+	lua_setfield(L, -2, "misses");
+	lua_pushinteger(L, (lua_Integer)(cache->sets * CACHE_WAYS));
+	lua_setfield(L, -2, "pages");
+	lua_pushnumber(L, (lua_Number)cache->generation);
+	lua_setfield(L, -2, "generation");
+	return 1;
+}
\ No newline at end of file
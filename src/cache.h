@@ -0,0 +1,61 @@
+#ifndef MEMREADER_CACHE_H
+#define MEMREADER_CACHE_H
+
+#include "memreader.h"
+#include "process.h"
+#include "platform.h"
+#include "stats.h"
+
+#define CACHE_PAGE_SIZE 4096
+#define CACHE_WAYS 4
+// Reads larger than this bypass the cache, so that they don't evict everything else
+#define CACHE_MAX_READ (16 * CACHE_PAGE_SIZE)
+// Misses are fetched with one platform_readv of up to this many pages
+#define CACHE_BATCH_PAGES 64
+#define CACHE_MIN_PAGES 128
+#define CACHE_DEFAULT_PAGES 256
+
+typedef struct {
+	const char* page; // address of the page in the target
+	uint64_t generation; // the entry is stale unless this is the cache's current generation
+	uint64_t fetched; // platform_time_us() when the page was read
+	uint64_t used; // for picking the least recently used way of a set
+} cache_entry_t;
+
+/**
+An opt-in read-through cache of whole pages of a process, for scripts that
+read many small values from the same few pages. It's set-associative with
+a fixed number of pages, so its memory use is bounded. Invalidating it just
+bumps the generation, and entries can also expire after a TTL.
+*/
+struct page_cache_t {
+	SIZE_T sets; // a power of two; consecutive pages map to consecutive sets
+	cache_entry_t* entries; // sets * CACHE_WAYS
+	unsigned char* data; // CACHE_PAGE_SIZE bytes per entry
+	uint64_t generation;
+	uint64_t ttl; // in microseconds, 0 for none
+	uint64_t clock;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+// pages is rounded up to a power of two, and to at least CACHE_MIN_PAGES
+page_cache_t* page_cache_new(SIZE_T pages, uint64_t ttl);
+void page_cache_free(page_cache_t* cache);
+void page_cache_invalidate(page_cache_t* cache);
+
+/**
+Reads memory of the process like platform_read, through its cache if it has
+one. Pages that aren't cached (or are stale) are fetched with one batched
+read; if any of them can't be read, the read falls back to platform_read so
+that partial reads behave the same with and without the cache.
+*/
+BOOL process_read_memory(process_t* process, LPCVOID address, LPVOID buffer, SIZE_T size, SIZE_T* bytesRead);
+// Like platform_readv, through the cache; the pages of all of the requests are fetched together
+SIZE_T process_readv_memory(process_t* process, read_request_t* requests, SIZE_T count);
+
+int process_cache(lua_State *L);
+int process_invalidate(lua_State *L);
+int process_cache_stats(lua_State *L);
+
+#endif
\ No newline at end of file
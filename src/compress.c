@@ -0,0 +1,227 @@
+#include "compress.h"
+
+// The limits of the LZ4 block format
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5 // the last 5 bytes are always literals
+#define LZ_MATCH_LIMIT 12 // and the last match starts at least 12 bytes from the end
+#define LZ_MAX_DISTANCE 65535
+
+#define LZ_HASH_BITS 12
+// Skips ahead faster the longer it's gone without a match, so incompressible data is passed over quickly
+#define LZ_SKIP_TRIGGER 6
+
+static uint32_t read_u32(const unsigned char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t read_u64(const unsigned char* p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint32_t lz_hash(uint32_t sequence)
+{
+	return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char* write_length(unsigned char* op, SIZE_T length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+/**
+Writes a sequence: literalLength bytes of literals, then (unless
+matchLength is 0, for the last sequence) a match of matchLength bytes at
+distance back. Returns NULL if it doesn't fit before oend.
+*/
+static unsigned char* write_sequence(unsigned char* op, unsigned char* oend, const unsigned char* literals, SIZE_T literalLength, SIZE_T distance, SIZE_T matchLength)
+{
+	SIZE_T matchCode = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+	SIZE_T needed = 1 + literalLength / 255 + 1 + literalLength + (matchLength ? 2 + matchCode / 255 + 1 : 0);
+	if (needed > (SIZE_T)(oend - op))
+		return NULL;
+
+	unsigned char* token = op++;
+	*token = (unsigned char)((literalLength < 15 ? literalLength : 15) << 4);
+	if (literalLength >= 15)
+		op = write_length(op, literalLength - 15);
+	memcpy(op, literals, literalLength);
+	op += literalLength;
+	if (!matchLength)
+		return op;
+
+	*op++ = (unsigned char)(distance & 0xff);
+	*op++ = (unsigned char)(distance >> 8);
+	*token |= (unsigned char)(matchCode < 15 ? matchCode : 15);
+	if (matchCode >= 15)
+		op = write_length(op, matchCode - 15);
+	return op;
+}
+
+SIZE_T compress_block(const unsigned char* src, SIZE_T size, unsigned char* dst, SIZE_T capacity)
+{
+	uint32_t table[1 << LZ_HASH_BITS];
+	const unsigned char* ip = src;
+	const unsigned char* anchor = src;
+	const unsigned char* end = src + size;
+	unsigned char* op = dst;
+	unsigned char* oend = dst + capacity;
+
+	// positions are only ever candidates, checked against the data, so a zeroed table is as good as an empty one
+	memset(table, 0, sizeof(table));
+	if (size > LZ_MATCH_LIMIT)
+	{
+		const unsigned char* matchStartLimit = end - LZ_MATCH_LIMIT;
+		const unsigned char* matchEndLimit = end - LZ_LAST_LITERALS;
+		SIZE_T misses = 0;
+		ip++;
+		while (ip < matchStartLimit)
+		{
+			uint32_t sequence = read_u32(ip);
+			uint32_t h = lz_hash(sequence);
+			const unsigned char* ref = src + table[h];
+			table[h] = (uint32_t)(ip - src);
+			if (ref >= ip || ip - ref > LZ_MAX_DISTANCE || read_u32(ref) != sequence)
+			{
+				ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+				continue;
+			}
+			misses = 0;
+
+			while (ip > anchor && ref > src && ip[-1] == ref[-1])
+			{
+				ip--;
+				ref--;
+			}
+			const unsigned char* matchEnd = ip + LZ_MIN_MATCH;
+			const unsigned char* refEnd = ref + LZ_MIN_MATCH;
+			while (matchEnd + 8 <= matchEndLimit && read_u64(matchEnd) == read_u64(refEnd))
+			{
+				matchEnd += 8;
+				refEnd += 8;
+			}
+			while (matchEnd < matchEndLimit && *matchEnd == *refEnd)
+			{
+				matchEnd++;
+				refEnd++;
+			}
+
+			op = write_sequence(op, oend, anchor, (SIZE_T)(ip - anchor), (SIZE_T)(ip - ref), (SIZE_T)(matchEnd - ip));
+			if (!op)
+				return 0;
+			// the position two before the end of the match is likely to start the next one
+			if (matchEnd - 2 > ip)
+				table[lz_hash(read_u32(matchEnd - 2))] = (uint32_t)(matchEnd - 2 - src);
+			ip = matchEnd;
+			anchor = ip;
+		}
+	}
+
+	op = write_sequence(op, oend, anchor, (SIZE_T)(end - anchor), 0, 0);
+	return op ? (SIZE_T)(op - dst) : 0;
+}
+
+// Copies 8 bytes at a time, so it can write up to 7 bytes past op + length: the caller checks there's room
+static void copy_wild(unsigned char* op, const unsigned char* ip, SIZE_T length)
+{
+	unsigned char* end = op + length;
+	while (op < end)
+	{
+		memcpy(op, ip, 8);
+		op += 8;
+		ip += 8;
+	}
+}
+
+static BOOL read_length(const unsigned char** ip, const unsigned char* iend, SIZE_T* length)
+{
+	unsigned char byte;
+	do
+	{
+		if (*ip >= iend)
+			return FALSE;
+		byte = *(*ip)++;
+		*length += byte;
+	} while (byte == 255);
+	return TRUE;
+}
+
+BOOL decompress_block(const unsigned char* src, SIZE_T srcSize, unsigned char* dst, SIZE_T size)
+{
+	const unsigned char* ip = src;
+	const unsigned char* iend = src + srcSize;
+	unsigned char* op = dst;
+	unsigned char* oend = dst + size;
+
+	while (ip < iend)
+	{
+		unsigned char token = *ip++;
+		SIZE_T length = token >> 4;
+		if (length == 15 && !read_length(&ip, iend, &length))
+			return FALSE;
+		if (length > (SIZE_T)(iend - ip) || length > (SIZE_T)(oend - op))
+			return FALSE;
+		if (length + 8 <= (SIZE_T)(oend - op) && length + 8 <= (SIZE_T)(iend - ip))
+			copy_wild(op, ip, length);
+		else
+			memcpy(op, ip, length);
+		op += length;
+		ip += length;
+		// the last sequence is only literals
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return FALSE;
+		SIZE_T distance = (SIZE_T)ip[0] | ((SIZE_T)ip[1] << 8);
+		ip += 2;
+		if (distance == 0 || distance > (SIZE_T)(op - dst))
+			return FALSE;
+		length = token & 15;
+		if (length == 15 && !read_length(&ip, iend, &length))
+			return FALSE;
+		length += LZ_MIN_MATCH;
+		if (length > (SIZE_T)(oend - op))
+			return FALSE;
+
+		/**
+		A match can overlap the bytes it produces (a run of one byte is a
+		match at distance 1). Copying the first few bytes one at a time makes
+		the pattern repeat at a distance of at least 8, from which 8 bytes
+		can be copied at a time.
+		*/
+		const unsigned char* ref = op - distance;
+		SIZE_T i = 0;
+		if (distance < 8)
+		{
+			SIZE_T period = distance;
+			while (period < 8)
+				period += distance;
+			for (; i < length && i < period; i++)
+				op[i] = ref[i];
+			ref = op + i - period;
+		}
+		else
+			ref += i;
+		if (length - i + 8 <= (SIZE_T)(oend - op - i))
+			copy_wild(op + i, ref, length - i);
+		else
+		{
+			for (; i < length; i++, ref++)
+				op[i] = *ref;
+		}
+		op += length;
+	}
+	return op == oend;
+}
\ No newline at end of file
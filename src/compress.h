@@ -0,0 +1,18 @@
+#ifndef MEMREADER_COMPRESS_H
+#define MEMREADER_COMPRESS_H
+
+#include "memreader.h"
+
+/**
+A small compressor for the chunks of process:dump, in the LZ4 block format
+(so a dump's chunks can also be decompressed by anything that reads LZ4
+blocks). It's the fast greedy kind, with a single 4-byte hash table: memory
+compresses well enough that favoring speed is the right tradeoff.
+*/
+
+// Compresses size bytes of src into dst, returning the compressed size, or 0 if it didn't fit in capacity
+SIZE_T compress_block(const unsigned char* src, SIZE_T size, unsigned char* dst, SIZE_T capacity);
+// Decompresses a block that should decompress to exactly size bytes, failing on anything malformed
+BOOL decompress_block(const unsigned char* src, SIZE_T srcSize, unsigned char* dst, SIZE_T size);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,388 @@
+#include "dump.h"
+#include "region.h"
+#include "snapshot.h"
+#include "compress.h"
+#include "threadpool.h"
+
+#include <stdio.h>
+#include <errno.h>
+
+// A chunk of a region, read into one of the two buffers of the pipeline
+typedef struct {
+	const char* address;
+	SIZE_T size;
+	SIZE_T region;
+	SIZE_T offset; // within the region
+	unsigned char* buffer;
+} dump_chunk_t;
+
+typedef struct {
+	FILE* file;
+	uint64_t dataOffset;
+	const snapshot_t* layout;
+	unsigned char* compressed; // NULL unless compressing
+	uint64_t* index; // for compressed dumps, the chunk index of every region back to back
+	SIZE_T chunk; // the chunk being written, counting from the first of the first region
+	uint64_t end; // of the data written so far
+	uint64_t stored; // bytes of memory actually written (so not counting the index)
+} dump_t;
+
+static void read_chunk(process_t* process, dump_chunk_t* chunk)
+{
+	SIZE_T numBytesRead;
+	// memory that can't be read (because it was freed since it was listed) is dumped as zeros
+	if (!platform_read(process, chunk->address, chunk->buffer, chunk->size, &numBytesRead))
+		memset(chunk->buffer + numBytesRead, 0, chunk->size - numBytesRead);
+}
+
+static BOOL is_zero(const unsigned char* data, SIZE_T size)
+{
+	uint64_t bits = 0;
+	SIZE_T i;
+	for (i = 0; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		bits |= word;
+	}
+	for (; i < size; i++)
+		bits |= data[i];
+	return bits == 0;
+}
+
+static BOOL write_at(dump_t* dump, uint64_t offset, const void* data, SIZE_T size)
+{
+	if (!platform_seek_file(dump->file, offset) || fwrite(data, 1, size, dump->file) != size)
+		return FALSE;
+	if (offset + size > dump->end)
+		dump->end = offset + size;
+	return TRUE;
+}
+
+// Writes the chunk where its region's data goes, leaving out runs of zero pages
+static BOOL write_sparse(dump_t* dump, const dump_chunk_t* chunk)
+{
+	uint64_t offset = dump->dataOffset + dump->layout->regions[chunk->region].offset + chunk->offset;
+	SIZE_T page = 0;
+	while (page < chunk->size)
+	{
+		SIZE_T start, size;
+		while (page < chunk->size && is_zero(chunk->buffer + page, chunk->size - page < SNAPSHOT_PAGE_SIZE ? chunk->size - page : SNAPSHOT_PAGE_SIZE))
+			page += SNAPSHOT_PAGE_SIZE;
+		start = page;
+		while (page < chunk->size && !is_zero(chunk->buffer + page, chunk->size - page < SNAPSHOT_PAGE_SIZE ? chunk->size - page : SNAPSHOT_PAGE_SIZE))
+			page += SNAPSHOT_PAGE_SIZE;
+		size = (page < chunk->size ? page : chunk->size) - start;
+		if (size && !write_at(dump, offset + start, chunk->buffer + start, size))
+			return FALSE;
+		dump->stored += size;
+	}
+	return TRUE;
+}
+
+// Appends the chunk compressed (or as is, if it doesn't compress) and records it in the index
+static BOOL write_compressed(dump_t* dump, const dump_chunk_t* chunk)
+{
+	uint64_t* entry = &dump->index[dump->chunk * 2];
+	entry[0] = dump->end;
+	entry[1] = 0;
+	if (is_zero(chunk->buffer, chunk->size))
+		return TRUE;
+
+	SIZE_T size = compress_block(chunk->buffer, chunk->size, dump->compressed, chunk->size - 1);
+	entry[1] = size ? size : chunk->size;
+	dump->stored += entry[1];
+	return write_at(dump, dump->end, size ? dump->compressed : chunk->buffer, (SIZE_T)entry[1]);
+}
+
+// Moves to the chunk after this one, returning FALSE after the last
+static BOOL next_chunk(const snapshot_t* layout, dump_chunk_t* chunk)
+{
+	chunk->offset += SNAPSHOT_FILE_CHUNK_SIZE;
+	while (chunk->region < layout->regionCount && chunk->offset >= layout->regions[chunk->region].size)
+	{
+		chunk->region++;
+		chunk->offset = 0;
+	}
+	if (chunk->region == layout->regionCount)
+		return FALSE;
+
+	SIZE_T size = layout->regions[chunk->region].size - chunk->offset;
+	chunk->address = layout->regions[chunk->region].base + chunk->offset;
+	chunk->size = size < SNAPSHOT_FILE_CHUNK_SIZE ? size : SNAPSHOT_FILE_CHUNK_SIZE;
+	return TRUE;
+}
+
+/**
+The two buffers shared by the thread reading chunks and the one writing
+them: the reader fills them in turn while fewer than two are full, and the
+writer empties them in the same order. Everything is guarded by lock.
+*/
+typedef struct {
+	pool_mutex_t lock;
+	pool_cond_t changed; // signaled whenever full, done or failed changes
+	process_t* process;
+	const snapshot_t* layout;
+	dump_chunk_t chunks[2];
+	int full; // chunks that have been read and not written yet
+	BOOL done; // every chunk has been read
+	BOOL failed; // the writer gave up, so the reader should stop
+} dump_pipeline_t;
+
+static void reader_main(void* arg)
+{
+	dump_pipeline_t* pipeline = (dump_pipeline_t*)arg;
+	dump_chunk_t cursor;
+	int current = 0;
+
+	memset(&cursor, 0, sizeof(cursor));
+	// one chunk before the start of the first region, for next_chunk to move to it
+	cursor.offset = (SIZE_T)0 - SNAPSHOT_FILE_CHUNK_SIZE;
+	while (next_chunk(pipeline->layout, &cursor))
+	{
+		dump_chunk_t* chunk = &pipeline->chunks[current];
+		pool_mutex_lock(&pipeline->lock);
+		while (pipeline->full == 2 && !pipeline->failed)
+			pool_cond_wait(&pipeline->changed, &pipeline->lock);
+		BOOL failed = pipeline->failed;
+		pool_mutex_unlock(&pipeline->lock);
+		if (failed)
+			return;
+
+		cursor.buffer = chunk->buffer;
+		*chunk = cursor;
+		read_chunk(pipeline->process, chunk);
+
+		pool_mutex_lock(&pipeline->lock);
+		pipeline->full++;
+		pool_cond_signal(&pipeline->changed);
+		pool_mutex_unlock(&pipeline->lock);
+		current ^= 1;
+	}
+
+	pool_mutex_lock(&pipeline->lock);
+	pipeline->done = TRUE;
+	pool_cond_signal(&pipeline->changed);
+	pool_mutex_unlock(&pipeline->lock);
+}
+
+static BOOL write_chunk(dump_t* dump, const dump_chunk_t* chunk)
+{
+	BOOL success = dump->compressed ? write_compressed(dump, chunk) : write_sparse(dump, chunk);
+	dump->chunk++;
+	return success;
+}
+
+// Reads and writes the chunks one after the other, for when the reader thread can't be started
+static BOOL dump_serial(dump_t* dump, dump_pipeline_t* pipeline)
+{
+	dump_chunk_t* chunk = &pipeline->chunks[0];
+	unsigned char* buffer = chunk->buffer;
+	chunk->offset = (SIZE_T)0 - SNAPSHOT_FILE_CHUNK_SIZE;
+	while (next_chunk(dump->layout, chunk))
+	{
+		chunk->buffer = buffer;
+		read_chunk(pipeline->process, chunk);
+		if (!write_chunk(dump, chunk))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+Streams the regions of the layout to the file through two buffers: while
+one chunk is checked for zero pages, compressed and written, the next one
+is read by a thread started for the whole dump.
+*/
+static BOOL dump_regions(dump_t* dump, process_t* process)
+{
+	dump_pipeline_t pipeline;
+	pool_thread_t reader;
+	BOOL success = TRUE;
+	int current = 0;
+
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.process = process;
+	pipeline.layout = dump->layout;
+	pipeline.chunks[0].buffer = (unsigned char*)malloc(SNAPSHOT_FILE_CHUNK_SIZE);
+	pipeline.chunks[1].buffer = (unsigned char*)malloc(SNAPSHOT_FILE_CHUNK_SIZE);
+	if (!pipeline.chunks[0].buffer || !pipeline.chunks[1].buffer)
+	{
+		free(pipeline.chunks[0].buffer);
+		free(pipeline.chunks[1].buffer);
+		errno = ENOMEM;
+		return FALSE;
+	}
+	pool_mutex_init(&pipeline.lock);
+	pool_cond_init(&pipeline.changed);
+
+	if (!pool_thread_start(&reader, reader_main, &pipeline))
+		success = dump_serial(dump, &pipeline);
+	else
+	{
+		for (;;)
+		{
+			pool_mutex_lock(&pipeline.lock);
+			while (pipeline.full == 0 && !pipeline.done)
+				pool_cond_wait(&pipeline.changed, &pipeline.lock);
+			BOOL empty = pipeline.full == 0;
+			pool_mutex_unlock(&pipeline.lock);
+			if (empty)
+				break;
+
+			success = write_chunk(dump, &pipeline.chunks[current]);
+			pool_mutex_lock(&pipeline.lock);
+			pipeline.full--;
+			pipeline.failed = !success;
+			pool_cond_signal(&pipeline.changed);
+			pool_mutex_unlock(&pipeline.lock);
+			if (!success)
+				break;
+			current ^= 1;
+		}
+		pool_thread_join(&reader);
+	}
+
+	pool_cond_destroy(&pipeline.changed);
+	pool_mutex_destroy(&pipeline.lock);
+	free(pipeline.chunks[0].buffer);
+	free(pipeline.chunks[1].buffer);
+	return success;
+}
+
+// Lays the regions out like a snapshot would, or (compressed) places their chunk indexes back to back
+static BOOL dump_layout(snapshot_t* layout, const region_list_t* list, BOOL compress, SIZE_T* chunkCount)
+{
+	SIZE_T i;
+	layout->regions = (snapshot_region_t*)malloc((list->count ? list->count : 1) * sizeof(snapshot_region_t));
+	if (!layout->regions)
+		return FALSE;
+
+	*chunkCount = 0;
+	for (i = 0; i < list->count; i++)
+	{
+		snapshot_region_t* region = &layout->regions[i];
+		SIZE_T chunks = (list->regions[i].size + SNAPSHOT_FILE_CHUNK_SIZE - 1) / SNAPSHOT_FILE_CHUNK_SIZE;
+		region->base = (char*)list->regions[i].base;
+		region->size = list->regions[i].size;
+		region->protect = list->regions[i].protect;
+		region->type = list->regions[i].type;
+		region->offset = layout->size;
+		layout->size += compress
+			? chunks * 2 * sizeof(uint64_t)
+			: (region->size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE * SNAPSHOT_PAGE_SIZE;
+		*chunkCount += chunks;
+	}
+	layout->regionCount = list->count;
+	return TRUE;
+}
+
+static BOOL dump_write(dump_t* dump, process_t* process, BOOL compress, SIZE_T chunkCount)
+{
+	const snapshot_t* layout = dump->layout;
+	uint64_t dataEnd;
+
+	// it's fine for a filesystem not to support holes, they just take up space
+	platform_make_sparse(dump->file);
+	if (!snapshot_write_header(layout, compress ? SNAPSHOT_FILE_VERSION_COMPRESSED : SNAPSHOT_FILE_VERSION, dump->file, &dump->dataOffset))
+		return FALSE;
+	dataEnd = dump->dataOffset + layout->size;
+	dump->end = compress ? dataEnd : dump->dataOffset;
+
+	if (compress)
+	{
+		dump->compressed = (unsigned char*)malloc(SNAPSHOT_FILE_CHUNK_SIZE);
+		dump->index = (uint64_t*)malloc((chunkCount ? chunkCount : 1) * 2 * sizeof(uint64_t));
+		if (!dump->compressed || !dump->index)
+		{
+			errno = ENOMEM;
+			return FALSE;
+		}
+	}
+
+	if (!dump_regions(dump, process))
+		return FALSE;
+
+	if (compress)
+		return write_at(dump, dump->dataOffset, dump->index, chunkCount * 2 * sizeof(uint64_t));
+	// a hole at the end of the file doesn't make it any longer, so its last byte is written
+	if (dump->end < dataEnd)
+	{
+		static const unsigned char zero = 0;
+		return write_at(dump, dataEnd - 1, &zero, 1);
+	}
+	return TRUE;
+}
+
+/**
+process:dump(path[, options])
+
+Writes the readable memory of the process to a file in the format of
+snapshot:save, without keeping more than two chunks of it in memory.
+options can contain the region filter fields (see process:regions) and
+compress. Returns the number of bytes of memory dumped, and the number of
+bytes that were written for them (which leaves out zero pages, and doesn't
+count the header or the chunk index).
+*/
+int process_dump(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	const char* path = luaL_checkstring(L, 2);
+	region_filter_t filter;
+	BOOL compress = FALSE;
+
+	check_region_filter(L, 3, &filter);
+	filter.readable = 1;
+	if (lua_istable(L, 3))
+	{
+		lua_getfield(L, 3, "compress");
+		compress = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+	}
+
+	snapshot_t layout;
+	region_list_t regions;
+	SIZE_T chunkCount, i;
+	memset(&layout, 0, sizeof(snapshot_t));
+	region_list_init(&regions);
+	if (!snapshot_describe(&layout, process) || !region_list_collect(process, &filter, &regions))
+	{
+		snapshot_free(&layout);
+		region_list_free(&regions);
+		return push_last_error(L);
+	}
+	BOOL success = dump_layout(&layout, &regions, compress, &chunkCount);
+	region_list_free(&regions);
+	if (!success)
+	{
+		snapshot_free(&layout);
+		return push_error(L, "not enough memory");
+	}
+
+	dump_t dump;
+	memset(&dump, 0, sizeof(dump_t));
+	dump.layout = &layout;
+	dump.file = fopen(path, "wb");
+	if (!dump.file)
+	{
+		snapshot_free(&layout);
+		return push_error(L, lua_pushfstring(L, "%s: %s", path, strerror(errno)));
+	}
+
+	success = dump_write(&dump, process, compress, chunkCount);
+	if (fclose(dump.file) != 0)
+		success = FALSE;
+	free(dump.compressed);
+	free(dump.index);
+
+	uint64_t memory = 0;
+	for (i = 0; i < layout.regionCount; i++)
+		memory += layout.regions[i].size;
+	snapshot_free(&layout);
+	if (!success)
+		return push_error(L, lua_pushfstring(L, "%s: %s", path, strerror(errno)));
+
+	lua_pushinteger(L, (lua_Integer)memory);
+	lua_pushinteger(L, (lua_Integer)dump.stored);
+	return 2;
+}
\ No newline at end of file
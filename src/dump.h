@@ -0,0 +1,9 @@
+#ifndef MEMREADER_DUMP_H
+#define MEMREADER_DUMP_H
+
+#include "memreader.h"
+#include "process.h"
+
+int process_dump(lua_State *L);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include "findprocess.h"
+#include "process.h"
+#include "platform.h"
+
+#include <ctype.h>
+
+/**
+What a process has to match: a name, a glob (a name with * and ? in it),
+or a Lua predicate called with pid, name. Names are compared
+case-insensitively on Windows.
+*/
+typedef struct {
+	const char* pattern;
+	BOOL glob;
+	int predicate; // stack index of the function, or 0
+} process_matcher_t;
+
+static BOOL char_equals(char a, char b)
+{
+#ifdef _WIN32
+	return tolower((unsigned char)a) == tolower((unsigned char)b);
+#else
+	return a == b;
+#endif
+}
+
+// Matches the whole of s, backtracking only to the last * (which is enough, since a * can absorb anything the earlier ones did)
+static BOOL glob_match(const char* pattern, const char* s)
+{
+	const char* star = NULL;
+	const char* resume = NULL;
+
+	while (*s)
+	{
+		if (*pattern == '*')
+		{
+			star = pattern++;
+			resume = s;
+		}
+		else if (*pattern && (*pattern == '?' || char_equals(*pattern, *s)))
+		{
+			pattern++;
+			s++;
+		}
+		else if (star)
+		{
+			pattern = star + 1;
+			s = ++resume;
+		}
+		else
+			return FALSE;
+	}
+	while (*pattern == '*')
+		pattern++;
+	return *pattern == '\0';
+}
+
+static BOOL name_matches(const process_matcher_t* matcher, const char* name)
+{
+	if (matcher->glob)
+		return glob_match(matcher->pattern, name);
+#ifdef _WIN32
+	return _stricmp(matcher->pattern, name) == 0;
+#else
+	return strcmp(matcher->pattern, name) == 0;
+#endif
+}
+
+static void check_matcher(lua_State *L, int index, process_matcher_t* matcher)
+{
+	memset(matcher, 0, sizeof(process_matcher_t));
+	if (lua_type(L, index) == LUA_TFUNCTION)
+	{
+		matcher->predicate = index;
+		return;
+	}
+	matcher->pattern = luaL_checkstring(L, index);
+	matcher->glob = strpbrk(matcher->pattern, "*?") != NULL;
+}
+
+/**
+Checks the entry against the matcher. Without a predicate, no Lua code
+runs; with one, the predicate gets the (possibly truncated) name. If the
+match was made on the full name, it replaces the name in the entry.
+*/
+static BOOL process_matches(lua_State *L, const process_matcher_t* matcher, iterator_t* it, process_entry_t* entry)
+{
+	if (matcher->predicate)
+	{
+		lua_pushvalue(L, matcher->predicate);
+		lua_pushinteger(L, entry->pid);
+		lua_pushstring(L, entry->name);
+		lua_call(L, 2, 1);
+		BOOL matches = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+		return matches;
+	}
+
+	if (name_matches(matcher, entry->name))
+		return TRUE;
+
+	TCHAR name[MAX_PATH];
+	if (platform_process_full_name(it, entry, name, MAX_PATH) && name_matches(matcher, name))
+	{
+		strcpy(entry->name, name);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+memreader.findprocess(matcher[, open])
+
+Returns the pid and name of the first process that matches, or, if open is
+true, the first matching process that could be opened. Returns nil and an
+error message if there is none.
+*/
+int memreader_findprocess(lua_State *L)
+{
+	process_matcher_t matcher;
+	check_matcher(L, 1, &matcher);
+	BOOL open = lua_toboolean(L, 2);
+	lua_settop(L, 2);
+
+	iterator_t* it = push_iterator(L);
+	if (!platform_processes_open(it))
+		return push_last_error(L);
+
+	// the error of the first matching process that couldn't be opened
+	int error = 0;
+	process_entry_t entry;
+	while (platform_processes_next(it, &entry))
+	{
+		if (!process_matches(L, &matcher, it, &entry))
+			continue;
+
+		if (!open)
+		{
+			lua_pushinteger(L, entry.pid);
+			lua_pushstring(L, entry.name);
+			return 2;
+		}
+
+		process_t process;
+		if (process_open(&process, entry.pid))
+		{
+			*push_process(L) = process;
+			return 1;
+		}
+		if (!error)
+		{
+			push_last_error(L);
+			error = lua_gettop(L);
+		}
+	}
+
+	if (error)
+	{
+		lua_pushnil(L);
+		lua_pushvalue(L, error);
+		return 2;
+	}
+	return push_error(L, "no matching process");
+}
+
+/**
+memreader.findprocesses(matcher[, open])
+
+Returns an array of the matching processes: {pid = pid, name = name}
+tables, or opened processes if open is true (skipping the ones that
+couldn't be opened).
+*/
+int memreader_findprocesses(lua_State *L)
+{
+	process_matcher_t matcher;
+	check_matcher(L, 1, &matcher);
+	BOOL open = lua_toboolean(L, 2);
+	lua_settop(L, 2);
+
+	iterator_t* it = push_iterator(L);
+	if (!platform_processes_open(it))
+		return push_last_error(L);
+
+	lua_newtable(L);
+	int results = lua_gettop(L);
+	int count = 0;
+	process_entry_t entry;
+	while (platform_processes_next(it, &entry))
+	{
+		if (!process_matches(L, &matcher, it, &entry))
+			continue;
+
+		if (open)
+		{
+			process_t process;
+			if (!process_open(&process, entry.pid))
+				continue;
+			*push_process(L) = process;
+		}
+		else
+		{
+			lua_createtable(L, 0, 2);
+			lua_pushinteger(L, entry.pid);
+			lua_setfield(L, -2, "pid");
+			lua_pushstring(L, entry.name);
+			lua_setfield(L, -2, "name");
+		}
+		lua_rawseti(L, results, ++count);
+	}
+	return 1;
+}
\ No newline at end of file
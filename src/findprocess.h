@@ -0,0 +1,9 @@
+#ifndef MEMREADER_FINDPROCESS_H
+#define MEMREADER_FINDPROCESS_H
+
+#include "memreader.h"
+
+int memreader_findprocess(lua_State *L);
+int memreader_findprocesses(lua_State *L);
+
+#endif
\ No newline at end of file
@@ -3,12 +3,23 @@
 #include "address.h"
 #include "module.h"
 #include "window.h"
-
-#include <psapi.h>
-#include <tlhelp32.h>
+#include "platform.h"
+#include "buffer.h"
+#include "struct.h"
+#include "scanner.h"
+#include "snapshot.h"
+#include "watch.h"
+#include "pointermap.h"
+#include "symbols.h"
+#include "findprocess.h"
+#include "stats.h"
+#include "async.h"
+#include "offline.h"
+#include "strscan.h"
 
 static int memreader_debug_privilege(lua_State *L)
 {
+#ifdef _WIN32
 	BOOL state = lua_toboolean(L, 1);
 	HANDLE hToken = NULL;
 	LUID luid;
@@ -28,80 +39,80 @@ static int memreader_debug_privilege(lua_State *L)
 
 	lua_pushboolean(L, TRUE);
 	return 1;
+#else
+	return push_error(L, "not supported on this platform");
+#endif
 }
 
 static int memreader_process_iterator(lua_State *L)
 {
-	HANDLE handle = *(HANDLE*)lua_touserdata(L, lua_upvalueindex(1));
-	static PROCESSENTRY32 pe32;
-	pe32.dwSize = sizeof(PROCESSENTRY32);
-
-	BOOL success;
-	if (lua_isnil(L, 2)) // control variable is nil on first iteration
-		success = Process32First(handle, &pe32);
-	else
-		success = Process32Next(handle, &pe32);
+	iterator_t* it = (iterator_t*)lua_touserdata(L, lua_upvalueindex(1));
 
-	if (!success)
+	process_entry_t entry;
+	if (!platform_processes_next(it, &entry))
 		return 0;
 
-	lua_pushinteger(L, pe32.th32ProcessID);
-	lua_pushstring(L, pe32.szExeFile);
+	lua_pushinteger(L, entry.pid);
+	lua_pushstring(L, entry.name);
 	return 2;
 }
 
-static int memreader_snapshot_gc(lua_State *L)
+static int memreader_iterator_gc(lua_State *L)
 {
-	HANDLE handle = *(HANDLE*)lua_touserdata(L, 1);
-	if (handle) CloseHandle(handle);
+	iterator_t* it = (iterator_t*)lua_touserdata(L, 1);
+	platform_iterator_close(it);
 	return 0;
 }
 
-static int register_snapshot(lua_State *L)
+static int register_iterator(lua_State *L)
 {
-	luaL_newmetatable(L, SNAPSHOT_T);
+	luaL_newmetatable(L, ITERATOR_T);
 	lua_pushstring(L, "__gc");
-	lua_pushcfunction(L, memreader_snapshot_gc);
+	lua_pushcfunction(L, memreader_iterator_gc);
 	lua_settable(L, -3);
 	lua_pop(L, 1);
 	return 0;
 }
 
-static int memreader_processes(lua_State *L)
+iterator_t* push_iterator(lua_State *L)
 {
-	HANDLE* handlePtr = (HANDLE*)lua_newuserdata(L, sizeof(HANDLE*));
-	luaL_getmetatable(L, SNAPSHOT_T);
+	iterator_t* it = (iterator_t*)lua_newuserdata(L, sizeof(iterator_t));
+	platform_iterator_init(it);
+	luaL_getmetatable(L, ITERATOR_T);
 	lua_setmetatable(L, -2);
+	return it;
+}
+
+static int memreader_processes(lua_State *L)
+{
+	iterator_t* it = push_iterator(L);
 
-	*handlePtr = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-	if (*handlePtr == INVALID_HANDLE_VALUE)
+	if (!platform_processes_open(it))
 		return push_last_error(L);
 
-	// memreader_process_iterator's upvalue is the HANDLE* userdata
+	// memreader_process_iterator's upvalue is the iterator_t userdata
 	lua_pushcclosure(L, memreader_process_iterator, 1);
 	return 1;
 }
 
 static int memreader_open_process(lua_State *L)
 {
-	DWORD processId = (int)luaL_checkinteger(L, 1);
+	lua_Integer processId = luaL_checkinteger(L, 1);
 
 	if (processId <= 0)
 		return push_error(L, "invalid process id");
 
-	HANDLE processHandle = OpenProcess(OPEN_PROCESS_FLAGS, 0, processId);
-
-	if (!processHandle)
+	process_t process;
+	if (!process_open(&process, (DWORD)processId))
 		return push_last_error(L);
 
-	process_t *process = push_process(L);
-	init_process(process, processId, processHandle);
-
+	*push_process(L) = process;
 	return 1;
 }
 
 static int memreader_find_window(lua_State *L)
 {
+#ifdef _WIN32
 	const char* windowName = luaL_checkstring(L, 1);
 	HWND windowHandle = FindWindow(NULL, windowName);
 	if (!windowHandle)
@@ -110,13 +121,41 @@ static int memreader_find_window(lua_State *L)
 	window_t* window = push_window(L);
 	init_window(window, windowHandle, windowName);
 	return 1;
+#else
+	luaL_checkstring(L, 1);
+	return push_error(L, "not supported on this platform");
+#endif
+}
+
+static int memreader_buffer(lua_State *L)
+{
+	lua_Integer size = luaL_optinteger(L, 1, 0);
+	luaL_argcheck(L, size >= 0, 1, "size must not be negative");
+
+	buffer_t* buffer = push_buffer(L);
+	if (!buffer_resize(buffer, (SIZE_T)size))
+		return push_error(L, "not enough memory");
+	return 1;
 }
 
 static const luaL_Reg memreader_funcs[] = {
 	{ "openprocess", memreader_open_process },
+	{ "opencore", memreader_opencore },
+	{ "opensnapshot", memreader_opensnapshot },
 	{ "debugprivilege", memreader_debug_privilege },
 	{ "processes", memreader_processes },
+	{ "findprocess", memreader_findprocess },
+	{ "findprocesses", memreader_findprocesses },
 	{ "findwindow", memreader_find_window },
+	{ "buffer", memreader_buffer },
+	{ "addressmode", memreader_addressmode },
+	{ "stats", memreader_stats },
+	{ "resetstats", memreader_reset_stats },
+	{ "poll", memreader_poll },
+	{ "pollfd", memreader_pollfd },
+	{ "struct", memreader_struct },
+	{ "scanner", memreader_scanner },
+	{ "loadpointermap", memreader_loadpointermap },
 	{ NULL, NULL }
 };
 
@@ -127,8 +166,19 @@ LUALIB_API int luaopen_memreader(lua_State *L)
 	register_process(L);
 	register_memaddress(L);
 	register_module(L);
+	register_symbols(L);
+#ifdef _WIN32
 	register_window(L);
+#endif
+	register_iterator(L);
+	register_buffer(L);
+	register_struct(L);
+	register_scanner(L);
 	register_snapshot(L);
+	register_watcher(L);
+	register_pointermap(L);
+	register_async(L);
+	register_strscan(L);
 
 	return 1;
 }
@@ -10,8 +10,11 @@
 # define luaL_newlib(L,l) (lua_newtable(L), luaL_register(L,NULL,l))
 #endif
 # define luaL_setfuncs(L,l,n) (assert(n==0), luaL_register(L,NULL,l))
+# define lua_rawlen lua_objlen
 #endif
 
+#ifdef _WIN32
+
 #ifndef WINVER
 #define WINVER 0x501
 #endif
@@ -21,14 +24,46 @@
 #define PSAPI_VERSION 1
 #include <windows.h>
 #include <tchar.h>
-#include <assert.h>
 
 #define OPEN_PROCESS_FLAGS PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ
+
+#else
+
+#include <stddef.h>
+#include <limits.h>
+
+// The rest of memreader is written against the WinAPI types, so provide
+// equivalents for the ones it uses on other platforms
+typedef int BOOL;
+typedef uint32_t DWORD;
+typedef size_t SIZE_T;
+typedef intptr_t LONG_PTR;
+typedef void* LPVOID;
+typedef const void* LPCVOID;
+typedef void* HMODULE;
+typedef char TCHAR;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define MAX_PATH PATH_MAX
+
+#endif
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #define MAX_PROCESSES 1024
 #define MAX_MODULES 1024
 
 #include "utils.h"
 
-#define SNAPSHOT_T MEMREADER_METATABLE(snapshot)
+#define ITERATOR_T MEMREADER_METATABLE(iterator)
 
 #endif
\ No newline at end of file
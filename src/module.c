@@ -1,8 +1,10 @@
 #include "module.h"
 #include "address.h"
+#include "platform.h"
+#include "symbols.h"
+#include "modulemap.h"
 
-#include <psapi.h>
-
+#ifdef _WIN32
 void init_module(module_t * module, MODULEENTRY32 * me32)
 {
 	module->handle = me32->hModule;
@@ -10,6 +12,22 @@ void init_module(module_t * module, MODULEENTRY32 * me32)
 	memcpy_s(module->path, sizeof(module->path), me32->szExePath, sizeof(me32->szExePath));
 	module->size = me32->modBaseSize;
 }
+#endif
+
+BOOL process_find_module(process_t* process, const char* name, module_t* module)
+{
+	const module_t* found;
+	if (!module_map_find(process, name, &found) || !found)
+		return FALSE;
+	*module = *found;
+	return TRUE;
+}
+
+module_t* check_module(lua_State *L, int index)
+{
+	module_t* module = (module_t*)luaL_checkudata(L, index, MODULE_T);
+	return module;
+}
 
 module_t* push_module(lua_State *L)
 {
@@ -23,6 +41,9 @@ static const luaL_Reg module_meta[] = {
 	{ NULL, NULL }
 };
 static const luaL_Reg module_methods[] = {
+	{ "symbol", module_symbol },
+	{ "symbols", module_symbols },
+	{ "symbolat", module_symbol_at },
 	{ NULL, NULL }
 };
 static udata_field_info module_getters[] = {
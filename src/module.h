@@ -2,19 +2,32 @@
 #define MEMREADER_MODULE_H
 
 #include "memreader.h"
+#include "process.h"
+
+#ifdef _WIN32
 #include <tlhelp32.h>
+#define MODULE_NAME_SIZE (MAX_MODULE_NAME32 + 1)
+#else
+#define MODULE_NAME_SIZE 256
+#endif
 
 #define MODULE_T MEMREADER_METATABLE(module)
 
 typedef struct {
 	HMODULE handle;
-	TCHAR name[MAX_MODULE_NAME32 + 1];
+	TCHAR name[MODULE_NAME_SIZE];
 	TCHAR path[MAX_PATH];
 	DWORD size;
 } module_t;
 
+#ifdef _WIN32
 void init_module(module_t * module, MODULEENTRY32 * me32);
+#endif
 int register_module(lua_State *L);
+module_t* check_module(lua_State *L, int index);
 module_t* push_module(lua_State *L);
 
+// Finds a module of the process by name (case-insensitively on Windows), using the module map of the process
+BOOL process_find_module(process_t* process, const char* name, module_t* module);
+
 #endif
\ No newline at end of file
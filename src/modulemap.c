@@ -0,0 +1,237 @@
+#include "modulemap.h"
+#include "address.h"
+#include "platform.h"
+
+#include <ctype.h>
+
+static uint32_t hash_module_name(const char* name)
+{
+	uint32_t hash = 2166136261u;
+	for (; *name; name++)
+	{
+#ifdef _WIN32
+		hash = (hash ^ (unsigned char)tolower((unsigned char)*name)) * 16777619u;
+#else
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+#endif
+	}
+	return hash;
+}
+
+static BOOL module_name_equals(const char* a, const char* b)
+{
+#ifdef _WIN32
+	return _stricmp(a, b) == 0;
+#else
+	return strcmp(a, b) == 0;
+#endif
+}
+
+static int compare_modules(const void* a, const void* b)
+{
+	const char* x = (const char*)((const module_t*)a)->handle;
+	const char* y = (const char*)((const module_t*)b)->handle;
+	if (x != y)
+		return x < y ? -1 : 1;
+	return 0;
+}
+
+void module_map_free(module_map_t* map)
+{
+	if (!map)
+		return;
+	free(map->modules);
+	free(map->index);
+	free(map);
+}
+
+// Lists the modules again and rebuilds the index
+static BOOL module_map_rebuild(module_map_t* map, process_t* process)
+{
+	iterator_t it;
+	module_t module;
+	module_t* modules = NULL;
+	SIZE_T i, count = 0, capacity = 0;
+	BOOL success = TRUE;
+
+	platform_iterator_init(&it);
+	if (!platform_modules_open(&it, process))
+		return FALSE;
+	while (success && platform_modules_next(&it, &module))
+	{
+		if (count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			module_t* grown = (module_t*)realloc(modules, capacity * sizeof(module_t));
+			success = grown != NULL;
+			if (!success)
+				break;
+			modules = grown;
+		}
+		modules[count++] = module;
+	}
+	platform_iterator_close(&it);
+
+	SIZE_T indexSize = 16;
+	while (indexSize < count * 2)
+		indexSize *= 2;
+	uint32_t* index = success ? (uint32_t*)calloc(indexSize, sizeof(uint32_t)) : NULL;
+	if (!index)
+	{
+		free(modules);
+		return FALSE;
+	}
+
+	// when names repeat, the lowest module is the one found by name
+	qsort(modules, count, sizeof(module_t), compare_modules);
+	for (i = 0; i < count; i++)
+	{
+		SIZE_T slot = hash_module_name(modules[i].name) & (indexSize - 1);
+		while (index[slot] && !module_name_equals(modules[index[slot] - 1].name, modules[i].name))
+			slot = (slot + 1) & (indexSize - 1);
+		if (!index[slot])
+			index[slot] = (uint32_t)i + 1;
+	}
+
+	free(map->modules);
+	free(map->index);
+	map->modules = modules;
+	map->count = count;
+	map->index = index;
+	map->indexSize = indexSize;
+	return TRUE;
+}
+
+/**
+Makes sure the map is up to date, unless it was checked less than maxAge
+microseconds ago.
+*/
+static BOOL module_map_refresh(process_t* process, uint64_t maxAge)
+{
+	module_map_t* map = process->modules;
+	uint64_t now = platform_time_us();
+	uint64_t signature;
+
+	if (!map)
+	{
+		map = (module_map_t*)calloc(1, sizeof(module_map_t));
+		if (!map)
+			return FALSE;
+		process->modules = map;
+	}
+	if (maxAge < map->checkTime * MODULE_MAP_CHECK_RATIO)
+		maxAge = map->checkTime * MODULE_MAP_CHECK_RATIO;
+	if (map->valid && now - map->checked < maxAge)
+		return TRUE;
+
+	if (!platform_modules_signature(process, &signature))
+		return FALSE;
+	map->checked = now;
+	map->checkTime = platform_time_us() - now;
+	if (map->valid && signature == map->signature)
+		return TRUE;
+
+	// the signature is taken first, so changes made during the rebuild are caught by the next check
+	map->valid = module_map_rebuild(map, process);
+	map->signature = signature;
+	return map->valid;
+}
+
+static const module_t* lookup_name(const module_map_t* map, const char* name)
+{
+	SIZE_T slot = hash_module_name(name) & (map->indexSize - 1);
+	while (map->index[slot])
+	{
+		const module_t* module = &map->modules[map->index[slot] - 1];
+		if (module_name_equals(module->name, name))
+			return module;
+		slot = (slot + 1) & (map->indexSize - 1);
+	}
+	return NULL;
+}
+
+static const module_t* lookup_address(const module_map_t* map, LPCVOID address)
+{
+	SIZE_T lo = 0, hi = map->count;
+	while (lo < hi)
+	{
+		SIZE_T mid = lo + (hi - lo) / 2;
+		if ((const char*)map->modules[mid].handle <= (const char*)address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return NULL;
+
+	const module_t* module = &map->modules[lo - 1];
+	return (SIZE_T)((const char*)address - (const char*)module->handle) < module->size ? module : NULL;
+}
+
+BOOL module_map_find(process_t* process, const char* name, const module_t** module)
+{
+	if (!module_map_refresh(process, MODULE_MAP_RECHECK_US))
+		return FALSE;
+	*module = lookup_name(process->modules, name);
+	if (!*module)
+	{
+		if (!module_map_refresh(process, MODULE_MAP_MISS_RECHECK_US))
+			return FALSE;
+		*module = lookup_name(process->modules, name);
+	}
+	return TRUE;
+}
+
+BOOL module_map_at(process_t* process, LPCVOID address, const module_t** module)
+{
+	if (!module_map_refresh(process, MODULE_MAP_RECHECK_US))
+		return FALSE;
+	*module = lookup_address(process->modules, address);
+	if (!*module)
+	{
+		if (!module_map_refresh(process, MODULE_MAP_MISS_RECHECK_US))
+			return FALSE;
+		*module = lookup_address(process->modules, address);
+	}
+	return TRUE;
+}
+
+/**
+process:module(name)
+
+Returns the module with the given name, or nil and an error message if
+there is none.
+*/
+int process_module(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	const char* name = luaL_checkstring(L, 2);
+	const module_t* module;
+
+	if (!module_map_find(process, name, &module))
+		return push_last_error(L);
+	if (!module)
+		return push_error(L, lua_pushfstring(L, "module '%s' not found", name));
+
+	*push_module(L) = *module;
+	return 1;
+}
+
+// process:moduleat(address) returns the module containing address, or nil
+int process_module_at(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	LPCVOID address = (LPCVOID)memaddress_checkptr(L, 2);
+	const module_t* module;
+
+	if (!module_map_at(process, address, &module))
+		return push_last_error(L);
+	if (!module)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	*push_module(L) = *module;
+	return 1;
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef MEMREADER_MODULEMAP_H
+#define MEMREADER_MODULEMAP_H
+
+#include "memreader.h"
+#include "process.h"
+#include "module.h"
+
+// How long the module map is trusted before checking whether the modules of the process changed
+#define MODULE_MAP_RECHECK_US 100000
+// The same, for lookups that found nothing (the module may have just been loaded)
+#define MODULE_MAP_MISS_RECHECK_US 10000
+// Checks are also spaced out to at least this many times as long as the last one took
+#define MODULE_MAP_CHECK_RATIO 50
+
+/**
+The modules of a process, kept between calls: sorted by base for address
+lookups, with an open-addressing hash index of the names (case-insensitive
+on Windows). To check whether it's stale, the platform computes a signature
+of the module list (a hash of the file-backed lines of the maps file on
+Linux, of the EnumProcessModules handles on Windows), and the map is only
+rebuilt when it changes. On Windows that's much cheaper than listing the
+modules, but on Linux it still means reading the whole maps file, so
+checks are also spaced out by how long the last one took.
+*/
+struct module_map_t {
+	module_t* modules;
+	SIZE_T count;
+	uint32_t* index; // module index + 1 for each slot, 0 for an empty slot
+	SIZE_T indexSize;
+	uint64_t signature;
+	uint64_t checked; // platform_time_us() of the last signature check
+	uint64_t checkTime; // how long it took, in microseconds
+	BOOL valid;
+};
+
+void module_map_free(module_map_t* map);
+
+// These return FALSE if the modules couldn't be listed, and set *module to NULL if there's no match
+BOOL module_map_find(process_t* process, const char* name, const module_t** module);
+BOOL module_map_at(process_t* process, LPCVOID address, const module_t** module);
+
+int process_module(lua_State *L);
+int process_module_at(lua_State *L);
+
+#endif
\ No newline at end of file
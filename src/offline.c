@@ -0,0 +1,814 @@
+#include "offline.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "compress.h"
+#include "threadpool.h"
+
+#ifdef _WIN32
+#define OFFLINE_FAULT ERROR_PARTIAL_COPY
+#else
+#include <errno.h>
+#define OFFLINE_FAULT EFAULT
+#endif
+
+// Finds the region containing address
+static const offline_region_t* find_region(const offline_image_t* image, const char* address)
+{
+	SIZE_T lo = 0, hi = image->regionCount;
+	while (lo < hi)
+	{
+		SIZE_T mid = lo + (hi - lo) / 2;
+		if (image->regions[mid].base <= address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return NULL;
+
+	const offline_region_t* region = &image->regions[lo - 1];
+	return (SIZE_T)(address - region->base) < region->size ? region : NULL;
+}
+
+// Copies as much of [address, address + size) as was saved, stopping at the first byte that wasn't
+static SIZE_T copy_out(const offline_image_t* image, const char* address, unsigned char* buffer, SIZE_T size)
+{
+	const offline_region_t* region = find_region(image, address);
+	const offline_region_t* end = image->regions + image->regionCount;
+	SIZE_T copied = 0;
+
+	while (copied < size && region && region->data)
+	{
+		SIZE_T offset = (SIZE_T)(address + copied - region->base);
+		SIZE_T n = region->size - offset < size - copied ? region->size - offset : size - copied;
+		memcpy(buffer + copied, region->data + offset, n);
+		copied += n;
+
+		// keep going only if the next region starts right where this one ends
+		const char* next = region->base + region->size;
+		region = region + 1 < end && region[1].base == next ? region + 1 : NULL;
+	}
+	return copied;
+}
+
+BOOL offline_read(process_t* process, LPCVOID address, LPVOID buffer, SIZE_T size, SIZE_T* bytesRead)
+{
+	STATS_START(start);
+	*bytesRead = copy_out(process->offline, (const char*)address, (unsigned char*)buffer, size);
+	STATS_READ(process, READ_BACKEND_MMAP, start, size, *bytesRead);
+	if (*bytesRead < size)
+	{
+		platform_set_last_error(OFFLINE_FAULT);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+SIZE_T offline_readv(process_t* process, read_request_t* requests, SIZE_T count)
+{
+	SIZE_T i, complete = 0;
+	STATS_START(start);
+	for (i = 0; i < count; i++)
+	{
+		read_request_t* req = &requests[i];
+		req->bytesRead = copy_out(process->offline, (const char*)req->address, (unsigned char*)req->buffer, req->size);
+		if (req->bytesRead == req->size)
+			complete++;
+	}
+	STATS_READV(process, READ_BACKEND_MMAP, start, count, requests, count);
+	return complete;
+}
+
+const unsigned char* offline_view(process_t* process, LPCVOID address, SIZE_T size)
+{
+	if (!process->offline)
+		return NULL;
+
+	const offline_region_t* region = find_region(process->offline, (const char*)address);
+	if (!region || !region->data)
+		return NULL;
+	SIZE_T offset = (SIZE_T)((const char*)address - region->base);
+	return size <= region->size - offset ? region->data + offset : NULL;
+}
+
+void offline_close(process_t* process)
+{
+	offline_image_t* image = process->offline;
+	if (!image)
+		return;
+	platform_unmap_file(&image->file);
+	if (image->unpacked)
+		platform_unmap_temp(&image->unpackedData);
+	free(image->regions);
+	free(image->modules);
+	free(image);
+	process->offline = NULL;
+}
+
+BOOL offline_exit_code(process_t* process, BOOL* running, DWORD* exitCode)
+{
+	*running = FALSE;
+	*exitCode = process->offline->exitCode;
+	return TRUE;
+}
+
+BOOL offline_modules_open(iterator_t* it, process_t* process)
+{
+	it->offline = process->offline;
+	it->index = 0;
+	return TRUE;
+}
+
+BOOL offline_modules_next(iterator_t* it, module_t* module)
+{
+	it->started = TRUE;
+	if (it->index >= it->offline->moduleCount)
+		return FALSE;
+	*module = it->offline->modules[it->index++];
+	return TRUE;
+}
+
+BOOL offline_regions_open(iterator_t* it, process_t* process)
+{
+	return offline_modules_open(it, process);
+}
+
+BOOL offline_regions_next(iterator_t* it, process_t* process, region_t* region, TCHAR* path, SIZE_T pathSize)
+{
+	it->started = TRUE;
+	if (it->index >= it->offline->regionCount)
+		return FALSE;
+
+	const offline_region_t* r = &it->offline->regions[it->index++];
+	region->base = r->base;
+	region->size = r->size;
+	region->protect = r->protect;
+	region->type = r->type;
+	if (path)
+	{
+		copy_string(path, pathSize, r->path ? r->path : "");
+	}
+	return TRUE;
+}
+
+// Loading
+
+static int compare_regions(const void* a, const void* b)
+{
+	const char* x = ((const offline_region_t*)a)->base;
+	const char* y = ((const offline_region_t*)b)->base;
+	return x < y ? -1 : x > y;
+}
+
+static int compare_modules(const void* a, const void* b)
+{
+	const char* x = (const char*)((const module_t*)a)->handle;
+	const char* y = (const char*)((const module_t*)b)->handle;
+	return x < y ? -1 : x > y;
+}
+
+// Checks that the regions don't overlap once sorted, since reads rely on finding a single region for an address
+static BOOL sort_regions(offline_image_t* image)
+{
+	SIZE_T i;
+	qsort(image->regions, image->regionCount, sizeof(offline_region_t), compare_regions);
+	for (i = 1; i < image->regionCount; i++)
+	{
+		const offline_region_t* prev = &image->regions[i - 1];
+		if ((SIZE_T)(image->regions[i].base - prev->base) < prev->size)
+			return FALSE;
+	}
+	qsort(image->modules, image->moduleCount, sizeof(module_t), compare_modules);
+	return TRUE;
+}
+
+// Whether an address of the target can be represented by a pointer of ours
+static BOOL address_fits(uint64_t address, uint64_t size)
+{
+	return address <= (uint64_t)(SIZE_T)-1 && size <= (uint64_t)(SIZE_T)-1 - address;
+}
+
+// ELF core dumps
+
+#define ELF_CLASS32 1
+#define ELF_CLASS64 2
+#define ELF_DATA_LSB 1
+#define ELF_DATA_MSB 2
+#define ELF_CORE 4
+#define ELF_PN_XNUM 0xffff
+#define ELF_PT_LOAD 1
+#define ELF_PT_NOTE 4
+#define ELF_PF_X 0x1
+#define ELF_PF_W 0x2
+#define ELF_PF_R 0x4
+#define ELF_NT_PRSTATUS 1
+#define ELF_NT_PRPSINFO 3
+#define ELF_NT_FILE 0x46494c45
+
+// The ELF structures are read field by field, so that 32 and 64-bit cores can be opened by either build
+typedef struct {
+	const unsigned char* data;
+	SIZE_T size;
+	BOOL is64;
+} elf_t;
+
+static uint64_t elf_u16(const unsigned char* p)
+{
+	uint16_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t elf_u32(const unsigned char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t elf_u64(const unsigned char* p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+// A field that's 4 bytes in 32-bit cores and 8 in 64-bit ones (an address, offset or long)
+static uint64_t elf_word(const elf_t* elf, const unsigned char* p)
+{
+	return elf->is64 ? elf_u64(p) : elf_u32(p);
+}
+
+// Whether [offset, offset + size) is within the file
+static BOOL elf_contains(const elf_t* elf, uint64_t offset, uint64_t size)
+{
+	return offset <= elf->size && size <= elf->size - offset;
+}
+
+typedef struct {
+	uint64_t start;
+	uint64_t end;
+	const char* path;
+} elf_file_t;
+
+typedef struct {
+	elf_file_t* files; // the NT_FILE mappings, in address order
+	SIZE_T fileCount;
+	char fname[17]; // pr_fname of NT_PRPSINFO
+	DWORD pid;
+	DWORD signal;
+} elf_notes_t;
+
+// Reads the mappings of an NT_FILE note: count, page size, then count {start, end, offset} and count paths
+static BOOL elf_parse_files(const elf_t* elf, const unsigned char* desc, SIZE_T size, elf_notes_t* notes)
+{
+	SIZE_T word = elf->is64 ? 8 : 4;
+	if (size < word * 2)
+		return TRUE;
+
+	uint64_t count = elf_word(elf, desc);
+	if (count > (size - word * 2) / (word * 3))
+		return TRUE;
+
+	notes->files = (elf_file_t*)malloc((count ? (SIZE_T)count : 1) * sizeof(elf_file_t));
+	if (!notes->files)
+		return FALSE;
+
+	const unsigned char* entry = desc + word * 2;
+	const char* path = (const char*)(entry + count * word * 3);
+	const char* end = (const char*)desc + size;
+	SIZE_T i;
+	for (i = 0; i < count; i++, entry += word * 3)
+	{
+		const char* nul = (const char*)memchr(path, '\0', end - path);
+		if (!nul)
+			break;
+		elf_file_t* file = &notes->files[notes->fileCount++];
+		file->start = elf_word(elf, entry);
+		file->end = elf_word(elf, entry + word);
+		file->path = path;
+		path = nul + 1;
+	}
+	return TRUE;
+}
+
+static BOOL elf_parse_notes(const elf_t* elf, const unsigned char* data, SIZE_T size, elf_notes_t* notes)
+{
+	SIZE_T offset = 0;
+	while (size - offset >= 12)
+	{
+		SIZE_T nameSize = (SIZE_T)elf_u32(data + offset);
+		SIZE_T descSize = (SIZE_T)elf_u32(data + offset + 4);
+		uint64_t type = elf_u32(data + offset + 8);
+		SIZE_T descOffset = offset + 12 + ((nameSize + 3) & ~(SIZE_T)3);
+		if (nameSize > size || descOffset > size || descSize > size - descOffset)
+			break;
+		const unsigned char* desc = data + descOffset;
+
+		if (type == ELF_NT_FILE && !notes->files)
+		{
+			if (!elf_parse_files(elf, desc, descSize, notes))
+				return FALSE;
+		}
+		else if (type == ELF_NT_PRSTATUS && !notes->signal && descSize >= 14)
+		{
+			// pr_cursig follows the 3 ints of pr_info; the first NT_PRSTATUS is the thread that dumped
+			notes->signal = (DWORD)elf_u16(desc + 12);
+		}
+		else if (type == ELF_NT_PRPSINFO)
+		{
+			// pr_pid and pr_fname come after pr_flag (a long) and pr_uid/pr_gid (16-bit in 32-bit cores)
+			SIZE_T pid = elf->is64 ? 24 : 12, fname = elf->is64 ? 40 : 28;
+			if (descSize >= fname + 16)
+			{
+				notes->pid = (DWORD)elf_u32(desc + pid);
+				memcpy(notes->fname, desc + fname, 16);
+				notes->fname[16] = '\0';
+			}
+		}
+		offset = descOffset + ((descSize + 3) & ~(SIZE_T)3);
+		if (offset > size)
+			break;
+	}
+	return TRUE;
+}
+
+// Groups the NT_FILE mappings into modules the way the maps file is grouped on Linux (see platform_modules_next)
+static BOOL elf_collect_modules(offline_image_t* image, const elf_notes_t* notes)
+{
+	SIZE_T i;
+	image->modules = (module_t*)calloc(notes->fileCount ? notes->fileCount : 1, sizeof(module_t));
+	if (!image->modules)
+		return FALSE;
+
+	for (i = 0; i < notes->fileCount; i++)
+	{
+		const elf_file_t* file = &notes->files[i];
+		if (file->end < file->start || !address_fits(file->start, file->end - file->start))
+			continue;
+		module_t* last = image->moduleCount ? &image->modules[image->moduleCount - 1] : NULL;
+		if (last && strcmp(last->path, file->path) == 0)
+		{
+			last->size = (DWORD)(file->end - (uint64_t)(uintptr_t)last->handle);
+			continue;
+		}
+
+		module_t* module = &image->modules[image->moduleCount++];
+		module->handle = (HMODULE)(uintptr_t)file->start;
+		module->size = (DWORD)(file->end - file->start);
+		copy_string(module->path, sizeof(module->path), file->path);
+		copy_string(module->name, sizeof(module->name), path_basename(file->path));
+	}
+	return TRUE;
+}
+
+static BOOL elf_add_region(offline_image_t* image, uint64_t base, uint64_t size, const unsigned char* data, DWORD protect, const elf_notes_t* notes)
+{
+	if (size == 0)
+		return TRUE;
+	if (!address_fits(base, size))
+		return FALSE;
+
+	offline_region_t* region = &image->regions[image->regionCount++];
+	region->base = (char*)(uintptr_t)base;
+	region->size = (SIZE_T)size;
+	region->data = data;
+	region->protect = protect;
+	region->type = REGION_PRIVATE;
+	region->path = NULL;
+
+	SIZE_T i;
+	for (i = 0; i < notes->fileCount; i++)
+	{
+		if (base >= notes->files[i].start && base < notes->files[i].end)
+		{
+			region->type = REGION_IMAGE;
+			region->path = notes->files[i].path;
+			break;
+		}
+	}
+	return TRUE;
+}
+
+static const char* elf_load_segments(offline_image_t* image, const elf_t* elf, const unsigned char* phdrs, SIZE_T phentsize, SIZE_T phnum, const elf_notes_t* notes)
+{
+	SIZE_T i;
+	// a segment that was only partly saved becomes two regions
+	image->regions = (offline_region_t*)malloc((phnum ? phnum : 1) * 2 * sizeof(offline_region_t));
+	if (!image->regions)
+		return "not enough memory";
+
+	for (i = 0; i < phnum; i++)
+	{
+		const unsigned char* ph = phdrs + i * phentsize;
+		uint64_t type = elf_u32(ph);
+		if (type != ELF_PT_LOAD)
+			continue;
+
+		uint64_t flags, offset, vaddr, filesz, memsz;
+		if (elf->is64)
+		{
+			flags = elf_u32(ph + 4);
+			offset = elf_u64(ph + 8);
+			vaddr = elf_u64(ph + 16);
+			filesz = elf_u64(ph + 32);
+			memsz = elf_u64(ph + 40);
+		}
+		else
+		{
+			offset = elf_u32(ph + 4);
+			vaddr = elf_u32(ph + 8);
+			filesz = elf_u32(ph + 16);
+			memsz = elf_u32(ph + 20);
+			flags = elf_u32(ph + 24);
+		}
+
+		// a truncated core has whatever made it into the file
+		if (offset > elf->size)
+			filesz = 0;
+		else if (filesz > elf->size - offset)
+			filesz = elf->size - offset;
+		if (filesz > memsz)
+			filesz = memsz;
+
+		DWORD protect = 0;
+		if (flags & ELF_PF_R)
+			protect |= REGION_READ;
+		if (flags & ELF_PF_W)
+			protect |= REGION_WRITE;
+		if (flags & ELF_PF_X)
+			protect |= REGION_EXECUTE;
+
+		// memory that wasn't dumped (e.g. the unmodified pages of mapped files) can't be read
+		if (!elf_add_region(image, vaddr, filesz, elf->data + (SIZE_T)offset, protect, notes)
+			|| !elf_add_region(image, vaddr + filesz, memsz - filesz, NULL, protect & ~(DWORD)REGION_READ, notes))
+			return "the core's addresses don't fit in the pointers of this build";
+	}
+	return NULL;
+}
+
+static const char* load_core(process_t* process, offline_image_t* image)
+{
+	const unsigned char* data = (const unsigned char*)image->file.data;
+	const uint16_t one = 1;
+	elf_t elf = { data, image->file.size, FALSE };
+
+	if (elf.size < 52 || memcmp(data, "\x7f" "ELF", 4) != 0)
+		return "not an ELF file";
+	if (data[4] != ELF_CLASS32 && data[4] != ELF_CLASS64)
+		return "unknown ELF class";
+	if (data[5] != (*(const unsigned char*)&one == 1 ? ELF_DATA_LSB : ELF_DATA_MSB))
+		return "the core's byte order isn't that of this machine";
+	elf.is64 = data[4] == ELF_CLASS64;
+	if (elf.is64 && elf.size < 64)
+		return "truncated ELF header";
+	if (elf_u16(data + 16) != ELF_CORE)
+		return "not a core dump";
+
+	uint64_t phoff = elf.is64 ? elf_u64(data + 32) : elf_u32(data + 28);
+	SIZE_T phentsize = (SIZE_T)elf_u16(data + (elf.is64 ? 54 : 42));
+	uint64_t phnum = elf_u16(data + (elf.is64 ? 56 : 44));
+	if (phnum == ELF_PN_XNUM)
+	{
+		// the real count is the sh_info of the first section header
+		uint64_t shoff = elf.is64 ? elf_u64(data + 40) : elf_u32(data + 32);
+		SIZE_T infoOffset = elf.is64 ? 44 : 28;
+		if (!elf_contains(&elf, shoff, infoOffset + 4))
+			return "truncated ELF header";
+		phnum = elf_u32(data + (SIZE_T)shoff + infoOffset);
+	}
+	if (phentsize < (elf.is64 ? 56u : 32u) || !elf_contains(&elf, phoff, phnum * phentsize))
+		return "truncated ELF header";
+	const unsigned char* phdrs = data + (SIZE_T)phoff;
+
+	elf_notes_t notes;
+	memset(&notes, 0, sizeof(notes));
+	const char* err = NULL;
+	SIZE_T i;
+	for (i = 0; i < phnum && !err; i++)
+	{
+		const unsigned char* ph = phdrs + i * phentsize;
+		if (elf_u32(ph) != ELF_PT_NOTE)
+			continue;
+		uint64_t offset = elf.is64 ? elf_u64(ph + 8) : elf_u32(ph + 4);
+		uint64_t size = elf.is64 ? elf_u64(ph + 32) : elf_u32(ph + 16);
+		if (elf_contains(&elf, offset, size) && !elf_parse_notes(&elf, data + (SIZE_T)offset, (SIZE_T)size, &notes))
+			err = "not enough memory";
+	}
+
+	if (!err && !elf_collect_modules(image, &notes))
+		err = "not enough memory";
+	if (!err)
+		err = elf_load_segments(image, &elf, phdrs, phentsize, (SIZE_T)phnum, &notes);
+	if (!err && !sort_regions(image))
+		err = "the core has overlapping segments";
+
+	if (!err)
+	{
+		process->pid = notes.pid;
+		process->pointerSize = elf.is64 ? 8 : 4;
+		image->exitCode = notes.signal;
+		copy_string(process->name, sizeof(process->name), notes.fname);
+
+		// the executable is the module pr_fname was cut from (it holds at most 15 characters)
+		SIZE_T length = strlen(notes.fname);
+		for (i = 0; i < image->moduleCount; i++)
+		{
+			const module_t* module = &image->modules[i];
+			if (length > 0 && strncmp(module->name, notes.fname, length) == 0)
+			{
+				process->module = module->handle;
+				copy_string(process->name, sizeof(process->name), module->name);
+				copy_string(process->path, sizeof(process->path), module->path);
+				break;
+			}
+		}
+	}
+	free(notes.files);
+	return err;
+}
+
+// Saved snapshots
+
+typedef struct {
+	const unsigned char* data;
+	SIZE_T size;
+	SIZE_T offset;
+	BOOL ok; // cleared by the first read past the end
+} file_reader_t;
+
+static const unsigned char* read_bytes(file_reader_t* reader, SIZE_T size)
+{
+	if (!reader->ok || size > reader->size - reader->offset)
+	{
+		reader->ok = FALSE;
+		return NULL;
+	}
+	const unsigned char* p = reader->data + reader->offset;
+	reader->offset += size;
+	return p;
+}
+
+static uint32_t read_u32(file_reader_t* reader)
+{
+	uint32_t value = 0;
+	const unsigned char* p = read_bytes(reader, sizeof(value));
+	if (p)
+		memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t read_u64(file_reader_t* reader)
+{
+	uint64_t value = 0;
+	const unsigned char* p = read_bytes(reader, sizeof(value));
+	if (p)
+		memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static void read_string(file_reader_t* reader, TCHAR* dest, SIZE_T size)
+{
+	uint32_t length = read_u32(reader);
+	const unsigned char* p = read_bytes(reader, length);
+	if (!p || length >= size)
+	{
+		reader->ok = FALSE;
+		dest[0] = '\0';
+		return;
+	}
+	memcpy(dest, p, length);
+	dest[length] = '\0';
+}
+
+typedef struct {
+	const unsigned char* entry; // in the chunk index
+	unsigned char* data;
+	SIZE_T size;
+} unpack_chunk_t;
+
+typedef struct {
+	const offline_image_t* image;
+	unpack_chunk_t* chunks;
+	SIZE_T failed;
+} unpack_job_t;
+
+static void unpack_task(void* ctx, int worker, SIZE_T task)
+{
+	unpack_job_t* job = (unpack_job_t*)ctx;
+	const unpack_chunk_t* chunk = &job->chunks[task];
+	uint64_t offset, size;
+	(void)worker;
+
+	memcpy(&offset, chunk->entry, sizeof(offset));
+	memcpy(&size, chunk->entry + 8, sizeof(size));
+	// all zeros, which the mapping already is
+	if (size == 0)
+		return;
+
+	const unsigned char* data = (const unsigned char*)job->image->file.data + (SIZE_T)offset;
+	BOOL valid = offset <= job->image->file.size && size <= job->image->file.size - offset && size <= chunk->size;
+	if (valid && size == chunk->size)
+		memcpy(chunk->data, data, chunk->size);
+	else if (!valid || !decompress_block(data, (SIZE_T)size, chunk->data, chunk->size))
+		POOL_STORE_RELEASE(&job->failed, 1);
+}
+
+/**
+The regions of a compressed snapshot point at their chunk index: this
+decompresses every chunk (on the thread pool) into a temporary file mapping,
+which the regions then point into instead.
+*/
+static const char* unpack_snapshot(offline_image_t* image)
+{
+	SIZE_T i, total = 0, chunkCount = 0;
+	for (i = 0; i < image->regionCount; i++)
+	{
+		SIZE_T size = image->regions[i].size;
+		SIZE_T chunks = size / SNAPSHOT_FILE_CHUNK_SIZE + (size % SNAPSHOT_FILE_CHUNK_SIZE != 0);
+		const unsigned char* index = image->regions[i].data;
+		if (chunks > (SIZE_T)((const unsigned char*)image->file.data + image->file.size - index) / 16)
+			return "invalid snapshot";
+		chunkCount += chunks;
+		total += (size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE * SNAPSHOT_PAGE_SIZE;
+	}
+	if (total == 0)
+		return NULL;
+
+	unpack_job_t job = { image, NULL, 0 };
+	job.chunks = (unpack_chunk_t*)malloc(chunkCount * sizeof(unpack_chunk_t));
+	if (!job.chunks)
+		return "not enough memory";
+	if (!platform_map_temp(&image->unpackedData, total))
+	{
+		free(job.chunks);
+		return "not enough memory for the decompressed snapshot";
+	}
+	image->unpacked = TRUE;
+
+	unsigned char* data = (unsigned char*)image->unpackedData.data;
+	SIZE_T c = 0;
+	for (i = 0; i < image->regionCount; i++)
+	{
+		offline_region_t* region = &image->regions[i];
+		SIZE_T offset;
+		for (offset = 0; offset < region->size; offset += SNAPSHOT_FILE_CHUNK_SIZE)
+		{
+			unpack_chunk_t* chunk = &job.chunks[c++];
+			chunk->entry = region->data + offset / SNAPSHOT_FILE_CHUNK_SIZE * 16;
+			chunk->data = data + offset;
+			chunk->size = region->size - offset < SNAPSHOT_FILE_CHUNK_SIZE ? region->size - offset : SNAPSHOT_FILE_CHUNK_SIZE;
+		}
+		region->data = data;
+		data += (region->size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE * SNAPSHOT_PAGE_SIZE;
+	}
+
+	pool_run(pool_default_workers(), chunkCount, unpack_task, &job);
+	free(job.chunks);
+	return job.failed ? "invalid snapshot" : NULL;
+}
+
+static const char* load_snapshot(process_t* process, offline_image_t* image)
+{
+	file_reader_t reader = { (const unsigned char*)image->file.data, image->file.size, 0, TRUE };
+	const unsigned char* magic = read_bytes(&reader, 4);
+	uint32_t version = read_u32(&reader);
+	if (!magic || memcmp(magic, SNAPSHOT_FILE_MAGIC, 4) != 0 || (version != SNAPSHOT_FILE_VERSION && version != SNAPSHOT_FILE_VERSION_COMPRESSED))
+		return "not a saved snapshot, or one from an incompatible version";
+
+	uint32_t pointerSize = read_u32(&reader);
+	process->pid = read_u32(&reader);
+	uint32_t moduleCount = read_u32(&reader);
+	uint32_t regionCount = read_u32(&reader);
+	uint64_t base = read_u64(&reader);
+	read_string(&reader, process->name, sizeof(process->name));
+	read_string(&reader, process->path, sizeof(process->path));
+	if (!reader.ok)
+		return "truncated snapshot";
+	if ((pointerSize != 4 && pointerSize != 8) || !address_fits(base, 0))
+		return "invalid snapshot";
+	process->pointerSize = pointerSize;
+	process->module = (HMODULE)(uintptr_t)base;
+
+	image->modules = (module_t*)calloc(moduleCount ? moduleCount : 1, sizeof(module_t));
+	image->regions = (offline_region_t*)calloc(regionCount ? regionCount : 1, sizeof(offline_region_t));
+	if (!image->modules || !image->regions)
+		return "not enough memory";
+
+	uint32_t i;
+	for (i = 0; i < moduleCount && reader.ok; i++)
+	{
+		module_t* module = &image->modules[i];
+		read_string(&reader, module->name, sizeof(module->name));
+		read_string(&reader, module->path, sizeof(module->path));
+		uint64_t moduleBase = read_u64(&reader);
+		uint64_t size = read_u64(&reader);
+		if (!address_fits(moduleBase, size))
+			return "the snapshot's addresses don't fit in the pointers of this build";
+		module->handle = (HMODULE)(uintptr_t)moduleBase;
+		module->size = (DWORD)size;
+		image->moduleCount++;
+	}
+
+	for (i = 0; i < regionCount && reader.ok; i++)
+	{
+		offline_region_t* region = &image->regions[i];
+		uint64_t regionBase = read_u64(&reader);
+		uint64_t size = read_u64(&reader);
+		region->protect = read_u32(&reader);
+		region->type = (region_type)read_u32(&reader);
+		uint64_t offset = read_u64(&reader);
+		if (!reader.ok)
+			break;
+		if (!address_fits(regionBase, size))
+			return "the snapshot's addresses don't fit in the pointers of this build";
+		// the chunk index of a compressed region is checked once its size is known, by unpack_snapshot
+		if (offset > image->file.size || region->type > REGION_IMAGE)
+			return "invalid snapshot";
+		if (version == SNAPSHOT_FILE_VERSION && size > image->file.size - offset)
+			return "invalid snapshot";
+		region->base = (char*)(uintptr_t)regionBase;
+		region->size = (SIZE_T)size;
+		region->data = (const unsigned char*)image->file.data + (SIZE_T)offset;
+		image->regionCount++;
+	}
+	if (!reader.ok)
+		return "truncated snapshot";
+	if (!sort_regions(image))
+		return "invalid snapshot";
+	if (version == SNAPSHOT_FILE_VERSION_COMPRESSED)
+	{
+		const char* err = unpack_snapshot(image);
+		if (err)
+			return err;
+	}
+
+	// regions within a module are backed by its file
+	SIZE_T r, m = 0;
+	for (r = 0; r < image->regionCount; r++)
+	{
+		offline_region_t* region = &image->regions[r];
+		while (m < image->moduleCount && (const char*)image->modules[m].handle + image->modules[m].size <= region->base)
+			m++;
+		if (m < image->moduleCount && region->base >= (const char*)image->modules[m].handle)
+			region->path = image->modules[m].path;
+	}
+	return NULL;
+}
+
+// Lua
+
+typedef const char* (*offline_loader)(process_t* process, offline_image_t* image);
+
+static int open_offline(lua_State *L, offline_loader load)
+{
+	const char* path = luaL_checkstring(L, 1);
+	process_t process;
+	memset(&process, 0, sizeof(process_t));
+	process_store_backend(&process, READ_BACKEND_AUTO);
+	process.preadThreshold = (SIZE_T)-1;
+#ifndef _WIN32
+	process.memfd = -1;
+#endif
+
+	process.offline = (offline_image_t*)calloc(1, sizeof(offline_image_t));
+	if (!process.offline)
+		return push_error(L, "not enough memory");
+	if (!platform_map_file(path, &process.offline->file))
+	{
+		free(process.offline);
+		return push_last_error(L);
+	}
+
+	const char* err = load(&process, process.offline);
+	if (err)
+	{
+		offline_close(&process);
+		return push_error(L, err);
+	}
+
+	process.stats = process_stats_new();
+	*push_process(L) = process;
+	return 1;
+}
+
+/**
+memreader.opencore(path)
+
+Opens an ELF core dump as a read-only process.
+*/
+int memreader_opencore(lua_State *L)
+{
+	return open_offline(L, load_core);
+}
+
+/**
+memreader.opensnapshot(path)
+
+Opens a snapshot saved with snapshot:save (or written by process:dump) as a
+read-only process.
+*/
+int memreader_opensnapshot(lua_State *L)
+{
+	return open_offline(L, load_snapshot);
+}
\ No newline at end of file
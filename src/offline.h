@@ -0,0 +1,53 @@
+#ifndef MEMREADER_OFFLINE_H
+#define MEMREADER_OFFLINE_H
+
+#include "memreader.h"
+#include "process.h"
+#include "platform.h"
+#include "module.h"
+
+typedef struct {
+	char* base; // in the target
+	SIZE_T size;
+	const unsigned char* data; // in the mapping of the file (or of a compressed snapshot's decompressed data), or NULL if the region's contents weren't saved
+	DWORD protect;
+	region_type type;
+	const TCHAR* path; // the file backing the region, or NULL
+} offline_region_t;
+
+/**
+The memory of a process that was saved to a file (an ELF core dump, or a
+snapshot saved with snapshot:save or process:dump), opened as a read-only
+process. The file stays mapped for as long as the process is open and reads
+are copies out of the mapping, so they never make a system call; bulk
+operations don't even copy, and scan the mapping in place (see
+offline_view).
+*/
+struct offline_image_t {
+	mapped_file_t file;
+	offline_region_t* regions; // sorted by base, never overlapping
+	SIZE_T regionCount;
+	module_t* modules; // sorted by base
+	SIZE_T moduleCount;
+	DWORD exitCode; // the signal that killed the process, for core dumps
+	BOOL unpacked; // the regions of a compressed snapshot are in unpackedData instead
+	temp_mapping_t unpackedData;
+};
+
+// The platform layer hands these the calls it gets for an offline process
+BOOL offline_read(process_t* process, LPCVOID address, LPVOID buffer, SIZE_T size, SIZE_T* bytesRead);
+SIZE_T offline_readv(process_t* process, read_request_t* requests, SIZE_T count);
+void offline_close(process_t* process);
+BOOL offline_exit_code(process_t* process, BOOL* running, DWORD* exitCode);
+BOOL offline_modules_open(iterator_t* it, process_t* process);
+BOOL offline_modules_next(iterator_t* it, module_t* module);
+BOOL offline_regions_open(iterator_t* it, process_t* process);
+BOOL offline_regions_next(iterator_t* it, process_t* process, region_t* region, TCHAR* path, SIZE_T pathSize);
+
+// The data at [address, address + size) within the mapping, or NULL if the process isn't offline or the range isn't in the file in one piece
+const unsigned char* offline_view(process_t* process, LPCVOID address, SIZE_T size);
+
+int memreader_opencore(lua_State *L);
+int memreader_opensnapshot(lua_State *L);
+
+#endif
\ No newline at end of file
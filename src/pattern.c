@@ -0,0 +1,415 @@
+#include "pattern.h"
+#include "process.h"
+#include "module.h"
+#include "address.h"
+#include "region.h"
+#include "simd.h"
+#include "threadpool.h"
+
+/**
+Rough frequency of bytes in x86 code and data, for picking anchors. Bytes
+that aren't listed are assumed to be uncommon.
+*/
+static int byte_commonness(unsigned char byte)
+{
+	switch (byte)
+	{
+	case 0x00: return 100;
+	case 0xFF: return 90;
+	case 0xCC: return 80;
+	case 0x48: return 75;
+	case 0x8B: return 70;
+	case 0x89: return 65;
+	case 0x0F: case 0xE8: case 0x24: case 0x4C: return 60;
+	case 0x85: case 0x83: case 0xC0: case 0x8D: case 0x44: case 0x01: return 50;
+	case 0x90: case 0xC3: case 0x74: case 0x75: case 0xEB: case 0x20: case 0x08: case 0x10: case 0x40: return 40;
+	default: return 10;
+	}
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+const char* pattern_compile(pattern_t* pattern, const char* source)
+{
+	const char* c = source;
+	SIZE_T fixedCount = 0;
+	pattern->length = 0;
+
+	while (*c)
+	{
+		if (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r')
+		{
+			c++;
+			continue;
+		}
+		if (pattern->length == PATTERN_MAX_LENGTH)
+			return "pattern is too long";
+
+		if (*c == '?')
+		{
+			// both ? and ?? are a wildcard byte
+			c += (c[1] == '?') ? 2 : 1;
+			pattern->bytes[pattern->length] = 0;
+			pattern->fixed[pattern->length] = 0;
+		}
+		else
+		{
+			int high = hex_digit(c[0]);
+			int low = high >= 0 ? hex_digit(c[1]) : -1;
+			if (low < 0)
+				return "pattern must be made of hex bytes and ?? wildcards";
+			c += 2;
+			pattern->bytes[pattern->length] = (unsigned char)(high << 4 | low);
+			pattern->fixed[pattern->length] = 1;
+			fixedCount++;
+		}
+		pattern->length++;
+	}
+
+	if (fixedCount == 0)
+		return "pattern must contain at least one non-wildcard byte";
+
+	// the rarest fixed byte is the anchor, and the next rarest (if any) is the second anchor
+	SIZE_T i;
+	int best = 1000, second = 1000;
+	pattern->anchor = pattern->anchor2 = 0;
+	for (i = 0; i < pattern->length; i++)
+	{
+		if (!pattern->fixed[i])
+			continue;
+		int score = byte_commonness(pattern->bytes[i]);
+		if (score < best)
+		{
+			second = best;
+			pattern->anchor2 = pattern->anchor;
+			best = score;
+			pattern->anchor = i;
+		}
+		else if (score < second)
+		{
+			second = score;
+			pattern->anchor2 = i;
+		}
+	}
+	if (fixedCount == 1)
+		pattern->anchor2 = pattern->anchor;
+
+	return NULL;
+}
+
+static BOOL pattern_verify(const pattern_t* pattern, const unsigned char* data)
+{
+	SIZE_T i;
+	for (i = 0; i < pattern->length; i++)
+	{
+		if (pattern->fixed[i] && data[i] != pattern->bytes[i])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+// limit is the number of start positions to check (beginning at pos)
+static BOOL find_scalar(const pattern_t* pattern, const unsigned char* data, SIZE_T pos, SIZE_T limit, pattern_match_fn fn, void* ctx)
+{
+	unsigned char anchor = pattern->bytes[pattern->anchor];
+	while (pos < limit)
+	{
+		const unsigned char* hit = (const unsigned char*)memchr(data + pos + pattern->anchor, anchor, limit - pos);
+		if (!hit)
+			break;
+		pos = (SIZE_T)(hit - data) - pattern->anchor;
+		if (pattern_verify(pattern, data + pos) && !fn(ctx, pos))
+			return FALSE;
+		pos++;
+	}
+	return TRUE;
+}
+
+#ifdef MEMREADER_X86
+SIMD_TARGET_SSE2
+static BOOL find_sse2(const pattern_t* pattern, const unsigned char* data, SIZE_T limit, pattern_match_fn fn, void* ctx)
+{
+	const __m128i a = _mm_set1_epi8((char)pattern->bytes[pattern->anchor]);
+	const __m128i b = _mm_set1_epi8((char)pattern->bytes[pattern->anchor2]);
+	SIZE_T pos;
+
+	for (pos = 0; pos + 16 <= limit; pos += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(data + pos + pattern->anchor));
+		__m128i y = _mm_loadu_si128((const __m128i*)(data + pos + pattern->anchor2));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x, a), _mm_cmpeq_epi8(y, b)));
+		while (mask)
+		{
+			SIZE_T match = pos + simd_ctz(mask);
+			mask &= mask - 1;
+			if (pattern_verify(pattern, data + match) && !fn(ctx, match))
+				return FALSE;
+		}
+	}
+	return find_scalar(pattern, data, pos, limit, fn, ctx);
+}
+
+SIMD_TARGET_AVX2
+static BOOL find_avx2(const pattern_t* pattern, const unsigned char* data, SIZE_T limit, pattern_match_fn fn, void* ctx)
+{
+	const __m256i a = _mm256_set1_epi8((char)pattern->bytes[pattern->anchor]);
+	const __m256i b = _mm256_set1_epi8((char)pattern->bytes[pattern->anchor2]);
+	SIZE_T pos;
+
+	for (pos = 0; pos + 32 <= limit; pos += 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(data + pos + pattern->anchor));
+		__m256i y = _mm256_loadu_si256((const __m256i*)(data + pos + pattern->anchor2));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(x, a), _mm256_cmpeq_epi8(y, b)));
+		while (mask)
+		{
+			SIZE_T match = pos + simd_ctz(mask);
+			mask &= mask - 1;
+			if (pattern_verify(pattern, data + match) && !fn(ctx, match))
+				return FALSE;
+		}
+	}
+	return find_scalar(pattern, data, pos, limit, fn, ctx);
+}
+#endif
+
+BOOL pattern_find(const pattern_t* pattern, const unsigned char* data, SIZE_T size, SIZE_T available, pattern_match_fn fn, void* ctx)
+{
+	if (available < pattern->length)
+		return TRUE;
+
+	// a match can only start where the whole pattern fits in the data
+	SIZE_T limit = available - pattern->length + 1;
+	if (limit > size)
+		limit = size;
+
+#ifdef MEMREADER_X86
+	switch (simd_detect())
+	{
+	case SIMD_AVX2: return find_avx2(pattern, data, limit, fn, ctx);
+	case SIMD_SSE2: return find_sse2(pattern, data, limit, fn, ctx);
+	default: break;
+	}
+#endif
+	return find_scalar(pattern, data, 0, limit, fn, ctx);
+}
+
+// The matches found in one chunk
+typedef struct {
+	const char** results;
+	SIZE_T count;
+	SIZE_T capacity;
+} match_list;
+
+typedef struct {
+	const pattern_t* pattern;
+	match_list* chunks;
+	SIZE_T max;
+	// chunks after one that found max matches by itself can't contribute to the results
+	SIZE_T lastChunk;
+	pool_mutex_t lock;
+	BOOL outOfMemory;
+} find_ctx;
+
+typedef struct {
+	find_ctx* find;
+	match_list* list;
+	const char* chunkAddress;
+} find_chunk_ctx;
+
+static BOOL find_on_match(void* ctx, SIZE_T offset)
+{
+	find_chunk_ctx* chunk = (find_chunk_ctx*)ctx;
+	match_list* list = chunk->list;
+	if (list->count == list->capacity)
+	{
+		SIZE_T capacity = list->capacity ? list->capacity * 2 : 16;
+		const char** results = (const char**)realloc((void*)list->results, capacity * sizeof(const char*));
+		if (!results)
+		{
+			chunk->find->outOfMemory = TRUE;
+			return FALSE;
+		}
+		list->results = results;
+		list->capacity = capacity;
+	}
+	list->results[list->count++] = chunk->chunkAddress + offset;
+	return list->count < chunk->find->max;
+}
+
+static BOOL find_on_chunk(void* ctx, int worker, SIZE_T index, const chunk_t* chunk)
+{
+	find_ctx* find = (find_ctx*)ctx;
+
+	pool_mutex_lock(&find->lock);
+	SIZE_T lastChunk = find->lastChunk;
+	pool_mutex_unlock(&find->lock);
+	if (index > lastChunk)
+		return TRUE;
+
+	find_chunk_ctx chunkCtx = { find, &find->chunks[index], chunk->address };
+	pattern_find(find->pattern, chunk->data, chunk->size, chunk->available, find_on_match, &chunkCtx);
+	if (find->outOfMemory)
+		return FALSE;
+
+	if (find->chunks[index].count >= find->max)
+	{
+		pool_mutex_lock(&find->lock);
+		if (index < find->lastChunk)
+			find->lastChunk = index;
+		pool_mutex_unlock(&find->lock);
+	}
+	return TRUE;
+}
+
+BOOL pattern_search(process_t* process, const pattern_t* pattern, const char* start, const char* end, SIZE_T max, int workers, pattern_matches_t* matches)
+{
+	memset(matches, 0, sizeof(pattern_matches_t));
+
+	region_filter_t filter = { 1, -1, -1, -1 };
+	region_list_t regions;
+	region_list_init(&regions);
+	if (!region_list_collect(process, &filter, &regions))
+	{
+		region_list_free(&regions);
+		return FALSE;
+	}
+	region_list_clip(&regions, start, end);
+	region_list_coalesce(&regions);
+
+	SIZE_T i, chunkCount = 0;
+	for (i = 0; i < regions.count; i++)
+		chunkCount += (regions.regions[i].size + REGION_CHUNK_SIZE - 1) / REGION_CHUNK_SIZE;
+
+	find_ctx find = { pattern, NULL, max > 0 ? max : (SIZE_T)-1, (SIZE_T)-1 };
+	find.outOfMemory = FALSE;
+	find.chunks = (match_list*)calloc(chunkCount ? chunkCount : 1, sizeof(match_list));
+	if (!find.chunks)
+	{
+		region_list_free(&regions);
+		matches->outOfMemory = TRUE;
+		return FALSE;
+	}
+
+	simd_detect(); // so that the workers don't race to detect it
+	pool_mutex_init(&find.lock);
+	if (!region_list_read_chunks_parallel(process, &regions, REGION_CHUNK_SIZE, pattern->length - 1, workers, find_on_chunk, &find))
+		find.outOfMemory = TRUE;
+	pool_mutex_destroy(&find.lock);
+	region_list_free(&regions);
+
+	// the chunks are in address order, so concatenating them keeps the matches sorted
+	SIZE_T total = 0;
+	for (i = 0; i < chunkCount; i++)
+		total += find.chunks[i].count;
+	if (total > find.max)
+		total = find.max;
+	if (!find.outOfMemory && total)
+	{
+		matches->addresses = (const char**)malloc(total * sizeof(const char*));
+		find.outOfMemory = matches->addresses == NULL;
+	}
+	for (i = 0; i < chunkCount; i++)
+	{
+		SIZE_T n = find.chunks[i].count;
+		if (n > total - matches->count)
+			n = total - matches->count;
+		if (!find.outOfMemory && n)
+			memcpy((void*)(matches->addresses + matches->count), find.chunks[i].results, n * sizeof(const char*));
+		matches->count += n;
+		free((void*)find.chunks[i].results);
+	}
+	free(find.chunks);
+
+	if (find.outOfMemory)
+	{
+		pattern_matches_free(matches);
+		matches->outOfMemory = TRUE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void pattern_matches_free(pattern_matches_t* matches)
+{
+	free((void*)matches->addresses);
+	matches->addresses = NULL;
+	matches->count = 0;
+}
+
+int pattern_check_scope(lua_State *L, process_t* process, int index, const char** start, const char** end)
+{
+	*start = NULL;
+	*end = (const char*)(uintptr_t)-1;
+
+	if (lua_type(L, index) == LUA_TSTRING)
+	{
+		module_t module;
+		if (!process_find_module(process, lua_tostring(L, index), &module))
+			return push_error(L, lua_pushfstring(L, "module '%s' not found", lua_tostring(L, index)));
+		*start = (const char*)module.handle;
+		*end = *start + module.size;
+	}
+	else if (!lua_isnoneornil(L, index))
+	{
+		luaL_checktype(L, index, LUA_TTABLE);
+		int top = lua_gettop(L);
+		lua_rawgeti(L, index, 1);
+		lua_rawgeti(L, index, 2);
+		*start = (const char*)memaddress_checkptr(L, top + 1);
+		*end = *start + (SIZE_T)luaL_checkinteger(L, top + 2);
+		lua_settop(L, top);
+	}
+	return 0;
+}
+
+int push_pattern_matches(lua_State *L, const pattern_matches_t* matches)
+{
+	SIZE_T i;
+	lua_createtable(L, (int)matches->count, 0);
+	for (i = 0; i < matches->count; i++)
+	{
+		push_address(L, (LPCVOID)matches->addresses[i]);
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+	return 1;
+}
+
+/**
+process:findpattern(pattern[, scope[, maxresults[, workers]]])
+
+scope is a module name, a {base, size} range, or nil for all readable memory.
+Returns an array of the addresses of the matches.
+*/
+int process_find_pattern(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	const char* source = luaL_checkstring(L, 2);
+	lua_Integer max = luaL_optinteger(L, 4, 0);
+	int workers = pool_check_workers(L, 5);
+	const char* start;
+	const char* end;
+
+	pattern_t* pattern = (pattern_t*)lua_newuserdata(L, sizeof(pattern_t));
+	const char* err = pattern_compile(pattern, source);
+	if (err)
+		return luaL_argerror(L, 2, err);
+
+	int results = pattern_check_scope(L, process, 3, &start, &end);
+	if (results)
+		return results;
+
+	pattern_matches_t matches;
+	if (!pattern_search(process, pattern, start, end, max > 0 ? (SIZE_T)max : 0, workers, &matches))
+		return matches.outOfMemory ? push_error(L, "not enough memory") : push_last_error(L);
+
+	push_pattern_matches(L, &matches);
+	pattern_matches_free(&matches);
+	return 1;
+}
\ No newline at end of file
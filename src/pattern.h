@@ -0,0 +1,59 @@
+#ifndef MEMREADER_PATTERN_H
+#define MEMREADER_PATTERN_H
+
+#include "memreader.h"
+#include "process.h"
+
+// Patterns longer than this are rejected
+#define PATTERN_MAX_LENGTH 1024
+
+/**
+A byte signature like "48 8B 05 ?? ?? ?? ?? 48 85 C0". Matching is driven
+by the two rarest fixed bytes (the anchors): they're compared against 16 or
+32 positions at a time, and only positions where both match are checked
+against the whole pattern.
+*/
+typedef struct {
+	unsigned char bytes[PATTERN_MAX_LENGTH];
+	unsigned char fixed[PATTERN_MAX_LENGTH]; // 0 for wildcards
+	SIZE_T length;
+	SIZE_T anchor;
+	SIZE_T anchor2;
+} pattern_t;
+
+// Called with the offset of each match in the data; return FALSE to stop
+typedef BOOL(*pattern_match_fn)(void* ctx, SIZE_T offset);
+
+// Returns NULL on success, or an error message
+const char* pattern_compile(pattern_t* pattern, const char* source);
+
+/**
+Finds every match that starts in data[0, size), using up to available bytes
+of data. Returns FALSE if fn stopped early.
+*/
+BOOL pattern_find(const pattern_t* pattern, const unsigned char* data, SIZE_T size, SIZE_T available, pattern_match_fn fn, void* ctx);
+
+// The matches of pattern_search, in address order
+typedef struct {
+	const char** addresses;
+	SIZE_T count;
+	BOOL outOfMemory; // why pattern_search failed, if it wasn't the OS
+} pattern_matches_t;
+
+/**
+Searches the readable memory of the process in [start, end) for up to max
+matches (0 for no limit) on up to workers threads. Doesn't touch Lua, so it
+can run on any thread. Returns FALSE on failure, with the OS error set
+unless matches->outOfMemory is.
+*/
+BOOL pattern_search(process_t* process, const pattern_t* pattern, const char* start, const char* end, SIZE_T max, int workers, pattern_matches_t* matches);
+void pattern_matches_free(pattern_matches_t* matches);
+
+// Parses the scope argument of findpattern at index; returns 0, or the number of results it pushed if the module wasn't found
+int pattern_check_scope(lua_State *L, process_t* process, int index, const char** start, const char** end);
+// Pushes an array of the addresses of the matches
+int push_pattern_matches(lua_State *L, const pattern_matches_t* matches);
+
+int process_find_pattern(lua_State *L);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,172 @@
+#ifndef MEMREADER_PLATFORM_H
+#define MEMREADER_PLATFORM_H
+
+#include "memreader.h"
+#include "process.h"
+#include "module.h"
+
+#ifndef _WIN32
+#include <stdio.h>
+#include <dirent.h>
+#endif
+
+/**
+The platform layer: everything that talks to the OS about another process
+goes through these functions. platform_win.c implements them with the WinAPI
+(ReadProcessMemory, Toolhelp32, psapi) and platform_linux.c with
+process_vm_readv and /proc.
+
+Functions returning BOOL return FALSE on failure and leave the reason in
+GetLastError()/errno, so callers can report it with push_last_error.
+
+The functions that take a process hand offline processes (see offline.h)
+over to their offline_ counterparts, so the rest of memreader doesn't need
+to tell them apart.
+*/
+
+typedef struct {
+	DWORD pid;
+	TCHAR name[MAX_PATH];
+} process_entry_t;
+
+// One entry of a scatter/gather read
+typedef struct {
+	LPCVOID address;
+	LPVOID buffer;
+	SIZE_T size;
+	SIZE_T bytesRead;
+} read_request_t;
+
+// region_t protection flags
+#define REGION_READ 0x1
+#define REGION_WRITE 0x2
+#define REGION_EXECUTE 0x4
+
+typedef enum {
+	REGION_PRIVATE, // anonymous memory owned by the process
+	REGION_MAPPED, // a mapped view of a file or shared memory
+	REGION_IMAGE // a mapped executable image
+} region_type;
+
+// A committed range of memory with the same protection and type
+typedef struct {
+	LPVOID base;
+	SIZE_T size;
+	DWORD protect;
+	region_type type;
+} region_t;
+
+// Enumeration state for processes()/modules()/regions(), owned by an ITERATOR_T userdata
+typedef struct {
+#ifdef _WIN32
+	HANDLE handle;
+	LPCVOID cursor;
+#else
+	DIR* dir;
+	FILE* file;
+	module_t pending;
+	BOOL hasPending;
+#endif
+	offline_image_t* offline; // when iterating over an offline process
+	SIZE_T index;
+	BOOL started;
+} iterator_t;
+
+// Memory backed by a temporary file, for data that may not fit in RAM. The file is deleted when unmapped.
+typedef struct {
+	LPVOID data;
+	SIZE_T size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+} temp_mapping_t;
+
+// A read-only view of a whole file
+typedef struct {
+	LPCVOID data;
+	SIZE_T size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+} mapped_file_t;
+
+// Something an event loop can wait on (an eventfd on Linux, an event on Windows) that stays signaled until cleared
+typedef struct {
+#ifdef _WIN32
+	HANDLE event;
+#else
+	int fd;
+#endif
+} notifier_t;
+
+iterator_t* push_iterator(lua_State *L);
+
+BOOL platform_open_process(process_t* process, DWORD pid);
+void platform_close_process(process_t* process);
+
+BOOL platform_read(process_t* process, LPCVOID address, LPVOID buffer, SIZE_T size, SIZE_T* bytesRead);
+// Reads every request (setting its bytesRead) in as few system calls as the platform allows, and
+// returns how many were read completely. A failed request doesn't stop the others from being read.
+SIZE_T platform_readv(process_t* process, read_request_t* requests, SIZE_T count);
+
+// Makes every read of the process use backend (or pick one per read, for READ_BACKEND_AUTO), failing if it isn't available for the process
+BOOL platform_set_read_backend(process_t* process, read_backend backend);
+// Times the backends on the process' own memory to set when READ_BACKEND_AUTO reads should use pread, then switches to READ_BACKEND_AUTO
+BOOL platform_tune_reads(process_t* process);
+
+// Sets *running to TRUE if the process has not exited, otherwise stores its exit code
+BOOL platform_exit_code(process_t* process, BOOL* running, DWORD* exitCode);
+
+void platform_iterator_init(iterator_t* it);
+void platform_iterator_close(iterator_t* it);
+BOOL platform_processes_open(iterator_t* it);
+BOOL platform_processes_next(iterator_t* it, process_entry_t* entry);
+// Gets the untruncated executable name of a process whose entry name may have been cut short (as comm is on Linux), returning FALSE if it wasn't or it can't be found
+BOOL platform_process_full_name(iterator_t* it, const process_entry_t* entry, TCHAR* name, SIZE_T size);
+BOOL platform_modules_open(iterator_t* it, process_t* process);
+BOOL platform_modules_next(iterator_t* it, module_t* module);
+// A value that changes when the modules of the process do (which is much cheaper to get than the modules themselves)
+BOOL platform_modules_signature(process_t* process, uint64_t* signature);
+BOOL platform_regions_open(iterator_t* it, process_t* process);
+// path (which can be NULL if it isn't needed) receives the file backing the region, or an empty string
+BOOL platform_regions_next(iterator_t* it, process_t* process, region_t* region, TCHAR* path, SIZE_T pathSize);
+
+// A monotonic clock, in microseconds
+uint64_t platform_time_us(void);
+// The same clock, in nanoseconds
+uint64_t platform_time_ns(void);
+// Sleeps until platform_time_us() reaches deadline (returning straight away if it already has)
+void platform_sleep_until_us(uint64_t deadline);
+
+// The error of the last failed call on this thread (errno or GetLastError()), and setting it (to report it on another thread)
+DWORD platform_last_error(void);
+void platform_set_last_error(DWORD error);
+
+BOOL platform_notifier_open(notifier_t* notifier);
+void platform_notifier_close(notifier_t* notifier);
+void platform_notifier_signal(notifier_t* notifier);
+void platform_notifier_clear(notifier_t* notifier);
+// Waits up to timeout milliseconds (or forever if negative) for the notifier to be signaled, returning whether it is
+BOOL platform_notifier_wait(notifier_t* notifier, int timeout);
+// The value to hand to an event loop: the fd, or the HANDLE as a number
+lua_Integer platform_notifier_handle(notifier_t* notifier);
+
+// Maps size bytes (initially zero) of a new temporary file
+BOOL platform_map_temp(temp_mapping_t* mapping, SIZE_T size);
+void platform_unmap_temp(temp_mapping_t* mapping);
+
+// Maps a file for reading; an empty file is mapped with data set to NULL
+BOOL platform_map_file(const TCHAR* path, mapped_file_t* file);
+void platform_unmap_file(mapped_file_t* file);
+// Gets the last modification time (in an unspecified unit) and size of a file
+BOOL platform_file_info(const TCHAR* path, uint64_t* mtime, uint64_t* size);
+// Seeks to a 64-bit offset, which fseek can't do everywhere
+BOOL platform_seek_file(FILE* file, uint64_t offset);
+// Lets parts of a file that are seeked over without being written stay holes that take no space
+BOOL platform_make_sparse(FILE* file);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,1128 @@
+#ifdef __linux__
+
+#define _GNU_SOURCE
+
+#include "platform.h"
+#include "stats.h"
+#include "offline.h"
+#include "threadpool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+
+// Reads a small /proc/<pid>/<file> into buf as a null-terminated string
+static ssize_t read_proc_file(int dirfd, const char* file, char* buf, size_t size)
+{
+	int fd = openat(dirfd, file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	ssize_t total = 0;
+	while ((size_t)total < size - 1)
+	{
+		ssize_t n = read(fd, buf + total, size - 1 - total);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		total += n;
+	}
+	close(fd);
+	buf[total] = '\0';
+	return total;
+}
+
+/**
+Parses a line of /proc/<pid>/maps:
+  start-end perms offset dev inode [path]
+perms receives the 4 permission characters (e.g. "r-xp"), and *pathOut
+points into line and is an empty string for anonymous mappings.
+*/
+static BOOL parse_maps_line(char* line, uintptr_t* start, uintptr_t* end, char perms[5], char** pathOut)
+{
+	unsigned long s, e;
+	int pathStart = 0;
+	if (sscanf(line, "%lx-%lx %4s %*s %*s %*s %n", &s, &e, perms, &pathStart) < 3)
+		return FALSE;
+
+	char* path = line + pathStart;
+	size_t len = strlen(path);
+	while (len > 0 && (path[len - 1] == '\n' || path[len - 1] == ' '))
+		path[--len] = '\0';
+
+	*start = (uintptr_t)s;
+	*end = (uintptr_t)e;
+	*pathOut = path;
+	return TRUE;
+}
+
+// The target's pointer size is the ELF class of its executable
+static SIZE_T exe_pointer_size(int dirfd)
+{
+	unsigned char ident[5];
+	SIZE_T size = sizeof(LPVOID);
+	int fd = openat(dirfd, "exe", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return size;
+
+	if (read(fd, ident, sizeof(ident)) == sizeof(ident) && memcmp(ident, "\x7f" "ELF", 4) == 0)
+		size = ident[4] == 1 ? 4 : 8;
+	close(fd);
+	return size;
+}
+
+// The mappings of a process are checked for changes at most this often by reads through them
+#define SHARED_RECHECK_US 100000
+// and at most as often as keeps the checks (which read the whole maps file) to 1/SHARED_CHECK_RATIO of the time
+#define SHARED_CHECK_RATIO 50
+// Only this many shared mappings are read through, and the table of them is only rebuilt this many times
+#define SHARED_MAX_MAPS 256
+#define SHARED_MAX_TABLES 16
+
+typedef struct {
+	uintptr_t start;
+	uintptr_t end; // clamped to the end of the file
+	const unsigned char* data; // our own mapping of the same part of the file
+} shared_map_t;
+
+typedef struct shared_table_t {
+	shared_map_t* maps; // sorted by start, as the maps file is
+	SIZE_T count;
+	uint64_t signature;
+	struct shared_table_t* previous;
+} shared_table_t;
+
+/**
+The file-backed shared mappings of a process (including memfds and shared
+anonymous memory), mapped into our own address space so that reads from
+them are a memcpy. Reads on other threads may still be using a table after
+it's been replaced, so replaced tables are kept until the process is closed,
+and the mmap backend is given up on for processes that keep changing them.
+*/
+struct shared_maps_t {
+	pool_mutex_t lock;
+	SIZE_T table; // the current shared_table_t*
+	SIZE_T checked; // platform_time_us() of the last check, truncated
+	SIZE_T interval; // how long to wait after it, in microseconds
+	SIZE_T disabled;
+	int tables;
+};
+
+static BOOL shared_map_file(process_t* process, uintptr_t start, uintptr_t end, uint64_t offset, uint64_t inode, const char* path, shared_map_t* map)
+{
+	char file[64];
+	struct stat st;
+
+	// map_files also has deleted files, memfds and shared anonymous memory, but needs CAP_SYS_ADMIN before Linux 4.3
+	snprintf(file, sizeof(file), "map_files/%lx-%lx", (unsigned long)start, (unsigned long)end);
+	int fd = openat(process->handle, file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return FALSE;
+
+	// device mappings can have side effects, and the path may have been replaced by another file since
+	BOOL success = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_ino == inode && (uint64_t)st.st_size > offset;
+	if (success)
+	{
+		// past the end of the file, both the process and we would get SIGBUS
+		SIZE_T size = (SIZE_T)(end - start);
+		if ((uint64_t)st.st_size - offset < size)
+			size = (SIZE_T)((uint64_t)st.st_size - offset);
+		void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, (off_t)offset);
+		success = data != MAP_FAILED;
+		if (success)
+		{
+			map->start = start;
+			map->end = start + size;
+			map->data = (const unsigned char*)data;
+		}
+	}
+	close(fd);
+	return success;
+}
+
+static shared_table_t* shared_build(process_t* process, uint64_t signature)
+{
+	char line[PATH_MAX + 128];
+	iterator_t it;
+
+	shared_table_t* table = (shared_table_t*)calloc(1, sizeof(shared_table_t));
+	if (!table)
+		return NULL;
+	table->maps = (shared_map_t*)malloc(SHARED_MAX_MAPS * sizeof(shared_map_t));
+	if (!table->maps)
+	{
+		free(table);
+		return NULL;
+	}
+	table->signature = signature;
+
+	platform_iterator_init(&it);
+	if (platform_modules_open(&it, process))
+	{
+		while (table->count < SHARED_MAX_MAPS && fgets(line, sizeof(line), it.file))
+		{
+			unsigned long start, end;
+			unsigned long long offset, inode;
+			char perms[5];
+			int pathStart = 0;
+			if (sscanf(line, "%lx-%lx %4s %llx %*s %llu %n", &start, &end, perms, &offset, &inode, &pathStart) < 5)
+				continue;
+			if (perms[0] != 'r' || perms[3] != 's' || line[pathStart] != '/' || end <= start)
+				continue;
+			char* path = line + pathStart;
+			path[strcspn(path, "\n")] = '\0';
+			if (shared_map_file(process, (uintptr_t)start, (uintptr_t)end, offset, inode, path, &table->maps[table->count]))
+				table->count++;
+		}
+	}
+	platform_iterator_close(&it);
+	return table;
+}
+
+static void shared_free(shared_maps_t* shared)
+{
+	shared_table_t* table = (shared_table_t*)shared->table;
+	while (table)
+	{
+		shared_table_t* previous = table->previous;
+		SIZE_T i;
+		for (i = 0; i < table->count; i++)
+			munmap((void*)table->maps[i].data, (SIZE_T)(table->maps[i].end - table->maps[i].start));
+		free(table->maps);
+		free(table);
+		table = previous;
+	}
+	pool_mutex_destroy(&shared->lock);
+	free(shared);
+}
+
+// Rebuilds the table if the mappings have changed since it was built
+static void shared_refresh(process_t* process, SIZE_T now)
+{
+	shared_maps_t* shared = process->shared;
+	uint64_t signature;
+
+	pool_mutex_lock(&shared->lock);
+	// another thread may have just done it
+	if (now - POOL_LOAD_ACQUIRE(&shared->checked) >= POOL_LOAD_ACQUIRE(&shared->interval))
+	{
+		shared_table_t* current = (shared_table_t*)shared->table;
+		if (platform_modules_signature(process, &signature) && (!current || current->signature != signature))
+		{
+			if (shared->tables == SHARED_MAX_TABLES)
+				POOL_STORE_RELEASE(&shared->disabled, 1);
+			else
+			{
+				shared_table_t* table = shared_build(process, signature);
+				if (table)
+				{
+					table->previous = current;
+					shared->tables++;
+					POOL_STORE_RELEASE(&shared->table, (SIZE_T)table);
+				}
+			}
+		}
+		SIZE_T interval = ((SIZE_T)platform_time_us() - now) * SHARED_CHECK_RATIO;
+		POOL_STORE_RELEASE(&shared->interval, interval > SHARED_RECHECK_US ? interval : SHARED_RECHECK_US);
+		POOL_STORE_RELEASE(&shared->checked, now);
+	}
+	pool_mutex_unlock(&shared->lock);
+}
+
+// Returns where [address, address + size) is in our mapping of it, or NULL if it isn't all in one shared mapping
+static const unsigned char* shared_lookup(process_t* process, LPCVOID address, SIZE_T size)
+{
+	shared_maps_t* shared = process->shared;
+	if (!shared || POOL_LOAD_ACQUIRE(&shared->disabled))
+		return NULL;
+
+	SIZE_T now = (SIZE_T)platform_time_us();
+	if (now - POOL_LOAD_ACQUIRE(&shared->checked) >= POOL_LOAD_ACQUIRE(&shared->interval))
+		shared_refresh(process, now);
+	const shared_table_t* table = (const shared_table_t*)POOL_LOAD_ACQUIRE(&shared->table);
+	if (!table)
+		return NULL;
+
+	// the last mapping that starts at or before address
+	uintptr_t addr = (uintptr_t)address;
+	SIZE_T lo = 0, hi = table->count;
+	while (lo < hi)
+	{
+		SIZE_T mid = lo + (hi - lo) / 2;
+		if (table->maps[mid].start <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return NULL;
+	const shared_map_t* map = &table->maps[lo - 1];
+	if (addr >= map->end || size > map->end - addr)
+		return NULL;
+	return map->data + (addr - map->start);
+}
+
+BOOL platform_open_process(process_t* process, DWORD pid)
+{
+	char procPath[32];
+	snprintf(procPath, sizeof(procPath), "/proc/%u", (unsigned)pid);
+
+	int handle = open(procPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (handle < 0)
+		return FALSE;
+
+	process->pid = pid;
+	process->handle = handle;
+	process->module = NULL;
+	process->name[0] = '\0';
+	process->path[0] = '\0';
+
+	// exe is only readable with ptrace access, in which case comm is the best we can do
+	ssize_t len = readlinkat(handle, "exe", process->path, sizeof(process->path) - 1);
+	if (len >= 0)
+	{
+		process->path[len] = '\0';
+		copy_string(process->name, sizeof(process->name), path_basename(process->path));
+	}
+	else
+	{
+		process->path[0] = '\0';
+		if (read_proc_file(handle, "comm", process->name, sizeof(process->name)) > 0)
+			process->name[strcspn(process->name, "\n")] = '\0';
+	}
+
+	process->pointerSize = exe_pointer_size(handle);
+
+	// mem is only readable with ptrace access too, and without it there's no pread backend
+	process->memfd = openat(handle, "mem", O_RDONLY | O_CLOEXEC);
+	process_store_backend(process, READ_BACKEND_AUTO);
+	process->preadThreshold = (SIZE_T)-1;
+	process->shared = (shared_maps_t*)calloc(1, sizeof(shared_maps_t));
+	if (process->shared)
+	{
+		pool_mutex_init(&process->shared->lock);
+		process->shared->interval = SHARED_RECHECK_US;
+	}
+
+	// the base is the lowest mapping of the executable's image
+	iterator_t it;
+	module_t module;
+	platform_iterator_init(&it);
+	if (platform_modules_open(&it, process))
+	{
+		while (platform_modules_next(&it, &module))
+		{
+			if (process->module == NULL || strcmp(module.path, process->path) == 0)
+				process->module = module.handle;
+			if (strcmp(module.path, process->path) == 0)
+				break;
+		}
+	}
+	platform_iterator_close(&it);
+
+	return TRUE;
+}
+
+void platform_close_process(process_t* process)
+{
+	if (process->offline)
+	{
+		offline_close(process);
+		return;
+	}
+	if (process->handle >= 0)
+		close(process->handle);
+	if (process->memfd >= 0)
+		close(process->memfd);
+	if (process->shared)
+		shared_free(process->shared);
+	process->handle = -1;
+	process->memfd = -1;
+	process->shared = NULL;
+}
+
+static ssize_t vm_read(process_t* process, LPCVOID address, LPVOID buffer, SIZE_T size)
+{
+	struct iovec local = { buffer, size };
+	struct iovec remote = { (void*)address, size };
+	return process_vm_readv((pid_t)process->pid, &local, 1, &remote, 1, 0);
+}
+
+// Reads from /proc/<pid>/mem, which stops at the first unreadable page like process_vm_readv does
+static ssize_t mem_read(process_t* process, LPCVOID address, LPVOID buffer, SIZE_T size)
+{
+	SIZE_T total = 0;
+	while (total < size)
+	{
+		ssize_t n = pread(process->memfd, (char*)buffer + total, size - total, (off_t)((uintptr_t)address + total));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && total == 0)
+		{
+			// an unmapped address is EIO here, but EFAULT from process_vm_readv
+			if (errno == EIO)
+				errno = EFAULT;
+			return -1;
+		}
+		if (n <= 0)
+			break;
+		total += (SIZE_T)n;
+	}
+	return (ssize_t)total;
+}
+
+/**
+Picks the backend for a read of size bytes at address: process_vm_readv, or
+pread from the size platform_tune_reads() found it to be faster at. Shared
+mappings are only read through our own mapping of them when the mmap
+backend is forced, since a read past the end of a file that was truncated
+after it was mapped is a SIGBUS for us, where process_vm_readv would fail.
+*/
+static read_backend pick_backend(process_t* process, LPCVOID address, SIZE_T size, const unsigned char** mapped)
+{
+	read_backend backend = process_load_backend(process);
+	if (backend == READ_BACKEND_MMAP)
+	{
+		*mapped = shared_lookup(process, address, size);
+		if (*mapped)
+			return READ_BACKEND_MMAP;
+		backend = READ_BACKEND_AUTO;
+	}
+	if (backend == READ_BACKEND_AUTO)
+		backend = size >= POOL_LOAD_ACQUIRE(&process->preadThreshold) ? READ_BACKEND_PREAD : READ_BACKEND_VM;
+	if (backend == READ_BACKEND_PREAD && process->memfd < 0)
+		backend = READ_BACKEND_VM;
+	return backend;
+}
+
+BOOL platform_read(process_t* process, LPCVOID address, LPVOID buffer, SIZE_T size, SIZE_T* bytesRead)
+{
+	const unsigned char* mapped = NULL;
+	ssize_t n;
+
+	if (process->offline)
+		return offline_read(process, address, buffer, size, bytesRead);
+
+	STATS_START(start);
+	read_backend backend = pick_backend(process, address, size, &mapped);
+	if (backend == READ_BACKEND_MMAP)
+	{
+		memcpy(buffer, mapped, size);
+		n = (ssize_t)size;
+	}
+	else if (backend == READ_BACKEND_PREAD)
+		n = mem_read(process, address, buffer, size);
+	else
+	{
+		n = vm_read(process, address, buffer, size);
+		// kernels without process_vm_readv (or with it filtered out) can still have mem
+		if (n < 0 && errno == ENOSYS && process->memfd >= 0)
+		{
+			backend = READ_BACKEND_PREAD;
+			n = mem_read(process, address, buffer, size);
+		}
+	}
+	STATS_READ(process, backend, start, size, n > 0 ? (SIZE_T)n : 0);
+	if (n < 0)
+	{
+		*bytesRead = 0;
+		return FALSE;
+	}
+
+	*bytesRead = (SIZE_T)n;
+	// like ReadProcessMemory, a partial read is a failure that still reports what was copied
+	if ((SIZE_T)n < size)
+	{
+		errno = EFAULT;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Copies every request out of the shared mappings, or returns FALSE (having copied some of them) if they aren't all in one
+static BOOL readv_mapped(process_t* process, read_request_t* requests, SIZE_T count)
+{
+	SIZE_T i;
+	STATS_START(start);
+	for (i = 0; i < count; i++)
+	{
+		const unsigned char* data = shared_lookup(process, requests[i].address, requests[i].size);
+		if (!data)
+			return FALSE;
+		memcpy(requests[i].buffer, data, requests[i].size);
+		requests[i].bytesRead = requests[i].size;
+	}
+	STATS_READV(process, READ_BACKEND_MMAP, start, count, requests, count);
+	return TRUE;
+}
+
+static SIZE_T readv_pread(process_t* process, read_request_t* requests, SIZE_T count)
+{
+	SIZE_T i, complete = 0;
+	STATS_START(start);
+	for (i = 0; i < count; i++)
+	{
+		ssize_t n = mem_read(process, requests[i].address, requests[i].buffer, requests[i].size);
+		requests[i].bytesRead = n > 0 ? (SIZE_T)n : 0;
+		if (requests[i].bytesRead == requests[i].size)
+			complete++;
+	}
+	STATS_READV(process, READ_BACKEND_PREAD, start, count, requests, count);
+	return complete;
+}
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/**
+process_vm_readv stops at the first remote iovec it can't read, so after a
+short read the request it stopped in is marked as failed and the batch
+continues from the one after it.
+*/
+SIZE_T platform_readv(process_t* process, read_request_t* requests, SIZE_T count)
+{
+	struct iovec local[IOV_MAX];
+	struct iovec remote[IOV_MAX];
+	SIZE_T i = 0, complete = 0, calls = 0;
+
+	if (process->offline)
+		return offline_readv(process, requests, count);
+	read_backend backend = process_load_backend(process);
+	if (backend == READ_BACKEND_PREAD && process->memfd >= 0)
+		return readv_pread(process, requests, count);
+	if (backend == READ_BACKEND_MMAP && readv_mapped(process, requests, count))
+		return count;
+
+	STATS_START(start);
+	while (i < count)
+	{
+		SIZE_T batch = count - i < IOV_MAX ? count - i : IOV_MAX;
+		SIZE_T j;
+		for (j = 0; j < batch; j++)
+		{
+			read_request_t* req = &requests[i + j];
+			req->bytesRead = 0;
+			local[j].iov_base = req->buffer;
+			local[j].iov_len = req->size;
+			remote[j].iov_base = (void*)req->address;
+			remote[j].iov_len = req->size;
+		}
+
+		ssize_t n = process_vm_readv((pid_t)process->pid, local, batch, remote, batch, 0);
+		calls++;
+		// errors other than a bad address (e.g. the process is gone) apply to every request
+		if (n < 0 && errno != EFAULT)
+		{
+			for (j = i + batch; j < count; j++)
+				requests[j].bytesRead = 0;
+			break;
+		}
+		SIZE_T remaining = n > 0 ? (SIZE_T)n : 0;
+
+		for (j = 0; j < batch; j++)
+		{
+			read_request_t* req = &requests[i + j];
+			if (remaining < req->size)
+			{
+				req->bytesRead = remaining;
+				break;
+			}
+			req->bytesRead = req->size;
+			remaining -= req->size;
+			complete++;
+		}
+		// j is the request that failed (if any); skip past it
+		i += (j < batch) ? j + 1 : batch;
+	}
+	STATS_READV(process, READ_BACKEND_VM, start, calls, requests, count);
+	return complete;
+}
+
+BOOL platform_set_read_backend(process_t* process, read_backend backend)
+{
+	BOOL available;
+	// an offline process is only ever read from its file's mapping
+	if (process->offline)
+		available = backend == READ_BACKEND_AUTO || backend == READ_BACKEND_MMAP;
+	else if (backend == READ_BACKEND_PREAD)
+		available = process->memfd >= 0;
+	else if (backend == READ_BACKEND_MMAP)
+		available = process->shared != NULL;
+	else
+		available = TRUE;
+
+	if (!available)
+	{
+		errno = ENOTSUP;
+		return FALSE;
+	}
+	process_store_backend(process, backend);
+	return TRUE;
+}
+
+// platform_tune_reads() times reads of these sizes (by TUNE_STEP), or up to the size of the largest private region
+#define TUNE_MIN_SIZE 4096
+#define TUNE_MAX_SIZE (1024 * 1024)
+#define TUNE_STEP 4
+#define TUNE_ROUNDS 3
+
+// The best of TUNE_ROUNDS times (in ns) for enough reads of size bytes to take a while
+static uint64_t tune_time(process_t* process, read_backend backend, LPCVOID address, LPVOID buffer, SIZE_T size)
+{
+	int reads = (int)(TUNE_MAX_SIZE / size);
+	uint64_t best = (uint64_t)-1;
+	int round, i;
+
+	if (reads < 4)
+		reads = 4;
+	if (reads > 64)
+		reads = 64;
+	for (round = 0; round < TUNE_ROUNDS; round++)
+	{
+		uint64_t start = platform_time_ns();
+		for (i = 0; i < reads; i++)
+		{
+			ssize_t n = backend == READ_BACKEND_PREAD ? mem_read(process, address, buffer, size) : vm_read(process, address, buffer, size);
+			if (n != (ssize_t)size)
+				return (uint64_t)-1;
+		}
+		uint64_t elapsed = platform_time_ns() - start;
+		if (elapsed < best)
+			best = elapsed;
+	}
+	return best;
+}
+
+/**
+Times process_vm_readv against pread on a private region of the process and
+sets the size that reads switch to pread at in the auto backend, if there's
+one from which pread is faster at every size, then switches to the auto
+backend. The backend is left alone if the regions can't be listed. These
+reads aren't counted in the statistics.
+*/
+BOOL platform_tune_reads(process_t* process)
+{
+	iterator_t it;
+	region_t region;
+	LPCVOID base = NULL;
+	SIZE_T largest = 0;
+
+	if (process->offline || process->memfd < 0)
+	{
+		process_store_backend(process, READ_BACKEND_AUTO);
+		return TRUE;
+	}
+
+	platform_iterator_init(&it);
+	if (!platform_regions_open(&it, process))
+		return FALSE;
+	while (platform_regions_next(&it, process, &region, NULL, 0))
+	{
+		if ((region.protect & REGION_READ) && region.type == REGION_PRIVATE && region.size > largest)
+		{
+			base = region.base;
+			largest = region.size;
+		}
+	}
+	platform_iterator_close(&it);
+	if (largest > TUNE_MAX_SIZE)
+		largest = TUNE_MAX_SIZE;
+	if (largest < TUNE_MIN_SIZE)
+	{
+		process_store_backend(process, READ_BACKEND_AUTO);
+		return TRUE;
+	}
+
+	void* buffer = malloc(largest);
+	if (!buffer)
+	{
+		errno = ENOMEM;
+		return FALSE;
+	}
+	SIZE_T threshold = (SIZE_T)-1, size;
+	for (size = TUNE_MIN_SIZE; size <= largest; size *= TUNE_STEP)
+	{
+		uint64_t vm = tune_time(process, READ_BACKEND_VM, base, buffer, size);
+		uint64_t pread = tune_time(process, READ_BACKEND_PREAD, base, buffer, size);
+		if (pread >= vm)
+			threshold = (SIZE_T)-1;
+		else if (threshold == (SIZE_T)-1)
+			threshold = size;
+	}
+	free(buffer);
+	POOL_STORE_RELEASE(&process->preadThreshold, threshold);
+	process_store_backend(process, READ_BACKEND_AUTO);
+	return TRUE;
+}
+
+BOOL platform_exit_code(process_t* process, BOOL* running, DWORD* exitCode)
+{
+	if (process->offline)
+		return offline_exit_code(process, running, exitCode);
+
+	// our own children can be checked without reaping them
+	siginfo_t info;
+	memset(&info, 0, sizeof(info));
+	if (waitid(P_PID, (id_t)process->pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0)
+	{
+		*running = (info.si_pid == 0);
+		*exitCode = (DWORD)info.si_status;
+		return TRUE;
+	}
+
+	// anything else is running until it becomes a zombie; stat fails once it has been reaped
+	char stat[1024];
+	if (read_proc_file(process->handle, "stat", stat, sizeof(stat)) <= 0)
+		return FALSE;
+
+	// the comm field can contain spaces and parentheses, so skip to the last ')'
+	char* fields = strrchr(stat, ')');
+	if (!fields || fields[1] != ' ')
+	{
+		errno = EINVAL;
+		return FALSE;
+	}
+	char state = fields[2];
+	*running = (state != 'Z' && state != 'X');
+	*exitCode = 0;
+
+	if (!*running)
+	{
+		// exit_code is the 52nd field (Linux 3.5+), 49 fields after the state
+		char* field = fields + 2;
+		int i;
+		for (i = 0; i < 49 && field; i++)
+		{
+			field = strchr(field, ' ');
+			if (field)
+				field++;
+		}
+		if (field)
+			*exitCode = (DWORD)((strtoul(field, NULL, 10) >> 8) & 0xff);
+	}
+	return TRUE;
+}
+
+void platform_iterator_init(iterator_t* it)
+{
+	it->dir = NULL;
+	it->file = NULL;
+	it->hasPending = FALSE;
+	it->offline = NULL;
+	it->index = 0;
+	it->started = FALSE;
+}
+
+void platform_iterator_close(iterator_t* it)
+{
+	if (it->dir)
+		closedir(it->dir);
+	if (it->file)
+		fclose(it->file);
+	it->dir = NULL;
+	it->file = NULL;
+}
+
+BOOL platform_processes_open(iterator_t* it)
+{
+	it->dir = opendir("/proc");
+	return it->dir != NULL;
+}
+
+BOOL platform_processes_next(iterator_t* it, process_entry_t* entry)
+{
+	struct dirent* ent;
+	it->started = TRUE;
+	while ((ent = readdir(it->dir)) != NULL)
+	{
+		char* end;
+		unsigned long pid = strtoul(ent->d_name, &end, 10);
+		if (*end != '\0' || end == ent->d_name)
+			continue;
+
+		// the process can exit between readdir and reading comm, so just skip it if so
+		char commPath[32];
+		snprintf(commPath, sizeof(commPath), "%lu/comm", pid);
+		if (read_proc_file(dirfd(it->dir), commPath, entry->name, sizeof(entry->name)) <= 0)
+			continue;
+
+		entry->name[strcspn(entry->name, "\n")] = '\0';
+		entry->pid = (DWORD)pid;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+BOOL platform_process_full_name(iterator_t* it, const process_entry_t* entry, TCHAR* name, SIZE_T size)
+{
+	char path[MAX_PATH];
+	char file[32];
+
+	// comm holds at most 15 characters
+	if (strlen(entry->name) < 15)
+		return FALSE;
+
+	// exe can only be read with the same permissions as the process' memory, so fall back to argv[0]
+	snprintf(file, sizeof(file), "%lu/exe", (unsigned long)entry->pid);
+	ssize_t n = readlinkat(dirfd(it->dir), file, path, sizeof(path) - 1);
+	if (n > 0)
+		path[n] = '\0';
+	else
+	{
+		snprintf(file, sizeof(file), "%lu/cmdline", (unsigned long)entry->pid);
+		if (read_proc_file(dirfd(it->dir), file, path, sizeof(path)) <= 0)
+			return FALSE;
+	}
+
+	const char* base = strrchr(path, '/');
+	base = base ? base + 1 : path;
+	// only trust it if it's the name comm was cut from
+	if (strncmp(base, entry->name, 15) != 0)
+		return FALSE;
+
+	copy_string(name, size, base);
+	return TRUE;
+}
+
+BOOL platform_modules_open(iterator_t* it, process_t* process)
+{
+	if (process->offline)
+		return offline_modules_open(it, process);
+
+	int fd = openat(process->handle, "maps", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return FALSE;
+
+	it->file = fdopen(fd, "r");
+	if (!it->file)
+	{
+		close(fd);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+A module is every file-backed mapping of the same path that appears in a row
+in the maps file (an image's segments, plus any anonymous .bss mapping after
+them, which is skipped over). Its base is the start of the first mapping.
+*/
+BOOL platform_modules_next(iterator_t* it, module_t* module)
+{
+	char line[MAX_PATH + 128];
+	if (it->offline)
+		return offline_modules_next(it, module);
+	it->started = TRUE;
+
+	while (fgets(line, sizeof(line), it->file))
+	{
+		uintptr_t start, end;
+		char perms[5];
+		char* path;
+		if (!parse_maps_line(line, &start, &end, perms, &path) || path[0] != '/')
+			continue;
+
+		if (it->hasPending && strcmp(it->pending.path, path) == 0)
+		{
+			it->pending.size = (DWORD)(end - (uintptr_t)it->pending.handle);
+			continue;
+		}
+
+		BOOL hadPending = it->hasPending;
+		if (hadPending)
+			*module = it->pending;
+
+		it->pending.handle = (HMODULE)start;
+		it->pending.size = (DWORD)(end - start);
+		copy_string(it->pending.path, sizeof(it->pending.path), path);
+		copy_string(it->pending.name, sizeof(it->pending.name), path_basename(path));
+		it->hasPending = TRUE;
+
+		if (hadPending)
+			return TRUE;
+	}
+
+	if (it->hasPending)
+	{
+		*module = it->pending;
+		it->hasPending = FALSE;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+Hashes the file-backed lines of the maps file, which change whenever a
+module is loaded or unloaded. procfs has nothing cheaper to go by (maps has
+no meaningful size or mtime), so this costs as much as reading the file,
+and callers limit how often they call it.
+*/
+BOOL platform_modules_signature(process_t* process, uint64_t* signature)
+{
+	char line[PATH_MAX + 128];
+	uint64_t hash = 14695981039346656037ull;
+	iterator_t it;
+
+	// an offline process' modules never change
+	if (process->offline)
+	{
+		*signature = 0;
+		return TRUE;
+	}
+
+	platform_iterator_init(&it);
+	if (!platform_modules_open(&it, process))
+		return FALSE;
+	while (fgets(line, sizeof(line), it.file))
+	{
+		const char* c;
+		if (!strchr(line, '/'))
+			continue;
+		for (c = line; *c; c++)
+			hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+	}
+	platform_iterator_close(&it);
+
+	*signature = hash;
+	return TRUE;
+}
+
+BOOL platform_regions_open(iterator_t* it, process_t* process)
+{
+	if (process->offline)
+		return offline_regions_open(it, process);
+	return platform_modules_open(it, process);
+}
+
+BOOL platform_regions_next(iterator_t* it, process_t* process, region_t* region, TCHAR* path, SIZE_T pathSize)
+{
+	char line[MAX_PATH + 128];
+	if (it->offline)
+		return offline_regions_next(it, process, region, path, pathSize);
+	it->started = TRUE;
+
+	while (fgets(line, sizeof(line), it->file))
+	{
+		uintptr_t start, end;
+		char perms[5];
+		char* mapPath;
+		if (!parse_maps_line(line, &start, &end, perms, &mapPath))
+			continue;
+
+		region->base = (LPVOID)start;
+		region->size = (SIZE_T)(end - start);
+		region->protect = 0;
+		// [vvar] (and [vvar_vclock]) are readable by the process itself, but not through process_vm_readv
+		if (perms[0] == 'r' && strncmp(mapPath, "[vvar", 5) != 0)
+			region->protect |= REGION_READ;
+		if (perms[1] == 'w')
+			region->protect |= REGION_WRITE;
+		if (perms[2] == 'x')
+			region->protect |= REGION_EXECUTE;
+
+		if (perms[3] == 's')
+			region->type = REGION_MAPPED;
+		else if (mapPath[0] == '/')
+			region->type = REGION_IMAGE;
+		else
+			region->type = REGION_PRIVATE;
+
+		if (path)
+			copy_string(path, pathSize, mapPath);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+uint64_t platform_time_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+uint64_t platform_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void platform_sleep_until_us(uint64_t deadline)
+{
+	struct timespec ts;
+	ts.tv_sec = (time_t)(deadline / 1000000);
+	ts.tv_nsec = (long)(deadline % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+DWORD platform_last_error(void)
+{
+	return (DWORD)errno;
+}
+
+void platform_set_last_error(DWORD error)
+{
+	errno = (int)error;
+}
+
+BOOL platform_notifier_open(notifier_t* notifier)
+{
+	notifier->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return notifier->fd >= 0;
+}
+
+void platform_notifier_close(notifier_t* notifier)
+{
+	if (notifier->fd >= 0)
+		close(notifier->fd);
+	notifier->fd = -1;
+}
+
+void platform_notifier_signal(notifier_t* notifier)
+{
+	uint64_t one = 1;
+	// the only possible failure is the counter overflowing, and then it's signaled anyway
+	if (write(notifier->fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+void platform_notifier_clear(notifier_t* notifier)
+{
+	uint64_t count;
+	if (read(notifier->fd, &count, sizeof(count)) < 0)
+		return;
+}
+
+BOOL platform_notifier_wait(notifier_t* notifier, int timeout)
+{
+	struct pollfd pfd = { notifier->fd, POLLIN, 0 };
+	int n;
+	do
+		n = poll(&pfd, 1, timeout);
+	while (n < 0 && errno == EINTR);
+	return n > 0;
+}
+
+lua_Integer platform_notifier_handle(notifier_t* notifier)
+{
+	return notifier->fd;
+}
+
+BOOL platform_map_temp(temp_mapping_t* mapping, SIZE_T size)
+{
+	const char* dir = getenv("TMPDIR");
+	mapping->data = NULL;
+	mapping->size = size;
+
+	// an unnamed file goes away by itself, even if the process dies
+	mapping->fd = open(dir ? dir : "/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (mapping->fd < 0)
+	{
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/memreader-XXXXXX", dir ? dir : "/tmp");
+		mapping->fd = mkstemp(path);
+		if (mapping->fd < 0)
+			return FALSE;
+		unlink(path);
+	}
+
+	if (ftruncate(mapping->fd, (off_t)size) == 0)
+	{
+		mapping->data = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, MAP_SHARED, mapping->fd, 0);
+		if (mapping->data != MAP_FAILED)
+			return TRUE;
+	}
+
+	// keep errno from the call that failed
+	int err = errno;
+	mapping->data = NULL;
+	close(mapping->fd);
+	errno = err;
+	return FALSE;
+}
+
+void platform_unmap_temp(temp_mapping_t* mapping)
+{
+	if (!mapping->data)
+		return;
+	munmap(mapping->data, mapping->size ? mapping->size : 1);
+	close(mapping->fd);
+	mapping->data = NULL;
+}
+
+BOOL platform_map_file(const TCHAR* path, mapped_file_t* file)
+{
+	struct stat st;
+	file->data = NULL;
+	file->size = 0;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return FALSE;
+
+	BOOL success = fstat(fd, &st) == 0;
+	if (success && st.st_size > 0)
+	{
+		void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		success = data != MAP_FAILED;
+		if (success)
+		{
+			file->data = data;
+			file->size = (SIZE_T)st.st_size;
+		}
+	}
+
+	// the mapping stays valid without the fd
+	int err = errno;
+	close(fd);
+	errno = err;
+	return success;
+}
+
+void platform_unmap_file(mapped_file_t* file)
+{
+	if (file->data)
+		munmap((void*)file->data, file->size);
+	file->data = NULL;
+	file->size = 0;
+}
+
+BOOL platform_file_info(const TCHAR* path, uint64_t* mtime, uint64_t* size)
+{
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return FALSE;
+	*mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + (uint64_t)st.st_mtim.tv_nsec;
+	*size = (uint64_t)st.st_size;
+	return TRUE;
+}
+
+BOOL platform_seek_file(FILE* file, uint64_t offset)
+{
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+}
+
+// Seeking past the end of a file before writing already leaves a hole on the filesystems that support them
+BOOL platform_make_sparse(FILE* file)
+{
+	(void)file;
+	return TRUE;
+}
+
+#endif
\ No newline at end of file
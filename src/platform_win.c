@@ -0,0 +1,472 @@
+#ifdef _WIN32
+
+#include "platform.h"
+#include "stats.h"
+#include "offline.h"
+
+#include <io.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+#include <winioctl.h>
+
+BOOL platform_open_process(process_t* process, DWORD pid)
+{
+	HANDLE handle = OpenProcess(OPEN_PROCESS_FLAGS, 0, pid);
+	if (!handle)
+		return FALSE;
+
+	process->pid = pid;
+	process->handle = handle;
+
+	DWORD cb;
+	EnumProcessModules(process->handle, &process->module, sizeof(HMODULE), &cb);
+
+	GetModuleBaseName(process->handle, NULL, process->name, sizeof(process->name) / sizeof(TCHAR));
+	GetModuleFileNameEx(process->handle, NULL, process->path, sizeof(process->path) / sizeof(TCHAR));
+
+	process->pointerSize = sizeof(LPVOID);
+#ifdef _WIN64
+	BOOL wow64;
+	if (IsWow64Process(process->handle, &wow64) && wow64)
+		process->pointerSize = 4;
+#endif
+	process_store_backend(process, READ_BACKEND_AUTO);
+	process->preadThreshold = (SIZE_T)-1;
+	return TRUE;
+}
+
+void platform_close_process(process_t* process)
+{
+	if (process->offline)
+	{
+		offline_close(process);
+		return;
+	}
+	CloseHandle(process->handle);
+}
+
+BOOL platform_read(process_t* process, LPCVOID address, LPVOID buffer, SIZE_T size, SIZE_T* bytesRead)
+{
+	if (process->offline)
+		return offline_read(process, address, buffer, size, bytesRead);
+
+	*bytesRead = 0;
+	STATS_START(start);
+	BOOL success = ReadProcessMemory(process->handle, address, buffer, size, bytesRead);
+	STATS_READ(process, READ_BACKEND_VM, start, size, *bytesRead);
+	return success;
+}
+
+SIZE_T platform_readv(process_t* process, read_request_t* requests, SIZE_T count)
+{
+	// there's no vectored ReadProcessMemory, so this is one call per request
+	SIZE_T i, complete = 0;
+	if (process->offline)
+		return offline_readv(process, requests, count);
+
+	STATS_START(start);
+	for (i = 0; i < count; i++)
+	{
+		read_request_t* req = &requests[i];
+		req->bytesRead = 0;
+		if (ReadProcessMemory(process->handle, req->address, req->buffer, req->size, &req->bytesRead))
+			complete++;
+	}
+	STATS_READV(process, READ_BACKEND_VM, start, count, requests, count);
+	return complete;
+}
+
+// ReadProcessMemory is the only way to read another process on Windows
+BOOL platform_set_read_backend(process_t* process, read_backend backend)
+{
+	BOOL available = process->offline
+		? backend == READ_BACKEND_AUTO || backend == READ_BACKEND_MMAP
+		: backend == READ_BACKEND_AUTO || backend == READ_BACKEND_VM;
+	if (!available)
+	{
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return FALSE;
+	}
+	process_store_backend(process, backend);
+	return TRUE;
+}
+
+BOOL platform_tune_reads(process_t* process)
+{
+	process_store_backend(process, READ_BACKEND_AUTO);
+	return TRUE;
+}
+
+BOOL platform_exit_code(process_t* process, BOOL* running, DWORD* exitCode)
+{
+	if (process->offline)
+		return offline_exit_code(process, running, exitCode);
+
+	if (!GetExitCodeProcess(process->handle, exitCode))
+		return FALSE;
+
+	*running = (*exitCode == STILL_ACTIVE);
+	return TRUE;
+}
+
+void platform_iterator_init(iterator_t* it)
+{
+	it->handle = INVALID_HANDLE_VALUE;
+	it->cursor = NULL;
+	it->offline = NULL;
+	it->index = 0;
+	it->started = FALSE;
+}
+
+void platform_iterator_close(iterator_t* it)
+{
+	if (it->handle != INVALID_HANDLE_VALUE)
+		CloseHandle(it->handle);
+	it->handle = INVALID_HANDLE_VALUE;
+}
+
+BOOL platform_processes_open(iterator_t* it)
+{
+	it->handle = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	return it->handle != INVALID_HANDLE_VALUE;
+}
+
+BOOL platform_processes_next(iterator_t* it, process_entry_t* entry)
+{
+	PROCESSENTRY32 pe32;
+	pe32.dwSize = sizeof(PROCESSENTRY32);
+
+	BOOL success;
+	if (!it->started)
+		success = Process32First(it->handle, &pe32);
+	else
+		success = Process32Next(it->handle, &pe32);
+	it->started = TRUE;
+
+	if (!success)
+		return FALSE;
+
+	entry->pid = pe32.th32ProcessID;
+	strncpy_s(entry->name, sizeof(entry->name), pe32.szExeFile, _TRUNCATE);
+	return TRUE;
+}
+
+BOOL platform_process_full_name(iterator_t* it, const process_entry_t* entry, TCHAR* name, SIZE_T size)
+{
+	// szExeFile is never truncated
+	return FALSE;
+}
+
+BOOL platform_modules_open(iterator_t* it, process_t* process)
+{
+	if (process->offline)
+		return offline_modules_open(it, process);
+
+	// From the WinAPI docs:
+	// "If the function fails with ERROR_BAD_LENGTH when called with TH32CS_SNAPMODULE or TH32CS_SNAPMODULE32,
+	// call the function again until it succeeds."
+	do
+	{
+		it->handle = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE | TH32CS_SNAPMODULE32, process->pid);
+	}
+	while (it->handle == INVALID_HANDLE_VALUE && GetLastError() == ERROR_BAD_LENGTH);
+
+	return it->handle != INVALID_HANDLE_VALUE;
+}
+
+BOOL platform_modules_next(iterator_t* it, module_t* module)
+{
+	if (it->offline)
+		return offline_modules_next(it, module);
+
+	MODULEENTRY32 me32;
+	me32.dwSize = sizeof(MODULEENTRY32);
+
+	BOOL success;
+	if (!it->started)
+		success = Module32First(it->handle, &me32);
+	else
+		success = Module32Next(it->handle, &me32);
+	it->started = TRUE;
+
+	if (!success)
+		return FALSE;
+
+	init_module(module, &me32);
+	return TRUE;
+}
+
+// There's no cheap way to be told about module loads, but listing the module handles is much cheaper than a Toolhelp snapshot
+BOOL platform_modules_signature(process_t* process, uint64_t* signature)
+{
+	HMODULE modules[MAX_MODULES];
+	uint64_t hash = 14695981039346656037ull;
+	DWORD cb, i;
+
+	// an offline process' modules never change
+	if (process->offline)
+	{
+		*signature = 0;
+		return TRUE;
+	}
+
+	if (!EnumProcessModules(process->handle, modules, sizeof(modules), &cb))
+		return FALSE;
+
+	// cb is the size needed for all of the modules, so it also changes when there are more than fit
+	hash = (hash ^ cb) * 1099511628211ull;
+	if (cb > sizeof(modules))
+		cb = sizeof(modules);
+	for (i = 0; i < cb / sizeof(HMODULE); i++)
+		hash = (hash ^ (uint64_t)(uintptr_t)modules[i]) * 1099511628211ull;
+
+	*signature = hash;
+	return TRUE;
+}
+
+BOOL platform_regions_open(iterator_t* it, process_t* process)
+{
+	if (process->offline)
+		return offline_regions_open(it, process);
+	it->cursor = NULL;
+	return TRUE;
+}
+
+static DWORD region_protect(DWORD protect)
+{
+	DWORD flags = 0;
+	if (protect & (PAGE_NOACCESS | PAGE_GUARD))
+		return 0;
+	if (protect & (PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY))
+		flags |= REGION_READ;
+	if (protect & (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY))
+		flags |= REGION_WRITE;
+	if (protect & (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY))
+		flags |= REGION_EXECUTE;
+	return flags;
+}
+
+BOOL platform_regions_next(iterator_t* it, process_t* process, region_t* region, TCHAR* path, SIZE_T pathSize)
+{
+	MEMORY_BASIC_INFORMATION mbi;
+	if (it->offline)
+		return offline_regions_next(it, process, region, path, pathSize);
+	it->started = TRUE;
+
+	while (VirtualQueryEx(process->handle, it->cursor, &mbi, sizeof(mbi)) == sizeof(mbi))
+	{
+		char* end = (char*)mbi.BaseAddress + mbi.RegionSize;
+		if (end <= (char*)it->cursor)
+			break;
+		it->cursor = end;
+
+		if (mbi.State != MEM_COMMIT)
+			continue;
+
+		region->base = mbi.BaseAddress;
+		region->size = mbi.RegionSize;
+		region->protect = region_protect(mbi.Protect);
+		region->type = mbi.Type == MEM_IMAGE ? REGION_IMAGE : mbi.Type == MEM_MAPPED ? REGION_MAPPED : REGION_PRIVATE;
+
+		if (path)
+		{
+			path[0] = '\0';
+			if (region->type != REGION_PRIVATE)
+				GetMappedFileName(process->handle, mbi.BaseAddress, path, (DWORD)pathSize);
+		}
+		return TRUE;
+	}
+	return FALSE;
+}
+
+uint64_t platform_time_us(void)
+{
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	// split up to avoid overflowing for counters with a high frequency
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000
+		+ (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+uint64_t platform_time_ns(void)
+{
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000
+		+ (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+}
+
+void platform_sleep_until_us(uint64_t deadline)
+{
+	uint64_t now = platform_time_us();
+	// Sleep() is only accurate to the scheduler tick, so it's used for all but the last
+	// couple of milliseconds and the rest is spent yielding
+	if (deadline > now + 2000)
+		Sleep((DWORD)((deadline - now - 2000) / 1000));
+	while (platform_time_us() < deadline)
+		SwitchToThread();
+}
+
+DWORD platform_last_error(void)
+{
+	return GetLastError();
+}
+
+void platform_set_last_error(DWORD error)
+{
+	SetLastError(error);
+}
+
+BOOL platform_notifier_open(notifier_t* notifier)
+{
+	notifier->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	return notifier->event != NULL;
+}
+
+void platform_notifier_close(notifier_t* notifier)
+{
+	if (notifier->event)
+		CloseHandle(notifier->event);
+	notifier->event = NULL;
+}
+
+void platform_notifier_signal(notifier_t* notifier)
+{
+	SetEvent(notifier->event);
+}
+
+void platform_notifier_clear(notifier_t* notifier)
+{
+	ResetEvent(notifier->event);
+}
+
+BOOL platform_notifier_wait(notifier_t* notifier, int timeout)
+{
+	return WaitForSingleObject(notifier->event, timeout < 0 ? INFINITE : (DWORD)timeout) == WAIT_OBJECT_0;
+}
+
+lua_Integer platform_notifier_handle(notifier_t* notifier)
+{
+	return (lua_Integer)(intptr_t)notifier->event;
+}
+
+BOOL platform_map_temp(temp_mapping_t* mapping, SIZE_T size)
+{
+	TCHAR dir[MAX_PATH], path[MAX_PATH];
+	mapping->data = NULL;
+	mapping->size = size;
+
+	if (!GetTempPath(MAX_PATH, dir) || !GetTempFileName(dir, TEXT("mem"), 0, path))
+		return FALSE;
+
+	mapping->file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if (mapping->file == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	ULONGLONG mappingSize = size ? size : 1;
+	mapping->mapping = CreateFileMapping(mapping->file, NULL, PAGE_READWRITE, (DWORD)(mappingSize >> 32), (DWORD)mappingSize, NULL);
+	if (!mapping->mapping)
+	{
+		CloseHandle(mapping->file);
+		return FALSE;
+	}
+
+	mapping->data = MapViewOfFile(mapping->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (!mapping->data)
+	{
+		CloseHandle(mapping->mapping);
+		CloseHandle(mapping->file);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void platform_unmap_temp(temp_mapping_t* mapping)
+{
+	if (!mapping->data)
+		return;
+	UnmapViewOfFile(mapping->data);
+	CloseHandle(mapping->mapping);
+	CloseHandle(mapping->file);
+	mapping->data = NULL;
+}
+
+BOOL platform_map_file(const TCHAR* path, mapped_file_t* file)
+{
+	LARGE_INTEGER size;
+	file->data = NULL;
+	file->size = 0;
+	file->mapping = NULL;
+
+	file->file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file->file == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	if (!GetFileSizeEx(file->file, &size) || (ULONGLONG)size.QuadPart > (SIZE_T)-1)
+	{
+		CloseHandle(file->file);
+		return FALSE;
+	}
+	if (size.QuadPart == 0)
+		return TRUE;
+
+	file->mapping = CreateFileMapping(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!file->mapping)
+	{
+		CloseHandle(file->file);
+		return FALSE;
+	}
+
+	file->data = MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!file->data)
+	{
+		CloseHandle(file->mapping);
+		CloseHandle(file->file);
+		return FALSE;
+	}
+	file->size = (SIZE_T)size.QuadPart;
+	return TRUE;
+}
+
+void platform_unmap_file(mapped_file_t* file)
+{
+	if (file->data)
+		UnmapViewOfFile(file->data);
+	if (file->mapping)
+		CloseHandle(file->mapping);
+	CloseHandle(file->file);
+	file->data = NULL;
+	file->size = 0;
+}
+
+BOOL platform_file_info(const TCHAR* path, uint64_t* mtime, uint64_t* size)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesEx(path, GetFileExInfoStandard, &data))
+		return FALSE;
+	*mtime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	*size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	return TRUE;
+}
+
+BOOL platform_seek_file(FILE* file, uint64_t offset)
+{
+	return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+}
+
+// Without this, NTFS fills whatever is skipped over with zeros
+BOOL platform_make_sparse(FILE* file)
+{
+	DWORD bytes;
+	HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+	return DeviceIoControl(handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,1274 @@
+#include "pointermap.h"
+#include "address.h"
+#include "region.h"
+#include "platform.h"
+#include "threadpool.h"
+#include "varint.h"
+
+#include <stdio.h>
+#include <errno.h>
+
+#define POINTERMAP_MAGIC "MRPM"
+#define POINTERMAP_VERSION 1
+
+// Blocks encoded or decoded by one task
+#define POINTERMAP_GROUP 64
+
+#define PATHS_DEFAULT_DEPTH 5
+#define PATHS_DEFAULT_OFFSET 4096
+#define PATHS_DEFAULT_RESULTS 10000
+#define PATHS_DEFAULT_NODES (1024 * 1024)
+
+#define NO_MODULE ((SIZE_T)-1)
+
+pointermap_t* check_pointermap(lua_State *L, int index)
+{
+	pointermap_t* map = (pointermap_t*)luaL_checkudata(L, index, POINTERMAP_T);
+	return map;
+}
+
+static pointermap_t* push_pointermap(lua_State *L)
+{
+	pointermap_t* map = (pointermap_t*)lua_newuserdata(L, sizeof(pointermap_t));
+	memset(map, 0, sizeof(pointermap_t));
+	luaL_getmetatable(L, POINTERMAP_T);
+	lua_setmetatable(L, -2);
+	return map;
+}
+
+static void pointermap_free(pointermap_t* map)
+{
+	free(map->modules);
+	free(map->blocks);
+	free(map->data);
+	free(map->byLocation);
+	memset(map, 0, sizeof(pointermap_t));
+}
+
+static SIZE_T block_entries(const pointermap_t* map, SIZE_T block)
+{
+	SIZE_T remaining = map->count - block * POINTERMAP_BLOCK;
+	return remaining < POINTERMAP_BLOCK ? remaining : POINTERMAP_BLOCK;
+}
+
+static SIZE_T block_count(SIZE_T entries)
+{
+	return (entries + POINTERMAP_BLOCK - 1) / POINTERMAP_BLOCK;
+}
+
+static SIZE_T group_count(SIZE_T blocks)
+{
+	return (blocks + POINTERMAP_GROUP - 1) / POINTERMAP_GROUP;
+}
+
+// Returns the module containing address, or NO_MODULE
+static SIZE_T find_module(const pointermap_t* map, uint64_t address)
+{
+	SIZE_T lo = 0, hi = map->moduleCount;
+	while (lo < hi)
+	{
+		SIZE_T mid = lo + (hi - lo) / 2;
+		const pointermap_module_t* module = &map->modules[mid];
+		if (address < module->base)
+			hi = mid;
+		else if (address - module->base >= module->size)
+			lo = mid + 1;
+		else
+			return mid;
+	}
+	return NO_MODULE;
+}
+
+// Sorting
+
+typedef int(*entry_compare_fn)(const void* a, const void* b);
+
+static int compare_by_value(const void* a, const void* b)
+{
+	const pointer_entry_t* x = (const pointer_entry_t*)a;
+	const pointer_entry_t* y = (const pointer_entry_t*)b;
+	if (x->value != y->value)
+		return x->value < y->value ? -1 : 1;
+	if (x->location != y->location)
+		return x->location < y->location ? -1 : 1;
+	return 0;
+}
+
+static int compare_by_location(const void* a, const void* b)
+{
+	const pointer_entry_t* x = (const pointer_entry_t*)a;
+	const pointer_entry_t* y = (const pointer_entry_t*)b;
+	if (x->location != y->location)
+		return x->location < y->location ? -1 : 1;
+	return 0;
+}
+
+typedef struct {
+	const pointer_entry_t* src;
+	pointer_entry_t* dst;
+	const SIZE_T* bounds;
+	SIZE_T runs;
+	entry_compare_fn compare;
+} merge_job;
+
+// Merges runs task * 2 and task * 2 + 1 (or copies the last run if it has no partner)
+static void merge_task(void* ctx, int worker, SIZE_T task)
+{
+	merge_job* job = (merge_job*)ctx;
+	SIZE_T first = task * 2;
+	SIZE_T i = job->bounds[first], out = i;
+	SIZE_T mid = job->bounds[first + 1];
+	SIZE_T j = mid, end = first + 2 <= job->runs ? job->bounds[first + 2] : mid;
+
+	while (i < mid && j < end)
+		job->dst[out++] = job->compare(&job->src[j], &job->src[i]) < 0 ? job->src[j++] : job->src[i++];
+	memcpy(job->dst + out, job->src + i, (mid - i) * sizeof(pointer_entry_t));
+	out += mid - i;
+	memcpy(job->dst + out, job->src + j, (end - j) * sizeof(pointer_entry_t));
+}
+
+/**
+Merges sorted runs of entries (run i being [bounds[i], bounds[i + 1])) a
+level at a time, the pairs of each level being merged in parallel. scratch
+must be as large as *entries, and is swapped with it whenever the result
+ends up there. bounds is overwritten.
+*/
+static void merge_runs(pointer_entry_t** entries, pointer_entry_t** scratch, SIZE_T* bounds, SIZE_T runs, int workers, entry_compare_fn compare)
+{
+	while (runs > 1)
+	{
+		merge_job job = { *entries, *scratch, bounds, runs, compare };
+		SIZE_T i, pairs = (runs + 1) / 2;
+		pool_run(workers, pairs, merge_task, &job);
+
+		for (i = 0; i < pairs; i++)
+			bounds[i] = bounds[i * 2];
+		bounds[pairs] = bounds[runs];
+		runs = pairs;
+
+		pointer_entry_t* swap = *entries;
+		*entries = *scratch;
+		*scratch = swap;
+	}
+}
+
+typedef struct {
+	pointer_entry_t* entries;
+	const SIZE_T* bounds;
+	entry_compare_fn compare;
+} sort_job;
+
+static void sort_task(void* ctx, int worker, SIZE_T task)
+{
+	sort_job* job = (sort_job*)ctx;
+	qsort(job->entries + job->bounds[task], job->bounds[task + 1] - job->bounds[task], sizeof(pointer_entry_t), job->compare);
+}
+
+// Sorts runs of the entries in parallel, then merges them
+static BOOL sort_entries(pointer_entry_t** entries, SIZE_T count, int workers, entry_compare_fn compare)
+{
+	SIZE_T bounds[POOL_MAX_WORKERS * 4 + 1];
+	SIZE_T i, runs = (SIZE_T)(workers > POOL_MAX_WORKERS ? POOL_MAX_WORKERS : workers) * 4;
+	if (runs > count)
+		runs = count ? count : 1;
+
+	pointer_entry_t* scratch = (pointer_entry_t*)malloc((count ? count : 1) * sizeof(pointer_entry_t));
+	if (!scratch)
+		return FALSE;
+
+	for (i = 0; i <= runs; i++)
+		bounds[i] = count * i / runs;
+	sort_job job = { *entries, bounds, compare };
+	pool_run(workers, runs, sort_task, &job);
+
+	merge_runs(entries, &scratch, bounds, runs, workers, compare);
+	free(scratch);
+	return TRUE;
+}
+
+// Building
+
+typedef struct {
+	pointer_entry_t* entries;
+	SIZE_T count;
+	SIZE_T capacity;
+} entry_list;
+
+typedef struct {
+	SIZE_T pointerSize;
+	const region_t* targets;
+	SIZE_T targetCount;
+	uint64_t low;
+	uint64_t high;
+	entry_list* chunks;
+	volatile BOOL outOfMemory;
+} build_job;
+
+static uint64_t region_start(const region_t* region)
+{
+	return (uint64_t)(uintptr_t)region->base;
+}
+
+// Whether value points into one of the (sorted, coalesced) target regions
+static BOOL is_target(const build_job* job, uint64_t value)
+{
+	// most values aren't anywhere near the address space, so reject those before searching
+	if (value < job->low || value >= job->high)
+		return FALSE;
+
+	SIZE_T lo = 0, hi = job->targetCount;
+	while (hi - lo > 1)
+	{
+		SIZE_T mid = lo + (hi - lo) / 2;
+		if (region_start(&job->targets[mid]) <= value)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return value - region_start(&job->targets[lo]) < job->targets[lo].size;
+}
+
+static BOOL entry_list_push(entry_list* list, uint64_t value, uint64_t location)
+{
+	if (list->count == list->capacity)
+	{
+		SIZE_T capacity = list->capacity ? list->capacity * 2 : 1024;
+		pointer_entry_t* entries = (pointer_entry_t*)realloc(list->entries, capacity * sizeof(pointer_entry_t));
+		if (!entries)
+			return FALSE;
+		list->entries = entries;
+		list->capacity = capacity;
+	}
+	list->entries[list->count].value = value;
+	list->entries[list->count].location = location;
+	list->count++;
+	return TRUE;
+}
+
+static BOOL build_on_chunk(void* ctx, int worker, SIZE_T index, const chunk_t* chunk)
+{
+	build_job* job = (build_job*)ctx;
+	entry_list* list = &job->chunks[index];
+	uint64_t address = (uint64_t)(uintptr_t)chunk->address;
+	SIZE_T offset;
+
+	// chunks start at a page boundary, so every slot is aligned
+	if (job->pointerSize == 8)
+	{
+		for (offset = 0; offset + 8 <= chunk->size; offset += 8)
+		{
+			uint64_t value;
+			memcpy(&value, chunk->data + offset, 8);
+			if (is_target(job, value) && !entry_list_push(list, value, address + offset))
+				job->outOfMemory = TRUE;
+		}
+	}
+	else
+	{
+		for (offset = 0; offset + 4 <= chunk->size; offset += 4)
+		{
+			uint32_t value;
+			memcpy(&value, chunk->data + offset, 4);
+			if (is_target(job, value) && !entry_list_push(list, value, address + offset))
+				job->outOfMemory = TRUE;
+		}
+	}
+
+	// sorting each chunk here spreads most of the sorting over the readers
+	qsort(list->entries, list->count, sizeof(pointer_entry_t), compare_by_value);
+	return !job->outOfMemory;
+}
+
+typedef struct {
+	pointermap_t* map;
+	const pointer_entry_t* entries;
+	byte_vector* groups;
+	volatile BOOL outOfMemory;
+} encode_job;
+
+static uint64_t zigzag_encode(int64_t n)
+{
+	return n < 0 ? ((uint64_t)~n << 1) | 1 : (uint64_t)n << 1;
+}
+
+static int64_t zigzag_decode(uint64_t n)
+{
+	return n & 1 ? ~(int64_t)(n >> 1) : (int64_t)(n >> 1);
+}
+
+// Encodes a group of blocks into its own buffer, with the block offsets relative to it
+static void encode_task(void* ctx, int worker, SIZE_T task)
+{
+	encode_job* job = (encode_job*)ctx;
+	pointermap_t* map = job->map;
+	byte_vector* out = &job->groups[task];
+	SIZE_T block, end = (task + 1) * POINTERMAP_GROUP;
+	if (end > map->blockCount)
+		end = map->blockCount;
+
+	for (block = task * POINTERMAP_GROUP; block < end; block++)
+	{
+		const pointer_entry_t* entries = job->entries + block * POINTERMAP_BLOCK;
+		SIZE_T i, n = block_entries(map, block);
+
+		map->blocks[block].value = entries[0].value;
+		map->blocks[block].location = entries[0].location;
+		map->blocks[block].offset = out->size;
+		for (i = 1; i < n; i++)
+		{
+			int64_t slots = (int64_t)(entries[i].location - entries[i - 1].location) / (int64_t)map->pointerSize;
+			if (!append_varint(out, entries[i].value - entries[i - 1].value) || !append_varint(out, zigzag_encode(slots)))
+			{
+				job->outOfMemory = TRUE;
+				return;
+			}
+		}
+	}
+}
+
+// Encodes the sorted entries into the blocks and data of the map
+static BOOL pointermap_encode(pointermap_t* map, const pointer_entry_t* entries, SIZE_T count, int workers)
+{
+	map->count = count;
+	map->blockCount = block_count(count);
+	map->blocks = (pointermap_block_t*)malloc((map->blockCount ? map->blockCount : 1) * sizeof(pointermap_block_t));
+	if (!map->blocks)
+		return FALSE;
+
+	SIZE_T i, groups = group_count(map->blockCount);
+	encode_job job = { map, entries, NULL, FALSE };
+	job.groups = (byte_vector*)calloc(groups ? groups : 1, sizeof(byte_vector));
+	if (!job.groups)
+		return FALSE;
+
+	pool_run(workers, groups, encode_task, &job);
+
+	for (i = 0; i < groups; i++)
+		map->dataSize += job.groups[i].size;
+	map->data = job.outOfMemory ? NULL : (unsigned char*)malloc(map->dataSize ? map->dataSize : 1);
+
+	SIZE_T offset = 0;
+	for (i = 0; i < groups; i++)
+	{
+		if (map->data)
+		{
+			SIZE_T block, end = (i + 1) * POINTERMAP_GROUP < map->blockCount ? (i + 1) * POINTERMAP_GROUP : map->blockCount;
+			memcpy(map->data + offset, job.groups[i].data, job.groups[i].size);
+			for (block = i * POINTERMAP_GROUP; block < end; block++)
+				map->blocks[block].offset += offset;
+			offset += job.groups[i].size;
+		}
+		free(job.groups[i].data);
+	}
+	free(job.groups);
+	return map->data != NULL;
+}
+
+static int compare_modules(const void* a, const void* b)
+{
+	const pointermap_module_t* x = (const pointermap_module_t*)a;
+	const pointermap_module_t* y = (const pointermap_module_t*)b;
+	if (x->base != y->base)
+		return x->base < y->base ? -1 : 1;
+	return 0;
+}
+
+// Lists the modules of the process into the map; *outOfMemory tells a failed allocation from a failed listing
+static BOOL collect_modules(pointermap_t* map, process_t* process, BOOL* outOfMemory)
+{
+	iterator_t it;
+	module_t module;
+	SIZE_T capacity = 0;
+	BOOL success = TRUE;
+
+	*outOfMemory = FALSE;
+	platform_iterator_init(&it);
+	if (!platform_modules_open(&it, process))
+		return FALSE;
+
+	while (success && platform_modules_next(&it, &module))
+	{
+		if (map->moduleCount == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			pointermap_module_t* modules = (pointermap_module_t*)realloc(map->modules, capacity * sizeof(pointermap_module_t));
+			if (!modules)
+			{
+				*outOfMemory = TRUE;
+				success = FALSE;
+				break;
+			}
+			map->modules = modules;
+		}
+		pointermap_module_t* entry = &map->modules[map->moduleCount++];
+		// the name is written to files as is, so the rest of it is zeroed
+		memset(entry->name, 0, sizeof(entry->name));
+		copy_string(entry->name, sizeof(entry->name), module.name);
+		entry->base = (uint64_t)(uintptr_t)module.handle;
+		entry->size = module.size;
+	}
+	platform_iterator_close(&it);
+
+	qsort(map->modules, map->moduleCount, sizeof(pointermap_module_t), compare_modules);
+	return success;
+}
+
+/**
+Scans the regions for values pointing into the targets, then sorts and
+encodes them. Each chunk's entries are sorted as the chunk is scanned, so
+all that's left afterwards is a parallel merge of the chunks. On failure,
+*outOfMemory is FALSE if it was reading the regions that failed.
+*/
+static BOOL pointermap_build(pointermap_t* map, process_t* process, const region_list_t* regions, const region_list_t* targets, int workers, BOOL* outOfMemory)
+{
+	SIZE_T i, chunkCount = 0, count = 0;
+	build_job job;
+	BOOL success = FALSE;
+
+	*outOfMemory = TRUE;
+	memset(&job, 0, sizeof(job));
+	job.pointerSize = map->pointerSize;
+	job.targets = targets->regions;
+	job.targetCount = targets->count;
+	if (targets->count)
+	{
+		const region_t* last = &targets->regions[targets->count - 1];
+		job.low = region_start(&targets->regions[0]);
+		job.high = region_start(last) + last->size;
+	}
+
+	for (i = 0; i < regions->count; i++)
+		chunkCount += (regions->regions[i].size + REGION_CHUNK_SIZE - 1) / REGION_CHUNK_SIZE;
+	job.chunks = (entry_list*)calloc(chunkCount ? chunkCount : 1, sizeof(entry_list));
+	SIZE_T* bounds = (SIZE_T*)malloc((chunkCount + 1) * sizeof(SIZE_T));
+	pointer_entry_t* entries = NULL;
+	pointer_entry_t* scratch = NULL;
+	if (!job.chunks || !bounds)
+		goto done;
+
+	if (!region_list_read_chunks_parallel(process, regions, REGION_CHUNK_SIZE, 0, workers, build_on_chunk, &job) || job.outOfMemory)
+	{
+		*outOfMemory = job.outOfMemory;
+		goto done;
+	}
+
+	for (i = 0; i < chunkCount; i++)
+		count += job.chunks[i].count;
+	entries = (pointer_entry_t*)malloc((count ? count : 1) * sizeof(pointer_entry_t));
+	scratch = (pointer_entry_t*)malloc((count ? count : 1) * sizeof(pointer_entry_t));
+	if (!entries || !scratch)
+		goto done;
+
+	// every chunk is a sorted run of the concatenation
+	count = 0;
+	for (i = 0; i < chunkCount; i++)
+	{
+		bounds[i] = count;
+		memcpy(entries + count, job.chunks[i].entries, job.chunks[i].count * sizeof(pointer_entry_t));
+		count += job.chunks[i].count;
+		free(job.chunks[i].entries);
+		job.chunks[i].entries = NULL;
+	}
+	bounds[chunkCount] = count;
+
+	merge_runs(&entries, &scratch, bounds, chunkCount, workers, compare_by_value);
+	free(scratch);
+	scratch = NULL;
+
+	success = pointermap_encode(map, entries, count, workers);
+
+done:
+	if (job.chunks)
+	{
+		for (i = 0; i < chunkCount; i++)
+			free(job.chunks[i].entries);
+	}
+	free(job.chunks);
+	free(bounds);
+	free(entries);
+	free(scratch);
+	return success;
+}
+
+// Decoding
+
+typedef struct {
+	const pointermap_t* map;
+	SIZE_T block;
+	SIZE_T index; // within the block
+	const unsigned char* data;
+	pointer_entry_t entry;
+} pointermap_cursor;
+
+static void cursor_seek(pointermap_cursor* cursor, const pointermap_t* map, SIZE_T block)
+{
+	cursor->map = map;
+	cursor->block = block;
+	cursor->index = 0;
+	cursor->data = map->data + map->blocks[block].offset;
+	cursor->entry.value = map->blocks[block].value;
+	cursor->entry.location = map->blocks[block].location;
+}
+
+// Moves to the next entry, returning FALSE if there isn't one
+static BOOL cursor_next(pointermap_cursor* cursor)
+{
+	const pointermap_t* map = cursor->map;
+	if (++cursor->index == block_entries(map, cursor->block))
+	{
+		if (cursor->block + 1 == map->blockCount)
+			return FALSE;
+		cursor_seek(cursor, map, cursor->block + 1);
+		return TRUE;
+	}
+
+	cursor->entry.value += read_varint(&cursor->data);
+	int64_t slots = zigzag_decode(read_varint(&cursor->data));
+	cursor->entry.location += (uint64_t)(slots * (int64_t)map->pointerSize);
+	return TRUE;
+}
+
+// Moves to the first entry with a value of at least low, returning FALSE if there isn't one
+static BOOL cursor_find(pointermap_cursor* cursor, const pointermap_t* map, uint64_t low)
+{
+	if (!map->blockCount)
+		return FALSE;
+
+	// entries equal to low can start in the last block whose first value is below it
+	SIZE_T lo = 0, hi = map->blockCount;
+	while (hi - lo > 1)
+	{
+		SIZE_T mid = lo + (hi - lo) / 2;
+		if (map->blocks[mid].value < low)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	cursor_seek(cursor, map, lo);
+	while (cursor->entry.value < low)
+	{
+		if (!cursor_next(cursor))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+typedef struct {
+	const pointermap_t* map;
+	pointer_entry_t* entries;
+} decode_job;
+
+static void decode_task(void* ctx, int worker, SIZE_T task)
+{
+	decode_job* job = (decode_job*)ctx;
+	const pointermap_t* map = job->map;
+	SIZE_T block, end = (task + 1) * POINTERMAP_GROUP;
+	if (end > map->blockCount)
+		end = map->blockCount;
+
+	for (block = task * POINTERMAP_GROUP; block < end; block++)
+	{
+		pointer_entry_t* out = job->entries + block * POINTERMAP_BLOCK;
+		SIZE_T i, n = block_entries(map, block);
+		pointermap_cursor cursor;
+		cursor_seek(&cursor, map, block);
+		out[0] = cursor.entry;
+		for (i = 1; i < n; i++)
+		{
+			cursor_next(&cursor);
+			out[i] = cursor.entry;
+		}
+	}
+}
+
+// Builds map->byLocation if it hasn't been built yet
+static BOOL pointermap_index_locations(pointermap_t* map, int workers)
+{
+	if (map->byLocation)
+		return TRUE;
+
+	pointer_entry_t* entries = (pointer_entry_t*)malloc((map->count ? map->count : 1) * sizeof(pointer_entry_t));
+	if (!entries)
+		return FALSE;
+
+	decode_job job = { map, entries };
+	pool_run(workers, group_count(map->blockCount), decode_task, &job);
+	if (!sort_entries(&entries, map->count, workers, compare_by_location))
+	{
+		free(entries);
+		return FALSE;
+	}
+	map->byLocation = entries;
+	return TRUE;
+}
+
+// Finds the value stored at location, using map->byLocation
+static BOOL pointermap_value_at(const pointermap_t* map, uint64_t location, uint64_t* value)
+{
+	SIZE_T lo = 0, hi = map->count;
+	while (lo < hi)
+	{
+		SIZE_T mid = lo + (hi - lo) / 2;
+		uint64_t current = map->byLocation[mid].location;
+		if (current == location)
+		{
+			*value = map->byLocation[mid].value;
+			return TRUE;
+		}
+		if (current < location)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return FALSE;
+}
+
+// Path search
+
+#define PATH_ROOT ((SIZE_T)-1)
+
+// An address that leads to the target
+typedef struct {
+	uint64_t address;
+	SIZE_T parent; // the node this one points into, PATH_ROOT for the target itself
+	uint64_t offset; // added to the pointer at address to get the parent's address
+} path_node;
+
+// A pointer in a module that leads to the target
+typedef struct {
+	SIZE_T node;
+	SIZE_T module;
+	uint64_t location;
+	uint64_t offset;
+} path_result;
+
+// A pointer at location to the address of a node, minus offset
+typedef struct {
+	uint64_t location;
+	uint64_t offset;
+	SIZE_T node;
+} path_hit;
+
+typedef struct {
+	path_node* nodes;
+	SIZE_T nodeCount;
+	SIZE_T nodeCapacity;
+	path_result* results;
+	SIZE_T resultCount;
+	SIZE_T resultCapacity;
+	uint64_t* visited; // open addressing, 0 being an empty slot
+	SIZE_T visitedCount;
+	SIZE_T visitedCapacity;
+} path_search;
+
+typedef struct {
+	const pointermap_t* map;
+	const path_node* nodes;
+	SIZE_T first; // of the nodes whose pointers are being looked up
+	uint64_t maxOffset;
+	byte_vector* hits; // per node
+	volatile BOOL outOfMemory;
+} search_job;
+
+static void search_task(void* ctx, int worker, SIZE_T task)
+{
+	search_job* job = (search_job*)ctx;
+	SIZE_T node = job->first + task;
+	uint64_t address = job->nodes[node].address;
+	uint64_t low = address > job->maxOffset ? address - job->maxOffset : 0;
+	pointermap_cursor cursor;
+
+	if (!cursor_find(&cursor, job->map, low))
+		return;
+	do
+	{
+		if (cursor.entry.value > address)
+			break;
+		path_hit hit = { cursor.entry.location, address - cursor.entry.value, node };
+		if (!byte_vector_append(&job->hits[task], &hit, sizeof(hit)))
+		{
+			job->outOfMemory = TRUE;
+			return;
+		}
+	}
+	while (cursor_next(&cursor));
+}
+
+// Orders hits by offset, so that the closest pointer to an address is the one that claims it
+static int compare_hits(const void* a, const void* b)
+{
+	const path_hit* x = (const path_hit*)a;
+	const path_hit* y = (const path_hit*)b;
+	if (x->offset != y->offset)
+		return x->offset < y->offset ? -1 : 1;
+	if (x->node != y->node)
+		return x->node < y->node ? -1 : 1;
+	if (x->location != y->location)
+		return x->location < y->location ? -1 : 1;
+	return 0;
+}
+
+static SIZE_T hash_address(uint64_t address)
+{
+	address ^= address >> 33;
+	address *= 0xff51afd7ed558ccdULL;
+	address ^= address >> 33;
+	return (SIZE_T)address;
+}
+
+static void visited_insert(uint64_t* slots, SIZE_T capacity, uint64_t address)
+{
+	SIZE_T i = hash_address(address) & (capacity - 1);
+	while (slots[i] && slots[i] != address)
+		i = (i + 1) & (capacity - 1);
+	slots[i] = address;
+}
+
+// Adds address to the visited set; *added is FALSE if it was already there
+static BOOL visited_add(path_search* search, uint64_t address, BOOL* added)
+{
+	if ((search->visitedCount + 1) * 2 > search->visitedCapacity)
+	{
+		SIZE_T i, capacity = search->visitedCapacity ? search->visitedCapacity * 2 : 1024;
+		uint64_t* slots = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+		if (!slots)
+			return FALSE;
+		for (i = 0; i < search->visitedCapacity; i++)
+		{
+			if (search->visited[i])
+				visited_insert(slots, capacity, search->visited[i]);
+		}
+		free(search->visited);
+		search->visited = slots;
+		search->visitedCapacity = capacity;
+	}
+
+	SIZE_T i = hash_address(address) & (search->visitedCapacity - 1);
+	while (search->visited[i] && search->visited[i] != address)
+		i = (i + 1) & (search->visitedCapacity - 1);
+	*added = !search->visited[i];
+	search->visited[i] = address;
+	search->visitedCount += *added;
+	return TRUE;
+}
+
+static BOOL push_node(path_search* search, uint64_t address, SIZE_T parent, uint64_t offset)
+{
+	if (search->nodeCount == search->nodeCapacity)
+	{
+		SIZE_T capacity = search->nodeCapacity ? search->nodeCapacity * 2 : 256;
+		path_node* nodes = (path_node*)realloc(search->nodes, capacity * sizeof(path_node));
+		if (!nodes)
+			return FALSE;
+		search->nodes = nodes;
+		search->nodeCapacity = capacity;
+	}
+	path_node* node = &search->nodes[search->nodeCount++];
+	node->address = address;
+	node->parent = parent;
+	node->offset = offset;
+	return TRUE;
+}
+
+static BOOL push_result(path_search* search, SIZE_T module, const path_hit* hit)
+{
+	if (search->resultCount == search->resultCapacity)
+	{
+		SIZE_T capacity = search->resultCapacity ? search->resultCapacity * 2 : 256;
+		path_result* results = (path_result*)realloc(search->results, capacity * sizeof(path_result));
+		if (!results)
+			return FALSE;
+		search->results = results;
+		search->resultCapacity = capacity;
+	}
+	path_result* result = &search->results[search->resultCount++];
+	result->node = hit->node;
+	result->module = module;
+	result->location = hit->location;
+	result->offset = hit->offset;
+	return TRUE;
+}
+
+static void path_search_free(path_search* search)
+{
+	free(search->nodes);
+	free(search->results);
+	free(search->visited);
+}
+
+/**
+A reverse breadth-first search from the target: each level looks up the
+pointers into [address - maxOffset, address] of every node of the level in
+parallel, then goes through all of the hits in order of offset (so results
+don't depend on the number of workers). Pointers stored in a module are
+results; the others become the nodes of the next level, unless the address
+already is a node. Only keeping the shortest way to reach an address (with
+the smallest offset, among equally short ones) is what keeps the search
+from blowing up.
+*/
+static BOOL pointermap_search(const pointermap_t* map, uint64_t target, int maxDepth, uint64_t maxOffset, SIZE_T maxResults, SIZE_T maxNodes, int workers, path_search* search)
+{
+	BOOL added, success = TRUE;
+	int depth;
+
+	if (!push_node(search, target, PATH_ROOT, 0) || !visited_add(search, target, &added))
+		return FALSE;
+
+	SIZE_T levelStart = 0, levelEnd = 1;
+	for (depth = 0; success && depth < maxDepth && levelStart < levelEnd && search->resultCount < maxResults; depth++)
+	{
+		SIZE_T i, count = levelEnd - levelStart;
+		byte_vector level = { NULL, 0, 0 };
+		search_job job = { map, search->nodes, levelStart, maxOffset, NULL, FALSE };
+		job.hits = (byte_vector*)calloc(count, sizeof(byte_vector));
+		if (!job.hits)
+			return FALSE;
+
+		pool_run(workers, count, search_task, &job);
+		success = !job.outOfMemory;
+		for (i = 0; i < count; i++)
+		{
+			if (success && job.hits[i].size)
+				success = byte_vector_append(&level, job.hits[i].data, job.hits[i].size);
+			free(job.hits[i].data);
+		}
+		free(job.hits);
+
+		path_hit* hits = (path_hit*)level.data;
+		SIZE_T h, hitCount = level.size / sizeof(path_hit);
+		if (success)
+			qsort(hits, hitCount, sizeof(path_hit), compare_hits);
+		for (h = 0; success && h < hitCount && search->resultCount < maxResults; h++)
+		{
+			SIZE_T module = find_module(map, hits[h].location);
+			if (module != NO_MODULE)
+				success = push_result(search, module, &hits[h]);
+			else if (depth + 1 < maxDepth && search->nodeCount < maxNodes)
+			{
+				success = visited_add(search, hits[h].location, &added);
+				if (success && added)
+					success = push_node(search, hits[h].location, hits[h].node, hits[h].offset);
+			}
+		}
+		free(level.data);
+
+		levelStart = levelEnd;
+		levelEnd = search->nodeCount;
+	}
+	return success;
+}
+
+// Pushes a path as {module name, {offsets...}}, in the form process:readchain takes
+static void push_path(lua_State *L, const pointermap_t* map, const path_search* search, const path_result* result)
+{
+	const pointermap_module_t* module = &map->modules[result->module];
+	SIZE_T node;
+	int n = 0;
+
+	lua_createtable(L, 2, 0);
+	lua_pushstring(L, module->name);
+	lua_rawseti(L, -2, 1);
+
+	lua_newtable(L);
+	lua_pushinteger(L, (lua_Integer)(result->location - module->base));
+	lua_rawseti(L, -2, ++n);
+	lua_pushinteger(L, (lua_Integer)result->offset);
+	lua_rawseti(L, -2, ++n);
+	for (node = result->node; search->nodes[node].parent != PATH_ROOT; node = search->nodes[node].parent)
+	{
+		lua_pushinteger(L, (lua_Integer)search->nodes[node].offset);
+		lua_rawseti(L, -2, ++n);
+	}
+	lua_rawseti(L, -2, 2);
+}
+
+// Saving and loading
+
+static BOOL write_bytes(FILE* file, const void* data, SIZE_T size)
+{
+	return fwrite(data, 1, size, file) == size;
+}
+
+static BOOL write_u32(FILE* file, uint32_t value)
+{
+	return write_bytes(file, &value, sizeof(value));
+}
+
+static BOOL write_u64(FILE* file, uint64_t value)
+{
+	return write_bytes(file, &value, sizeof(value));
+}
+
+static BOOL pointermap_write(const pointermap_t* map, FILE* file)
+{
+	SIZE_T i;
+	BOOL success = write_bytes(file, POINTERMAP_MAGIC, 4)
+		&& write_u32(file, POINTERMAP_VERSION)
+		&& write_u32(file, (uint32_t)map->pointerSize)
+		&& write_u32(file, (uint32_t)map->moduleCount)
+		&& write_u64(file, map->count)
+		&& write_u64(file, map->blockCount)
+		&& write_u64(file, map->dataSize);
+
+	for (i = 0; success && i < map->moduleCount; i++)
+	{
+		const pointermap_module_t* module = &map->modules[i];
+		uint32_t length = (uint32_t)strlen(module->name);
+		success = write_u32(file, length)
+			&& write_bytes(file, module->name, length)
+			&& write_u64(file, module->base)
+			&& write_u64(file, module->size);
+	}
+	return success
+		&& write_bytes(file, map->blocks, map->blockCount * sizeof(pointermap_block_t))
+		&& write_bytes(file, map->data, map->dataSize);
+}
+
+static BOOL read_bytes(FILE* file, void* data, SIZE_T size)
+{
+	return fread(data, 1, size, file) == size;
+}
+
+// Checks that the data holds exactly count varints of at most 10 bytes each
+static BOOL check_varints(const unsigned char* data, const unsigned char* end, SIZE_T count)
+{
+	while (count--)
+	{
+		const unsigned char* start = data;
+		do
+		{
+			if (data == end || data - start == 10)
+				return FALSE;
+		}
+		while (*data++ & 0x80);
+	}
+	return data == end;
+}
+
+// Reads a saved map, returning an error message on failure
+static const char* pointermap_read(pointermap_t* map, FILE* file)
+{
+	char magic[4];
+	uint32_t version, pointerSize, moduleCount;
+	uint64_t count, blockCount, dataSize;
+	SIZE_T i;
+
+	if (!read_bytes(file, magic, 4) || memcmp(magic, POINTERMAP_MAGIC, 4) != 0
+		|| !read_bytes(file, &version, 4) || version != POINTERMAP_VERSION)
+		return "not a pointer map, or one from an incompatible version";
+	if (!read_bytes(file, &pointerSize, 4) || !read_bytes(file, &moduleCount, 4)
+		|| !read_bytes(file, &count, 8) || !read_bytes(file, &blockCount, 8) || !read_bytes(file, &dataSize, 8))
+		return "truncated pointer map";
+	if ((pointerSize != 4 && pointerSize != 8) || count > (SIZE_T)-1 / sizeof(pointer_entry_t)
+		|| blockCount != block_count((SIZE_T)count) || dataSize > (SIZE_T)-1)
+		return "invalid pointer map";
+
+	map->pointerSize = pointerSize;
+	map->count = (SIZE_T)count;
+	map->blockCount = (SIZE_T)blockCount;
+	map->dataSize = (SIZE_T)dataSize;
+	map->modules = (pointermap_module_t*)calloc(moduleCount ? moduleCount : 1, sizeof(pointermap_module_t));
+	map->blocks = (pointermap_block_t*)malloc((map->blockCount ? map->blockCount : 1) * sizeof(pointermap_block_t));
+	map->data = (unsigned char*)malloc(map->dataSize ? map->dataSize : 1);
+	if (!map->modules || !map->blocks || !map->data)
+		return "not enough memory";
+
+	for (i = 0; i < moduleCount; i++)
+	{
+		pointermap_module_t* module = &map->modules[i];
+		uint32_t length;
+		if (!read_bytes(file, &length, 4) || length >= sizeof(module->name) || !read_bytes(file, module->name, length)
+			|| !read_bytes(file, &module->base, 8) || !read_bytes(file, &module->size, 8))
+			return "truncated pointer map";
+		map->moduleCount++;
+	}
+	qsort(map->modules, map->moduleCount, sizeof(pointermap_module_t), compare_modules);
+
+	if (!read_bytes(file, map->blocks, map->blockCount * sizeof(pointermap_block_t)) || !read_bytes(file, map->data, map->dataSize))
+		return "truncated pointer map";
+
+	// a corrupt file could otherwise make lookups read past the data
+	for (i = 0; i < map->blockCount; i++)
+	{
+		uint64_t start = map->blocks[i].offset;
+		uint64_t end = i + 1 < map->blockCount ? map->blocks[i + 1].offset : map->dataSize;
+		if (start > end || end > map->dataSize
+			|| !check_varints(map->data + (SIZE_T)start, map->data + (SIZE_T)end, (block_entries(map, i) - 1) * 2))
+			return "invalid pointer map";
+	}
+	return NULL;
+}
+
+// Lua
+
+/**
+process:pointermap([options])
+
+options can contain the region filter fields (see process:regions) for the
+memory to scan, which defaults to writable memory, and workers. Every
+pointer-sized value in it that points into a readable region is indexed.
+*/
+int process_pointermap(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	region_filter_t filter;
+	region_filter_t readable = { 1, -1, -1, -1 };
+	int workers = pool_default_workers();
+
+	check_region_filter(L, 2, &filter);
+	filter.readable = 1;
+	if (filter.writable < 0)
+		filter.writable = 1;
+	if (lua_istable(L, 2))
+	{
+		lua_getfield(L, 2, "workers");
+		workers = pool_check_workers(L, lua_gettop(L));
+		lua_pop(L, 1);
+	}
+
+	pointermap_t* map = push_pointermap(L);
+	BOOL outOfMemory;
+	map->pointerSize = process->pointerSize;
+	if (!collect_modules(map, process, &outOfMemory))
+		return outOfMemory ? push_error(L, "not enough memory") : push_last_error(L);
+
+	region_list_t regions, targets;
+	region_list_init(&regions);
+	region_list_init(&targets);
+	if (!region_list_collect(process, &filter, &regions) || !region_list_collect(process, &readable, &targets))
+	{
+		region_list_free(&regions);
+		region_list_free(&targets);
+		return push_last_error(L);
+	}
+	region_list_coalesce(&targets);
+
+	BOOL success = pointermap_build(map, process, &regions, &targets, workers, &outOfMemory);
+	region_list_free(&regions);
+	region_list_free(&targets);
+	if (!success)
+	{
+		pointermap_free(map);
+		return outOfMemory ? push_error(L, "not enough memory") : push_last_error(L);
+	}
+	return 1;
+}
+
+/**
+memreader.loadpointermap(path)
+
+Loads a pointer map saved with pointermap:save.
+*/
+int memreader_loadpointermap(lua_State *L)
+{
+	const char* path = luaL_checkstring(L, 1);
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return push_error(L, lua_pushfstring(L, "%s: %s", path, strerror(errno)));
+
+	pointermap_t* map = push_pointermap(L);
+	const char* err = pointermap_read(map, file);
+	fclose(file);
+	if (err)
+	{
+		pointermap_free(map);
+		return push_error(L, err);
+	}
+	return 1;
+}
+
+static lua_Integer get_option_integer(lua_State *L, int index, const char* name, lua_Integer def)
+{
+	if (!lua_istable(L, index))
+		return def;
+	lua_getfield(L, index, name);
+	lua_Integer value = lua_isnil(L, -1) ? def : (lua_Integer)luaL_checknumber(L, -1);
+	lua_pop(L, 1);
+	return value;
+}
+
+/**
+pointermap:paths(target[, maxdepth[, maxoffset[, options]]])
+
+Finds pointer paths from the modules of the process to target, following
+at most maxdepth pointers (default 5) and allowing offsets of up to
+maxoffset bytes (default 4096) from each pointer. options can contain
+maxresults (default 10000), maxnodes (the most intermediate addresses
+explored, default 1048576) and workers.
+
+Returns an array of paths, shortest first. Each is {module name, offsets},
+which process:readchain accepts as its base and offsets.
+*/
+static int pointermap_paths(lua_State *L)
+{
+	pointermap_t* map = check_pointermap(L, 1);
+	uint64_t target = (uint64_t)(uintptr_t)memaddress_checkptr(L, 2);
+	lua_Integer maxDepth = luaL_optinteger(L, 3, PATHS_DEFAULT_DEPTH);
+	lua_Integer maxOffset = luaL_optinteger(L, 4, PATHS_DEFAULT_OFFSET);
+	lua_Integer maxResults = get_option_integer(L, 5, "maxresults", PATHS_DEFAULT_RESULTS);
+	lua_Integer maxNodes = get_option_integer(L, 5, "maxnodes", PATHS_DEFAULT_NODES);
+	int workers = pool_default_workers();
+
+	luaL_argcheck(L, maxDepth > 0, 3, "maxdepth must be positive");
+	luaL_argcheck(L, maxOffset >= 0, 4, "maxoffset must not be negative");
+	luaL_argcheck(L, maxResults > 0, 5, "maxresults must be positive");
+	luaL_argcheck(L, maxNodes > 0, 5, "maxnodes must be positive");
+	if (lua_istable(L, 5))
+	{
+		lua_getfield(L, 5, "workers");
+		workers = pool_check_workers(L, lua_gettop(L));
+		lua_pop(L, 1);
+	}
+
+	path_search search;
+	memset(&search, 0, sizeof(search));
+	if (!pointermap_search(map, target, (int)maxDepth, (uint64_t)maxOffset, (SIZE_T)maxResults, (SIZE_T)maxNodes, workers, &search))
+	{
+		path_search_free(&search);
+		return push_error(L, "not enough memory");
+	}
+
+	SIZE_T i;
+	lua_createtable(L, (int)search.resultCount, 0);
+	for (i = 0; i < search.resultCount; i++)
+	{
+		push_path(L, map, &search, &search.results[i]);
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+	path_search_free(&search);
+	return 1;
+}
+
+static const pointermap_module_t* find_module_by_name(const pointermap_t* map, const char* name)
+{
+	SIZE_T i;
+	for (i = 0; i < map->moduleCount; i++)
+	{
+#ifdef _WIN32
+		if (_stricmp(map->modules[i].name, name) == 0)
+#else
+		if (strcmp(map->modules[i].name, name) == 0)
+#endif
+			return &map->modules[i];
+	}
+	return NULL;
+}
+
+// Follows a path ({module name, offsets}) at index through the map, returning whether it ends at target
+static BOOL pointermap_follow(lua_State *L, const pointermap_t* map, int index, uint64_t target)
+{
+	int top = lua_gettop(L);
+	BOOL reached = FALSE;
+
+	lua_rawgeti(L, index, 1);
+	lua_rawgeti(L, index, 2);
+	const pointermap_module_t* module = lua_type(L, top + 1) == LUA_TSTRING ? find_module_by_name(map, lua_tostring(L, top + 1)) : NULL;
+	if (module && lua_istable(L, top + 2))
+	{
+		int level, levels = (int)lua_rawlen(L, top + 2);
+		uint64_t address = module->base;
+		reached = levels > 0;
+		for (level = 1; reached && level <= levels; level++)
+		{
+			lua_rawgeti(L, top + 2, level);
+			uint64_t offset = (uint64_t)(LONG_PTR)memaddress_checkptr(L, lua_gettop(L));
+			lua_pop(L, 1);
+			if (level > 1)
+				reached = pointermap_value_at(map, address, &address);
+			address += offset;
+		}
+		reached = reached && address == target;
+	}
+	lua_settop(L, top);
+	return reached;
+}
+
+/**
+pointermap:intersect(paths, target[, workers])
+
+Returns the paths (as returned by pointermap:paths, usually of a map from
+an earlier run) that lead to target in this map. Module bases are taken
+from this map, so paths survive a module being loaded somewhere else.
+*/
+static int pointermap_intersect(lua_State *L)
+{
+	pointermap_t* map = check_pointermap(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	uint64_t target = (uint64_t)(uintptr_t)memaddress_checkptr(L, 3);
+	int workers = pool_check_workers(L, 4);
+
+	if (!pointermap_index_locations(map, workers))
+		return push_error(L, "not enough memory");
+
+	int i, n = 0, count = (int)lua_rawlen(L, 2);
+	lua_newtable(L);
+	for (i = 1; i <= count; i++)
+	{
+		lua_rawgeti(L, 2, i);
+		if (lua_istable(L, -1) && pointermap_follow(L, map, lua_gettop(L), target))
+			lua_rawseti(L, -2, ++n);
+		else
+			lua_pop(L, 1);
+	}
+	return 1;
+}
+
+// pointermap:save(path) writes the map to a file, to be loaded with memreader.loadpointermap
+static int pointermap_save(lua_State *L)
+{
+	pointermap_t* map = check_pointermap(L, 1);
+	const char* path = luaL_checkstring(L, 2);
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return push_error(L, lua_pushfstring(L, "%s: %s", path, strerror(errno)));
+
+	BOOL success = pointermap_write(map, file);
+	if (fclose(file) != 0)
+		success = FALSE;
+	if (!success)
+		return push_error(L, lua_pushfstring(L, "%s: %s", path, strerror(errno)));
+
+	lua_pushboolean(L, TRUE);
+	return 1;
+}
+
+static int pointermap_gc(lua_State *L)
+{
+	pointermap_t* map = check_pointermap(L, 1);
+	pointermap_free(map);
+	return 0;
+}
+
+static int pointermap_len(lua_State *L)
+{
+	pointermap_t* map = check_pointermap(L, 1);
+	lua_pushinteger(L, (lua_Integer)map->count);
+	return 1;
+}
+
+static const luaL_Reg pointermap_meta[] = {
+	{ "__gc", pointermap_gc },
+	{ "__len", pointermap_len },
+	{ NULL, NULL }
+};
+static const luaL_Reg pointermap_methods[] = {
+	{ "paths", pointermap_paths },
+	{ "intersect", pointermap_intersect },
+	{ "save", pointermap_save },
+	{ NULL, NULL }
+};
+static udata_field_info pointermap_getters[] = {
+	{ "count", udata_field_get_size, offsetof(pointermap_t, count) },
+	{ "pointersize", udata_field_get_size, offsetof(pointermap_t, pointerSize) },
+	{ NULL, NULL }
+};
+static udata_field_info pointermap_setters[] = {
+	{ NULL, NULL }
+};
+
+int register_pointermap(lua_State *L)
+{
+	UDATA_REGISTER_TYPE_WITH_FIELDS(pointermap, POINTERMAP_T)
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef MEMREADER_POINTERMAP_H
+#define MEMREADER_POINTERMAP_H
+
+#include "memreader.h"
+#include "process.h"
+#include "module.h"
+
+#define POINTERMAP_T MEMREADER_METATABLE(pointermap)
+
+// Entries are encoded in blocks of this many, so that a lookup only has to decode one block to find its start
+#define POINTERMAP_BLOCK 256
+
+// A pointer found in memory: the value stored at location
+typedef struct {
+	uint64_t value;
+	uint64_t location;
+} pointer_entry_t;
+
+typedef struct {
+	char name[MODULE_NAME_SIZE];
+	uint64_t base;
+	uint64_t size;
+} pointermap_module_t;
+
+// The first entry of a block is stored as is, the rest are varints starting at offset in the data
+typedef struct {
+	uint64_t value;
+	uint64_t location;
+	uint64_t offset;
+} pointermap_block_t;
+
+/**
+Every pointer-sized value in the scanned memory of a process that points
+into one of its readable regions, sorted by value (then location). Each
+block stores the deltas from the previous entry: the value delta as a
+varint and the location delta (in pointer-sized slots) as a zigzag varint,
+which typically takes 3-5 bytes per pointer instead of 16.
+
+Addresses are stored as 64-bit numbers whatever the pointer size, so maps
+can be saved and loaded by any build.
+*/
+typedef struct {
+	SIZE_T pointerSize;
+	pointermap_module_t* modules; // sorted by base
+	SIZE_T moduleCount;
+	pointermap_block_t* blocks;
+	SIZE_T blockCount;
+	unsigned char* data;
+	SIZE_T dataSize;
+	SIZE_T count;
+	pointer_entry_t* byLocation; // every entry sorted by location, built the first time it's needed
+} pointermap_t;
+
+pointermap_t* check_pointermap(lua_State *L, int index);
+
+int process_pointermap(lua_State *L);
+int memreader_loadpointermap(lua_State *L);
+int register_pointermap(lua_State *L);
+
+#endif
\ No newline at end of file
@@ -1,8 +1,22 @@
 #include "process.h"
 #include "address.h"
 #include "module.h"
-
-#include <psapi.h>
+#include "platform.h"
+#include "value.h"
+#include "buffer.h"
+#include "struct.h"
+#include "region.h"
+#include "pattern.h"
+#include "snapshot.h"
+#include "dump.h"
+#include "cache.h"
+#include "watch.h"
+#include "pointermap.h"
+#include "modulemap.h"
+#include "stats.h"
+#include "async.h"
+#include "strscan.h"
+#include "threadpool.h"
 
 process_t* check_process(lua_State *L, int index)
 {
@@ -18,50 +32,402 @@ process_t* push_process(lua_State *L)
 	return proc;
 }
 
-void init_process(process_t* process, DWORD pid, HANDLE handle)
+static const char* const read_backend_names[] = { "auto", "vm", "pread", "mmap", "autotune", NULL };
+
+const char* read_backend_name(read_backend backend)
 {
-	process->pid = pid;
-	process->handle = handle;
+	return read_backend_names[backend + 1];
+}
 
-	DWORD cb;
-	EnumProcessModules(process->handle, &process->module, sizeof(HMODULE), &cb);
+read_backend process_load_backend(process_t* process)
+{
+	return (read_backend)(LONG_PTR)POOL_LOAD_ACQUIRE(&process->readBackend);
+}
 
-	GetModuleBaseName(process->handle, NULL, process->name, sizeof(process->name) / sizeof(TCHAR));
-	GetModuleFileNameEx(process->handle, NULL, process->path, sizeof(process->path) / sizeof(TCHAR));
+void process_store_backend(process_t* process, read_backend backend)
+{
+	POOL_STORE_RELEASE(&process->readBackend, (SIZE_T)(LONG_PTR)backend);
 }
 
-static int process_read(lua_State *L)
+BOOL process_open(process_t* process, DWORD pid)
+{
+	memset(process, 0, sizeof(process_t));
+	if (!platform_open_process(process, pid))
+		return FALSE;
+	process->stats = process_stats_new();
+
+	// MEMREADER_READ_BACKEND is what process:readbackend() is called with for every process that's opened
+	const char* backend = getenv("MEMREADER_READ_BACKEND");
+	int i;
+	for (i = 0; backend && read_backend_names[i]; i++)
+	{
+		if (strcmp(backend, read_backend_names[i]) != 0)
+			continue;
+		if (i == READ_BACKENDS + 1)
+			platform_tune_reads(process);
+		else
+			platform_set_read_backend(process, (read_backend)(i - 1));
+		break;
+	}
+	return TRUE;
+}
+
+/**
+process:readbackend([backend])
+
+Sets how the memory of the process is read: backend is one of
+read_backend_names, where "autotune" measures the backends and then picks
+one per read like "auto" does. Returns the backend that was in effect
+before the call, and the size from which "auto" reads use pread (nil if
+they never do).
+*/
+static int process_read_backend(lua_State *L)
 {
 	process_t* process = check_process(L, 1);
-	LPVOID address = (LPVOID)memaddress_checkptr(L, 2);
-	SIZE_T bytes = (SIZE_T)luaL_checkinteger(L, 3);
+	read_backend previous = process_load_backend(process);
+	SIZE_T threshold = POOL_LOAD_ACQUIRE(&process->preadThreshold);
 
-	char *buff = malloc(bytes);
+	if (!lua_isnoneornil(L, 2))
+	{
+		int option = luaL_checkoption(L, 2, NULL, read_backend_names);
+		BOOL success = option == READ_BACKENDS + 1
+			? platform_tune_reads(process)
+			: platform_set_read_backend(process, (read_backend)(option - 1));
+		if (!success)
+			return push_last_error(L);
+	}
+
+	lua_pushstring(L, read_backend_name(previous));
+	if (threshold == (SIZE_T)-1)
+		lua_pushnil(L);
+	else
+		lua_pushinteger(L, (lua_Integer)threshold);
+	return 2;
+}
+
+// Reads up to this many bytes into a stack buffer instead of allocating one
+#define READ_STACK_BUFFER_SIZE 256
+
+static int push_read(lua_State *L, process_t* process, LPCVOID address, SIZE_T bytes)
+{
+	char stackBuff[READ_STACK_BUFFER_SIZE];
+	char *buff = bytes <= sizeof(stackBuff) ? stackBuff : malloc(bytes);
 	SIZE_T numBytesRead;
+	int results;
+
+	if (!buff)
+		return push_error(L, "not enough memory");
 
-	if (!ReadProcessMemory(process->handle, address, buff, bytes, &numBytesRead))
+	if (!process_read_memory(process, address, buff, bytes, &numBytesRead))
+		results = push_last_error(L);
+	else
+	{
+		lua_pushlstring(L, buff, numBytesRead);
+		results = 1;
+	}
+
+	if (buff != stackBuff)
+		free(buff);
+	return results;
+}
+
+// Reads a pointer of the target's width
+static BOOL read_pointer(process_t* process, LPCVOID address, LPVOID* ptr)
+{
+	uint64_t value = 0; // a 32-bit pointer only fills the low bytes
+	SIZE_T numBytesRead;
+
+	if (!process_read_memory(process, address, &value, process->pointerSize, &numBytesRead))
+		return FALSE;
+
+	*ptr = (LPVOID)(uintptr_t)value;
+	return TRUE;
+}
+
+static int push_read_value(lua_State *L, process_t* process, LPCVOID address, value_type type)
+{
+	char buff[VALUE_MAX_SIZE];
+	SIZE_T numBytesRead;
+
+	if (type == VALUE_PTR)
+	{
+		LPVOID ptr;
+		if (!read_pointer(process, address, &ptr))
+			return push_last_error(L);
+		return push_value(L, type, &ptr);
+	}
+
+	if (!process_read_memory(process, address, buff, value_types[type].size, &numBytesRead))
 		return push_last_error(L);
 
-	lua_pushlstring(L, buff, numBytesRead);
-	return 1;
+	return push_value(L, type, buff);
+}
+
+static LPCVOID check_relative_address(lua_State *L, process_t* process, int index)
+{
+	LONG_PTR offset = memaddress_checkptr(L, index);
+	return (LPCVOID)((char*)process->module + offset);
+}
+
+static int process_read(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	LPCVOID address = (LPCVOID)memaddress_checkptr(L, 2);
+	SIZE_T bytes = (SIZE_T)luaL_checkinteger(L, 3);
+	return push_read(L, process, address, bytes);
 }
 
 static int process_read_relative(lua_State *L)
 {
 	process_t* process = check_process(L, 1);
-	LPVOID address = process->module;
-	LONG_PTR offset = memaddress_checkptr(L, 2);
+	LPCVOID address = check_relative_address(L, process, 2);
 	SIZE_T bytes = (SIZE_T)luaL_checkinteger(L, 3);
-	address = (LPVOID)((char*)address + offset);
-	lua_settop(L, 1); // pop everything but the process_t
-	memaddress_t* absAddress = push_memaddress(L);
-	absAddress->ptr = address;
-	lua_pushinteger(L, bytes);
-	return process_read(L);
+	return push_read(L, process, address, bytes);
+}
+
+/**
+process:readinto(buffer, address, nbytes[, offset])
+
+Reads into the buffer at the given 0-based offset, growing it if needed.
+Returns the number of bytes read.
+*/
+static int process_read_into(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	buffer_t* buffer = check_buffer(L, 2);
+	LPCVOID address = (LPCVOID)memaddress_checkptr(L, 3);
+	lua_Integer bytes = luaL_checkinteger(L, 4);
+	lua_Integer offset = luaL_optinteger(L, 5, 0);
+	luaL_argcheck(L, bytes >= 0, 4, "size must not be negative");
+	luaL_argcheck(L, offset >= 0, 5, "offset must not be negative");
+	// on 32-bit builds, either can be too large for a SIZE_T, and so can their sum
+	luaL_argcheck(L, (uint64_t)bytes <= (uint64_t)(SIZE_T)-1, 4, "size is too large");
+	luaL_argcheck(L, (uint64_t)offset <= (uint64_t)((SIZE_T)-1 - (SIZE_T)bytes), 5, "offset is too large");
+
+	SIZE_T end = (SIZE_T)offset + (SIZE_T)bytes;
+	if (end > buffer->size && !buffer_resize(buffer, end))
+		return push_error(L, "not enough memory");
+
+	SIZE_T numBytesRead;
+	if (!process_read_memory(process, address, buffer->data + offset, (SIZE_T)bytes, &numBytesRead))
+		return push_last_error(L);
+
+	lua_pushinteger(L, (lua_Integer)numBytesRead);
+	return 1;
+}
+
+// Turns the nil, errmsg on top of the stack into nil, "level <level>: <msg> <address>: <errmsg>", level
+static int push_chain_error(lua_State *L, int level, const char* msg, LPCVOID address)
+{
+	lua_pushfstring(L, "level %d: %s %p: %s", level, msg, address, lua_tostring(L, -1));
+	lua_remove(L, -2);
+	lua_pushinteger(L, level);
+	return 3;
+}
+
+/**
+process:readchain(base, offsets[, nbytes or type])
+
+Resolves a pointer path: the first offset is added to base, and every
+offset after that is added to the pointer read from the previous address.
+Returns the final address, followed by the data at it if nbytes (a number
+of bytes, or a value type name for a typed read) is given.
+
+On failure returns nil, errmsg, level, where level is the index of the
+offset whose pointer couldn't be read (or #offsets + 1 for the final read).
+*/
+static int process_read_chain(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	char* address;
+
+	if (lua_type(L, 2) == LUA_TSTRING)
+	{
+		module_t module;
+		if (!process_find_module(process, lua_tostring(L, 2), &module))
+			return push_error(L, lua_pushfstring(L, "module '%s' not found", lua_tostring(L, 2)));
+		address = (char*)module.handle;
+	}
+	else
+		address = (char*)memaddress_checkptr(L, 2);
+
+	luaL_checktype(L, 3, LUA_TTABLE);
+	int levels = (int)lua_rawlen(L, 3);
+	int level;
+
+	for (level = 1; level <= levels; level++)
+	{
+		lua_rawgeti(L, 3, level);
+		LONG_PTR offset = memaddress_checkptr(L, lua_gettop(L));
+		lua_pop(L, 1);
+
+		if (level > 1)
+		{
+			LPVOID ptr;
+			if (!read_pointer(process, address, &ptr))
+			{
+				push_last_error(L);
+				return push_chain_error(L, level, "unable to read pointer at", address);
+			}
+			if (!ptr)
+			{
+				lua_pushnil(L);
+				lua_pushfstring(L, "level %d: null pointer at %p", level, (void*)address);
+				lua_pushinteger(L, level);
+				return 3;
+			}
+			address = (char*)ptr;
+		}
+		address += offset;
+	}
+
+	push_address(L, address);
+	if (lua_isnoneornil(L, 4))
+		return 1;
+
+	int results;
+	if (lua_type(L, 4) == LUA_TSTRING)
+		results = push_read_value(L, process, address, check_value_type(L, 4));
+	else
+		results = push_read(L, process, address, (SIZE_T)luaL_checkinteger(L, 4));
+
+	if (results != 1)
+		return push_chain_error(L, levels + 1, "unable to read value at", address);
+	return 2;
+}
+
+/**
+Defines process_read_<name>(process, address) and
+process_read_relative_<name>(process, offset) for a value_type
+*/
+#define PROCESS_TYPED_READ(name, type)										\
+	static int process_read_##name(lua_State *L)							\
+	{																		\
+		process_t* process = check_process(L, 1);							\
+		LPCVOID address = (LPCVOID)memaddress_checkptr(L, 2);				\
+		return push_read_value(L, process, address, type);					\
+	}																		\
+	static int process_read_relative_##name(lua_State *L)					\
+	{																		\
+		process_t* process = check_process(L, 1);							\
+		LPCVOID address = check_relative_address(L, process, 2);			\
+		return push_read_value(L, process, address, type);					\
+	}
+
+PROCESS_TYPED_READ(u8, VALUE_U8)
+PROCESS_TYPED_READ(i8, VALUE_I8)
+PROCESS_TYPED_READ(u16, VALUE_U16)
+PROCESS_TYPED_READ(i16, VALUE_I16)
+PROCESS_TYPED_READ(u32, VALUE_U32)
+PROCESS_TYPED_READ(i32, VALUE_I32)
+PROCESS_TYPED_READ(u64, VALUE_U64)
+PROCESS_TYPED_READ(i64, VALUE_I64)
+PROCESS_TYPED_READ(f32, VALUE_F32)
+PROCESS_TYPED_READ(f64, VALUE_F64)
+PROCESS_TYPED_READ(ptr, VALUE_PTR)
+
+// Whether the value at index is a number or a memory address userdata
+static BOOL readv_is_address(lua_State *L, int index)
+{
+	int t = lua_type(L, index);
+	if (t == LUA_TNUMBER)
+		return TRUE;
+	if (t != LUA_TUSERDATA || !lua_getmetatable(L, index))
+		return FALSE;
+	luaL_getmetatable(L, MEMORY_ADDRESS_T);
+	BOOL isAddress = lua_rawequal(L, -1, -2);
+	lua_pop(L, 2);
+	return isAddress;
+}
+
+/**
+process:readv({ {address, nbytes}, ... }[, packed])
+
+Without packed, returns a table with the data for each request as a string
+(or false if that request couldn't be read completely).
+With packed, returns all the data in one string along with a table of
+each request's 0-based offset within it (or false, as above). What a
+failed request couldn't read is zeros in the string.
+*/
+static int process_readv(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	BOOL packed = lua_toboolean(L, 3);
+	SIZE_T count = (SIZE_T)lua_rawlen(L, 2);
+	SIZE_T i, total = 0;
+
+	// both allocations are userdata so that they're collected if an argument error is thrown
+	read_request_t* requests = (read_request_t*)lua_newuserdata(L, count * sizeof(read_request_t));
+	for (i = 0; i < count; i++)
+	{
+		lua_rawgeti(L, 2, (int)i + 1);
+		if (!lua_istable(L, -1))
+			return luaL_error(L, "bad request #%d to 'readv' (table expected, got %s)", (int)i + 1, luaL_typename(L, -1));
+		int entry = lua_gettop(L);
+		lua_rawgeti(L, entry, 1);
+		lua_rawgeti(L, entry, 2);
+		// the fields are checked here so that errors name the request rather than a stack slot
+		if (!readv_is_address(L, entry + 1))
+			return luaL_error(L, "bad request #%d to 'readv' (address expected, got %s)", (int)i + 1, luaL_typename(L, entry + 1));
+		if (lua_type(L, entry + 2) != LUA_TNUMBER)
+			return luaL_error(L, "bad request #%d to 'readv' (number expected for size, got %s)", (int)i + 1, luaL_typename(L, entry + 2));
+#if LUA_VERSION_NUM >= 503
+		if (!lua_isinteger(L, entry + 2))
+			return luaL_error(L, "bad request #%d to 'readv' (size has no integer representation)", (int)i + 1);
+#endif
+		requests[i].address = (LPCVOID)memaddress_checkptr(L, entry + 1);
+		lua_Integer bytes = lua_tointeger(L, entry + 2);
+		if (bytes < 0)
+			return luaL_error(L, "bad request #%d to 'readv' (negative size)", (int)i + 1);
+		// a wrapped total would leave the buffer smaller than what the requests write to it
+		if ((uint64_t)bytes > (uint64_t)((SIZE_T)-1 - total))
+			return luaL_error(L, "bad request #%d to 'readv' (total size too large)", (int)i + 1);
+		requests[i].size = (SIZE_T)bytes;
+		total += requests[i].size;
+		lua_pop(L, 3);
+	}
+
+	char* buff = (char*)lua_newuserdata(L, total);
+	char* cur = buff;
+	for (i = 0; i < count; i++)
+	{
+		requests[i].buffer = cur;
+		cur += requests[i].size;
+	}
+
+	process_readv_memory(process, requests, count);
+
+	if (packed)
+	{
+		// the data of a failed request is never read from the packed string, but it mustn't leak what was in memory before
+		for (i = 0; i < count; i++)
+		{
+			if (requests[i].bytesRead < requests[i].size)
+				memset((char*)requests[i].buffer + requests[i].bytesRead, 0, requests[i].size - requests[i].bytesRead);
+		}
+		lua_pushlstring(L, buff, total);
+	}
+
+	lua_createtable(L, (int)count, 0);
+	SIZE_T offset = 0;
+	for (i = 0; i < count; i++)
+	{
+		if (requests[i].bytesRead != requests[i].size)
+			lua_pushboolean(L, FALSE);
+		else if (packed)
+			lua_pushinteger(L, offset);
+		else
+			lua_pushlstring(L, (const char*)requests[i].buffer, requests[i].size);
+		lua_rawseti(L, -2, (int)i + 1);
+		offset += requests[i].size;
+	}
+	return packed ? 2 : 1;
 }
 
 static int process_version(lua_State *L)
 {
+#ifdef _WIN32
 	process_t* process = check_process(L, 1);
 
 	const char* exe = process->path;
@@ -117,49 +483,34 @@ static int process_version(lua_State *L)
 	free(pVersionResource);
 
 	return 1;
+#else
+	check_process(L, 1);
+	return push_error(L, "not supported on this platform");
+#endif
 }
 
 static int process_modules_iterator(lua_State *L)
 {
-	process_t* process = check_process(L, 1);
-	HANDLE handle = *(HANDLE*)lua_touserdata(L, lua_upvalueindex(1));
-	static MODULEENTRY32 me32;
-	me32.dwSize = sizeof(MODULEENTRY32);
-
-	BOOL success;
-	if (lua_isnil(L, 2)) // control variable is nil on first iteration
-		success = Module32First(handle, &me32);
-	else
-		success = Module32Next(handle, &me32);
+	check_process(L, 1);
+	iterator_t* it = (iterator_t*)lua_touserdata(L, lua_upvalueindex(1));
 
-	if (!success)
+	module_t module;
+	if (!platform_modules_next(it, &module))
 		return 0;
 
-	module_t* module = push_module(L);
-	init_module(module, &me32);
+	*push_module(L) = module;
 	return 1;
 }
 
 static int process_modules(lua_State *L)
 {
 	process_t* process = check_process(L, 1);
-	HANDLE* handlePtr = (HANDLE*)lua_newuserdata(L, sizeof(HANDLE*));
-	luaL_getmetatable(L, SNAPSHOT_T);
-	lua_setmetatable(L, -2);
-
-	// From the WinAPI docs:
-	// "If the function fails with ERROR_BAD_LENGTH when called with TH32CS_SNAPMODULE or TH32CS_SNAPMODULE32, 
-	// call the function again until it succeeds."
-	do
-	{
-		*handlePtr = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE | TH32CS_SNAPMODULE32, process->pid);
-	}
-	while (*handlePtr == INVALID_HANDLE_VALUE && GetLastError() == ERROR_BAD_LENGTH);
+	iterator_t* it = push_iterator(L);
 
-	if (*handlePtr == INVALID_HANDLE_VALUE)
+	if (!platform_modules_open(it, process))
 		return push_last_error(L);
 
-	// process_modules_iterator's upvalue is the HANDLE* userdata
+	// process_modules_iterator's upvalue is the iterator_t userdata
 	lua_pushcclosure(L, process_modules_iterator, 1);
 	// push process_t to make it the invariant state
 	lua_pushvalue(L, 1);
@@ -169,11 +520,12 @@ static int process_modules(lua_State *L)
 static int process_exit_code(lua_State *L)
 {
 	process_t* process = check_process(L, 1);
+	BOOL running;
 	DWORD exitCode;
-	if (!GetExitCodeProcess(process->handle, &exitCode))
+	if (!platform_exit_code(process, &running, &exitCode))
 		return push_last_error(L);
 
-	if (exitCode == STILL_ACTIVE)
+	if (running)
 		return 0;
 
 	lua_pushinteger(L, exitCode);
@@ -183,7 +535,13 @@ static int process_exit_code(lua_State *L)
 static int process_gc(lua_State *L)
 {
 	process_t* process = check_process(L, 1);
-	CloseHandle(process->handle);
+	platform_close_process(process);
+	page_cache_free(process->cache);
+	process->cache = NULL;
+	module_map_free(process->modules);
+	process->modules = NULL;
+	process_stats_free(process->stats);
+	process->stats = NULL;
 	return 0;
 }
 
@@ -195,7 +553,52 @@ static const luaL_Reg process_methods[] = {
 	{ "version", process_version },
 	{ "read", process_read },
 	{ "readrelative", process_read_relative },
+	{ "readv", process_readv },
+	{ "readasync", process_read_async },
+	{ "readinto", process_read_into },
+	{ "readchain", process_read_chain },
+	{ "readstruct", process_read_struct },
+	{ "readstructs", process_read_structs },
+	{ "readu8", process_read_u8 },
+	{ "readi8", process_read_i8 },
+	{ "readu16", process_read_u16 },
+	{ "readi16", process_read_i16 },
+	{ "readu32", process_read_u32 },
+	{ "readi32", process_read_i32 },
+	{ "readu64", process_read_u64 },
+	{ "readi64", process_read_i64 },
+	{ "readf32", process_read_f32 },
+	{ "readf64", process_read_f64 },
+	{ "readptr", process_read_ptr },
+	{ "readrelativeu8", process_read_relative_u8 },
+	{ "readrelativei8", process_read_relative_i8 },
+	{ "readrelativeu16", process_read_relative_u16 },
+	{ "readrelativei16", process_read_relative_i16 },
+	{ "readrelativeu32", process_read_relative_u32 },
+	{ "readrelativei32", process_read_relative_i32 },
+	{ "readrelativeu64", process_read_relative_u64 },
+	{ "readrelativei64", process_read_relative_i64 },
+	{ "readrelativef32", process_read_relative_f32 },
+	{ "readrelativef64", process_read_relative_f64 },
+	{ "readrelativeptr", process_read_relative_ptr },
 	{ "modules", process_modules },
+	{ "module", process_module },
+	{ "moduleat", process_module_at },
+	{ "stats", process_stats },
+	{ "resetstats", process_reset_stats },
+	{ "readbackend", process_read_backend },
+	{ "regions", process_regions },
+	{ "findpattern", process_find_pattern },
+	{ "scanasync", process_scan_async },
+	{ "strings", process_strings },
+	{ "eachstring", process_each_string },
+	{ "snapshot", process_snapshot },
+	{ "dump", process_dump },
+	{ "cache", process_cache },
+	{ "invalidate", process_invalidate },
+	{ "cachestats", process_cache_stats },
+	{ "watch", process_watch },
+	{ "pointermap", process_pointermap },
 	{ "exitcode", process_exit_code },
 	{ NULL, NULL }
 };
@@ -204,6 +607,7 @@ static udata_field_info process_getters[] = {
 	{ "name", udata_field_get_string, offsetof(process_t, name) },
 	{ "path", udata_field_get_string, offsetof(process_t, path) },
 	{ "base", udata_field_get_memaddress, offsetof(process_t, module) },
+	{ "pointersize", udata_field_get_size, offsetof(process_t, pointerSize) },
 	{ NULL, NULL }
 };
 static udata_field_info process_setters[] = {
@@ -5,17 +5,55 @@
 
 #define PROCESS_T MEMREADER_METATABLE(process)
 
+typedef struct page_cache_t page_cache_t;
+typedef struct module_map_t module_map_t;
+typedef struct process_stats_t process_stats_t;
+typedef struct offline_image_t offline_image_t;
+typedef struct shared_maps_t shared_maps_t;
+
+// The interfaces memory can be read with (see process:readbackend); Windows only has READ_BACKEND_VM
+typedef enum {
+	READ_BACKEND_AUTO = -1, // pick one for each read
+	READ_BACKEND_VM, // process_vm_readv, or ReadProcessMemory
+	READ_BACKEND_PREAD, // pread on /proc/<pid>/mem
+	READ_BACKEND_MMAP, // copying out of our own mapping of the file behind a shared mapping (or of an offline process' file)
+	READ_BACKENDS
+} read_backend;
+
+// "auto", "vm", "pread" or "mmap"
+const char* read_backend_name(read_backend backend);
+
 typedef struct {
 	DWORD pid;
+#ifdef _WIN32
 	HANDLE handle;
+#else
+	int handle; // directory fd of /proc/<pid>
+#endif
 	HMODULE module;
+	SIZE_T pointerSize; // of the target, which can differ from ours (e.g. WOW64)
 	TCHAR name[MAX_PATH];
 	TCHAR path[MAX_PATH];
+	page_cache_t* cache; // NULL unless enabled with process:cache()
+	module_map_t* modules; // built by the first module lookup
+	process_stats_t* stats; // NULL if there are no per-process statistics
+	offline_image_t* offline; // the file of a process opened with memreader.opencore/opensnapshot, NULL for a live one
+	// these two are read by worker threads while Lua can change them, so they're only accessed atomically
+	SIZE_T readBackend; // a read_backend, READ_BACKEND_AUTO unless overridden (see process_load_backend)
+	SIZE_T preadThreshold; // READ_BACKEND_AUTO reads at least this many bytes with pread (see platform_tune_reads)
+#ifndef _WIN32
+	int memfd; // /proc/<pid>/mem, or -1 if it couldn't be opened
+	shared_maps_t* shared;
+#endif
 } process_t;
 
+read_backend process_load_backend(process_t* process);
+void process_store_backend(process_t* process, read_backend backend);
+
 process_t* check_process(lua_State *L, int index);
 process_t* push_process(lua_State *L);
-void init_process(process_t* process, DWORD pid, HANDLE handle);
+// Opens the process with the given pid into process (which is cleared first)
+BOOL process_open(process_t* process, DWORD pid);
 
 int register_process(lua_State *L);
 
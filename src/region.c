@@ -0,0 +1,336 @@
+#include "region.h"
+#include "process.h"
+#include "address.h"
+#include "threadpool.h"
+#include "offline.h"
+
+static int get_filter_field(lua_State *L, int index, const char* name)
+{
+	int value;
+	lua_getfield(L, index, name);
+	value = lua_isnil(L, -1) ? -1 : lua_toboolean(L, -1);
+	lua_pop(L, 1);
+	return value;
+}
+
+void check_region_filter(lua_State *L, int index, region_filter_t* filter)
+{
+	filter->readable = -1;
+	filter->writable = -1;
+	filter->executable = -1;
+	filter->private = -1;
+
+	if (lua_isnoneornil(L, index))
+		return;
+
+	luaL_checktype(L, index, LUA_TTABLE);
+	filter->readable = get_filter_field(L, index, "readable");
+	filter->writable = get_filter_field(L, index, "writable");
+	filter->executable = get_filter_field(L, index, "executable");
+	filter->private = get_filter_field(L, index, "private");
+}
+
+static BOOL filter_flag_matches(int wanted, BOOL value)
+{
+	return wanted < 0 || (wanted != 0) == (value != 0);
+}
+
+BOOL region_matches(const region_filter_t* filter, const region_t* region)
+{
+	return filter_flag_matches(filter->readable, region->protect & REGION_READ)
+		&& filter_flag_matches(filter->writable, region->protect & REGION_WRITE)
+		&& filter_flag_matches(filter->executable, region->protect & REGION_EXECUTE)
+		&& filter_flag_matches(filter->private, region->type == REGION_PRIVATE);
+}
+
+void region_list_init(region_list_t* list)
+{
+	list->regions = NULL;
+	list->count = 0;
+	list->capacity = 0;
+}
+
+void region_list_free(region_list_t* list)
+{
+	free(list->regions);
+	region_list_init(list);
+}
+
+BOOL region_list_push(region_list_t* list, const region_t* region)
+{
+	if (list->count == list->capacity)
+	{
+		SIZE_T capacity = list->capacity ? list->capacity * 2 : 64;
+		region_t* regions = (region_t*)realloc(list->regions, capacity * sizeof(region_t));
+		if (!regions)
+			return FALSE;
+		list->regions = regions;
+		list->capacity = capacity;
+	}
+	list->regions[list->count++] = *region;
+	return TRUE;
+}
+
+BOOL region_list_collect(process_t* process, const region_filter_t* filter, region_list_t* list)
+{
+	iterator_t it;
+	region_t region;
+	BOOL success = TRUE;
+
+	platform_iterator_init(&it);
+	if (!platform_regions_open(&it, process))
+		return FALSE;
+
+	while (success && platform_regions_next(&it, process, &region, NULL, 0))
+	{
+		if (region_matches(filter, &region))
+			success = region_list_push(list, &region);
+	}
+	platform_iterator_close(&it);
+	return success;
+}
+
+void region_list_clip(region_list_t* list, const char* start, const char* end)
+{
+	SIZE_T i, kept = 0;
+	for (i = 0; i < list->count; i++)
+	{
+		region_t region = list->regions[i];
+		const char* regionStart = (const char*)region.base;
+		const char* regionEnd = regionStart + region.size;
+		if (regionStart < start) regionStart = start;
+		if (regionEnd > end) regionEnd = end;
+		if (regionStart >= regionEnd)
+			continue;
+
+		region.base = (LPVOID)regionStart;
+		region.size = (SIZE_T)(regionEnd - regionStart);
+		list->regions[kept++] = region;
+	}
+	list->count = kept;
+}
+
+void region_list_coalesce(region_list_t* list)
+{
+	SIZE_T i, kept = 0;
+	for (i = 0; i < list->count; i++)
+	{
+		region_t* last = kept ? &list->regions[kept - 1] : NULL;
+		if (last && (const char*)last->base + last->size == (const char*)list->regions[i].base)
+			last->size += list->regions[i].size;
+		else
+			list->regions[kept++] = list->regions[i];
+	}
+	list->count = kept;
+}
+
+BOOL region_list_read_chunks(process_t* process, const region_list_t* list, SIZE_T chunkSize, SIZE_T overlap, chunk_fn fn, void* ctx)
+{
+	unsigned char* buffer = (unsigned char*)malloc(chunkSize + overlap);
+	SIZE_T i;
+
+	if (!buffer)
+		return FALSE;
+
+	for (i = 0; i < list->count; i++)
+	{
+		const region_t* region = &list->regions[i];
+		SIZE_T offset;
+		for (offset = 0; offset < region->size; offset += chunkSize)
+		{
+			SIZE_T remaining = region->size - offset;
+			SIZE_T size = remaining < chunkSize ? remaining : chunkSize;
+			SIZE_T available = remaining < chunkSize + overlap ? remaining : chunkSize + overlap;
+			const char* address = (const char*)region->base + offset;
+			SIZE_T numBytesRead;
+
+			// the memory of an offline process can be used where it is, without copying it
+			const unsigned char* data = offline_view(process, address, available);
+			// the region may have changed since it was listed, so use whatever could be read
+			if (!data && !platform_read(process, address, buffer, available, &numBytesRead))
+			{
+				if (numBytesRead == 0)
+					continue;
+				available = numBytesRead;
+				if (size > available)
+					size = available;
+			}
+
+			chunk_t chunk = { address, data ? data : buffer, size, available };
+			if (!fn(ctx, &chunk))
+			{
+				free(buffer);
+				return FALSE;
+			}
+		}
+	}
+
+	free(buffer);
+	return TRUE;
+}
+
+typedef struct {
+	const char* address;
+	SIZE_T size;
+	SIZE_T available;
+} chunk_range;
+
+typedef struct {
+	process_t* process;
+	chunk_range* ranges;
+	SIZE_T bufferSize;
+	unsigned char* buffers[POOL_MAX_WORKERS];
+	parallel_chunk_fn fn;
+	void* ctx;
+	volatile BOOL stopped;
+} parallel_read;
+
+static void read_chunk_task(void* ctx, int worker, SIZE_T task)
+{
+	parallel_read* read = (parallel_read*)ctx;
+	const chunk_range* range = &read->ranges[task];
+	SIZE_T size = range->size, available = range->available;
+	SIZE_T numBytesRead;
+
+	if (read->stopped)
+		return;
+
+	const unsigned char* data = offline_view(read->process, range->address, available);
+	if (data)
+	{
+		chunk_t chunk = { range->address, data, size, available };
+		if (!read->fn(read->ctx, worker, task, &chunk))
+			read->stopped = TRUE;
+		return;
+	}
+
+	// each worker only ever touches its own buffer
+	if (!read->buffers[worker])
+	{
+		read->buffers[worker] = (unsigned char*)malloc(read->bufferSize);
+		if (!read->buffers[worker])
+		{
+			read->stopped = TRUE;
+			return;
+		}
+	}
+
+	if (!platform_read(read->process, range->address, read->buffers[worker], available, &numBytesRead))
+	{
+		if (numBytesRead == 0)
+			return;
+		available = numBytesRead;
+		if (size > available)
+			size = available;
+	}
+
+	chunk_t chunk = { range->address, read->buffers[worker], size, available };
+	if (!read->fn(read->ctx, worker, task, &chunk))
+		read->stopped = TRUE;
+}
+
+BOOL region_list_read_chunks_parallel(process_t* process, const region_list_t* list, SIZE_T chunkSize, SIZE_T overlap, int workers, parallel_chunk_fn fn, void* ctx)
+{
+	parallel_read read;
+	SIZE_T i, count = 0;
+
+	for (i = 0; i < list->count; i++)
+		count += (list->regions[i].size + chunkSize - 1) / chunkSize;
+
+	memset(&read, 0, sizeof(read));
+	read.process = process;
+	read.bufferSize = chunkSize + overlap;
+	read.fn = fn;
+	read.ctx = ctx;
+	read.ranges = (chunk_range*)malloc((count ? count : 1) * sizeof(chunk_range));
+	if (!read.ranges)
+		return FALSE;
+
+	count = 0;
+	for (i = 0; i < list->count; i++)
+	{
+		const region_t* region = &list->regions[i];
+		SIZE_T offset;
+		for (offset = 0; offset < region->size; offset += chunkSize)
+		{
+			SIZE_T remaining = region->size - offset;
+			chunk_range* range = &read.ranges[count++];
+			range->address = (const char*)region->base + offset;
+			range->size = remaining < chunkSize ? remaining : chunkSize;
+			range->available = remaining < chunkSize + overlap ? remaining : chunkSize + overlap;
+		}
+	}
+
+	pool_run(workers, count, read_chunk_task, &read);
+
+	for (i = 0; i < POOL_MAX_WORKERS; i++)
+		free(read.buffers[i]);
+	free(read.ranges);
+	return !read.stopped;
+}
+
+static const char* region_type_names[] = { "private", "mapped", "image" };
+
+// The ITERATOR_T __gc only knows about the iterator_t, so it has to come first
+typedef struct {
+	iterator_t it;
+	region_filter_t filter;
+} region_iterator_t;
+
+static int process_regions_iterator(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	region_iterator_t* ri = (region_iterator_t*)lua_touserdata(L, lua_upvalueindex(1));
+	region_t region;
+	TCHAR path[MAX_PATH];
+
+	do
+	{
+		if (!platform_regions_next(&ri->it, process, &region, path, sizeof(path) / sizeof(TCHAR)))
+			return 0;
+	}
+	while (!region_matches(&ri->filter, &region));
+
+	char protect[4] = "---";
+	if (region.protect & REGION_READ) protect[0] = 'r';
+	if (region.protect & REGION_WRITE) protect[1] = 'w';
+	if (region.protect & REGION_EXECUTE) protect[2] = 'x';
+
+	push_address(L, region.base);
+	lua_pushinteger(L, (lua_Integer)region.size);
+	lua_pushstring(L, protect);
+	lua_pushstring(L, region_type_names[region.type]);
+	if (path[0])
+		lua_pushstring(L, path);
+	else
+		lua_pushnil(L);
+	return 5;
+}
+
+/**
+process:regions([filter])
+
+Returns an iterator over the committed memory regions of the process,
+yielding base, size, protection ("rwx"), type and backing file (or nil).
+*/
+int process_regions(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	region_filter_t filter;
+	check_region_filter(L, 2, &filter);
+
+	region_iterator_t* ri = (region_iterator_t*)lua_newuserdata(L, sizeof(region_iterator_t));
+	platform_iterator_init(&ri->it);
+	ri->filter = filter;
+	luaL_getmetatable(L, ITERATOR_T);
+	lua_setmetatable(L, -2);
+
+	if (!platform_regions_open(&ri->it, process))
+		return push_last_error(L);
+
+	// process_regions_iterator's upvalue is the region_iterator_t userdata
+	lua_pushcclosure(L, process_regions_iterator, 1);
+	// push process_t to make it the invariant state
+	lua_pushvalue(L, 1);
+	return 2;
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef MEMREADER_REGION_H
+#define MEMREADER_REGION_H
+
+#include "memreader.h"
+#include "platform.h"
+
+/**
+Which regions an operation should look at. Each of the tri-state fields is
+-1 to allow anything, or 0/1 to require the property to be absent/present.
+*/
+typedef struct {
+	int readable;
+	int writable;
+	int executable;
+	int private;
+} region_filter_t;
+
+// A growable array of regions, for operations that need to know about them up front
+typedef struct {
+	region_t* regions;
+	SIZE_T count;
+	SIZE_T capacity;
+} region_list_t;
+
+// One piece of a region, as read by region_list_read_chunks
+typedef struct {
+	const char* address; // in the target, of data[0]
+	const unsigned char* data;
+	SIZE_T size; // bytes of data that belong to this chunk
+	SIZE_T available; // bytes of data that were read, including any overlap into the next chunk
+} chunk_t;
+
+// Return FALSE to stop reading chunks
+typedef BOOL(*chunk_fn)(void* ctx, const chunk_t* chunk);
+
+// The chunk size used by bulk operations unless they have a reason to pick another
+#define REGION_CHUNK_SIZE (1024 * 1024)
+
+// Parses an optional filter table ({ readable=true, private=true, ... }) at index
+void check_region_filter(lua_State *L, int index, region_filter_t* filter);
+BOOL region_matches(const region_filter_t* filter, const region_t* region);
+
+void region_list_init(region_list_t* list);
+void region_list_free(region_list_t* list);
+BOOL region_list_push(region_list_t* list, const region_t* region);
+// Appends every region of the process that matches filter
+BOOL region_list_collect(process_t* process, const region_filter_t* filter, region_list_t* list);
+// Drops the parts of the regions outside of [start, end)
+void region_list_clip(region_list_t* list, const char* start, const char* end);
+// Merges regions that are directly adjacent, so that reads can span them
+void region_list_coalesce(region_list_t* list);
+
+/**
+Reads the regions in chunks of at most chunkSize bytes, with each chunk
+also containing up to overlap bytes of the next one (so that matches
+spanning two chunks can be found), and calls fn with each chunk.
+Chunks that can't be read are skipped. Returns FALSE if fn stopped early
+or a buffer couldn't be allocated.
+*/
+BOOL region_list_read_chunks(process_t* process, const region_list_t* list, SIZE_T chunkSize, SIZE_T overlap, chunk_fn fn, void* ctx);
+
+// index is the chunk's position in address order, worker the thread calling (see pool_run)
+typedef BOOL(*parallel_chunk_fn)(void* ctx, int worker, SIZE_T index, const chunk_t* chunk);
+
+/**
+Like region_list_read_chunks, but spreads the chunks over up to workers
+threads, so fn must be thread-safe. Chunks start at chunkSize boundaries of
+their region (so they're page-aligned if chunkSize is a multiple of the
+page size), and are numbered in address order so that results can be stored
+per chunk and merged in order. Once fn returns FALSE, chunks that haven't
+been read yet are skipped.
+*/
+BOOL region_list_read_chunks_parallel(process_t* process, const region_list_t* list, SIZE_T chunkSize, SIZE_T overlap, int workers, parallel_chunk_fn fn, void* ctx);
+
+int process_regions(lua_State *L);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,819 @@
+#include "scanner.h"
+#include "address.h"
+#include "platform.h"
+#include "threadpool.h"
+#include "varint.h"
+
+// A region becomes sparse once it has fewer than one candidate per this many slots
+#define SCAN_SPARSE_RATIO 64
+// Limits on how much a sparse pass reads per batch
+#define SCAN_BATCH_REQUESTS 1024
+#define SCAN_BATCH_BYTES (1024 * 1024)
+
+static const char* const scan_op_names[] = {
+	"eq", "ne", "gt", "lt", "range", "any",
+	"changed", "unchanged", "increased", "decreased", "delta",
+	NULL
+};
+
+scanner_t* check_scanner(lua_State *L, int index)
+{
+	scanner_t* scanner = (scanner_t*)luaL_checkudata(L, index, SCANNER_T);
+	return scanner;
+}
+
+// Comparing values
+
+typedef enum {
+	CLASS_SIGNED,
+	CLASS_UNSIGNED,
+	CLASS_FLOAT
+} value_class;
+
+static value_class class_of(value_type type)
+{
+	switch (type)
+	{
+	case VALUE_I8: case VALUE_I16: case VALUE_I32: case VALUE_I64: return CLASS_SIGNED;
+	case VALUE_F32: case VALUE_F64: return CLASS_FLOAT;
+	default: return CLASS_UNSIGNED;
+	}
+}
+
+static scalar_t load_scalar(value_type type, const unsigned char* data)
+{
+	scalar_t v;
+	switch (type)
+	{
+	case VALUE_U8: v.u = *data; break;
+	case VALUE_I8: v.i = (int8_t)*data; break;
+	case VALUE_U16: { uint16_t x; memcpy(&x, data, 2); v.u = x; break; }
+	case VALUE_I16: { int16_t x; memcpy(&x, data, 2); v.i = x; break; }
+	case VALUE_U32: { uint32_t x; memcpy(&x, data, 4); v.u = x; break; }
+	case VALUE_I32: { int32_t x; memcpy(&x, data, 4); v.i = x; break; }
+	case VALUE_I64: memcpy(&v.i, data, 8); break;
+	case VALUE_F32: { float x; memcpy(&x, data, 4); v.f = x; break; }
+	case VALUE_F64: memcpy(&v.f, data, 8); break;
+	case VALUE_PTR: { uintptr_t x; memcpy(&x, data, sizeof(x)); v.u = x; break; }
+	default: memcpy(&v.u, data, 8); break;
+	}
+	return v;
+}
+
+static int scalar_compare(value_class cls, scalar_t x, scalar_t y)
+{
+	switch (cls)
+	{
+	case CLASS_SIGNED: return x.i < y.i ? -1 : x.i > y.i;
+	case CLASS_UNSIGNED: return x.u < y.u ? -1 : x.u > y.u;
+	default: return x.f < y.f ? -1 : x.f > y.f;
+	}
+}
+
+static BOOL scan_matches(const scan_test_t* test, value_class cls, scalar_t cur, const scalar_t* prev)
+{
+	switch (test->op)
+	{
+	case SCAN_EQ: return scalar_compare(cls, cur, test->a) == 0;
+	case SCAN_NE: return scalar_compare(cls, cur, test->a) != 0;
+	case SCAN_GT: return scalar_compare(cls, cur, test->a) > 0;
+	case SCAN_LT: return scalar_compare(cls, cur, test->a) < 0;
+	case SCAN_RANGE: return scalar_compare(cls, cur, test->a) >= 0 && scalar_compare(cls, cur, test->b) <= 0;
+	case SCAN_ANY: return TRUE;
+	case SCAN_CHANGED: return scalar_compare(cls, cur, *prev) != 0;
+	case SCAN_UNCHANGED: return scalar_compare(cls, cur, *prev) == 0;
+	case SCAN_INCREASED: return scalar_compare(cls, cur, *prev) > 0;
+	case SCAN_DECREASED: return scalar_compare(cls, cur, *prev) < 0;
+	case SCAN_DELTA:
+		if (cls == CLASS_FLOAT)
+			return cur.f - prev->f == test->a.f;
+		return cur.u - prev->u == test->a.u; // wraps the same way for signed values
+	}
+	return FALSE;
+}
+
+// Region candidate sets
+
+// The number of SCAN_BLOCK_SIZE blocks a dense region is split into
+static SIZE_T scan_region_blocks(const scan_region_t* region)
+{
+	return (region->size + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+}
+
+static void scan_region_free_blocks(scan_region_t* region)
+{
+	SIZE_T i;
+	if (region->blocks)
+	{
+		for (i = 0; i < scan_region_blocks(region); i++)
+			free(region->blocks[i]);
+	}
+	free(region->blocks);
+	region->blocks = NULL;
+}
+
+// The previous value of a slot of a dense region, kept by the block the slot starts in
+static const unsigned char* dense_value(const scanner_t* scanner, const scan_region_t* region, SIZE_T slot)
+{
+	SIZE_T at = slot * scanner->stride;
+	return region->blocks[at / SCAN_BLOCK_SIZE] + at % SCAN_BLOCK_SIZE;
+}
+
+static void scan_region_free(scan_region_t* region)
+{
+	scan_region_free_blocks(region);
+	free(region->bitmap);
+	free(region->values);
+	free(region->deltas);
+	region->bitmap = NULL;
+	region->values = NULL;
+	region->deltas = NULL;
+	region->deltasSize = 0;
+	region->count = 0;
+}
+
+static void scanner_free_regions(scanner_t* scanner)
+{
+	SIZE_T i;
+	for (i = 0; i < scanner->regionCount; i++)
+		scan_region_free(&scanner->regions[i]);
+	free(scanner->regions);
+	scanner->regions = NULL;
+	scanner->regionCount = 0;
+	scanner->count = 0;
+}
+
+#define BITMAP_GET(bitmap, i) (((bitmap)[(i) >> 6] >> ((i) & 63)) & 1)
+#define BITMAP_SET(bitmap, i) ((bitmap)[(i) >> 6] |= (uint64_t)1 << ((i) & 63))
+#define BITMAP_CLEAR(bitmap, i) ((bitmap)[(i) >> 6] &= ~((uint64_t)1 << ((i) & 63)))
+
+static BOOL bitmap_any(const uint64_t* bitmap, SIZE_T first, SIZE_T end)
+{
+	SIZE_T i = first;
+	while (i < end && (i & 63))
+	{
+		if (BITMAP_GET(bitmap, i))
+			return TRUE;
+		i++;
+	}
+	for (; i + 64 <= end; i += 64)
+	{
+		if (bitmap[i >> 6])
+			return TRUE;
+	}
+	for (; i < end; i++)
+	{
+		if (BITMAP_GET(bitmap, i))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+// Converts a dense region to a sparse one
+static BOOL scan_region_make_sparse(scanner_t* scanner, scan_region_t* region)
+{
+	byte_vector deltas = { NULL, 0, 0 };
+	unsigned char* values = (unsigned char*)malloc(region->count * scanner->valueSize + 1);
+	SIZE_T slot, last = 0, n = 0;
+
+	if (!values)
+		return FALSE;
+
+	for (slot = 0; slot < region->slots; slot++)
+	{
+		if (!region->bitmap[slot >> 6])
+		{
+			slot |= 63;
+			continue;
+		}
+		if (!BITMAP_GET(region->bitmap, slot))
+			continue;
+		if (!append_varint(&deltas, slot - last))
+		{
+			free(values);
+			free(deltas.data);
+			return FALSE;
+		}
+		memcpy(values + n * scanner->valueSize, dense_value(scanner, region, slot), scanner->valueSize);
+		last = slot;
+		n++;
+	}
+
+	scan_region_free_blocks(region);
+	free(region->bitmap);
+	region->bitmap = NULL;
+	region->values = values;
+	region->deltas = deltas.data;
+	region->deltasSize = deltas.size;
+	region->sparse = TRUE;
+	return TRUE;
+}
+
+/**
+One unit of work of a scan: a block of a dense region, or a whole sparse
+region. Blocks of the same region are scanned concurrently, which is safe
+because a block only ever writes the bits and previous values of its own
+slots: blocks start at multiples of 64 slots, so they never share a bitmap
+word, and each block keeps its previous values in its own allocation.
+*/
+typedef struct {
+	scan_region_t* region;
+	SIZE_T offset;
+	SIZE_T found;
+} scan_task;
+
+typedef struct sparse_batch sparse_batch;
+
+typedef struct {
+	scanner_t* scanner;
+	const scan_test_t* test;
+	BOOL first;
+	scan_task* tasks;
+	unsigned char* buffers[POOL_MAX_WORKERS];
+	sparse_batch* batches[POOL_MAX_WORKERS];
+	volatile BOOL failed;
+} scan_job;
+
+static void scan_block(scan_job* job, int worker, scan_task* task)
+{
+	scanner_t* scanner = job->scanner;
+	scan_region_t* region = task->region;
+	value_class cls = class_of(scanner->type);
+	SIZE_T stride = scanner->stride, valueSize = scanner->valueSize;
+	SIZE_T offset = task->offset;
+	BOOL first = job->first;
+
+	if (!job->buffers[worker])
+	{
+		job->buffers[worker] = (unsigned char*)malloc(SCAN_BLOCK_SIZE + VALUE_MAX_SIZE);
+		if (!job->buffers[worker])
+		{
+			job->failed = TRUE;
+			return;
+		}
+	}
+	unsigned char* buffer = job->buffers[worker];
+
+	SIZE_T firstSlot = (offset + stride - 1) / stride;
+	SIZE_T endSlot = (offset + SCAN_BLOCK_SIZE + stride - 1) / stride;
+	if (endSlot > region->slots)
+		endSlot = region->slots;
+	// a block's values include the bytes of the values straddling into the next block
+	SIZE_T storedSize = region->size - offset < SCAN_BLOCK_SIZE + valueSize - 1 ? region->size - offset : SCAN_BLOCK_SIZE + valueSize - 1;
+	SIZE_T available = storedSize;
+	SIZE_T numBytesRead;
+	unsigned char** stored = &region->blocks[offset / SCAN_BLOCK_SIZE];
+
+	// the region may have changed since it was listed, so use whatever could be read
+	if (!platform_read(scanner->process, region->base + offset, buffer, available, &numBytesRead))
+		available = numBytesRead;
+
+	SIZE_T slot, found = 0;
+	for (slot = firstSlot; slot < endSlot; slot++)
+	{
+		if (!first && !BITMAP_GET(region->bitmap, slot))
+			continue;
+
+		SIZE_T at = slot * stride - offset;
+		BOOL match = FALSE;
+		if (at + valueSize <= available)
+		{
+			scalar_t cur = load_scalar(scanner->type, buffer + at);
+			scalar_t prev;
+			if (!first)
+				prev = load_scalar(scanner->type, *stored + at);
+			match = scan_matches(job->test, cls, cur, &prev);
+		}
+
+		if (match)
+		{
+			BITMAP_SET(region->bitmap, slot);
+			found++;
+		}
+		else if (!first)
+			BITMAP_CLEAR(region->bitmap, slot);
+	}
+	task->found = found;
+
+	// the values are only kept for as long as the block has candidates
+	if (!found)
+	{
+		free(*stored);
+		*stored = NULL;
+		return;
+	}
+	if (!*stored)
+	{
+		*stored = (unsigned char*)malloc(storedSize);
+		if (!*stored)
+		{
+			job->failed = TRUE;
+			return;
+		}
+	}
+	memcpy(*stored, buffer, available);
+}
+
+static BOOL block_active(const scan_region_t* region, SIZE_T stride, SIZE_T offset, BOOL first)
+{
+	SIZE_T firstSlot = (offset + stride - 1) / stride;
+	SIZE_T endSlot = (offset + SCAN_BLOCK_SIZE + stride - 1) / stride;
+	if (endSlot > region->slots)
+		endSlot = region->slots;
+	if (firstSlot >= endSlot)
+		return FALSE;
+	return first || bitmap_any(region->bitmap, firstSlot, endSlot);
+}
+
+typedef struct {
+	SIZE_T slot;
+	SIZE_T request;
+	SIZE_T index; // into the region's previous values
+} sparse_candidate;
+
+struct sparse_batch {
+	read_request_t requests[SCAN_BATCH_REQUESTS];
+	sparse_candidate candidates[SCAN_BATCH_BYTES / SCAN_PAGE_SIZE * 4];
+	unsigned char buffer[SCAN_BATCH_BYTES + SCAN_PAGE_SIZE];
+	SIZE_T requestCount;
+	SIZE_T candidateCount;
+	SIZE_T bufferUsed;
+};
+
+// Evaluates the candidates of a batch, appending the survivors to deltas/values
+static BOOL sparse_flush(scanner_t* scanner, scan_region_t* region, const scan_test_t* test, sparse_batch* batch,
+	byte_vector* deltas, byte_vector* values, SIZE_T* lastSlot)
+{
+	value_class cls = class_of(scanner->type);
+	SIZE_T i;
+
+	platform_readv(scanner->process, batch->requests, batch->requestCount);
+
+	for (i = 0; i < batch->candidateCount; i++)
+	{
+		sparse_candidate* c = &batch->candidates[i];
+		read_request_t* req = &batch->requests[c->request];
+		if (req->bytesRead != req->size)
+			continue;
+
+		const unsigned char* data = (const unsigned char*)req->buffer + (region->base + c->slot * scanner->stride - (const char*)req->address);
+		scalar_t cur = load_scalar(scanner->type, data);
+		scalar_t prev = load_scalar(scanner->type, region->values + c->index * scanner->valueSize);
+		if (!scan_matches(test, cls, cur, &prev))
+			continue;
+
+		if (!append_varint(deltas, c->slot - *lastSlot) || !byte_vector_append(values, data, scanner->valueSize))
+			return FALSE;
+		*lastSlot = c->slot;
+		region->count++;
+	}
+
+	batch->requestCount = 0;
+	batch->candidateCount = 0;
+	batch->bufferUsed = 0;
+	return TRUE;
+}
+
+/**
+Re-reads only the pages of a sparse region that hold candidates, batching
+them into as few platform_readv calls as possible.
+*/
+static BOOL scan_sparse(scanner_t* scanner, scan_region_t* region, const scan_test_t* test, sparse_batch* batch)
+{
+	byte_vector deltas = { NULL, 0, 0 };
+	byte_vector values = { NULL, 0, 0 };
+	const unsigned char* cursor = region->deltas;
+	const unsigned char* end = region->deltas + region->deltasSize;
+	SIZE_T slot = 0, index = 0, lastSlot = 0;
+	SIZE_T requestEnd = 0; // region offset that the last request reads up to
+	BOOL success = TRUE;
+
+	batch->requestCount = 0;
+	batch->candidateCount = 0;
+	batch->bufferUsed = 0;
+	region->count = 0;
+
+	while (success && cursor < end)
+	{
+		slot += (SIZE_T)read_varint(&cursor);
+		SIZE_T start = slot * scanner->stride;
+		SIZE_T stop = start + scanner->valueSize;
+
+		if (batch->requestCount == 0 || stop > requestEnd)
+		{
+			SIZE_T pageStart = start - start % SCAN_PAGE_SIZE;
+			SIZE_T pageEnd = (stop + SCAN_PAGE_SIZE - 1) / SCAN_PAGE_SIZE * SCAN_PAGE_SIZE;
+			if (pageEnd > region->size)
+				pageEnd = region->size;
+
+			if (batch->requestCount == SCAN_BATCH_REQUESTS
+				|| batch->bufferUsed + (pageEnd - pageStart) > sizeof(batch->buffer)
+				|| batch->candidateCount == sizeof(batch->candidates) / sizeof(batch->candidates[0]))
+			{
+				success = sparse_flush(scanner, region, test, batch, &deltas, &values, &lastSlot);
+			}
+
+			read_request_t* req = &batch->requests[batch->requestCount++];
+			req->address = region->base + pageStart;
+			req->buffer = batch->buffer + batch->bufferUsed;
+			req->size = pageEnd - pageStart;
+			batch->bufferUsed += req->size;
+			requestEnd = pageEnd;
+		}
+		else if (batch->candidateCount == sizeof(batch->candidates) / sizeof(batch->candidates[0]))
+		{
+			// flushing would drop the request this candidate belongs to, so re-issue it
+			read_request_t current = batch->requests[batch->requestCount - 1];
+			success = sparse_flush(scanner, region, test, batch, &deltas, &values, &lastSlot);
+			current.buffer = batch->buffer;
+			batch->requests[batch->requestCount++] = current;
+			batch->bufferUsed = current.size;
+		}
+
+		sparse_candidate* c = &batch->candidates[batch->candidateCount++];
+		c->slot = slot;
+		c->request = batch->requestCount - 1;
+		c->index = index++;
+	}
+
+	if (success && batch->candidateCount)
+		success = sparse_flush(scanner, region, test, batch, &deltas, &values, &lastSlot);
+
+	free(region->deltas);
+	free(region->values);
+	region->deltas = deltas.data;
+	region->deltasSize = deltas.size;
+	region->values = values.data;
+	return success;
+}
+
+static void scan_task_run(void* ctx, int worker, SIZE_T index)
+{
+	scan_job* job = (scan_job*)ctx;
+	scan_task* task = &job->tasks[index];
+
+	if (job->failed)
+		return;
+
+	if (!task->region->sparse)
+	{
+		scan_block(job, worker, task);
+		return;
+	}
+
+	if (!job->batches[worker])
+		job->batches[worker] = (sparse_batch*)malloc(sizeof(sparse_batch));
+	if (!job->batches[worker] || !scan_sparse(job->scanner, task->region, job->test, job->batches[worker]))
+		job->failed = TRUE;
+}
+
+// Lists the tasks of a scan, or counts them if tasks is NULL
+static SIZE_T scanner_list_tasks(scanner_t* scanner, BOOL first, scan_task* tasks)
+{
+	SIZE_T i, count = 0;
+	for (i = 0; i < scanner->regionCount; i++)
+	{
+		scan_region_t* region = &scanner->regions[i];
+		if (region->sparse)
+		{
+			if (tasks)
+			{
+				memset(&tasks[count], 0, sizeof(scan_task));
+				tasks[count].region = region;
+			}
+			count++;
+			continue;
+		}
+
+		SIZE_T offset;
+		for (offset = 0; offset < region->size; offset += SCAN_BLOCK_SIZE)
+		{
+			if (!block_active(region, scanner->stride, offset, first))
+				continue;
+			if (tasks)
+			{
+				memset(&tasks[count], 0, sizeof(scan_task));
+				tasks[count].region = region;
+				tasks[count].offset = offset;
+			}
+			count++;
+		}
+	}
+	return count;
+}
+
+// Runs a scan over every region, dropping the ones left without candidates
+static BOOL scanner_run(scanner_t* scanner, const scan_test_t* test, BOOL first)
+{
+	scan_job job;
+	SIZE_T i, kept = 0;
+
+	memset(&job, 0, sizeof(job));
+	job.scanner = scanner;
+	job.test = test;
+	job.first = first;
+
+	SIZE_T count = scanner_list_tasks(scanner, first, NULL);
+	job.tasks = (scan_task*)malloc((count ? count : 1) * sizeof(scan_task));
+	if (!job.tasks)
+		return FALSE;
+	scanner_list_tasks(scanner, first, job.tasks);
+
+	for (i = 0; i < scanner->regionCount; i++)
+	{
+		if (!scanner->regions[i].sparse)
+			scanner->regions[i].count = 0;
+	}
+
+	pool_run(scanner->workers, count, scan_task_run, &job);
+
+	for (i = 0; i < count; i++)
+	{
+		if (!job.tasks[i].region->sparse)
+			job.tasks[i].region->count += job.tasks[i].found;
+	}
+
+	BOOL success = !job.failed;
+	scanner->count = 0;
+	for (i = 0; i < scanner->regionCount; i++)
+	{
+		scan_region_t* region = &scanner->regions[i];
+		if (success && !region->sparse && region->count && region->count < region->slots / SCAN_SPARSE_RATIO)
+			success = scan_region_make_sparse(scanner, region);
+
+		if (success && region->count)
+		{
+			scanner->count += region->count;
+			scanner->regions[kept++] = *region;
+		}
+		else
+			scan_region_free(region);
+	}
+	scanner->regionCount = kept;
+
+	for (i = 0; i < POOL_MAX_WORKERS; i++)
+	{
+		free(job.buffers[i]);
+		free(job.batches[i]);
+	}
+	free(job.tasks);
+	return success;
+}
+
+// Lists the regions to scan; *outOfMemory tells a failed allocation from a failed listing
+static BOOL scanner_init_regions(scanner_t* scanner, BOOL* outOfMemory)
+{
+	region_list_t list;
+	*outOfMemory = FALSE;
+	region_list_init(&list);
+	if (!region_list_collect(scanner->process, &scanner->filter, &list))
+	{
+		region_list_free(&list);
+		return FALSE;
+	}
+	region_list_coalesce(&list);
+
+	*outOfMemory = TRUE;
+	scanner->regions = (scan_region_t*)calloc(list.count ? list.count : 1, sizeof(scan_region_t));
+	if (!scanner->regions)
+	{
+		region_list_free(&list);
+		return FALSE;
+	}
+
+	SIZE_T i;
+	for (i = 0; i < list.count; i++)
+	{
+		scan_region_t* region = &scanner->regions[scanner->regionCount];
+		region->base = (char*)list.regions[i].base;
+		region->size = list.regions[i].size;
+		if (region->size < scanner->valueSize)
+			continue;
+		region->slots = (region->size - scanner->valueSize) / scanner->stride + 1;
+		region->bitmap = (uint64_t*)calloc((region->slots + 63) / 64, sizeof(uint64_t));
+		// the values of a block are only allocated once it has candidates
+		region->blocks = (unsigned char**)calloc(scan_region_blocks(region), sizeof(unsigned char*));
+		scanner->regionCount++;
+		if (!region->bitmap || !region->blocks)
+		{
+			region_list_free(&list);
+			return FALSE;
+		}
+	}
+	region_list_free(&list);
+	*outOfMemory = FALSE;
+	return TRUE;
+}
+
+// Lua
+
+static void check_scan_test(lua_State *L, scanner_t* scanner, int index, scan_test_t* test)
+{
+	test->op = (scan_op)luaL_checkoption(L, index, NULL, scan_op_names);
+	test->a.u = test->b.u = 0;
+
+	int args = test->op == SCAN_RANGE ? 2 : (test->op <= SCAN_LT || test->op == SCAN_DELTA) ? 1 : 0;
+	int i;
+	for (i = 0; i < args; i++)
+	{
+		scalar_t* v = i == 0 ? &test->a : &test->b;
+		switch (class_of(scanner->type))
+		{
+		case CLASS_FLOAT: v->f = (double)luaL_checknumber(L, index + 1 + i); break;
+		case CLASS_SIGNED: v->i = (int64_t)luaL_checknumber(L, index + 1 + i); break;
+		default: v->u = lua_type(L, index + 1 + i) == LUA_TUSERDATA
+			? (uint64_t)(uintptr_t)memaddress_checkptr(L, index + 1 + i)
+			: (uint64_t)(int64_t)luaL_checknumber(L, index + 1 + i);
+			break;
+		}
+#if LUA_VERSION_NUM >= 503
+		// integers beyond 2^53 would lose precision as a lua_Number
+		if (class_of(scanner->type) != CLASS_FLOAT && lua_isinteger(L, index + 1 + i))
+			v->i = (int64_t)lua_tointeger(L, index + 1 + i);
+#endif
+	}
+}
+
+/**
+memreader.scanner(process, type[, options])
+
+options can contain the region filter fields (see process:regions),
+aligned (default true), which only checks addresses that are a multiple of
+the type's size, and workers, the number of threads scans run on. Only
+writable regions are scanned unless writable is set.
+*/
+int memreader_scanner(lua_State *L)
+{
+	process_t* process = (process_t*)luaL_checkudata(L, 1, PROCESS_T);
+	value_type type = check_value_type(L, 2);
+
+	scanner_t* scanner = (scanner_t*)lua_newuserdata(L, sizeof(scanner_t));
+	memset(scanner, 0, sizeof(scanner_t));
+	scanner->processRef = LUA_NOREF;
+	luaL_getmetatable(L, SCANNER_T);
+	lua_setmetatable(L, -2);
+
+	scanner->process = process;
+	scanner->type = type;
+	scanner->valueSize = value_types[type].size;
+	scanner->stride = scanner->valueSize;
+
+	check_region_filter(L, 3, &scanner->filter);
+	scanner->filter.readable = 1;
+	if (scanner->filter.writable < 0)
+		scanner->filter.writable = 1;
+	if (lua_istable(L, 3))
+	{
+		lua_getfield(L, 3, "aligned");
+		if (!lua_isnil(L, -1) && !lua_toboolean(L, -1))
+			scanner->stride = 1;
+		lua_getfield(L, 3, "workers");
+		scanner->workers = pool_check_workers(L, lua_gettop(L));
+		lua_pop(L, 2);
+	}
+	else
+		scanner->workers = pool_default_workers();
+
+	// keep the process alive for as long as the scanner
+	lua_pushvalue(L, 1);
+	scanner->processRef = luaL_ref(L, LUA_REGISTRYINDEX);
+	return 1;
+}
+
+// scanner:first(op[, a[, b]]) starts a new scan and returns the number of candidates
+static int scanner_first(lua_State *L)
+{
+	scanner_t* scanner = check_scanner(L, 1);
+	scan_test_t test;
+	check_scan_test(L, scanner, 2, &test);
+	if (test.op > SCAN_ANY)
+		return luaL_argerror(L, 2, "the first scan has no previous values to compare against");
+
+	scanner_free_regions(scanner);
+	scanner->scanned = FALSE;
+	BOOL outOfMemory;
+	if (!scanner_init_regions(scanner, &outOfMemory))
+	{
+		scanner_free_regions(scanner);
+		return outOfMemory ? push_error(L, "not enough memory") : push_last_error(L);
+	}
+	if (!scanner_run(scanner, &test, TRUE))
+	{
+		scanner_free_regions(scanner);
+		return push_error(L, "not enough memory");
+	}
+	scanner->scanned = TRUE;
+
+	lua_pushinteger(L, (lua_Integer)scanner->count);
+	return 1;
+}
+
+// scanner:next(op[, a[, b]]) narrows down the candidates and returns how many are left
+static int scanner_next(lua_State *L)
+{
+	scanner_t* scanner = check_scanner(L, 1);
+	scan_test_t test;
+	check_scan_test(L, scanner, 2, &test);
+	if (!scanner->scanned)
+		return luaL_error(L, "scanner:next called before scanner:first");
+
+	if (!scanner_run(scanner, &test, FALSE))
+		return push_error(L, "not enough memory");
+
+	lua_pushinteger(L, (lua_Integer)scanner->count);
+	return 1;
+}
+
+/**
+scanner:results([max])
+
+Returns an array of candidate addresses and an array of their values as of
+the last scan.
+*/
+static int scanner_results(lua_State *L)
+{
+	scanner_t* scanner = check_scanner(L, 1);
+	lua_Integer max = luaL_optinteger(L, 2, 0);
+	SIZE_T limit = max > 0 && (SIZE_T)max < scanner->count ? (SIZE_T)max : scanner->count;
+	SIZE_T i, n = 0;
+
+	lua_createtable(L, (int)limit, 0);
+	lua_createtable(L, (int)limit, 0);
+	for (i = 0; i < scanner->regionCount && n < limit; i++)
+	{
+		scan_region_t* region = &scanner->regions[i];
+		const unsigned char* cursor = region->deltas;
+		SIZE_T slot = 0, index = 0;
+
+		while (n < limit)
+		{
+			const unsigned char* value;
+			if (region->sparse)
+			{
+				if (cursor >= region->deltas + region->deltasSize)
+					break;
+				slot += (SIZE_T)read_varint(&cursor);
+				value = region->values + index++ * scanner->valueSize;
+			}
+			else
+			{
+				while (slot < region->slots && !BITMAP_GET(region->bitmap, slot))
+					slot++;
+				if (slot >= region->slots)
+					break;
+				value = dense_value(scanner, region, slot);
+			}
+
+			n++;
+			push_address(L, region->base + slot * scanner->stride);
+			lua_rawseti(L, -3, (int)n);
+			push_value(L, scanner->type, value);
+			lua_rawseti(L, -2, (int)n);
+
+			if (!region->sparse)
+				slot++;
+		}
+	}
+	return 2;
+}
+
+static int scanner_reset(lua_State *L)
+{
+	scanner_t* scanner = check_scanner(L, 1);
+	scanner_free_regions(scanner);
+	scanner->scanned = FALSE;
+	return 0;
+}
+
+static int scanner_gc(lua_State *L)
+{
+	scanner_t* scanner = check_scanner(L, 1);
+	scanner_free_regions(scanner);
+	luaL_unref(L, LUA_REGISTRYINDEX, scanner->processRef);
+	scanner->processRef = LUA_NOREF;
+	return 0;
+}
+
+static const luaL_Reg scanner_meta[] = {
+	{ "__gc", scanner_gc },
+	{ NULL, NULL }
+};
+static const luaL_Reg scanner_methods[] = {
+	{ "first", scanner_first },
+	{ "next", scanner_next },
+	{ "results", scanner_results },
+	{ "reset", scanner_reset },
+	{ NULL, NULL }
+};
+static udata_field_info scanner_getters[] = {
+	{ "count", udata_field_get_size, offsetof(scanner_t, count) },
+	{ NULL, NULL }
+};
+static udata_field_info scanner_setters[] = {
+	{ NULL, NULL }
+};
+
+int register_scanner(lua_State *L)
+{
+	UDATA_REGISTER_TYPE_WITH_FIELDS(scanner, SCANNER_T)
+}
\ No newline at end of file
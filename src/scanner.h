@@ -0,0 +1,82 @@
+#ifndef MEMREADER_SCANNER_H
+#define MEMREADER_SCANNER_H
+
+#include "memreader.h"
+#include "process.h"
+#include "value.h"
+#include "region.h"
+
+#define SCANNER_T MEMREADER_METATABLE(scanner)
+
+// Dense candidate sets are read and stored in blocks of this many bytes
+#define SCAN_BLOCK_SIZE (64 * 1024)
+// Sparse candidate sets are re-read a page at a time
+#define SCAN_PAGE_SIZE 4096
+
+typedef enum {
+	SCAN_EQ,
+	SCAN_NE,
+	SCAN_GT,
+	SCAN_LT,
+	SCAN_RANGE,
+	SCAN_ANY,
+	// the rest compare against the value from the previous scan
+	SCAN_CHANGED,
+	SCAN_UNCHANGED,
+	SCAN_INCREASED,
+	SCAN_DECREASED,
+	SCAN_DELTA
+} scan_op;
+
+typedef union {
+	int64_t i;
+	uint64_t u;
+	double f;
+} scalar_t;
+
+typedef struct {
+	scan_op op;
+	scalar_t a;
+	scalar_t b;
+} scan_test_t;
+
+/**
+The candidates within one region. A region starts out dense: a bitmap with
+a bit per slot, plus the previous values of each block that has candidates
+(blocks without candidates have no allocation, so they cost no memory).
+Once it has few enough candidates it becomes sparse: the slot numbers are
+delta-encoded as varints, with the previous values packed alongside.
+*/
+typedef struct {
+	char* base;
+	SIZE_T size;
+	SIZE_T slots;
+	SIZE_T count;
+	BOOL sparse;
+	uint64_t* bitmap;
+	unsigned char** blocks; // dense: the previous values of each block, or NULL
+	unsigned char* values; // sparse: the previous values of the candidates
+	unsigned char* deltas;
+	SIZE_T deltasSize;
+} scan_region_t;
+
+typedef struct {
+	process_t* process;
+	int processRef;
+	value_type type;
+	SIZE_T valueSize;
+	SIZE_T stride;
+	region_filter_t filter;
+	int workers;
+	BOOL scanned;
+	scan_region_t* regions;
+	SIZE_T regionCount;
+	SIZE_T count;
+} scanner_t;
+
+scanner_t* check_scanner(lua_State *L, int index);
+
+int memreader_scanner(lua_State *L);
+int register_scanner(lua_State *L);
+
+#endif
\ No newline at end of file
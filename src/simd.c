@@ -0,0 +1,84 @@
+#include "simd.h"
+
+#if defined(MEMREADER_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static const char* simd_names[] = { "none", "sse2", "avx2" };
+
+const char* simd_name(simd_level level)
+{
+	return simd_names[level];
+}
+
+#ifdef MEMREADER_X86
+static void cpuid(int leaf, int subleaf, int regs[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex(regs, leaf, subleaf);
+#else
+	__asm__ __volatile__("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) : "a"(leaf), "c"(subleaf));
+#endif
+}
+
+// Whether the OS saves the YMM registers on context switches (needed for AVX)
+static BOOL os_supports_avx(void)
+{
+	unsigned long long xcr0;
+#if defined(_MSC_VER)
+	xcr0 = _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	xcr0 = ((unsigned long long)edx << 32) | eax;
+#endif
+	return (xcr0 & 0x6) == 0x6;
+}
+
+static simd_level detect(void)
+{
+	int regs[4];
+	simd_level level = SIMD_NONE;
+
+	cpuid(0, 0, regs);
+	int maxLeaf = regs[0];
+
+	cpuid(1, 0, regs);
+	if (regs[3] & (1 << 26))
+		level = SIMD_SSE2;
+
+	BOOL osxsave = (regs[2] & (1 << 27)) != 0;
+	BOOL avx = (regs[2] & (1 << 28)) != 0;
+	if (maxLeaf >= 7 && osxsave && avx && os_supports_avx())
+	{
+		cpuid(7, 0, regs);
+		if (regs[1] & (1 << 5))
+			level = SIMD_AVX2;
+	}
+	return level;
+}
+#else
+static simd_level detect(void)
+{
+	return SIMD_NONE;
+}
+#endif
+
+simd_level simd_detect(void)
+{
+	// racing threads can only ever compute the same value, so this needs no locking
+	static volatile int detected = -1;
+	if (detected < 0)
+	{
+		simd_level level = detect();
+		const char* cap = getenv("MEMREADER_SIMD");
+		int i;
+		for (i = 0; cap && i <= (int)SIMD_AVX2; i++)
+		{
+			if (strcmp(cap, simd_names[i]) == 0 && (simd_level)i < level)
+				level = (simd_level)i;
+		}
+		detected = (int)level;
+	}
+	return (simd_level)detected;
+}
\ No newline at end of file
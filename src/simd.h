@@ -0,0 +1,47 @@
+#ifndef MEMREADER_SIMD_H
+#define MEMREADER_SIMD_H
+
+#include "memreader.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MEMREADER_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// Kernels using instructions the compiler wouldn't otherwise emit need to be marked for GCC/Clang
+#if defined(MEMREADER_X86) && defined(__GNUC__)
+#define SIMD_TARGET_SSE2 __attribute__((target("sse2")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SIMD_TARGET_SSE2
+#define SIMD_TARGET_AVX2
+#endif
+
+typedef enum {
+	SIMD_NONE,
+	SIMD_SSE2,
+	SIMD_AVX2
+} simd_level;
+
+/**
+The best instruction set supported by both the CPU and the OS, detected
+once. Setting the MEMREADER_SIMD environment variable to "none", "sse2" or
+"avx2" caps it, which is mostly useful for testing the fallbacks.
+*/
+simd_level simd_detect(void);
+const char* simd_name(simd_level level);
+
+// Index of the lowest set bit of a non-zero mask
+static inline unsigned simd_ctz(unsigned mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned)index;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+#endif
\ No newline at end of file
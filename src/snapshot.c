@@ -0,0 +1,642 @@
+#include "snapshot.h"
+#include "process.h"
+#include "address.h"
+#include "region.h"
+#include "simd.h"
+#include "threadpool.h"
+
+#include <stdio.h>
+#include <errno.h>
+
+snapshot_t* check_snapshot(lua_State *L, int index)
+{
+	snapshot_t* snapshot = (snapshot_t*)luaL_checkudata(L, index, SNAPSHOT_T);
+	return snapshot;
+}
+
+void snapshot_free(snapshot_t* snapshot)
+{
+	if (snapshot->mapped)
+		platform_unmap_temp(&snapshot->mapping);
+	else
+		free(snapshot->data);
+	free(snapshot->regions);
+	free(snapshot->hashes);
+	free(snapshot->modules);
+	snapshot->data = NULL;
+	snapshot->regions = NULL;
+	snapshot->hashes = NULL;
+	snapshot->modules = NULL;
+	snapshot->moduleCount = 0;
+	snapshot->regionCount = 0;
+	snapshot->size = 0;
+	snapshot->mapped = FALSE;
+}
+
+static SIZE_T page_count(SIZE_T size)
+{
+	return (size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+}
+
+/**
+A 64-bit hash of a page, in the style of XXH3's accumulate loop: eight
+independent lanes of 32x32->64 multiplies that compilers vectorize well, so
+hashing keeps up with copying the page.
+*/
+static uint64_t hash_page(const unsigned char* data, SIZE_T size)
+{
+	static const uint64_t keys[8] = {
+		0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+		0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL
+	};
+	uint64_t acc[8];
+	SIZE_T i;
+	int lane;
+
+	memcpy(acc, keys, sizeof(acc));
+	for (i = 0; i + 64 <= size; i += 64)
+	{
+		for (lane = 0; lane < 8; lane++)
+		{
+			uint64_t word, key;
+			memcpy(&word, data + i + lane * 8, 8);
+			key = word ^ keys[lane];
+			acc[lane ^ 1] += word;
+			acc[lane] += (key & 0xffffffff) * (key >> 32);
+		}
+	}
+	for (; i < size; i++)
+		acc[i & 7] = (acc[i & 7] ^ data[i]) * 0x100000001b3ULL;
+
+	uint64_t hash = size * 0x9e3779b185ebca87ULL;
+	for (lane = 0; lane < 8; lane++)
+	{
+		hash = (hash ^ acc[lane]) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+// Capturing
+
+typedef struct {
+	SIZE_T region;
+	SIZE_T offset; // within the region
+	SIZE_T size;
+} capture_chunk;
+
+typedef struct {
+	process_t* process;
+	snapshot_t* snapshot;
+	capture_chunk* chunks;
+} capture_job;
+
+static void capture_task(void* ctx, int worker, SIZE_T task)
+{
+	capture_job* job = (capture_job*)ctx;
+	const capture_chunk* chunk = &job->chunks[task];
+	const snapshot_region_t* region = &job->snapshot->regions[chunk->region];
+	unsigned char* data = job->snapshot->data + region->offset + chunk->offset;
+	SIZE_T numBytesRead, i;
+
+	// memory that can't be read (because it was freed since it was listed) is left as zeros
+	if (!platform_read(job->process, region->base + chunk->offset, data, chunk->size, &numBytesRead))
+		memset(data + numBytesRead, 0, chunk->size - numBytesRead);
+
+	uint64_t* hashes = job->snapshot->hashes + (region->offset + chunk->offset) / SNAPSHOT_PAGE_SIZE;
+	for (i = 0; i < chunk->size; i += SNAPSHOT_PAGE_SIZE)
+	{
+		SIZE_T size = chunk->size - i < SNAPSHOT_PAGE_SIZE ? chunk->size - i : SNAPSHOT_PAGE_SIZE;
+		*hashes++ = hash_page(data + i, size);
+	}
+}
+
+static BOOL snapshot_capture(snapshot_t* snapshot, process_t* process, const region_list_t* list, BOOL mapped, int workers)
+{
+	SIZE_T i, chunkCount = 0;
+
+	snapshot->regions = (snapshot_region_t*)malloc((list->count ? list->count : 1) * sizeof(snapshot_region_t));
+	if (!snapshot->regions)
+		return FALSE;
+
+	for (i = 0; i < list->count; i++)
+	{
+		snapshot_region_t* region = &snapshot->regions[i];
+		region->base = (char*)list->regions[i].base;
+		region->size = list->regions[i].size;
+		region->protect = list->regions[i].protect;
+		region->type = list->regions[i].type;
+		region->offset = snapshot->size;
+		snapshot->size += page_count(region->size) * SNAPSHOT_PAGE_SIZE;
+		chunkCount += (region->size + REGION_CHUNK_SIZE - 1) / REGION_CHUNK_SIZE;
+	}
+	snapshot->regionCount = list->count;
+
+	snapshot->hashes = (uint64_t*)malloc((page_count(snapshot->size) + 1) * sizeof(uint64_t));
+	if (!snapshot->hashes)
+		return FALSE;
+
+	if (mapped)
+	{
+		if (!platform_map_temp(&snapshot->mapping, snapshot->size))
+			return FALSE;
+		snapshot->mapped = TRUE;
+		snapshot->data = (unsigned char*)snapshot->mapping.data;
+	}
+	else
+	{
+		snapshot->data = (unsigned char*)malloc(snapshot->size ? snapshot->size : 1);
+		if (!snapshot->data)
+			return FALSE;
+	}
+
+	capture_job job = { process, snapshot, NULL };
+	job.chunks = (capture_chunk*)malloc((chunkCount ? chunkCount : 1) * sizeof(capture_chunk));
+	if (!job.chunks)
+		return FALSE;
+
+	chunkCount = 0;
+	for (i = 0; i < list->count; i++)
+	{
+		SIZE_T offset, size = snapshot->regions[i].size;
+		for (offset = 0; offset < size; offset += REGION_CHUNK_SIZE)
+		{
+			capture_chunk* chunk = &job.chunks[chunkCount++];
+			chunk->region = i;
+			chunk->offset = offset;
+			chunk->size = size - offset < REGION_CHUNK_SIZE ? size - offset : REGION_CHUNK_SIZE;
+		}
+	}
+
+	pool_run(workers, chunkCount, capture_task, &job);
+	free(job.chunks);
+	return TRUE;
+}
+
+BOOL snapshot_describe(snapshot_t* snapshot, process_t* process)
+{
+	iterator_t it;
+	module_t module;
+	SIZE_T capacity = 0;
+	BOOL success = TRUE;
+
+	snapshot->pid = process->pid;
+	snapshot->pointerSize = process->pointerSize;
+	snapshot->module = process->module;
+	memcpy(snapshot->name, process->name, sizeof(snapshot->name));
+	memcpy(snapshot->path, process->path, sizeof(snapshot->path));
+
+	platform_iterator_init(&it);
+	if (!platform_modules_open(&it, process))
+		return FALSE;
+
+	while (platform_modules_next(&it, &module))
+	{
+		if (snapshot->moduleCount == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			module_t* modules = (module_t*)realloc(snapshot->modules, capacity * sizeof(module_t));
+			if (!modules)
+			{
+				success = FALSE;
+				break;
+			}
+			snapshot->modules = modules;
+		}
+		snapshot->modules[snapshot->moduleCount++] = module;
+	}
+	platform_iterator_close(&it);
+	return success;
+}
+
+// Saving
+
+static BOOL write_bytes(FILE* file, const void* data, SIZE_T size)
+{
+	return fwrite(data, 1, size, file) == size;
+}
+
+static BOOL write_u32(FILE* file, uint32_t value)
+{
+	return write_bytes(file, &value, sizeof(value));
+}
+
+static BOOL write_u64(FILE* file, uint64_t value)
+{
+	return write_bytes(file, &value, sizeof(value));
+}
+
+static BOOL write_string(FILE* file, const TCHAR* s)
+{
+	uint32_t length = (uint32_t)strlen(s);
+	return write_u32(file, length) && write_bytes(file, s, length);
+}
+
+BOOL snapshot_write_header(const snapshot_t* snapshot, uint32_t version, FILE* file, uint64_t* dataOffset)
+{
+	static const unsigned char zeros[SNAPSHOT_PAGE_SIZE];
+	SIZE_T i;
+
+	// the data starts at the first page boundary after the header and tables
+	uint64_t headerSize = 4 + 4 * 5 + 8 + 8 + strlen(snapshot->name) + strlen(snapshot->path);
+	for (i = 0; i < snapshot->moduleCount; i++)
+		headerSize += 8 + strlen(snapshot->modules[i].name) + strlen(snapshot->modules[i].path) + 16;
+	headerSize += snapshot->regionCount * 32;
+	*dataOffset = (headerSize + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE * SNAPSHOT_PAGE_SIZE;
+
+	BOOL success = write_bytes(file, SNAPSHOT_FILE_MAGIC, 4)
+		&& write_u32(file, version)
+		&& write_u32(file, (uint32_t)snapshot->pointerSize)
+		&& write_u32(file, snapshot->pid)
+		&& write_u32(file, (uint32_t)snapshot->moduleCount)
+		&& write_u32(file, (uint32_t)snapshot->regionCount)
+		&& write_u64(file, (uint64_t)(uintptr_t)snapshot->module)
+		&& write_string(file, snapshot->name)
+		&& write_string(file, snapshot->path);
+
+	for (i = 0; success && i < snapshot->moduleCount; i++)
+	{
+		const module_t* module = &snapshot->modules[i];
+		success = write_string(file, module->name)
+			&& write_string(file, module->path)
+			&& write_u64(file, (uint64_t)(uintptr_t)module->handle)
+			&& write_u64(file, module->size);
+	}
+	for (i = 0; success && i < snapshot->regionCount; i++)
+	{
+		const snapshot_region_t* region = &snapshot->regions[i];
+		success = write_u64(file, (uint64_t)(uintptr_t)region->base)
+			&& write_u64(file, region->size)
+			&& write_u32(file, region->protect)
+			&& write_u32(file, (uint32_t)region->type)
+			&& write_u64(file, *dataOffset + region->offset);
+	}
+	return success && write_bytes(file, zeros, (SIZE_T)(*dataOffset - headerSize));
+}
+
+static BOOL snapshot_write(const snapshot_t* snapshot, FILE* file)
+{
+	uint64_t dataOffset;
+	return snapshot_write_header(snapshot, SNAPSHOT_FILE_VERSION, file, &dataOffset)
+		&& write_bytes(file, snapshot->data, snapshot->size);
+}
+
+// Diffing
+
+// Returns the index of the first byte in [0, size) where (a[i] != b[i]) == different, or size
+static SIZE_T find_scalar(const unsigned char* a, const unsigned char* b, SIZE_T pos, SIZE_T size, BOOL different)
+{
+	for (; pos < size; pos++)
+	{
+		if ((a[pos] != b[pos]) == different)
+			break;
+	}
+	return pos;
+}
+
+#ifdef MEMREADER_X86
+SIMD_TARGET_SSE2
+static SIZE_T find_sse2(const unsigned char* a, const unsigned char* b, SIZE_T size, BOOL different)
+{
+	const unsigned flip = different ? 0xffff : 0;
+	SIZE_T pos;
+
+	for (pos = 0; pos + 16 <= size; pos += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + pos));
+		__m128i y = _mm_loadu_si128((const __m128i*)(b + pos));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ flip;
+		if (mask)
+			return pos + simd_ctz(mask);
+	}
+	return find_scalar(a, b, pos, size, different);
+}
+
+SIMD_TARGET_AVX2
+static SIZE_T find_avx2(const unsigned char* a, const unsigned char* b, SIZE_T size, BOOL different)
+{
+	const unsigned flip = different ? 0xffffffff : 0;
+	SIZE_T pos;
+
+	for (pos = 0; pos + 32 <= size; pos += 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(a + pos));
+		__m256i y = _mm256_loadu_si256((const __m256i*)(b + pos));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) ^ flip;
+		if (mask)
+			return pos + simd_ctz(mask);
+	}
+	return find_scalar(a, b, pos, size, different);
+}
+#endif
+
+static SIZE_T find_boundary(const unsigned char* a, const unsigned char* b, SIZE_T size, BOOL different)
+{
+#ifdef MEMREADER_X86
+	switch (simd_detect())
+	{
+	case SIMD_AVX2: return find_avx2(a, b, size, different);
+	case SIMD_SSE2: return find_sse2(a, b, size, different);
+	default: break;
+	}
+#endif
+	return find_scalar(a, b, 0, size, different);
+}
+
+typedef struct {
+	const char* address;
+	SIZE_T size;
+} diff_range;
+
+// A page-aligned piece of the memory that two snapshots have in common
+typedef struct {
+	const char* address;
+	SIZE_T size;
+	const unsigned char* a;
+	const unsigned char* b;
+	const uint64_t* hashesA;
+	const uint64_t* hashesB;
+	diff_range* ranges;
+	SIZE_T count;
+	SIZE_T capacity;
+} diff_span;
+
+typedef struct {
+	diff_span* spans;
+	volatile BOOL outOfMemory;
+} diff_job;
+
+static BOOL span_add_range(diff_span* span, SIZE_T start, SIZE_T end)
+{
+	if (span->count == span->capacity)
+	{
+		SIZE_T capacity = span->capacity ? span->capacity * 2 : 16;
+		diff_range* ranges = (diff_range*)realloc(span->ranges, capacity * sizeof(diff_range));
+		if (!ranges)
+			return FALSE;
+		span->ranges = ranges;
+		span->capacity = capacity;
+	}
+	span->ranges[span->count].address = span->address + start;
+	span->ranges[span->count].size = end - start;
+	span->count++;
+	return TRUE;
+}
+
+static void diff_task(void* ctx, int worker, SIZE_T task)
+{
+	diff_job* job = (diff_job*)ctx;
+	diff_span* span = &job->spans[task];
+	SIZE_T page, pages = page_count(span->size);
+	SIZE_T runStart = 0;
+	BOOL inRun = FALSE;
+
+	for (page = 0; page < pages; page++)
+	{
+		SIZE_T pos = page * SNAPSHOT_PAGE_SIZE;
+		SIZE_T end = span->size - pos < SNAPSHOT_PAGE_SIZE ? span->size : pos + SNAPSHOT_PAGE_SIZE;
+
+		if (span->hashesA[page] == span->hashesB[page])
+		{
+			if (inRun && !span_add_range(span, runStart, pos))
+				job->outOfMemory = TRUE;
+			inRun = FALSE;
+			continue;
+		}
+
+		while (pos < end)
+		{
+			SIZE_T next = pos + find_boundary(span->a + pos, span->b + pos, end - pos, !inRun);
+			if (inRun && next < end && !span_add_range(span, runStart, next))
+				job->outOfMemory = TRUE;
+			if (!inRun && next < end)
+				runStart = next;
+			if (next < end)
+				inRun = !inRun;
+			pos = next;
+		}
+	}
+	if (inRun && !span_add_range(span, runStart, span->size))
+		job->outOfMemory = TRUE;
+}
+
+// Lists the spans of memory two snapshots have in common, or counts them if spans is NULL
+static SIZE_T snapshot_spans(const snapshot_t* a, const snapshot_t* b, diff_span* spans)
+{
+	SIZE_T i = 0, j = 0, count = 0;
+	while (i < a->regionCount && j < b->regionCount)
+	{
+		const snapshot_region_t* ra = &a->regions[i];
+		const snapshot_region_t* rb = &b->regions[j];
+		char* start = ra->base > rb->base ? ra->base : rb->base;
+		char* endA = ra->base + ra->size;
+		char* endB = rb->base + rb->size;
+		char* end = endA < endB ? endA : endB;
+
+		for (; start < end; start += REGION_CHUNK_SIZE)
+		{
+			if (spans)
+			{
+				diff_span* span = &spans[count];
+				SIZE_T offsetA = ra->offset + (SIZE_T)(start - ra->base);
+				SIZE_T offsetB = rb->offset + (SIZE_T)(start - rb->base);
+				memset(span, 0, sizeof(diff_span));
+				span->address = start;
+				span->size = (SIZE_T)(end - start) < REGION_CHUNK_SIZE ? (SIZE_T)(end - start) : REGION_CHUNK_SIZE;
+				span->a = a->data + offsetA;
+				span->b = b->data + offsetB;
+				span->hashesA = a->hashes + offsetA / SNAPSHOT_PAGE_SIZE;
+				span->hashesB = b->hashes + offsetB / SNAPSHOT_PAGE_SIZE;
+			}
+			count++;
+		}
+
+		if (endA <= endB)
+			i++;
+		else
+			j++;
+	}
+	return count;
+}
+
+// Lua
+
+/**
+process:snapshot([options])
+
+options can contain the region filter fields (see process:regions), file
+(to store the snapshot in a temporary file mapping instead of memory) and
+workers. Only readable memory is captured.
+*/
+int process_snapshot(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	region_filter_t filter;
+	BOOL mapped = FALSE;
+	int workers = pool_default_workers();
+
+	check_region_filter(L, 2, &filter);
+	filter.readable = 1;
+	if (lua_istable(L, 2))
+	{
+		lua_getfield(L, 2, "file");
+		mapped = lua_toboolean(L, -1);
+		lua_getfield(L, 2, "workers");
+		workers = pool_check_workers(L, lua_gettop(L));
+		lua_pop(L, 2);
+	}
+
+	snapshot_t* snapshot = (snapshot_t*)lua_newuserdata(L, sizeof(snapshot_t));
+	memset(snapshot, 0, sizeof(snapshot_t));
+	luaL_getmetatable(L, SNAPSHOT_T);
+	lua_setmetatable(L, -2);
+
+	region_list_t regions;
+	region_list_init(&regions);
+	if (!snapshot_describe(snapshot, process) || !region_list_collect(process, &filter, &regions))
+	{
+		region_list_free(&regions);
+		return push_last_error(L);
+	}
+
+	simd_detect(); // so that the workers don't race to detect it
+	BOOL success = snapshot_capture(snapshot, process, &regions, mapped, workers);
+	region_list_free(&regions);
+	if (!success)
+	{
+		// the temp file functions leave the reason in errno/GetLastError, allocation failures don't
+		snapshot_free(snapshot);
+		return mapped ? push_last_error(L) : push_error(L, "not enough memory");
+	}
+	return 1;
+}
+
+/**
+snapshot:diff(other[, workers])
+
+Returns an array of {address, size} tables for every range of bytes that
+differs between the two snapshots, in ascending order. Only memory that is
+in both snapshots is compared.
+*/
+static int snapshot_diff(lua_State *L)
+{
+	snapshot_t* a = check_snapshot(L, 1);
+	snapshot_t* b = check_snapshot(L, 2);
+	int workers = pool_check_workers(L, 3);
+
+	diff_job job = { NULL, FALSE };
+	SIZE_T i, count = snapshot_spans(a, b, NULL);
+	job.spans = (diff_span*)malloc((count ? count : 1) * sizeof(diff_span));
+	if (!job.spans)
+		return push_error(L, "not enough memory");
+	snapshot_spans(a, b, job.spans);
+
+	simd_detect();
+	pool_run(workers, count, diff_task, &job);
+
+	if (!job.outOfMemory)
+	{
+		// spans are in address order; a range that runs into the next span is joined with its continuation
+		int n = 0;
+		const char* lastEnd = NULL;
+		lua_newtable(L);
+		for (i = 0; i < count; i++)
+		{
+			SIZE_T r;
+			for (r = 0; r < job.spans[i].count; r++)
+			{
+				diff_range* range = &job.spans[i].ranges[r];
+				if (n > 0 && range->address == lastEnd)
+				{
+					lua_rawgeti(L, -1, n);
+					lua_rawgeti(L, -1, 2);
+					lua_Integer size = lua_tointeger(L, -1) + (lua_Integer)range->size;
+					lua_pop(L, 1);
+					lua_pushinteger(L, size);
+					lua_rawseti(L, -2, 2);
+					lua_pop(L, 1);
+				}
+				else
+				{
+					lua_createtable(L, 2, 0);
+					push_address(L, (LPCVOID)range->address);
+					lua_rawseti(L, -2, 1);
+					lua_pushinteger(L, (lua_Integer)range->size);
+					lua_rawseti(L, -2, 2);
+					lua_rawseti(L, -2, ++n);
+				}
+				lastEnd = range->address + range->size;
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		free(job.spans[i].ranges);
+	free(job.spans);
+
+	if (job.outOfMemory)
+		return push_error(L, "not enough memory");
+	return 1;
+}
+
+/**
+snapshot:save(path)
+
+Writes the snapshot to a file, which memreader.opensnapshot can open as a
+process.
+*/
+static int snapshot_save(lua_State *L)
+{
+	snapshot_t* snapshot = check_snapshot(L, 1);
+	const char* path = luaL_checkstring(L, 2);
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return push_error(L, lua_pushfstring(L, "%s: %s", path, strerror(errno)));
+
+	BOOL success = snapshot_write(snapshot, file);
+	if (fclose(file) != 0)
+		success = FALSE;
+	if (!success)
+		return push_error(L, lua_pushfstring(L, "%s: %s", path, strerror(errno)));
+
+	lua_pushboolean(L, TRUE);
+	return 1;
+}
+
+static int snapshot_gc(lua_State *L)
+{
+	snapshot_t* snapshot = check_snapshot(L, 1);
+	snapshot_free(snapshot);
+	return 0;
+}
+
+static int snapshot_len(lua_State *L)
+{
+	snapshot_t* snapshot = check_snapshot(L, 1);
+	lua_pushinteger(L, (lua_Integer)snapshot->regionCount);
+	return 1;
+}
+
+static const luaL_Reg snapshot_meta[] = {
+	{ "__gc", snapshot_gc },
+	{ "__len", snapshot_len },
+	{ NULL, NULL }
+};
+static const luaL_Reg snapshot_methods[] = {
+	{ "diff", snapshot_diff },
+	{ "save", snapshot_save },
+	{ NULL, NULL }
+};
+static udata_field_info snapshot_getters[] = {
+	{ "size", udata_field_get_size, offsetof(snapshot_t, size) },
+	{ NULL, NULL }
+};
+static udata_field_info snapshot_setters[] = {
+	{ NULL, NULL }
+};
+
+int register_snapshot(lua_State *L)
+{
+	UDATA_REGISTER_TYPE_WITH_FIELDS(snapshot, SNAPSHOT_T)
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#ifndef MEMREADER_SNAPSHOT_H
+#define MEMREADER_SNAPSHOT_H
+
+#include "memreader.h"
+#include "platform.h"
+#include "module.h"
+
+#define SNAPSHOT_T MEMREADER_METATABLE(snapshot)
+
+// Snapshots hash and compare memory a page at a time
+#define SNAPSHOT_PAGE_SIZE 4096
+
+typedef struct {
+	char* base; // in the target
+	SIZE_T size;
+	SIZE_T offset; // of the region's data within the snapshot, always page-aligned
+	DWORD protect;
+	region_type type;
+} snapshot_region_t;
+
+/**
+A copy of some of the memory of a process. The data of all of the regions
+is stored back to back, either in ordinary memory or in a temporary file
+mapping, along with a hash of every page so that diffs can skip pages that
+haven't changed without touching their data.
+*/
+typedef struct {
+	snapshot_region_t* regions;
+	SIZE_T regionCount;
+	unsigned char* data;
+	SIZE_T size;
+	uint64_t* hashes;
+	BOOL mapped;
+	temp_mapping_t mapping;
+	// what's known of the process it was taken from, for snapshot:save
+	DWORD pid;
+	SIZE_T pointerSize;
+	HMODULE module;
+	TCHAR name[MAX_PATH];
+	TCHAR path[MAX_PATH];
+	module_t* modules;
+	SIZE_T moduleCount;
+} snapshot_t;
+
+/**
+The file written by snapshot:save, which memreader.opensnapshot opens as a
+process: a header, the modules and the regions of the process, then the
+data of every region at a page-aligned offset, so that it can be used in
+place from a mapping of the file. Numbers are in the byte order of the
+machine that saved it, and addresses are 64-bit whatever the pointer size.
+
+  header: magic, version, pointer size, pid, module count, region count (u32 each), base (u64), name, path
+  module: name, path, base (u64), size (u64)
+  region: base (u64), size (u64), protect (u32), type (u32), offset of the data (u64)
+
+with strings stored as a u32 length followed by that many bytes. Pages of
+data that are all zeros may be holes in the file (process:dump leaves them
+out).
+
+Compressed files (written by process:dump) have another version, in which
+the offset of a region is that of its chunk index instead: an offset (u64)
+and size (u64) for every SNAPSHOT_FILE_CHUNK_SIZE bytes of the region, of
+the chunk's data compressed in the LZ4 block format (see compress.h). A
+chunk of all zeros has a size of 0, and one that didn't compress is stored
+as is, with a size equal to the chunk's.
+*/
+#define SNAPSHOT_FILE_MAGIC "MRSS"
+#define SNAPSHOT_FILE_VERSION 1
+#define SNAPSHOT_FILE_VERSION_COMPRESSED 2
+#define SNAPSHOT_FILE_CHUNK_SIZE (1024 * 1024)
+
+snapshot_t* check_snapshot(lua_State *L, int index);
+void snapshot_free(snapshot_t* snapshot);
+
+// Keeps what a saved snapshot needs to know about the process
+BOOL snapshot_describe(snapshot_t* snapshot, process_t* process);
+// Writes everything but the data of the regions, whose offsets are relative to *dataOffset (the end of what's written)
+BOOL snapshot_write_header(const snapshot_t* snapshot, uint32_t version, FILE* file, uint64_t* dataOffset);
+
+int process_snapshot(lua_State *L);
+int register_snapshot(lua_State *L);
+
+#endif
\ No newline at end of file
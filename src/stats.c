@@ -0,0 +1,252 @@
+#include "stats.h"
+
+#ifdef MEMREADER_STATS
+
+#if defined(_MSC_VER)
+#define STATS_THREAD_LOCAL __declspec(thread)
+#define STATS_ADD(p, v) InterlockedExchangeAdd64((volatile LONG64*)(p), (LONG64)(v))
+#define STATS_LOAD(p) (*(volatile uint64_t*)(p))
+#define STATS_STORE(p, v) (*(volatile uint64_t*)(p) = (v))
+#else
+#define STATS_THREAD_LOCAL __thread
+#define STATS_ADD(p, v) __atomic_fetch_add((p), (uint64_t)(v), __ATOMIC_RELAXED)
+#define STATS_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STATS_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+static process_stats_t global_stats;
+static uint64_t next_shard;
+static STATS_THREAD_LOCAL int thread_shard = -1;
+
+process_stats_t* process_stats_new(void)
+{
+	return (process_stats_t*)calloc(1, sizeof(process_stats_t));
+}
+
+void process_stats_free(process_stats_t* stats)
+{
+	free(stats);
+}
+
+/**
+Threads get consecutive shards, so up to STATS_SHARDS threads never share
+one. Counters are still added to atomically (it's cheap when the cache line
+isn't shared), since more threads than that do have to share.
+*/
+static int current_shard(void)
+{
+	if (thread_shard < 0)
+		thread_shard = (int)(STATS_ADD(&next_shard, 1) % STATS_SHARDS);
+	return thread_shard;
+}
+
+static int latency_bucket(uint64_t ns)
+{
+	int bucket = 0;
+	while (ns > 1 && bucket < STATS_BUCKETS - 1)
+	{
+		ns >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static void record_call(stats_t* stats, uint64_t elapsed, SIZE_T calls)
+{
+	STATS_ADD(&stats->calls, calls);
+	STATS_ADD(&stats->time, elapsed);
+	// a batch of calls is put in the bucket of their average
+	STATS_ADD(&stats->latency[latency_bucket(elapsed / (calls ? calls : 1))], calls);
+}
+
+static void record_request(stats_t* stats, read_backend backend, SIZE_T size, SIZE_T bytesRead)
+{
+	STATS_ADD(&stats->requests, 1);
+	STATS_ADD(&stats->backendRequests[backend], 1);
+	STATS_ADD(&stats->backendBytes[backend], bytesRead);
+	STATS_ADD(&stats->bytesRequested, size);
+	STATS_ADD(&stats->bytesRead, bytesRead);
+	if (bytesRead == 0 && size > 0)
+		STATS_ADD(&stats->failed, 1);
+	else if (bytesRead < size)
+		STATS_ADD(&stats->partial, 1);
+}
+
+void stats_record_read(process_t* process, read_backend backend, uint64_t start, SIZE_T size, SIZE_T bytesRead)
+{
+	uint64_t elapsed = platform_time_ns() - start;
+	int shard = current_shard();
+
+	record_call(&global_stats.shards[shard].counters, elapsed, 1);
+	record_request(&global_stats.shards[shard].counters, backend, size, bytesRead);
+	if (process->stats)
+	{
+		record_call(&process->stats->shards[shard].counters, elapsed, 1);
+		record_request(&process->stats->shards[shard].counters, backend, size, bytesRead);
+	}
+}
+
+void stats_record_readv(process_t* process, read_backend backend, uint64_t start, SIZE_T calls, const read_request_t* requests, SIZE_T count)
+{
+	uint64_t elapsed = platform_time_ns() - start;
+	int shard = current_shard();
+	stats_t* process_shard = process->stats ? &process->stats->shards[shard].counters : NULL;
+	SIZE_T i;
+
+	record_call(&global_stats.shards[shard].counters, elapsed, calls);
+	if (process_shard)
+		record_call(process_shard, elapsed, calls);
+	for (i = 0; i < count; i++)
+	{
+		record_request(&global_stats.shards[shard].counters, backend, requests[i].size, requests[i].bytesRead);
+		if (process_shard)
+			record_request(process_shard, backend, requests[i].size, requests[i].bytesRead);
+	}
+}
+
+void stats_record_cache(process_t* process, SIZE_T hits, SIZE_T misses)
+{
+	int shard = current_shard();
+	STATS_ADD(&global_stats.shards[shard].counters.cacheHits, hits);
+	STATS_ADD(&global_stats.shards[shard].counters.cacheMisses, misses);
+	if (process->stats)
+	{
+		STATS_ADD(&process->stats->shards[shard].counters.cacheHits, hits);
+		STATS_ADD(&process->stats->shards[shard].counters.cacheMisses, misses);
+	}
+}
+
+// Sums up the shards; counters that are being added to at the same time may be off by the calls in flight
+static void stats_merge(const process_stats_t* stats, stats_t* total)
+{
+	uint64_t* sums = (uint64_t*)total;
+	SIZE_T i, n = sizeof(stats_t) / sizeof(uint64_t);
+	int shard;
+
+	memset(total, 0, sizeof(stats_t));
+	for (shard = 0; shard < STATS_SHARDS; shard++)
+	{
+		const uint64_t* counters = (const uint64_t*)&stats->shards[shard].counters;
+		for (i = 0; i < n; i++)
+			sums[i] += STATS_LOAD(&counters[i]);
+	}
+}
+
+static void stats_reset(process_stats_t* stats)
+{
+	SIZE_T i, n = sizeof(stats_t) / sizeof(uint64_t);
+	int shard;
+	for (shard = 0; shard < STATS_SHARDS; shard++)
+	{
+		uint64_t* counters = (uint64_t*)&stats->shards[shard].counters;
+		for (i = 0; i < n; i++)
+			STATS_STORE(&counters[i], 0);
+	}
+}
+
+static void push_counter(lua_State *L, const char* name, uint64_t value)
+{
+	lua_pushnumber(L, (lua_Number)value);
+	lua_setfield(L, -2, name);
+}
+
+static int push_stats(lua_State *L, const process_stats_t* stats)
+{
+	stats_t total;
+	stats_merge(stats, &total);
+
+	lua_createtable(L, 0, 10);
+	push_counter(L, "calls", total.calls);
+	push_counter(L, "requests", total.requests);
+	push_counter(L, "bytesrequested", total.bytesRequested);
+	push_counter(L, "bytesread", total.bytesRead);
+	push_counter(L, "partial", total.partial);
+	push_counter(L, "failed", total.failed);
+	push_counter(L, "cachehits", total.cacheHits);
+	push_counter(L, "cachemisses", total.cacheMisses);
+	lua_pushnumber(L, (lua_Number)total.time / 1000);
+	lua_setfield(L, -2, "time");
+
+	int i;
+	lua_createtable(L, STATS_BUCKETS, 0);
+	for (i = 0; i < STATS_BUCKETS; i++)
+	{
+		lua_pushnumber(L, (lua_Number)total.latency[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "latency");
+
+	lua_createtable(L, 0, READ_BACKENDS);
+	for (i = 0; i < READ_BACKENDS; i++)
+	{
+		lua_createtable(L, 0, 2);
+		push_counter(L, "requests", total.backendRequests[i]);
+		push_counter(L, "bytes", total.backendBytes[i]);
+		lua_setfield(L, -2, read_backend_name((read_backend)i));
+	}
+	lua_setfield(L, -2, "backends");
+	return 1;
+}
+
+#define STATS_UNAVAILABLE(L) push_error(L, "not enough memory for the statistics of the process")
+
+#else
+
+#define STATS_UNAVAILABLE(L) push_error(L, "statistics were disabled at compile time")
+
+#endif
+
+/**
+process:stats()
+
+Returns a table with the counters of the reads made from the process: see
+stats_t for what they are. time is in microseconds, and latency is the
+histogram of the time each call took (latency[i] counts calls that took
+[2^(i-1), 2^i) ns).
+*/
+int process_stats(lua_State *L)
+{
+#ifdef MEMREADER_STATS
+	process_t* process = check_process(L, 1);
+	if (process->stats)
+	{
+		push_stats(L, process->stats);
+		lua_pushstring(L, read_backend_name(process_load_backend(process)));
+		lua_setfield(L, -2, "backend");
+		return 1;
+	}
+#else
+	check_process(L, 1);
+#endif
+	return STATS_UNAVAILABLE(L);
+}
+
+int process_reset_stats(lua_State *L)
+{
+#ifdef MEMREADER_STATS
+	process_t* process = check_process(L, 1);
+	if (process->stats)
+		stats_reset(process->stats);
+#else
+	check_process(L, 1);
+#endif
+	return 0;
+}
+
+// memreader.stats() is process:stats() for the reads from every process together
+int memreader_stats(lua_State *L)
+{
+#ifdef MEMREADER_STATS
+	return push_stats(L, &global_stats);
+#else
+	return STATS_UNAVAILABLE(L);
+#endif
+}
+
+int memreader_reset_stats(lua_State *L)
+{
+#ifdef MEMREADER_STATS
+	stats_reset(&global_stats);
+#endif
+	return 0;
+}
\ No newline at end of file
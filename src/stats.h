@@ -0,0 +1,92 @@
+#ifndef MEMREADER_STATS_H
+#define MEMREADER_STATS_H
+
+#include "memreader.h"
+#include "process.h"
+#include "platform.h"
+
+// Build with MEMREADER_NO_STATS defined to compile the counters out entirely
+#ifndef MEMREADER_NO_STATS
+#define MEMREADER_STATS
+#endif
+
+// Latency bucket i counts read calls that took [2^i, 2^(i+1)) ns; the last one also counts anything slower
+#define STATS_BUCKETS 32
+// Each thread adds to one of this many copies of the counters, picked when it first reads
+#define STATS_SHARDS 16
+// The cache line size assumed to keep the shards apart
+#define STATS_CACHE_LINE 64
+
+/**
+Counters for the reads made through the platform layer. A call is one
+system call (or, on Windows, one ReadProcessMemory, and for an offline
+process, one read out of its file); a request is one range, so a batched
+process_vm_readv is one call with many requests.
+*/
+typedef struct {
+	uint64_t calls;
+	uint64_t requests;
+	uint64_t bytesRequested;
+	uint64_t bytesRead;
+	uint64_t partial; // requests that read some, but not all, of their bytes
+	uint64_t failed; // requests that read nothing
+	uint64_t cacheHits;
+	uint64_t cacheMisses;
+	uint64_t time; // total time spent in calls, in ns
+	uint64_t latency[STATS_BUCKETS];
+	// the requests (and the bytes they read) made with each read_backend
+	uint64_t backendRequests[READ_BACKENDS];
+	uint64_t backendBytes[READ_BACKENDS];
+} stats_t;
+
+/**
+The counters of one shard, followed by a cache line of padding: the array
+of shards isn't aligned to cache lines (it can come from calloc), but with
+a whole line between the counters of neighboring shards, no line has both.
+*/
+typedef union {
+	stats_t counters;
+	char padding[sizeof(stats_t) + STATS_CACHE_LINE];
+} stats_shard_t;
+
+/**
+The counters of a process (or the global ones) are split into shards so
+that threads reading at the same time don't contend on the same cache
+lines; they are only summed up when they're read.
+*/
+struct process_stats_t {
+	stats_shard_t shards[STATS_SHARDS];
+};
+
+#ifdef MEMREADER_STATS
+
+process_stats_t* process_stats_new(void);
+void process_stats_free(process_stats_t* stats);
+
+// The counting is done by the platform layer, around its system calls
+#define STATS_START(var) uint64_t var = platform_time_ns()
+#define STATS_READ(process, backend, start, size, bytesRead) stats_record_read((process), (backend), (start), (size), (bytesRead))
+#define STATS_READV(process, backend, start, calls, requests, count) stats_record_readv((process), (backend), (start), (calls), (requests), (count))
+#define STATS_CACHE(process, hits, misses) stats_record_cache((process), (hits), (misses))
+
+void stats_record_read(process_t* process, read_backend backend, uint64_t start, SIZE_T size, SIZE_T bytesRead);
+void stats_record_readv(process_t* process, read_backend backend, uint64_t start, SIZE_T calls, const read_request_t* requests, SIZE_T count);
+void stats_record_cache(process_t* process, SIZE_T hits, SIZE_T misses);
+
+#else
+
+#define process_stats_new() NULL
+#define process_stats_free(stats) ((void)(stats))
+#define STATS_START(var)
+#define STATS_READ(process, backend, start, size, bytesRead)
+#define STATS_READV(process, backend, start, calls, requests, count)
+#define STATS_CACHE(process, hits, misses)
+
+#endif
+
+int process_stats(lua_State *L);
+int process_reset_stats(lua_State *L);
+int memreader_stats(lua_State *L);
+int memreader_reset_stats(lua_State *L);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,762 @@
+#include "strscan.h"
+#include "address.h"
+#include "region.h"
+#include "simd.h"
+#include "threadpool.h"
+
+typedef enum {
+	STRINGS_ASCII, // printable ASCII and tabs
+	STRINGS_UTF8, // the same, plus well-formed UTF-8 sequences (but no C1 controls)
+	STRINGS_UTF16LE, // printable ASCII code units at even addresses
+	STRINGS_ENCODINGS
+} strings_encoding;
+
+static const char* const encoding_names[] = { "ascii", "utf8", "utf16le", NULL };
+
+#define STRINGS_DEFAULT_MIN_LENGTH 4
+#define STRINGS_DEFAULT_MAX_LENGTH 1024
+// Chunks are read with enough of the next one that a run starting at their end can reach its maximum length
+#define STRINGS_MAX_CHAR_SIZE 4
+// The iterator reads this many chunks per worker at a time
+#define STRINGS_BATCH_CHUNKS 4
+
+typedef struct {
+	SIZE_T minLength; // in characters
+	SIZE_T maxLength; // longer runs are cut off after this many characters
+	BOOL encodings[STRINGS_ENCODINGS];
+	int workers;
+} strings_options_t;
+
+// A run of text, which is kept as UTF-8 whatever its encoding
+typedef struct {
+	const char* address;
+	SIZE_T offset; // of the text, in the text of its chunk
+	SIZE_T length;
+	strings_encoding encoding;
+} string_hit_t;
+
+// The runs that start in one chunk of memory
+typedef struct {
+	string_hit_t* hits;
+	SIZE_T count;
+	SIZE_T capacity;
+	char* text;
+	SIZE_T textSize;
+	SIZE_T textCapacity;
+	// where the last run that starts in the chunk ends, for each encoding
+	const char* covered[STRINGS_ENCODINGS];
+	BOOL skip; // the chunk is only read as the overlap of the one before it
+} strings_chunk_t;
+
+typedef struct {
+	const strings_options_t* options;
+	strings_chunk_t* chunks;
+	BOOL outOfMemory;
+} strings_scan_t;
+
+static void chunk_free(strings_chunk_t* chunk)
+{
+	free(chunk->hits);
+	free(chunk->text);
+	memset(chunk, 0, sizeof(strings_chunk_t));
+}
+
+// Classifying bytes
+
+/**
+Bit i of each mask is about byte i of the block: printable is set for
+printable ASCII (and tabs), high for bytes with the top bit set (which may
+be part of a UTF-8 sequence), and zero for zeros. Blocks are 32 bytes, or n
+for the scalar version.
+*/
+typedef struct {
+	uint32_t printable;
+	uint32_t high;
+	uint32_t zero;
+} block_masks_t;
+
+typedef void(*classify_fn)(const unsigned char* data, block_masks_t* masks);
+
+static void classify_scalar(const unsigned char* data, SIZE_T n, block_masks_t* masks)
+{
+	SIZE_T i;
+	masks->printable = masks->high = masks->zero = 0;
+	for (i = 0; i < n; i++)
+	{
+		unsigned char c = data[i];
+		if ((c >= 0x20 && c < 0x7f) || c == '\t')
+			masks->printable |= 1u << i;
+		if (c & 0x80)
+			masks->high |= 1u << i;
+		if (c == 0)
+			masks->zero |= 1u << i;
+	}
+}
+
+static void classify_none(const unsigned char* data, block_masks_t* masks)
+{
+	classify_scalar(data, 32, masks);
+}
+
+#ifdef MEMREADER_X86
+SIMD_TARGET_SSE2
+static uint32_t printable_sse2(__m128i x)
+{
+	// as signed bytes, everything from 0x80 up is negative, so > 0x1f is 0x20-0x7f
+	__m128i above = _mm_cmpgt_epi8(x, _mm_set1_epi8(0x1f));
+	__m128i del = _mm_cmpeq_epi8(x, _mm_set1_epi8(0x7f));
+	__m128i tab = _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'));
+	return (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_andnot_si128(del, above), tab));
+}
+
+SIMD_TARGET_SSE2
+static void classify_sse2(const unsigned char* data, block_masks_t* masks)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i*)data);
+	__m128i hi = _mm_loadu_si128((const __m128i*)(data + 16));
+	__m128i zero = _mm_setzero_si128();
+	masks->printable = printable_sse2(lo) | (printable_sse2(hi) << 16);
+	masks->high = (uint32_t)_mm_movemask_epi8(lo) | ((uint32_t)_mm_movemask_epi8(hi) << 16);
+	masks->zero = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, zero)) | ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, zero)) << 16);
+}
+
+SIMD_TARGET_AVX2
+static void classify_avx2(const unsigned char* data, block_masks_t* masks)
+{
+	__m256i x = _mm256_loadu_si256((const __m256i*)data);
+	__m256i above = _mm256_cmpgt_epi8(x, _mm256_set1_epi8(0x1f));
+	__m256i del = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(0x7f));
+	__m256i tab = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'));
+	masks->printable = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_andnot_si256(del, above), tab));
+	masks->high = (uint32_t)_mm256_movemask_epi8(x);
+	masks->zero = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+}
+#endif
+
+static classify_fn pick_classify(void)
+{
+#ifdef MEMREADER_X86
+	switch (simd_detect())
+	{
+	case SIMD_AVX2: return classify_avx2;
+	case SIMD_SSE2: return classify_sse2;
+	default: break;
+	}
+#endif
+	return classify_none;
+}
+
+// The bytes of the block that are text in the encoding; for UTF-16LE, both bytes of every printable code unit
+static uint32_t text_mask(const block_masks_t* masks, strings_encoding encoding)
+{
+	if (encoding == STRINGS_UTF16LE)
+	{
+		uint32_t units = masks->printable & (masks->zero >> 1) & 0x55555555u;
+		return units | (units << 1);
+	}
+	return masks->printable;
+}
+
+// The length of the well-formed UTF-8 sequence of 2 to 4 bytes at p, or 0
+static SIZE_T utf8_sequence(const unsigned char* p, SIZE_T available)
+{
+	unsigned char c = p[0];
+	SIZE_T length, i;
+	unsigned char min = 0x80, max = 0xbf;
+
+	if (c >= 0xc2 && c <= 0xdf)
+	{
+		length = 2;
+		// U+0080-U+009F are control characters
+		if (c == 0xc2)
+			min = 0xa0;
+	}
+	else if (c >= 0xe0 && c <= 0xef)
+	{
+		length = 3;
+		if (c == 0xe0)
+			min = 0xa0; // overlong
+		else if (c == 0xed)
+			max = 0x9f; // surrogates
+	}
+	else if (c >= 0xf0 && c <= 0xf4)
+	{
+		length = 4;
+		if (c == 0xf0)
+			min = 0x90; // overlong
+		else if (c == 0xf4)
+			max = 0x8f; // past U+10FFFF
+	}
+	else
+		return 0;
+
+	if (length > available || p[1] < min || p[1] > max)
+		return 0;
+	for (i = 2; i < length; i++)
+	{
+		if (p[i] < 0x80 || p[i] > 0xbf)
+			return 0;
+	}
+	return length;
+}
+
+// Finding runs
+
+static BOOL add_hit(strings_chunk_t* chunk, const char* address, const unsigned char* data, SIZE_T length, strings_encoding encoding)
+{
+	SIZE_T i;
+	if (chunk->count == chunk->capacity)
+	{
+		SIZE_T capacity = chunk->capacity ? chunk->capacity * 2 : 64;
+		string_hit_t* hits = (string_hit_t*)realloc(chunk->hits, capacity * sizeof(string_hit_t));
+		if (!hits)
+			return FALSE;
+		chunk->hits = hits;
+		chunk->capacity = capacity;
+	}
+	if (chunk->textSize + length > chunk->textCapacity)
+	{
+		SIZE_T capacity = chunk->textCapacity ? chunk->textCapacity * 2 : 4096;
+		while (capacity < chunk->textSize + length)
+			capacity *= 2;
+		char* text = (char*)realloc(chunk->text, capacity);
+		if (!text)
+			return FALSE;
+		chunk->text = text;
+		chunk->textCapacity = capacity;
+	}
+
+	string_hit_t* hit = &chunk->hits[chunk->count++];
+	hit->address = address;
+	hit->offset = chunk->textSize;
+	hit->length = length;
+	hit->encoding = encoding;
+	// UTF-16LE runs are all ASCII, so the text is the low bytes
+	if (encoding == STRINGS_UTF16LE)
+	{
+		for (i = 0; i < length; i++)
+			chunk->text[chunk->textSize + i] = (char)data[i * 2];
+	}
+	else
+		memcpy(chunk->text + chunk->textSize, data, length);
+	chunk->textSize += length;
+	return TRUE;
+}
+
+// Keeps the run [start, end) of the chunk's data if it's long enough, cut off at the maximum length
+static BOOL emit_run(strings_scan_t* scan, strings_chunk_t* chunk, const chunk_t* data, SIZE_T start, SIZE_T end, strings_encoding encoding)
+{
+	const strings_options_t* options = scan->options;
+	const unsigned char* text = data->data + start;
+	SIZE_T bytes = end - start, length, characters;
+
+	chunk->covered[encoding] = data->address + end;
+	if (encoding == STRINGS_UTF16LE)
+	{
+		characters = bytes / 2;
+		length = characters < options->maxLength ? characters : options->maxLength;
+	}
+	else if (encoding == STRINGS_ASCII)
+	{
+		characters = bytes;
+		length = characters < options->maxLength ? characters : options->maxLength;
+	}
+	else
+	{
+		// count the characters (the bytes that don't continue a sequence), stopping at the maximum length
+		SIZE_T i;
+		characters = 0;
+		length = bytes;
+		for (i = 0; i < bytes; i++)
+		{
+			if ((text[i] & 0xc0) == 0x80)
+				continue;
+			if (characters == options->maxLength)
+			{
+				length = i;
+				break;
+			}
+			characters++;
+		}
+	}
+	if (characters < options->minLength)
+		return TRUE;
+	return add_hit(chunk, data->address + start, text, length, encoding);
+}
+
+/**
+Finds the runs of text in the encoding that start in the chunk, following
+them into the overlap to find their end. The masks of each block are used
+for every run that starts or ends in it, so that scanning memory that's
+mostly short runs doesn't mean classifying the same bytes over and over;
+only UTF-8 sequences are checked one at a time.
+*/
+static BOOL scan_encoding(strings_scan_t* scan, strings_chunk_t* chunk, const chunk_t* data, strings_encoding encoding, classify_fn classify)
+{
+	const unsigned char* bytes = data->data;
+	SIZE_T available = data->available;
+	SIZE_T pos = 0, start = 0;
+	BOOL inRun = FALSE;
+	block_masks_t masks;
+
+	while (pos < available)
+	{
+		SIZE_T n = available - pos < 32 ? available - pos : 32;
+		SIZE_T next = pos + n;
+		unsigned bit = 0;
+		if (n == 32)
+			classify(bytes + pos, &masks);
+		else
+			classify_scalar(bytes + pos, n, &masks);
+		uint32_t valid = n == 32 ? 0xffffffffu : (1u << n) - 1;
+		uint32_t text = text_mask(&masks, encoding) & valid;
+		uint32_t starts = encoding == STRINGS_UTF8 ? text | (masks.high & valid) : text;
+
+		while (bit < n)
+		{
+			if (inRun)
+			{
+				uint32_t ends = (~text & valid) >> bit;
+				if (!ends)
+					break;
+				bit += simd_ctz(ends);
+				SIZE_T end = pos + bit;
+				if (encoding == STRINGS_UTF8 && (bytes[end] & 0x80))
+				{
+					SIZE_T length = utf8_sequence(bytes + end, available - end);
+					if (length)
+					{
+						// the run goes on after the sequence, which may be in the next block
+						if (bit + length < n)
+						{
+							bit += (unsigned)length;
+							continue;
+						}
+						next = end + length;
+						break;
+					}
+				}
+				if (!emit_run(scan, chunk, data, start, end, encoding))
+					return FALSE;
+				inRun = FALSE;
+			}
+			else
+			{
+				uint32_t candidates = starts >> bit;
+				if (!candidates)
+					break;
+				bit += simd_ctz(candidates);
+				start = pos + bit;
+				// runs that start in the overlap belong to the next chunk
+				if (start >= data->size)
+					return TRUE;
+				inRun = TRUE;
+				if (encoding == STRINGS_UTF8 && (bytes[start] & 0x80))
+				{
+					SIZE_T length = utf8_sequence(bytes + start, available - start);
+					if (!length)
+					{
+						inRun = FALSE;
+						bit++;
+						continue;
+					}
+					if (bit + length < n)
+					{
+						bit += (unsigned)length;
+						continue;
+					}
+					next = start + length;
+					break;
+				}
+			}
+		}
+		if (!inRun && next >= data->size)
+			break;
+		pos = next;
+	}
+	// the run goes on past what was read, up to the end of the region or the overlap
+	if (inRun)
+		return emit_run(scan, chunk, data, start, available, encoding);
+	return TRUE;
+}
+
+static int compare_hits(const void* a, const void* b)
+{
+	const string_hit_t* x = (const string_hit_t*)a;
+	const string_hit_t* y = (const string_hit_t*)b;
+	if (x->address != y->address)
+		return x->address < y->address ? -1 : 1;
+	return (int)x->encoding - (int)y->encoding;
+}
+
+static BOOL scan_chunk(void* ctx, int worker, SIZE_T index, const chunk_t* data)
+{
+	strings_scan_t* scan = (strings_scan_t*)ctx;
+	strings_chunk_t* chunk = &scan->chunks[index];
+	classify_fn classify = pick_classify();
+	int encoding, encodings = 0;
+	(void)worker;
+
+	if (chunk->skip)
+		return TRUE;
+	for (encoding = 0; encoding < STRINGS_ENCODINGS; encoding++)
+	{
+		chunk->covered[encoding] = data->address;
+		if (!scan->options->encodings[encoding])
+			continue;
+		encodings++;
+		if (!scan_encoding(scan, chunk, data, (strings_encoding)encoding, classify))
+		{
+			scan->outOfMemory = TRUE;
+			return FALSE;
+		}
+	}
+	// each encoding's runs are in order, but they're found one encoding after the other
+	if (encodings > 1)
+		qsort(chunk->hits, chunk->count, sizeof(string_hit_t), compare_hits);
+	return TRUE;
+}
+
+// Options and results
+
+static void check_strings_options(lua_State *L, int index, strings_options_t* options, region_filter_t* filter)
+{
+	memset(options, 0, sizeof(strings_options_t));
+	options->minLength = STRINGS_DEFAULT_MIN_LENGTH;
+	options->maxLength = STRINGS_DEFAULT_MAX_LENGTH;
+	options->encodings[STRINGS_ASCII] = TRUE;
+	options->encodings[STRINGS_UTF16LE] = TRUE;
+	options->workers = pool_default_workers();
+
+	if (lua_isnoneornil(L, index))
+		check_region_filter(L, index, filter);
+	else
+	{
+		luaL_checktype(L, index, LUA_TTABLE);
+		int top = lua_gettop(L);
+
+		lua_getfield(L, index, "minlen");
+		lua_Integer minLength = luaL_optinteger(L, top + 1, STRINGS_DEFAULT_MIN_LENGTH);
+		luaL_argcheck(L, minLength >= 1, index, "minlen must be at least 1");
+		options->minLength = (SIZE_T)minLength;
+
+		lua_getfield(L, index, "maxlen");
+		lua_Integer maxLength = luaL_optinteger(L, top + 2, STRINGS_DEFAULT_MAX_LENGTH);
+		luaL_argcheck(L, maxLength >= minLength && maxLength <= REGION_CHUNK_SIZE / STRINGS_MAX_CHAR_SIZE, index, "maxlen must be at least minlen, and at most 262144");
+		options->maxLength = (SIZE_T)maxLength;
+
+		lua_getfield(L, index, "encodings");
+		if (lua_type(L, top + 3) == LUA_TSTRING)
+		{
+			memset(options->encodings, 0, sizeof(options->encodings));
+			options->encodings[luaL_checkoption(L, top + 3, NULL, encoding_names)] = TRUE;
+		}
+		else if (!lua_isnil(L, top + 3))
+		{
+			int i, count;
+			luaL_checktype(L, top + 3, LUA_TTABLE);
+			memset(options->encodings, 0, sizeof(options->encodings));
+			count = (int)lua_rawlen(L, top + 3);
+			for (i = 1; i <= count; i++)
+			{
+				lua_rawgeti(L, top + 3, i);
+				options->encodings[luaL_checkoption(L, -1, NULL, encoding_names)] = TRUE;
+				lua_pop(L, 1);
+			}
+			luaL_argcheck(L, count > 0, index, "encodings must not be empty");
+		}
+
+		lua_getfield(L, index, "regions");
+		check_region_filter(L, top + 4, filter);
+		lua_getfield(L, index, "workers");
+		options->workers = pool_check_workers(L, top + 5);
+		lua_settop(L, top);
+	}
+	// UTF-8 includes ASCII, and scanning for both would find every ASCII run twice
+	if (options->encodings[STRINGS_UTF8])
+		options->encodings[STRINGS_ASCII] = FALSE;
+	filter->readable = 1;
+}
+
+static BOOL collect_regions(process_t* process, const region_filter_t* filter, region_list_t* regions)
+{
+	region_list_init(regions);
+	if (!region_list_collect(process, filter, regions))
+		return FALSE;
+	// runs can go from one region into the next
+	region_list_coalesce(regions);
+	return TRUE;
+}
+
+static SIZE_T chunk_count(const region_list_t* list)
+{
+	SIZE_T i, count = 0;
+	for (i = 0; i < list->count; i++)
+		count += (list->regions[i].size + REGION_CHUNK_SIZE - 1) / REGION_CHUNK_SIZE;
+	return count;
+}
+
+static SIZE_T strings_overlap(const strings_options_t* options)
+{
+	return options->maxLength * STRINGS_MAX_CHAR_SIZE;
+}
+
+// Scans the regions, whose chunks go into chunks (which must have room for all of them, with skip set where needed)
+static BOOL strings_scan(process_t* process, const region_list_t* list, const strings_options_t* options, strings_chunk_t* chunks)
+{
+	strings_scan_t scan = { options, chunks, FALSE };
+	simd_detect(); // so that the workers don't race to detect it
+	if (!region_list_read_chunks_parallel(process, list, REGION_CHUNK_SIZE, strings_overlap(options), options->workers, scan_chunk, &scan))
+		return FALSE;
+	return !scan.outOfMemory;
+}
+
+/**
+A run that crosses into the next chunk is found from its start by the chunk
+it starts in, and also (from wherever that chunk begins) by the next chunk:
+runs of a chunk that start before the end of the previous chunk's last run
+of the same encoding are left out.
+*/
+static BOOL hit_covered(const string_hit_t* hit, const char* const covered[STRINGS_ENCODINGS])
+{
+	return hit->address < covered[hit->encoding];
+}
+
+static void cover(const char* covered[STRINGS_ENCODINGS], const strings_chunk_t* chunk)
+{
+	int i;
+	for (i = 0; i < STRINGS_ENCODINGS; i++)
+	{
+		if (chunk->covered[i] > covered[i])
+			covered[i] = chunk->covered[i];
+	}
+}
+
+static void push_hit(lua_State *L, const strings_chunk_t* chunk, const string_hit_t* hit)
+{
+	push_address(L, hit->address);
+	lua_pushlstring(L, chunk->text + hit->offset, hit->length);
+	lua_pushstring(L, encoding_names[hit->encoding]);
+}
+
+/**
+process:strings([options])
+
+Returns an array of {address, string, encoding} for every run of text in
+the readable memory of the process, in address order. options can contain
+minlen, maxlen (in characters), encodings (an array of encoding_names, or
+one of them), regions (a region filter, see process:regions) and workers.
+*/
+int process_strings(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	strings_options_t options;
+	region_filter_t filter;
+	region_list_t regions;
+	check_strings_options(L, 2, &options, &filter);
+
+	if (!collect_regions(process, &filter, &regions))
+	{
+		region_list_free(&regions);
+		return push_last_error(L);
+	}
+	SIZE_T i, j, count = chunk_count(&regions);
+	strings_chunk_t* chunks = (strings_chunk_t*)calloc(count ? count : 1, sizeof(strings_chunk_t));
+	BOOL success = chunks && strings_scan(process, &regions, &options, chunks);
+	region_list_free(&regions);
+	if (!success)
+	{
+		for (i = 0; chunks && i < count; i++)
+			chunk_free(&chunks[i]);
+		free(chunks);
+		return push_error(L, "not enough memory");
+	}
+
+	const char* covered[STRINGS_ENCODINGS] = { NULL, NULL, NULL };
+	int n = 0;
+	lua_newtable(L);
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < chunks[i].count; j++)
+		{
+			const string_hit_t* hit = &chunks[i].hits[j];
+			if (hit_covered(hit, covered))
+				continue;
+			lua_createtable(L, 3, 0);
+			push_hit(L, &chunks[i], hit);
+			lua_rawseti(L, -4, 3);
+			lua_rawseti(L, -3, 2);
+			lua_rawseti(L, -2, 1);
+			lua_rawseti(L, -2, ++n);
+		}
+		cover(covered, &chunks[i]);
+		chunk_free(&chunks[i]);
+	}
+	free(chunks);
+	return 1;
+}
+
+// Streaming
+
+/**
+The state of process:eachstring(): the regions are scanned a batch of
+chunks at a time, and the runs of a batch are handed out before the next
+one is read.
+*/
+typedef struct {
+	region_list_t regions;
+	strings_options_t options;
+	SIZE_T region; // where the next batch starts
+	SIZE_T offset;
+	strings_chunk_t* chunks; // of the current batch
+	SIZE_T chunkCount;
+	SIZE_T chunk; // the next run to hand out
+	SIZE_T hit;
+	const char* covered[STRINGS_ENCODINGS];
+} strings_iterator_t;
+
+static void iterator_free_batch(strings_iterator_t* it)
+{
+	SIZE_T i;
+	for (i = 0; i < it->chunkCount; i++)
+		chunk_free(&it->chunks[i]);
+	free(it->chunks);
+	it->chunks = NULL;
+	it->chunkCount = 0;
+	it->chunk = 0;
+	it->hit = 0;
+}
+
+/**
+Scans up to STRINGS_BATCH_CHUNKS chunks per worker of the remaining
+regions. Each region's part of the batch runs on by the overlap, which
+becomes a chunk of its own that is only read for the chunk before it.
+*/
+static BOOL iterator_next_batch(strings_iterator_t* it, process_t* process)
+{
+	SIZE_T budget = (SIZE_T)it->options.workers * STRINGS_BATCH_CHUNKS;
+	SIZE_T overlap = strings_overlap(&it->options);
+	region_list_t batch;
+	BOOL success;
+
+	iterator_free_batch(it);
+	// every part has at most one overlap chunk, and there are at most budget parts
+	it->chunks = (strings_chunk_t*)calloc(budget * 2, sizeof(strings_chunk_t));
+	if (!it->chunks)
+		return FALSE;
+
+	region_list_init(&batch);
+	while (budget && it->region < it->regions.count)
+	{
+		const region_t* region = &it->regions.regions[it->region];
+		SIZE_T remaining = region->size - it->offset;
+		SIZE_T chunks = (remaining + REGION_CHUNK_SIZE - 1) / REGION_CHUNK_SIZE;
+		SIZE_T taken = chunks < budget ? chunks : budget;
+		SIZE_T size = taken * REGION_CHUNK_SIZE;
+
+		region_t part = *region;
+		part.base = (char*)region->base + it->offset;
+		part.size = size + overlap < remaining ? size + overlap : remaining;
+		if (!region_list_push(&batch, &part))
+		{
+			region_list_free(&batch);
+			return FALSE;
+		}
+		SIZE_T partChunks = (part.size + REGION_CHUNK_SIZE - 1) / REGION_CHUNK_SIZE;
+		SIZE_T i;
+		for (i = 0; i < partChunks; i++)
+			it->chunks[it->chunkCount++].skip = i >= taken;
+
+		budget -= taken;
+		it->offset += size;
+		if (it->offset >= region->size)
+		{
+			it->region++;
+			it->offset = 0;
+		}
+	}
+
+	success = strings_scan(process, &batch, &it->options, it->chunks);
+	region_list_free(&batch);
+	return success;
+}
+
+// Hands out the next run that isn't covered by the ones before it, reading batches as needed
+static int process_strings_iterator(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	strings_iterator_t* it = (strings_iterator_t*)lua_touserdata(L, lua_upvalueindex(1));
+
+	for (;;)
+	{
+		for (; it->chunk < it->chunkCount; it->chunk++, it->hit = 0)
+		{
+			strings_chunk_t* chunk = &it->chunks[it->chunk];
+			while (it->hit < chunk->count)
+			{
+				const string_hit_t* hit = &chunk->hits[it->hit++];
+				if (hit_covered(hit, it->covered))
+					continue;
+				push_hit(L, chunk, hit);
+				return 3;
+			}
+			cover(it->covered, chunk);
+		}
+		if (it->region >= it->regions.count)
+		{
+			iterator_free_batch(it);
+			return 0;
+		}
+		if (!iterator_next_batch(it, process))
+		{
+			iterator_free_batch(it);
+			return luaL_error(L, "not enough memory");
+		}
+	}
+}
+
+/**
+process:eachstring([options])
+
+Like process:strings(), but returns an iterator yielding address, string
+and encoding, which only keeps a batch of chunks' runs in memory at once.
+*/
+int process_each_string(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	strings_options_t options;
+	region_filter_t filter;
+	check_strings_options(L, 2, &options, &filter);
+
+	strings_iterator_t* it = (strings_iterator_t*)lua_newuserdata(L, sizeof(strings_iterator_t));
+	memset(it, 0, sizeof(strings_iterator_t));
+	it->options = options;
+	luaL_getmetatable(L, STRINGS_ITERATOR_T);
+	lua_setmetatable(L, -2);
+
+	if (!collect_regions(process, &filter, &it->regions))
+		return push_last_error(L);
+
+	// process_strings_iterator's upvalue is the strings_iterator_t userdata
+	lua_pushcclosure(L, process_strings_iterator, 1);
+	// push process_t to make it the invariant state
+	lua_pushvalue(L, 1);
+	return 2;
+}
+
+static int strings_iterator_gc(lua_State *L)
+{
+	strings_iterator_t* it = (strings_iterator_t*)luaL_checkudata(L, 1, STRINGS_ITERATOR_T);
+	iterator_free_batch(it);
+	region_list_free(&it->regions);
+	return 0;
+}
+
+int register_strscan(lua_State *L)
+{
+	luaL_newmetatable(L, STRINGS_ITERATOR_T);
+	lua_pushcfunction(L, strings_iterator_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	return 0;
+}
\ No newline at end of file
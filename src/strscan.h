@@ -0,0 +1,13 @@
+#ifndef MEMREADER_STRSCAN_H
+#define MEMREADER_STRSCAN_H
+
+#include "memreader.h"
+#include "process.h"
+
+#define STRINGS_ITERATOR_T MEMREADER_METATABLE(stringiterator)
+
+int process_strings(lua_State *L);
+int process_each_string(lua_State *L);
+int register_strscan(lua_State *L);
+
+#endif
\ No newline at end of file
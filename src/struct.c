@@ -0,0 +1,268 @@
+#include "struct.h"
+#include "process.h"
+#include "address.h"
+#include "platform.h"
+#include "cache.h"
+
+// Structs up to this size are read into a stack buffer instead of allocating one
+#define STRUCT_STACK_BUFFER_SIZE 4096
+
+struct_t* check_struct(lua_State *L, int index)
+{
+	struct_t* schema = (struct_t*)luaL_checkudata(L, index, STRUCT_T);
+	return schema;
+}
+
+SIZE_T struct_span(struct_t* schema, SIZE_T pointerSize)
+{
+	return schema->span[pointerSize == 4 ? 0 : 1];
+}
+
+static SIZE_T field_size(struct_field_t* field, SIZE_T pointerSize)
+{
+	if (field->bytes)
+		return field->length;
+	if (field->type == VALUE_PTR)
+		return pointerSize;
+	return value_types[field->type].size;
+}
+
+void struct_decode(lua_State *L, struct_t* schema, const char* data, SIZE_T pointerSize, int tableIndex)
+{
+	int i;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, schema->namesRef);
+	for (i = 0; i < schema->count; i++)
+	{
+		struct_field_t* field = &schema->fields[i];
+		const char* fieldData = data + field->offset;
+
+		lua_rawgeti(L, -1, i + 1);
+		if (field->bytes)
+			lua_pushlstring(L, fieldData, field->length);
+		else if (field->type == VALUE_PTR)
+			push_pointer_value(L, fieldData, pointerSize);
+		else
+			push_value(L, field->type, fieldData);
+		lua_rawset(L, tableIndex);
+	}
+	lua_pop(L, 1);
+}
+
+/**
+memreader.struct({ {name, type, offset[, length]}, ... }[, size])
+
+type is a value type name, or "bytes" for a string of length bytes.
+size is the stride used by readstructs, and defaults to the span of the fields.
+*/
+int memreader_struct(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int count = (int)lua_rawlen(L, 1);
+	luaL_argcheck(L, count > 0, 1, "struct must have at least one field");
+
+	struct_t* schema = (struct_t*)lua_newuserdata(L, sizeof(struct_t) + (count - 1) * sizeof(struct_field_t));
+	schema->namesRef = LUA_NOREF;
+	schema->count = count;
+	schema->span[0] = schema->span[1] = 0;
+	luaL_getmetatable(L, STRUCT_T);
+	lua_setmetatable(L, -2);
+	int schemaIndex = lua_gettop(L);
+
+	lua_createtable(L, count, 0);
+	int namesIndex = lua_gettop(L);
+
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		struct_field_t* field = &schema->fields[i];
+		lua_rawgeti(L, 1, i + 1);
+		int entry = lua_gettop(L);
+		if (!lua_istable(L, entry))
+			return luaL_error(L, "bad field #%d to 'struct' (table expected, got %s)", i + 1, luaL_typename(L, entry));
+
+		lua_rawgeti(L, entry, 1);
+		if (lua_type(L, -1) != LUA_TSTRING)
+			return luaL_error(L, "bad field #%d to 'struct' (name must be a string)", i + 1);
+		lua_rawseti(L, namesIndex, i + 1);
+
+		lua_rawgeti(L, entry, 2);
+		lua_rawgeti(L, entry, 3);
+		lua_rawgeti(L, entry, 4);
+		lua_Integer offset = luaL_checkinteger(L, entry + 2);
+		if (offset < 0)
+			return luaL_error(L, "bad field #%d to 'struct' (negative offset)", i + 1);
+		field->offset = (SIZE_T)offset;
+
+		const char* type = luaL_checkstring(L, entry + 1);
+		field->bytes = strcmp(type, "bytes") == 0;
+		field->length = 0;
+		if (field->bytes)
+		{
+			lua_Integer length = luaL_checkinteger(L, entry + 3);
+			if (length < 0)
+				return luaL_error(L, "bad field #%d to 'struct' (negative length)", i + 1);
+			field->length = (SIZE_T)length;
+		}
+		else
+			field->type = check_value_type(L, entry + 1);
+		lua_settop(L, namesIndex);
+
+		SIZE_T end4 = field->offset + field_size(field, 4);
+		SIZE_T end8 = field->offset + field_size(field, 8);
+		if (end4 > schema->span[0]) schema->span[0] = end4;
+		if (end8 > schema->span[1]) schema->span[1] = end8;
+	}
+
+	schema->namesRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	lua_Integer size = luaL_optinteger(L, 2, 0);
+	luaL_argcheck(L, size >= 0, 2, "size must not be negative");
+	schema->size = size > 0 ? (SIZE_T)size : schema->span[1];
+
+	lua_settop(L, schemaIndex);
+	return 1;
+}
+
+/**
+process:readstruct(schema, address[, table])
+
+Reads the struct with one read and decodes its fields into table (or a new
+table), which is returned. On failure returns nil, errmsg.
+*/
+int process_read_struct(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	struct_t* schema = check_struct(L, 2);
+	LPCVOID address = (LPCVOID)memaddress_checkptr(L, 3);
+	SIZE_T span = struct_span(schema, process->pointerSize);
+
+	if (lua_isnoneornil(L, 4))
+	{
+		lua_settop(L, 3);
+		lua_createtable(L, 0, schema->count);
+	}
+	else
+	{
+		luaL_checktype(L, 4, LUA_TTABLE);
+		lua_settop(L, 4);
+	}
+
+	char stackBuff[STRUCT_STACK_BUFFER_SIZE];
+	char* buff = span <= sizeof(stackBuff) ? stackBuff : malloc(span);
+	SIZE_T numBytesRead;
+
+	if (!buff)
+		return push_error(L, "not enough memory");
+
+	if (!process_read_memory(process, address, buff, span, &numBytesRead))
+	{
+		if (buff != stackBuff)
+			free(buff);
+		return push_last_error(L);
+	}
+
+	struct_decode(L, schema, buff, process->pointerSize, 4);
+	if (buff != stackBuff)
+		free(buff);
+	return 1;
+}
+
+/**
+process:readstructs(schema, address, count[, tables])
+
+Reads count consecutive structs (schema.size bytes apart) with one read and
+returns an array of tables, reusing any tables already in the tables array.
+*/
+int process_read_structs(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	struct_t* schema = check_struct(L, 2);
+	LPCVOID address = (LPCVOID)memaddress_checkptr(L, 3);
+	lua_Integer count = luaL_checkinteger(L, 4);
+	luaL_argcheck(L, count >= 0, 4, "count must not be negative");
+
+	if (lua_isnoneornil(L, 5))
+	{
+		lua_settop(L, 4);
+		lua_createtable(L, (int)count, 0);
+	}
+	else
+	{
+		luaL_checktype(L, 5, LUA_TTABLE);
+		lua_settop(L, 5);
+	}
+
+	if (count == 0)
+		return 1;
+
+	SIZE_T span = struct_span(schema, process->pointerSize);
+	if ((SIZE_T)(count - 1) > ((SIZE_T)-1 - span) / (schema->size ? schema->size : 1))
+		return push_error(L, "too many structs");
+	SIZE_T total = schema->size * (SIZE_T)(count - 1) + span;
+
+	char* buff = (char*)malloc(total);
+	SIZE_T numBytesRead;
+
+	if (!buff)
+		return push_error(L, "not enough memory");
+
+	if (!process_read_memory(process, address, buff, total, &numBytesRead))
+	{
+		free(buff);
+		return push_last_error(L);
+	}
+
+	lua_Integer i;
+	for (i = 0; i < count; i++)
+	{
+		lua_rawgeti(L, 5, (int)i + 1);
+		if (!lua_istable(L, -1))
+		{
+			lua_pop(L, 1);
+			lua_createtable(L, 0, schema->count);
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, 5, (int)i + 1);
+		}
+		struct_decode(L, schema, buff + schema->size * (SIZE_T)i, process->pointerSize, lua_gettop(L));
+		lua_pop(L, 1);
+	}
+
+	free(buff);
+	return 1;
+}
+
+static int struct_gc(lua_State *L)
+{
+	struct_t* schema = check_struct(L, 1);
+	luaL_unref(L, LUA_REGISTRYINDEX, schema->namesRef);
+	schema->namesRef = LUA_NOREF;
+	return 0;
+}
+
+static int struct_len(lua_State *L)
+{
+	struct_t* schema = check_struct(L, 1);
+	lua_pushinteger(L, schema->count);
+	return 1;
+}
+
+static const luaL_Reg struct_meta[] = {
+	{ "__gc", struct_gc },
+	{ "__len", struct_len },
+	{ NULL, NULL }
+};
+static const luaL_Reg struct_methods[] = {
+	{ NULL, NULL }
+};
+static udata_field_info struct_getters[] = {
+	{ "size", udata_field_get_size, offsetof(struct_t, size) },
+	{ NULL, NULL }
+};
+static udata_field_info struct_setters[] = {
+	{ NULL, NULL }
+};
+
+int register_struct(lua_State *L)
+{
+	UDATA_REGISTER_TYPE_WITH_FIELDS(struct, STRUCT_T)
+}
\ No newline at end of file
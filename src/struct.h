@@ -0,0 +1,39 @@
+#ifndef MEMREADER_STRUCT_H
+#define MEMREADER_STRUCT_H
+
+#include "memreader.h"
+#include "value.h"
+
+#define STRUCT_T MEMREADER_METATABLE(struct)
+
+typedef struct {
+	SIZE_T offset;
+	value_type type;
+	SIZE_T length; // for "bytes" fields, which are returned as strings
+	BOOL bytes;
+} struct_field_t;
+
+/**
+A compiled struct schema. Field names are kept in a Lua table (referenced
+from the registry) so decoding can push them without re-hashing.
+*/
+typedef struct {
+	int namesRef;
+	SIZE_T size; // stride between structs in an array
+	SIZE_T span[2]; // bytes that need to be read, for 4 and 8-byte pointers
+	int count;
+	struct_field_t fields[1];
+} struct_t;
+
+struct_t* check_struct(lua_State *L, int index);
+SIZE_T struct_span(struct_t* schema, SIZE_T pointerSize);
+// Decodes one struct from data into the table at tableIndex
+void struct_decode(lua_State *L, struct_t* schema, const char* data, SIZE_T pointerSize, int tableIndex);
+
+int memreader_struct(lua_State *L);
+int process_read_struct(lua_State *L);
+int process_read_structs(lua_State *L);
+
+int register_struct(lua_State *L);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,642 @@
+#include "symbols.h"
+#include "address.h"
+#include "platform.h"
+#include "varint.h"
+
+#define SYMBOL_CACHE MEMREADER_METATABLE(symbolcache)
+
+// Marks a duplicate symbol while a table is being built
+#define SYMBOL_REMOVED 0xffffffff
+
+static const char* symbol_type_names[] = { "function", "object", "other" };
+
+static void symbols_free(symbols_t* symbols)
+{
+	free(symbols->symbols);
+	free(symbols->names);
+	free(symbols->index);
+	symbols->symbols = NULL;
+	symbols->names = NULL;
+	symbols->index = NULL;
+	symbols->count = 0;
+	symbols->indexSize = 0;
+}
+
+// Image parsing (images are little-endian, like every platform memreader runs on)
+
+typedef struct {
+	const unsigned char* data;
+	SIZE_T size;
+} image_t;
+
+typedef struct {
+	symbol_t* symbols;
+	SIZE_T count;
+	SIZE_T capacity;
+	byte_vector names;
+} symbol_builder;
+
+static BOOL in_bounds(const image_t* image, uint64_t offset, uint64_t size)
+{
+	return offset <= image->size && size <= image->size - offset;
+}
+
+static uint16_t read_u16(const unsigned char* p)
+{
+	uint16_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint32_t read_u32(const unsigned char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t read_u64(const unsigned char* p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+// Finds the null-terminated string at offset, returning its length or -1 if it runs past end
+static int64_t string_length(const image_t* image, uint64_t offset, uint64_t end)
+{
+	if (end > image->size || offset >= end)
+		return -1;
+	const char* start = (const char*)image->data + offset;
+	const char* terminator = (const char*)memchr(start, '\0', (SIZE_T)(end - offset));
+	return terminator ? (int64_t)(terminator - start) : -1;
+}
+
+static BOOL builder_add(symbol_builder* builder, const image_t* image, uint64_t nameOffset, SIZE_T nameLength, uint64_t address, uint64_t size, symbol_type type)
+{
+	if (builder->count == builder->capacity)
+	{
+		SIZE_T capacity = builder->capacity ? builder->capacity * 2 : 256;
+		symbol_t* symbols = (symbol_t*)realloc(builder->symbols, capacity * sizeof(symbol_t));
+		if (!symbols)
+			return FALSE;
+		builder->symbols = symbols;
+		builder->capacity = capacity;
+	}
+
+	symbol_t* symbol = &builder->symbols[builder->count];
+	symbol->address = address;
+	symbol->size = size;
+	symbol->name = (uint32_t)builder->names.size;
+	symbol->type = type;
+	if (!byte_vector_append(&builder->names, image->data + nameOffset, nameLength) || !byte_vector_append(&builder->names, "", 1))
+		return FALSE;
+	builder->count++;
+	return TRUE;
+}
+
+#define ELF_PT_LOAD 1
+#define ELF_SHT_SYMTAB 2
+#define ELF_SHT_DYNSYM 11
+#define ELF_SHN_UNDEF 0
+#define ELF_SHN_LORESERVE 0xff00
+
+/**
+Adds the defined symbols of the .symtab and .dynsym sections. Addresses are
+made relative to the lowest PT_LOAD segment, which is where the first
+mapping of the file (the base of the module) is.
+*/
+static const char* parse_elf(const image_t* image, symbol_builder* builder)
+{
+	const unsigned char* d = image->data;
+	if (image->size < 0x40)
+		return "truncated ELF file";
+	if ((d[4] != 1 && d[4] != 2) || d[5] != 1)
+		return "unsupported ELF file (only little-endian files are supported)";
+
+	BOOL is64 = d[4] == 2;
+	uint64_t phoff = is64 ? read_u64(d + 0x20) : read_u32(d + 0x1c);
+	uint64_t shoff = is64 ? read_u64(d + 0x28) : read_u32(d + 0x20);
+	unsigned phentsize = read_u16(d + (is64 ? 0x36 : 0x2a));
+	unsigned phnum = read_u16(d + (is64 ? 0x38 : 0x2c));
+	unsigned shentsize = read_u16(d + (is64 ? 0x3a : 0x2e));
+	unsigned shnum = read_u16(d + (is64 ? 0x3c : 0x30));
+	unsigned i;
+
+	uint64_t base = (uint64_t)-1;
+	for (i = 0; i < phnum; i++)
+	{
+		uint64_t ph = phoff + (uint64_t)i * phentsize;
+		if (phentsize < (is64 ? 0x38u : 0x20u) || !in_bounds(image, ph, phentsize))
+			return "malformed ELF program headers";
+		if (read_u32(d + ph) != ELF_PT_LOAD)
+			continue;
+		uint64_t vaddr = is64 ? read_u64(d + ph + 0x10) : read_u32(d + ph + 0x08);
+		if (vaddr < base)
+			base = vaddr;
+	}
+	if (base == (uint64_t)-1)
+		base = 0;
+	base &= ~(uint64_t)0xfff;
+
+	if (shnum && (shentsize < (is64 ? 0x40u : 0x28u) || !in_bounds(image, shoff, (uint64_t)shnum * shentsize)))
+		return "malformed ELF section headers";
+
+	for (i = 0; i < shnum; i++)
+	{
+		const unsigned char* sh = d + shoff + (uint64_t)i * shentsize;
+		uint32_t type = read_u32(sh + 4);
+		if (type != ELF_SHT_SYMTAB && type != ELF_SHT_DYNSYM)
+			continue;
+
+		uint64_t offset = is64 ? read_u64(sh + 0x18) : read_u32(sh + 0x10);
+		uint64_t size = is64 ? read_u64(sh + 0x20) : read_u32(sh + 0x14);
+		uint32_t link = read_u32(sh + (is64 ? 0x28 : 0x18));
+		uint64_t entsize = is64 ? read_u64(sh + 0x38) : read_u32(sh + 0x24);
+		if (link >= shnum || entsize < (is64 ? 24u : 16u) || !in_bounds(image, offset, size))
+			return "malformed ELF symbol table";
+
+		const unsigned char* strtab = d + shoff + (uint64_t)link * shentsize;
+		uint64_t strOffset = is64 ? read_u64(strtab + 0x18) : read_u32(strtab + 0x10);
+		uint64_t strSize = is64 ? read_u64(strtab + 0x20) : read_u32(strtab + 0x14);
+		if (!in_bounds(image, strOffset, strSize))
+			return "malformed ELF string table";
+
+		uint64_t j, count = size / entsize;
+		for (j = 0; j < count; j++)
+		{
+			const unsigned char* sym = d + offset + j * entsize;
+			uint32_t name = read_u32(sym);
+			unsigned char info = sym[is64 ? 4 : 12];
+			uint16_t shndx = read_u16(sym + (is64 ? 6 : 14));
+			uint64_t value = is64 ? read_u64(sym + 8) : read_u32(sym + 4);
+			uint64_t symSize = is64 ? read_u64(sym + 16) : read_u32(sym + 8);
+			symbol_type symType;
+
+			if (shndx == ELF_SHN_UNDEF || shndx >= ELF_SHN_LORESERVE || name == 0 || value < base)
+				continue;
+			switch (info & 0xf)
+			{
+			case 0: symType = SYMBOL_OTHER; break; // STT_NOTYPE
+			case 1: symType = SYMBOL_OBJECT; break; // STT_OBJECT
+			case 2: // STT_FUNC
+			case 10: symType = SYMBOL_FUNCTION; break; // STT_GNU_IFUNC
+			default: continue; // sections, files, TLS and so on don't have an address
+			}
+
+			int64_t length = string_length(image, strOffset + name, strOffset + strSize);
+			if (length <= 0)
+				continue;
+			if (!builder_add(builder, image, strOffset + name, (SIZE_T)length, value - base, symSize, symType))
+				return "not enough memory";
+		}
+	}
+	return NULL;
+}
+
+#define PE_SCN_MEM_EXECUTE 0x20000000
+
+typedef struct {
+	const image_t* image;
+	uint64_t sections;
+	unsigned sectionCount;
+} pe_image;
+
+// Finds the file offset of an RVA, and whether its section is executable
+static BOOL pe_rva_to_offset(const pe_image* pe, uint32_t rva, uint64_t* offset, BOOL* executable)
+{
+	unsigned i;
+	for (i = 0; i < pe->sectionCount; i++)
+	{
+		const unsigned char* section = pe->image->data + pe->sections + i * 40;
+		uint32_t virtualSize = read_u32(section + 8);
+		uint32_t virtualAddress = read_u32(section + 12);
+		uint32_t rawSize = read_u32(section + 16);
+		uint32_t rawOffset = read_u32(section + 20);
+		uint32_t span = virtualSize ? virtualSize : rawSize;
+		if (rva >= virtualAddress && rva - virtualAddress < span)
+		{
+			*offset = (uint64_t)rawOffset + (rva - virtualAddress);
+			if (executable)
+				*executable = (read_u32(section + 36) & PE_SCN_MEM_EXECUTE) != 0;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/**
+Adds the named exports of the export directory. Export addresses are RVAs,
+i.e. already relative to the base of the module. Forwarded exports (which
+are implemented by another module) are skipped.
+*/
+static const char* parse_pe(const image_t* image, symbol_builder* builder)
+{
+	const unsigned char* d = image->data;
+	pe_image pe;
+	uint32_t i;
+
+	if (image->size < 0x40)
+		return "truncated PE file";
+	uint64_t coff = (uint64_t)read_u32(d + 0x3c) + 4;
+	if (!in_bounds(image, coff - 4, 24 + 2) || memcmp(d + coff - 4, "PE\0\0", 4) != 0)
+		return "malformed PE header";
+
+	pe.image = image;
+	pe.sectionCount = read_u16(d + coff + 2);
+	uint16_t optionalSize = read_u16(d + coff + 16);
+	uint64_t optional = coff + 20;
+	pe.sections = optional + optionalSize;
+	if (!in_bounds(image, optional, optionalSize) || !in_bounds(image, pe.sections, (uint64_t)pe.sectionCount * 40))
+		return "malformed PE header";
+
+	uint16_t magic = read_u16(d + optional);
+	if (magic != 0x10b && magic != 0x20b)
+		return "unsupported PE optional header";
+	uint64_t directories = optional + (magic == 0x20b ? 112 : 96);
+	if (directories + 8 > optional + optionalSize || read_u32(d + directories - 4) < 1)
+		return NULL; // no export directory
+
+	uint32_t exportRva = read_u32(d + directories);
+	uint32_t exportSize = read_u32(d + directories + 4);
+	uint64_t dir;
+	if (!exportRva)
+		return NULL;
+	if (!pe_rva_to_offset(&pe, exportRva, &dir, NULL) || !in_bounds(image, dir, 40))
+		return "malformed PE export directory";
+
+	uint32_t functionCount = read_u32(d + dir + 20);
+	uint32_t nameCount = read_u32(d + dir + 24);
+	uint64_t functions, names, ordinals;
+	if (!pe_rva_to_offset(&pe, read_u32(d + dir + 28), &functions, NULL) || !in_bounds(image, functions, (uint64_t)functionCount * 4)
+		|| !pe_rva_to_offset(&pe, read_u32(d + dir + 32), &names, NULL) || !in_bounds(image, names, (uint64_t)nameCount * 4)
+		|| !pe_rva_to_offset(&pe, read_u32(d + dir + 36), &ordinals, NULL) || !in_bounds(image, ordinals, (uint64_t)nameCount * 2))
+	{
+		// a DLL without named exports can leave the name tables out
+		if (nameCount == 0)
+			return NULL;
+		return "malformed PE export directory";
+	}
+
+	for (i = 0; i < nameCount; i++)
+	{
+		uint16_t ordinal = read_u16(d + ordinals + (uint64_t)i * 2);
+		uint64_t nameOffset;
+		BOOL executable;
+		if (ordinal >= functionCount)
+			continue;
+
+		uint32_t rva = read_u32(d + functions + (uint64_t)ordinal * 4);
+		if (rva - exportRva < exportSize || !pe_rva_to_offset(&pe, read_u32(d + names + (uint64_t)i * 4), &nameOffset, NULL))
+			continue;
+
+		int64_t length = string_length(image, nameOffset, image->size);
+		if (length <= 0)
+			continue;
+		uint64_t unused;
+		if (!pe_rva_to_offset(&pe, rva, &unused, &executable))
+			executable = FALSE;
+		if (!builder_add(builder, image, nameOffset, (SIZE_T)length, rva, 0, executable ? SYMBOL_FUNCTION : SYMBOL_OBJECT))
+			return "not enough memory";
+	}
+	return NULL;
+}
+
+// Building the table
+
+static uint32_t hash_name(const char* name)
+{
+	uint32_t hash = 2166136261u;
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	return hash;
+}
+
+static int compare_symbols(const void* a, const void* b)
+{
+	const symbol_t* x = (const symbol_t*)a;
+	const symbol_t* y = (const symbol_t*)b;
+	if (x->address != y->address)
+		return x->address < y->address ? -1 : 1;
+	if (x->name != y->name)
+		return x->name < y->name ? -1 : 1;
+	return 0;
+}
+
+/**
+Indexes the names of the symbols. A name that's already in the index keeps
+its first (lowest) address; if removeDuplicates is set, later symbols with
+the same name and address (an ELF symbol in both .dynsym and .symtab) are
+marked as removed.
+*/
+static void symbols_index(symbols_t* symbols, BOOL removeDuplicates)
+{
+	SIZE_T i;
+	memset(symbols->index, 0, symbols->indexSize * sizeof(uint32_t));
+	for (i = 0; i < symbols->count; i++)
+	{
+		symbol_t* symbol = &symbols->symbols[i];
+		const char* name = symbols->names + symbol->name;
+		SIZE_T slot = hash_name(name) & (symbols->indexSize - 1);
+		BOOL found = FALSE;
+
+		while (symbols->index[slot])
+		{
+			const symbol_t* other = &symbols->symbols[symbols->index[slot] - 1];
+			if (strcmp(symbols->names + other->name, name) == 0)
+			{
+				found = TRUE;
+				if (removeDuplicates && other->address == symbol->address)
+					symbol->type = SYMBOL_REMOVED;
+				break;
+			}
+			slot = (slot + 1) & (symbols->indexSize - 1);
+		}
+		if (!found)
+			symbols->index[slot] = (uint32_t)i + 1;
+	}
+}
+
+static BOOL symbols_build(symbols_t* symbols, symbol_builder* builder)
+{
+	SIZE_T i, kept = 0;
+
+	symbols->symbols = builder->symbols;
+	symbols->count = builder->count;
+	symbols->names = (char*)builder->names.data;
+	builder->symbols = NULL;
+	builder->names.data = NULL;
+	if (symbols->count >= 0x7fffffff)
+		return FALSE;
+
+	symbols->indexSize = 16;
+	while (symbols->indexSize < symbols->count * 2)
+		symbols->indexSize *= 2;
+	symbols->index = (uint32_t*)malloc(symbols->indexSize * sizeof(uint32_t));
+	if (!symbols->index)
+		return FALSE;
+
+	qsort(symbols->symbols, symbols->count, sizeof(symbol_t), compare_symbols);
+	symbols_index(symbols, TRUE);
+	for (i = 0; i < symbols->count; i++)
+	{
+		if (symbols->symbols[i].type != SYMBOL_REMOVED)
+			symbols->symbols[kept++] = symbols->symbols[i];
+	}
+	if (kept != symbols->count)
+	{
+		symbols->count = kept;
+		symbols_index(symbols, FALSE);
+	}
+	return TRUE;
+}
+
+// Parses the file, returning an error message on failure
+static const char* symbols_parse(symbols_t* symbols, const image_t* image)
+{
+	symbol_builder builder;
+	const char* err;
+
+	memset(&builder, 0, sizeof(builder));
+	if (image->size >= 4 && memcmp(image->data, "\177ELF", 4) == 0)
+		err = parse_elf(image, &builder);
+	else if (image->size >= 2 && memcmp(image->data, "MZ", 2) == 0)
+		err = parse_pe(image, &builder);
+	else
+		err = "not an ELF or PE file";
+
+	if (!err && !symbols_build(symbols, &builder))
+		err = "not enough memory";
+	free(builder.symbols);
+	free(builder.names.data);
+	return err;
+}
+
+static const symbol_t* symbols_find(const symbols_t* symbols, const char* name)
+{
+	SIZE_T slot = hash_name(name) & (symbols->indexSize - 1);
+	while (symbols->index[slot])
+	{
+		const symbol_t* symbol = &symbols->symbols[symbols->index[slot] - 1];
+		if (strcmp(symbols->names + symbol->name, name) == 0)
+			return symbol;
+		slot = (slot + 1) & (symbols->indexSize - 1);
+	}
+	return NULL;
+}
+
+// Finds the symbol with the highest address at or below address, preferring one whose size covers it
+static const symbol_t* symbols_nearest(const symbols_t* symbols, uint64_t address)
+{
+	SIZE_T lo = 0, hi = symbols->count;
+	while (lo < hi)
+	{
+		SIZE_T mid = lo + (hi - lo) / 2;
+		if (symbols->symbols[mid].address <= address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return NULL;
+
+	// a sized symbol covering the address (a function) is better than an unsized label after its start
+	const symbol_t* nearest = &symbols->symbols[lo - 1];
+	SIZE_T i;
+	for (i = lo; i-- > 0 && symbols->symbols[i].address + 64 * 1024 > address;)
+	{
+		const symbol_t* symbol = &symbols->symbols[i];
+		if (symbol->size && address - symbol->address < symbol->size)
+			return symbol;
+	}
+	return nearest;
+}
+
+// Lua
+
+/**
+Pushes the symbol table of the module's file, from the cache if its file
+hasn't changed, or pushes nil and an error message and returns NULL.
+*/
+static symbols_t* push_module_symbols(lua_State *L, const module_t* module)
+{
+	uint64_t now = platform_time_us();
+	uint64_t mtime, size;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, SYMBOL_CACHE);
+	if (!lua_istable(L, -1))
+	{
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, SYMBOL_CACHE);
+	}
+	int cache = lua_gettop(L);
+
+	lua_getfield(L, cache, module->path);
+	symbols_t* symbols = lua_type(L, -1) == LUA_TUSERDATA ? (symbols_t*)lua_touserdata(L, -1) : NULL;
+	if (symbols && now - symbols->checked < SYMBOLS_RECHECK_US)
+	{
+		lua_remove(L, cache);
+		return symbols;
+	}
+	if (!platform_file_info(module->path, &mtime, &size))
+	{
+		push_last_error(L);
+		return NULL;
+	}
+	if (symbols && symbols->mtime == mtime && symbols->fileSize == size)
+	{
+		symbols->checked = now;
+		lua_remove(L, cache);
+		return symbols;
+	}
+	lua_pop(L, 1);
+
+	symbols = (symbols_t*)lua_newuserdata(L, sizeof(symbols_t));
+	memset(symbols, 0, sizeof(symbols_t));
+	luaL_getmetatable(L, SYMBOLS_T);
+	lua_setmetatable(L, -2);
+
+	mapped_file_t file;
+	if (!platform_map_file(module->path, &file))
+	{
+		push_last_error(L);
+		return NULL;
+	}
+	image_t image = { (const unsigned char*)file.data, file.size };
+	const char* err = symbols_parse(symbols, &image);
+	platform_unmap_file(&file);
+	if (err)
+	{
+		symbols_free(symbols);
+		push_error(L, lua_pushfstring(L, "%s: %s", module->path, err));
+		return NULL;
+	}
+
+	symbols->mtime = mtime;
+	symbols->fileSize = size;
+	symbols->checked = now;
+	lua_pushvalue(L, -1);
+	lua_setfield(L, cache, module->path);
+	lua_remove(L, cache);
+	return symbols;
+}
+
+/**
+module:symbol(name)
+
+Returns the address and size (0 if unknown) of the symbol, or nil and an
+error message if the module has no symbol of that name.
+*/
+int module_symbol(lua_State *L)
+{
+	module_t* module = check_module(L, 1);
+	const char* name = luaL_checkstring(L, 2);
+	symbols_t* symbols = push_module_symbols(L, module);
+	if (!symbols)
+		return 2;
+
+	const symbol_t* symbol = symbols_find(symbols, name);
+	if (!symbol)
+		return push_error(L, lua_pushfstring(L, "symbol '%s' not found in %s", name, module->name));
+
+	push_address(L, (char*)module->handle + symbol->address);
+	lua_pushnumber(L, (lua_Number)symbol->size);
+	return 2;
+}
+
+static void push_symbol(lua_State *L, const module_t* module, const symbols_t* symbols, const symbol_t* symbol)
+{
+	lua_createtable(L, 0, 4);
+	lua_pushstring(L, symbols->names + symbol->name);
+	lua_setfield(L, -2, "name");
+	push_address(L, (char*)module->handle + symbol->address);
+	lua_setfield(L, -2, "address");
+	lua_pushnumber(L, (lua_Number)symbol->size);
+	lua_setfield(L, -2, "size");
+	lua_pushstring(L, symbol_type_names[symbol->type]);
+	lua_setfield(L, -2, "type");
+}
+
+/**
+module:symbols()
+
+Returns an array of {name, address, size, type} tables for every symbol,
+sorted by address.
+*/
+int module_symbols(lua_State *L)
+{
+	module_t* module = check_module(L, 1);
+	symbols_t* symbols = push_module_symbols(L, module);
+	if (!symbols)
+		return 2;
+
+	SIZE_T i;
+	lua_createtable(L, (int)symbols->count, 0);
+	for (i = 0; i < symbols->count; i++)
+	{
+		push_symbol(L, module, symbols, &symbols->symbols[i]);
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+	return 1;
+}
+
+/**
+module:symbolat(address)
+
+Returns the name of the symbol nearest below address (preferring one whose
+size covers it) and the offset of address from it, or nil if address isn't
+in the module or comes before its first symbol.
+*/
+int module_symbol_at(lua_State *L)
+{
+	module_t* module = check_module(L, 1);
+	const char* address = (const char*)memaddress_checkptr(L, 2);
+	if (address < (const char*)module->handle || (SIZE_T)(address - (const char*)module->handle) >= module->size)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	symbols_t* symbols = push_module_symbols(L, module);
+	if (!symbols)
+		return 2;
+
+	uint64_t offset = (uint64_t)(address - (const char*)module->handle);
+	const symbol_t* symbol = symbols_nearest(symbols, offset);
+	if (!symbol)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushstring(L, symbols->names + symbol->name);
+	lua_pushinteger(L, (lua_Integer)(offset - symbol->address));
+	return 2;
+}
+
+static int symbols_gc(lua_State *L)
+{
+	symbols_t* symbols = (symbols_t*)luaL_checkudata(L, 1, SYMBOLS_T);
+	symbols_free(symbols);
+	return 0;
+}
+
+static const luaL_Reg symbols_meta[] = {
+	{ "__gc", symbols_gc },
+	{ NULL, NULL }
+};
+static const luaL_Reg symbols_methods[] = {
+	{ NULL, NULL }
+};
+static udata_field_info symbols_getters[] = {
+	{ NULL, NULL }
+};
+static udata_field_info symbols_setters[] = {
+	{ NULL, NULL }
+};
+
+int register_symbols(lua_State *L)
+{
+	UDATA_REGISTER_TYPE_WITH_FIELDS(symbols, SYMBOLS_T)
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef MEMREADER_SYMBOLS_H
+#define MEMREADER_SYMBOLS_H
+
+#include "memreader.h"
+#include "module.h"
+
+#define SYMBOLS_T MEMREADER_METATABLE(symbols)
+
+// How long a cached symbol table is trusted before its file is checked for changes again
+#define SYMBOLS_RECHECK_US 1000000
+
+typedef enum {
+	SYMBOL_FUNCTION,
+	SYMBOL_OBJECT,
+	SYMBOL_OTHER
+} symbol_type;
+
+typedef struct {
+	uint64_t address; // relative to the base of the module
+	uint64_t size; // 0 if unknown
+	uint32_t name; // offset into the names of the table
+	uint32_t type;
+} symbol_t;
+
+/**
+The symbols of a module's file (ELF .dynsym and .symtab, or PE exports),
+sorted by address for nearest-symbol lookups, with an open-addressing hash
+index of the names for lookups by name. Tables are cached per path, and
+reparsed when the file's modification time or size changes.
+*/
+typedef struct {
+	uint64_t mtime;
+	uint64_t fileSize;
+	uint64_t checked; // when the file was last checked, from platform_time_us
+	symbol_t* symbols;
+	SIZE_T count;
+	char* names;
+	uint32_t* index; // symbol index + 1 for each slot, 0 for an empty slot
+	SIZE_T indexSize;
+} symbols_t;
+
+int module_symbol(lua_State *L);
+int module_symbols(lua_State *L);
+int module_symbol_at(lua_State *L);
+
+int register_symbols(lua_State *L);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,285 @@
+#include "threadpool.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+void pool_mutex_init(pool_mutex_t* mutex)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(mutex);
+#else
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void pool_mutex_destroy(pool_mutex_t* mutex)
+{
+#ifdef _WIN32
+	DeleteCriticalSection(mutex);
+#else
+	pthread_mutex_destroy(mutex);
+#endif
+}
+
+void pool_mutex_lock(pool_mutex_t* mutex)
+{
+#ifdef _WIN32
+	EnterCriticalSection(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+void pool_mutex_unlock(pool_mutex_t* mutex)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+void pool_cond_init(pool_cond_t* cond)
+{
+#ifdef _WIN32
+	InitializeConditionVariable(cond);
+#else
+	pthread_cond_init(cond, NULL);
+#endif
+}
+
+void pool_cond_destroy(pool_cond_t* cond)
+{
+#ifdef _WIN32
+	(void)cond;
+#else
+	pthread_cond_destroy(cond);
+#endif
+}
+
+void pool_cond_wait(pool_cond_t* cond, pool_mutex_t* mutex)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+	pthread_cond_wait(cond, mutex);
+#endif
+}
+
+void pool_cond_signal(pool_cond_t* cond)
+{
+#ifdef _WIN32
+	WakeConditionVariable(cond);
+#else
+	pthread_cond_signal(cond);
+#endif
+}
+
+void pool_cond_broadcast(pool_cond_t* cond)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(cond);
+#else
+	pthread_cond_broadcast(cond);
+#endif
+}
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID arg)
+#else
+static void* thread_main(void* arg)
+#endif
+{
+	pool_thread_t* thread = (pool_thread_t*)arg;
+	thread->fn(thread->arg);
+	return 0;
+}
+
+BOOL pool_thread_start(pool_thread_t* thread, void(*fn)(void* arg), void* arg)
+{
+	thread->fn = fn;
+	thread->arg = arg;
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL);
+	thread->started = thread->handle != NULL;
+#else
+	thread->started = pthread_create(&thread->handle, NULL, thread_main, thread) == 0;
+#endif
+	return thread->started;
+}
+
+void pool_thread_join(pool_thread_t* thread)
+{
+	if (!thread->started)
+		return;
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+	thread->started = FALSE;
+}
+
+int pool_default_workers(void)
+{
+	static int workers = 0;
+	if (workers == 0)
+	{
+		int count;
+		const char* env = getenv("MEMREADER_WORKERS");
+		if (env && atoi(env) > 0)
+			count = atoi(env);
+		else
+		{
+#ifdef _WIN32
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			count = (int)info.dwNumberOfProcessors;
+#else
+			count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		}
+		if (count < 1) count = 1;
+		if (count > POOL_MAX_WORKERS) count = POOL_MAX_WORKERS;
+		workers = count;
+	}
+	return workers;
+}
+
+int pool_check_workers(lua_State *L, int index)
+{
+	if (lua_isnoneornil(L, index))
+		return pool_default_workers();
+
+	lua_Integer workers = luaL_checkinteger(L, index);
+	luaL_argcheck(L, workers >= 1, index, "worker count must be at least 1");
+	return workers > POOL_MAX_WORKERS ? POOL_MAX_WORKERS : (int)workers;
+}
+
+// The tasks a worker has left, [next, end). Padded so that queues don't share a cache line.
+typedef struct {
+	pool_mutex_t lock;
+	SIZE_T next;
+	SIZE_T end;
+	char padding[64];
+} pool_queue;
+
+typedef struct {
+	pool_task_fn fn;
+	void* ctx;
+	int workers;
+	pool_queue* queues;
+} pool_job;
+
+typedef struct {
+	pool_job* job;
+	int index;
+} pool_worker;
+
+static BOOL queue_pop(pool_queue* queue, SIZE_T* task)
+{
+	BOOL popped = FALSE;
+	pool_mutex_lock(&queue->lock);
+	if (queue->next < queue->end)
+	{
+		*task = queue->next++;
+		popped = TRUE;
+	}
+	pool_mutex_unlock(&queue->lock);
+	return popped;
+}
+
+static BOOL queue_steal(pool_queue* victim, pool_queue* queue)
+{
+	SIZE_T start, end;
+
+	pool_mutex_lock(&victim->lock);
+	end = victim->end;
+	// take the back half, rounding up so that the last task of a worker that never started is still run
+	start = end - (end - victim->next + 1) / 2;
+	victim->end = start;
+	pool_mutex_unlock(&victim->lock);
+
+	if (start >= end)
+		return FALSE;
+
+	pool_mutex_lock(&queue->lock);
+	queue->next = start;
+	queue->end = end;
+	pool_mutex_unlock(&queue->lock);
+	return TRUE;
+}
+
+static void worker_run(pool_job* job, int index)
+{
+	pool_queue* queue = &job->queues[index];
+	SIZE_T task;
+
+	for (;;)
+	{
+		while (queue_pop(queue, &task))
+			job->fn(job->ctx, index, task);
+
+		// once every queue is empty, there's nothing left to start
+		int i;
+		BOOL stolen = FALSE;
+		for (i = 1; i < job->workers && !stolen; i++)
+			stolen = queue_steal(&job->queues[(index + i) % job->workers], queue);
+		if (!stolen)
+			break;
+	}
+}
+
+static void worker_main(void* arg)
+{
+	pool_worker* worker = (pool_worker*)arg;
+	worker_run(worker->job, worker->index);
+}
+
+void pool_run(int workers, SIZE_T count, pool_task_fn fn, void* ctx)
+{
+	pool_queue queues[POOL_MAX_WORKERS];
+	pool_worker args[POOL_MAX_WORKERS];
+	pool_thread_t threads[POOL_MAX_WORKERS];
+	pool_job job;
+	int i;
+
+	if (workers > POOL_MAX_WORKERS)
+		workers = POOL_MAX_WORKERS;
+	if ((SIZE_T)workers > count)
+		workers = (int)count;
+
+	if (workers <= 1)
+	{
+		SIZE_T task;
+		for (task = 0; task < count; task++)
+			fn(ctx, 0, task);
+		return;
+	}
+
+	job.fn = fn;
+	job.ctx = ctx;
+	job.workers = workers;
+	job.queues = queues;
+	for (i = 0; i < workers; i++)
+	{
+		pool_mutex_init(&queues[i].lock);
+		queues[i].next = count * i / workers;
+		queues[i].end = count * (i + 1) / workers;
+		args[i].job = &job;
+		args[i].index = i;
+	}
+
+	// the calling thread is worker 0
+	for (i = 1; i < workers; i++)
+		pool_thread_start(&threads[i], worker_main, &args[i]);
+	worker_run(&job, 0);
+
+	for (i = 1; i < workers; i++)
+		pool_thread_join(&threads[i]);
+
+	for (i = 0; i < workers; i++)
+		pool_mutex_destroy(&queues[i].lock);
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+#ifndef MEMREADER_THREADPOOL_H
+#define MEMREADER_THREADPOOL_H
+
+#include "memreader.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+// Upper limit on the number of workers of a single pool_run
+#define POOL_MAX_WORKERS 64
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION pool_mutex_t;
+#else
+typedef pthread_mutex_t pool_mutex_t;
+#endif
+
+void pool_mutex_init(pool_mutex_t* mutex);
+void pool_mutex_destroy(pool_mutex_t* mutex);
+void pool_mutex_lock(pool_mutex_t* mutex);
+void pool_mutex_unlock(pool_mutex_t* mutex);
+
+#ifdef _WIN32
+typedef CONDITION_VARIABLE pool_cond_t;
+#else
+typedef pthread_cond_t pool_cond_t;
+#endif
+
+void pool_cond_init(pool_cond_t* cond);
+void pool_cond_destroy(pool_cond_t* cond);
+// Unlocks mutex (which must be locked) while waiting for cond to be signaled
+void pool_cond_wait(pool_cond_t* cond, pool_mutex_t* mutex);
+void pool_cond_signal(pool_cond_t* cond);
+void pool_cond_broadcast(pool_cond_t* cond);
+
+/**
+Loads and stores for sharing a SIZE_T between two threads without a lock:
+the store publishes everything written before it to a thread that sees the
+stored value with the load. MSVC gives volatile accesses these semantics
+(/volatile:ms, its default on x86 and x64).
+*/
+#if defined(_MSC_VER)
+#define POOL_LOAD_ACQUIRE(p) (*(volatile SIZE_T*)(p))
+#define POOL_STORE_RELEASE(p, v) (*(volatile SIZE_T*)(p) = (v))
+#else
+#define POOL_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define POOL_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+// A thread running fn(arg)
+typedef struct {
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	void(*fn)(void* arg);
+	void* arg;
+	BOOL started;
+} pool_thread_t;
+
+// thread must stay valid until it has been joined
+BOOL pool_thread_start(pool_thread_t* thread, void(*fn)(void* arg), void* arg);
+void pool_thread_join(pool_thread_t* thread);
+
+// Runs one task; worker is in [0, workers) and identifies the thread running it
+typedef void(*pool_task_fn)(void* ctx, int worker, SIZE_T task);
+
+/**
+The number of workers used when a call doesn't ask for a specific number:
+the number of CPUs, unless the MEMREADER_WORKERS environment variable is set.
+*/
+int pool_default_workers(void);
+
+// Parses an optional worker count at index, defaulting to pool_default_workers()
+int pool_check_workers(lua_State *L, int index);
+
+/**
+Runs tasks [0, count) on up to workers threads, the calling thread being one
+of them, and returns once they have all finished. Each worker starts with a
+contiguous share of the tasks and works through it front to back; a worker
+that runs out steals the back half of another's remaining tasks. Tasks may
+run in any order, so results that need to be ordered should be stored per
+task and merged afterwards.
+
+If threads can't be created, the remaining workers (at least the calling
+thread) still run every task.
+*/
+void pool_run(int workers, SIZE_T count, pool_task_fn fn, void* ctx);
+
+#endif
\ No newline at end of file
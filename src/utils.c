@@ -1,5 +1,10 @@
 #include "utils.h"
 
+#ifndef _WIN32
+#include <errno.h>
+#include <string.h>
+#endif
+
 // Lua Stack
 
 int push_error(lua_State *L, const char* msg)
@@ -9,6 +14,7 @@ int push_error(lua_State *L, const char* msg)
 	return 2;
 }
 
+#ifdef _WIN32
 int push_last_error(lua_State *L)
 {
 	char err[256];
@@ -21,6 +27,12 @@ int push_last_error(lua_State *L)
 	err[strLen - 2] = '\0'; // strip the \r\n
 	return push_error(L, err);
 }
+#else
+int push_last_error(lua_State *L)
+{
+	return push_error(L, strerror(errno));
+}
+#endif
 
 const char *get_lua_string(lua_State *L, int index)
 {
@@ -33,6 +45,28 @@ const char *get_lua_string(lua_State *L, int index)
 	return s;
 }
 
+// Strings
+
+void copy_string(char* dest, SIZE_T size, const char* src)
+{
+	SIZE_T length = strlen(src);
+	if (size == 0)
+		return;
+	if (length >= size)
+		length = size - 1;
+	memcpy(dest, src, length);
+	dest[length] = '\0';
+}
+
+const char* path_basename(const char* path)
+{
+	const char* slash = strrchr(path, '/');
+	const char* backslash = strrchr(path, '\\');
+	if (backslash > slash)
+		slash = backslash;
+	return slash ? slash + 1 : path;
+}
+
 // Userdata Fields
 
 int udata_field_get_int(lua_State *L, void *v)
@@ -46,6 +80,12 @@ int udata_field_set_int(lua_State *L, void *v)
 	return 0;
 }
 
+int udata_field_get_size(lua_State *L, void *v)
+{
+	lua_pushinteger(L, (lua_Integer)*(SIZE_T*)v);
+	return 1;
+}
+
 int udata_field_get_string(lua_State *L, void *v)
 {
 	lua_pushstring(L, (const char*)v);
@@ -80,14 +120,14 @@ int udata_field_index_handler(lua_State *L)
 {
 	/* stack has userdata, index */
 	lua_pushvalue(L, 2);                     /* dup index */
-	lua_rawget(L, lua_upvalueindex(1));      /* lookup member by name */
-	if (!lua_islightuserdata(L, -1)) {
-		lua_pop(L, 1);                         /* drop value */
-		lua_pushvalue(L, 2);                   /* dup index */
-		lua_gettable(L, lua_upvalueindex(2));  /* else try methods */
+	lua_rawget(L, lua_upvalueindex(1));      /* lookup getter or method by name */
+	if (!lua_islightuserdata(L, -1))
 		return 1; // return either the method or nil
-	}
-	return udata_field_proxy(L);                      /* call get function */
+
+	udata_field_info* m = (udata_field_info*)lua_touserdata(L, -1);
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+	lua_pop(L, 1);                           /* drop lightuserdata */
+	return m->func(L, (void *)((char *)lua_touserdata(L, 1) + m->offset)); /* call get function */
 }
 
 int udata_field_newindex_handler(lua_State *L)
@@ -9,9 +9,17 @@ int push_error(lua_State *L, const char* msg);
 int push_last_error(lua_State *L);
 const char* get_lua_string(lua_State *L, int index);
 
+// Strings
+
+// Copies as much of src as fits into dest (of size chars), always terminating it
+void copy_string(char* dest, SIZE_T size, const char* src);
+// The file name at the end of path, which can have either kind of separator (cores and snapshots can come from Windows)
+const char* path_basename(const char* path);
+
 // Userdata Field Handling
 int udata_field_get_int(lua_State *L, void *v);
 int udata_field_set_int(lua_State *L, void *v);
+int udata_field_get_size(lua_State *L, void *v);
 int udata_field_get_string(lua_State *L, void *v);
 int udata_field_set_string(lua_State *L, void *v);
 
@@ -57,15 +65,15 @@ udata_field_info <name>_setters[]		// contains field setters
 	lua_rawset(L, metatable); /* metatable.__metatable = methods */		\
 																		\
 	lua_pushliteral(L, "__index");										\
-	lua_pushvalue(L, metatable);										\
-	register_udata_fields(L, name##_getters); /* put getters 
-											in the metatable */			\
-	lua_pushvalue(L, methods);											\
+	lua_newtable(L); /* one table for methods and getters, so that		\
+					any field is found with a single lookup */			\
+	luaL_setfuncs(L, name##_methods, 0);								\
+	register_udata_fields(L, name##_getters); /* getters shadow methods */ \
 	/* push udata_field_index_handler with the 
-	metatable and methods as upvalues */								\
-	lua_pushcclosure(L, udata_field_index_handler, 2);					\
+	lookup table as an upvalue */										\
+	lua_pushcclosure(L, udata_field_index_handler, 1);					\
 	lua_rawset(L, metatable); /* metatable.__index = 
-				udata_field_index_handler(metatable, methods) */		\
+				udata_field_index_handler(fields) */					\
 																		\
 	lua_pushliteral(L, "__newindex");									\
 	lua_newtable(L); /* table for setters */							\
@@ -0,0 +1,63 @@
+#include "value.h"
+#include "address.h"
+
+const value_type_info value_types[VALUE_TYPE_COUNT] = {
+	{ "u8", 1 },
+	{ "i8", 1 },
+	{ "u16", 2 },
+	{ "i16", 2 },
+	{ "u32", 4 },
+	{ "i32", 4 },
+	{ "u64", 8 },
+	{ "i64", 8 },
+	{ "f32", 4 },
+	{ "f64", 8 },
+	{ "ptr", sizeof(LPVOID) },
+};
+
+// Before 5.3, lua_Integer can be too small for the larger integer types
+#if LUA_VERSION_NUM >= 503
+#define push_wide_integer(L, v) lua_pushinteger(L, (lua_Integer)(v))
+#else
+#define push_wide_integer(L, v) lua_pushnumber(L, (lua_Number)(v))
+#endif
+
+int push_value(lua_State *L, value_type type, const void* data)
+{
+	switch (type)
+	{
+	case VALUE_U8: { uint8_t v; memcpy(&v, data, sizeof(v)); lua_pushinteger(L, v); break; }
+	case VALUE_I8: { int8_t v; memcpy(&v, data, sizeof(v)); lua_pushinteger(L, v); break; }
+	case VALUE_U16: { uint16_t v; memcpy(&v, data, sizeof(v)); lua_pushinteger(L, v); break; }
+	case VALUE_I16: { int16_t v; memcpy(&v, data, sizeof(v)); lua_pushinteger(L, v); break; }
+	case VALUE_U32: { uint32_t v; memcpy(&v, data, sizeof(v)); push_wide_integer(L, v); break; }
+	case VALUE_I32: { int32_t v; memcpy(&v, data, sizeof(v)); push_wide_integer(L, v); break; }
+	case VALUE_U64: { uint64_t v; memcpy(&v, data, sizeof(v)); push_wide_integer(L, v); break; }
+	case VALUE_I64: { int64_t v; memcpy(&v, data, sizeof(v)); push_wide_integer(L, v); break; }
+	case VALUE_F32: { float v; memcpy(&v, data, sizeof(v)); lua_pushnumber(L, v); break; }
+	case VALUE_F64: { double v; memcpy(&v, data, sizeof(v)); lua_pushnumber(L, v); break; }
+	case VALUE_PTR: { LPVOID ptr; memcpy(&ptr, data, sizeof(ptr)); push_address(L, ptr); break; }
+	default: lua_pushnil(L); break;
+	}
+	return 1;
+}
+
+int push_pointer_value(lua_State *L, const void* data, SIZE_T pointerSize)
+{
+	uint64_t value = 0; // a 32-bit pointer only fills the low bytes
+	memcpy(&value, data, pointerSize < sizeof(value) ? pointerSize : sizeof(value));
+	push_address(L, (LPCVOID)(uintptr_t)value);
+	return 1;
+}
+
+value_type check_value_type(lua_State *L, int index)
+{
+	const char* name = luaL_checkstring(L, index);
+	int i;
+	for (i = 0; i < VALUE_TYPE_COUNT; i++)
+	{
+		if (strcmp(value_types[i].name, name) == 0)
+			return (value_type)i;
+	}
+	return (value_type)luaL_argerror(L, index, lua_pushfstring(L, "invalid value type '%s'", name));
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef MEMREADER_VALUE_H
+#define MEMREADER_VALUE_H
+
+#include "memreader.h"
+
+/**
+The primitive types that memreader knows how to decode, shared by the typed
+reads and everything built on top of them.
+*/
+typedef enum {
+	VALUE_U8,
+	VALUE_I8,
+	VALUE_U16,
+	VALUE_I16,
+	VALUE_U32,
+	VALUE_I32,
+	VALUE_U64,
+	VALUE_I64,
+	VALUE_F32,
+	VALUE_F64,
+	VALUE_PTR,
+	VALUE_TYPE_COUNT
+} value_type;
+
+typedef struct {
+	const char* name;
+	SIZE_T size;
+} value_type_info;
+
+extern const value_type_info value_types[VALUE_TYPE_COUNT];
+
+// Largest size of any value_type
+#define VALUE_MAX_SIZE 8
+
+// Pushes the value of the given type stored at data (which doesn't need to be aligned)
+int push_value(lua_State *L, value_type type, const void* data);
+// Pushes a pointer of the given width (4 or 8 bytes) as a memreader.address
+int push_pointer_value(lua_State *L, const void* data, SIZE_T pointerSize);
+value_type check_value_type(lua_State *L, int index);
+
+#endif
\ No newline at end of file
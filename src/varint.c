@@ -0,0 +1,50 @@
+#include "varint.h"
+
+BOOL byte_vector_append(byte_vector* v, const void* data, SIZE_T size)
+{
+	if (v->size + size > v->capacity)
+	{
+		SIZE_T capacity = v->capacity ? v->capacity * 2 : 256;
+		while (capacity < v->size + size)
+			capacity *= 2;
+		unsigned char* grown = (unsigned char*)realloc(v->data, capacity);
+		if (!grown)
+			return FALSE;
+		v->data = grown;
+		v->capacity = capacity;
+	}
+	memcpy(v->data + v->size, data, size);
+	v->size += size;
+	return TRUE;
+}
+
+BOOL append_varint(byte_vector* v, uint64_t value)
+{
+	unsigned char bytes[10];
+	int n = 0;
+	do
+	{
+		bytes[n] = (unsigned char)(value & 0x7f);
+		value >>= 7;
+		if (value)
+			bytes[n] |= 0x80;
+		n++;
+	}
+	while (value);
+	return byte_vector_append(v, bytes, n);
+}
+
+uint64_t read_varint(const unsigned char** cursor)
+{
+	uint64_t value = 0;
+	int shift = 0;
+	unsigned char byte;
+	do
+	{
+		byte = *(*cursor)++;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		shift += 7;
+	}
+	while (byte & 0x80);
+	return value;
+}
\ No newline at end of file
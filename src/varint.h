@@ -0,0 +1,20 @@
+#ifndef MEMREADER_VARINT_H
+#define MEMREADER_VARINT_H
+
+#include "memreader.h"
+
+// A growable array of bytes
+typedef struct {
+	unsigned char* data;
+	SIZE_T size;
+	SIZE_T capacity;
+} byte_vector;
+
+BOOL byte_vector_append(byte_vector* v, const void* data, SIZE_T size);
+
+// Appends value as a LEB128 varint (7 bits per byte, low bits first)
+BOOL append_varint(byte_vector* v, uint64_t value);
+// Decodes a varint and advances the cursor past it
+uint64_t read_varint(const unsigned char** cursor);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,339 @@
+#include "watch.h"
+#include "address.h"
+
+// The sampler checks for watcher:stop() at least this often, however long the interval is
+#define WATCH_MAX_SLEEP 100000
+
+watcher_t* check_watcher(lua_State *L, int index)
+{
+	watcher_t* watcher = (watcher_t*)luaL_checkudata(L, index, WATCHER_T);
+	return watcher;
+}
+
+static unsigned char* record_at(watcher_t* watcher, SIZE_T index)
+{
+	return watcher->ring + (index & (watcher->capacity - 1)) * watcher->recordSize;
+}
+
+static void watcher_sample(watcher_t* watcher)
+{
+	SIZE_T head = watcher->head;
+	SIZE_T tail = POOL_LOAD_ACQUIRE(&watcher->tail);
+
+	if (head - tail == watcher->capacity)
+	{
+		POOL_STORE_RELEASE(&watcher->dropped, watcher->dropped + 1);
+		return;
+	}
+
+	unsigned char* record = record_at(watcher, head);
+	int i;
+	for (i = 0; i < watcher->itemCount; i++)
+		watcher->requests[i].buffer = record + watcher->items[i].offset;
+
+	platform_readv(watcher->process, watcher->requests, watcher->itemCount);
+
+	uint64_t now = platform_time_us();
+	memcpy(record, &now, sizeof(now));
+	for (i = 0; i < watcher->itemCount; i++)
+		record[sizeof(uint64_t) + i] = watcher->requests[i].bytesRead == watcher->requests[i].size;
+
+	POOL_STORE_RELEASE(&watcher->samples, watcher->samples + 1);
+	POOL_STORE_RELEASE(&watcher->head, head + 1);
+}
+
+/**
+Samples on a fixed schedule (start + n * interval) so that the time spent
+reading doesn't make the rate drift. If sampling falls behind by more than
+an interval, the missed samples are skipped instead of being taken in a
+burst.
+*/
+static void watcher_main(void* arg)
+{
+	watcher_t* watcher = (watcher_t*)arg;
+	uint64_t next = platform_time_us();
+
+	while (!watcher->stopping)
+	{
+		watcher_sample(watcher);
+
+		next += watcher->interval;
+		uint64_t now = platform_time_us();
+		if (now > next + watcher->interval)
+			next = now;
+
+		while (!watcher->stopping && now < next)
+		{
+			platform_sleep_until_us(next - now > WATCH_MAX_SLEEP ? now + WATCH_MAX_SLEEP : next);
+			now = platform_time_us();
+		}
+	}
+}
+
+static void watcher_stop(watcher_t* watcher)
+{
+	watcher->stopping = TRUE;
+	pool_thread_join(&watcher->thread);
+}
+
+static void check_watch_item(lua_State *L, watcher_t* watcher, int spec, int index, watch_item_t* item)
+{
+	int top = lua_gettop(L);
+	lua_rawgeti(L, spec, index);
+	if (!lua_istable(L, -1))
+		luaL_error(L, "bad item #%d to 'watch' (table expected, got %s)", index, luaL_typename(L, -1));
+
+	lua_rawgeti(L, top + 1, 1);
+	lua_rawgeti(L, top + 1, 2);
+	item->address = (LPCVOID)memaddress_checkptr(L, top + 2);
+	if (lua_type(L, top + 3) == LUA_TUSERDATA)
+	{
+		item->schema = check_struct(L, top + 3);
+		item->size = struct_span(item->schema, watcher->process->pointerSize);
+
+		// the refs table keeps the schema alive for as long as the watcher
+		lua_rawgeti(L, LUA_REGISTRYINDEX, watcher->refsRef);
+		lua_pushvalue(L, top + 3);
+		lua_rawseti(L, -2, index);
+	}
+	else
+	{
+		item->schema = NULL;
+		item->type = check_value_type(L, top + 3);
+		item->size = item->type == VALUE_PTR ? watcher->process->pointerSize : value_types[item->type].size;
+	}
+	lua_settop(L, top);
+}
+
+static lua_Integer get_spec_integer(lua_State *L, int spec, const char* name, lua_Integer def)
+{
+	lua_getfield(L, spec, name);
+	lua_Integer value = lua_isnil(L, -1) ? def : (lua_Integer)luaL_checknumber(L, -1);
+	lua_pop(L, 1);
+	return value;
+}
+
+/**
+process:watch(spec)
+
+spec is an array of {address, type} and {address, schema} items, plus the
+optional fields interval_us (the time between samples, in microseconds) and
+capacity (the number of records the ring buffer holds).
+*/
+int process_watch(lua_State *L)
+{
+	process_t* process = check_process(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	lua_Integer interval = get_spec_integer(L, 2, "interval_us", WATCH_DEFAULT_INTERVAL);
+	lua_Integer capacity = get_spec_integer(L, 2, "capacity", WATCH_DEFAULT_CAPACITY);
+	int count = (int)lua_rawlen(L, 2);
+	luaL_argcheck(L, interval > 0, 2, "interval_us must be positive");
+	luaL_argcheck(L, capacity > 0, 2, "capacity must be positive");
+	luaL_argcheck(L, count > 0, 2, "nothing to watch");
+
+	watcher_t* watcher = (watcher_t*)lua_newuserdata(L, sizeof(watcher_t));
+	memset(watcher, 0, sizeof(watcher_t));
+	watcher->refsRef = LUA_NOREF;
+	luaL_getmetatable(L, WATCHER_T);
+	lua_setmetatable(L, -2);
+	int index = lua_gettop(L);
+
+	watcher->process = process;
+	watcher->interval = (uint64_t)interval;
+	watcher->capacity = 1;
+	while (watcher->capacity < (SIZE_T)capacity)
+		watcher->capacity *= 2;
+
+	lua_createtable(L, count, 1);
+	lua_pushvalue(L, 1);
+	lua_setfield(L, -2, "process");
+	watcher->refsRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	watcher->items = (watch_item_t*)malloc(count * sizeof(watch_item_t));
+	watcher->requests = (read_request_t*)malloc(count * sizeof(read_request_t));
+	if (!watcher->items || !watcher->requests)
+		return push_error(L, "not enough memory");
+
+	// the record header is the timestamp and a byte per item, then each item's data is 8-byte aligned
+	SIZE_T offset = (sizeof(uint64_t) + count + 7) & ~(SIZE_T)7;
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		watch_item_t* item = &watcher->items[i];
+		check_watch_item(L, watcher, 2, i + 1, item);
+		watcher->itemCount = i + 1;
+		item->offset = offset;
+		offset = (offset + item->size + 7) & ~(SIZE_T)7;
+
+		watcher->requests[i].address = item->address;
+		watcher->requests[i].size = item->size;
+	}
+	watcher->recordSize = offset;
+
+	watcher->ring = (unsigned char*)malloc(watcher->capacity * watcher->recordSize);
+	if (!watcher->ring)
+		return push_error(L, "not enough memory");
+
+	if (!pool_thread_start(&watcher->thread, watcher_main, watcher))
+		return push_error(L, "couldn't start the sampler thread");
+
+	lua_pushvalue(L, index);
+	return 1;
+}
+
+// Decodes an item of a record into the table at tableIndex (structs) or onto the stack (values)
+static void push_item(lua_State *L, watcher_t* watcher, watch_item_t* item, const unsigned char* data, int tableIndex)
+{
+	if (item->schema)
+	{
+		struct_decode(L, item->schema, (const char*)data, watcher->process->pointerSize, tableIndex);
+		return;
+	}
+	if (item->type == VALUE_PTR)
+		push_pointer_value(L, data, watcher->process->pointerSize);
+	else
+		push_value(L, item->type, data);
+}
+
+/**
+watcher:poll([records[, max]])
+
+Moves up to max records (default: all of them) out of the ring buffer into
+the records array, reusing the tables already in it. Each record has a time
+field (in microseconds, from a monotonic clock) and the item values at
+[1..n], false for items that couldn't be read. Returns the number of
+records and the array.
+*/
+static int watcher_poll(lua_State *L)
+{
+	watcher_t* watcher = check_watcher(L, 1);
+	lua_Integer max = luaL_optinteger(L, 3, 0);
+
+	if (lua_isnoneornil(L, 2))
+	{
+		lua_settop(L, 1);
+		lua_newtable(L);
+	}
+	else
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+		lua_settop(L, 2);
+	}
+
+	SIZE_T tail = watcher->tail;
+	SIZE_T head = POOL_LOAD_ACQUIRE(&watcher->head);
+	SIZE_T available = head - tail;
+	if (max > 0 && (SIZE_T)max < available)
+		available = (SIZE_T)max;
+
+	SIZE_T n;
+	for (n = 0; n < available; n++)
+	{
+		const unsigned char* record = record_at(watcher, tail + n);
+
+		lua_rawgeti(L, 2, (int)n + 1);
+		if (!lua_istable(L, -1))
+		{
+			lua_pop(L, 1);
+			lua_createtable(L, watcher->itemCount, 1);
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, 2, (int)n + 1);
+		}
+		int recordIndex = lua_gettop(L);
+
+		uint64_t time;
+		memcpy(&time, record, sizeof(time));
+		lua_pushnumber(L, (lua_Number)time);
+		lua_setfield(L, recordIndex, "time");
+
+		int i;
+		for (i = 0; i < watcher->itemCount; i++)
+		{
+			watch_item_t* item = &watcher->items[i];
+			if (!record[sizeof(uint64_t) + i])
+				lua_pushboolean(L, FALSE);
+			else if (item->schema)
+			{
+				lua_rawgeti(L, recordIndex, i + 1);
+				if (!lua_istable(L, -1))
+				{
+					lua_pop(L, 1);
+					lua_createtable(L, 0, item->schema->count);
+				}
+				push_item(L, watcher, item, record + item->offset, lua_gettop(L));
+			}
+			else
+				push_item(L, watcher, item, record + item->offset, 0);
+			lua_rawseti(L, recordIndex, i + 1);
+		}
+		lua_pop(L, 1);
+	}
+
+	// only now can the sampler reuse the slots
+	POOL_STORE_RELEASE(&watcher->tail, tail + n);
+
+	lua_pushinteger(L, (lua_Integer)n);
+	lua_pushvalue(L, 2);
+	return 2;
+}
+
+// watcher:stop() stops the sampler; records that were already taken can still be polled
+static int watcher_stop_method(lua_State *L)
+{
+	watcher_t* watcher = check_watcher(L, 1);
+	watcher_stop(watcher);
+	return 0;
+}
+
+static int watcher_gc(lua_State *L)
+{
+	watcher_t* watcher = check_watcher(L, 1);
+	watcher_stop(watcher);
+	free(watcher->items);
+	free(watcher->requests);
+	free(watcher->ring);
+	watcher->items = NULL;
+	watcher->requests = NULL;
+	watcher->ring = NULL;
+	luaL_unref(L, LUA_REGISTRYINDEX, watcher->refsRef);
+	watcher->refsRef = LUA_NOREF;
+	return 0;
+}
+
+static int watcher_len(lua_State *L)
+{
+	watcher_t* watcher = check_watcher(L, 1);
+	lua_pushinteger(L, (lua_Integer)(POOL_LOAD_ACQUIRE(&watcher->head) - watcher->tail));
+	return 1;
+}
+
+static int udata_field_get_counter(lua_State *L, void *v)
+{
+	lua_pushnumber(L, (lua_Number)POOL_LOAD_ACQUIRE((SIZE_T*)v));
+	return 1;
+}
+
+static const luaL_Reg watcher_meta[] = {
+	{ "__gc", watcher_gc },
+	{ "__len", watcher_len },
+	{ NULL, NULL }
+};
+static const luaL_Reg watcher_methods[] = {
+	{ "poll", watcher_poll },
+	{ "stop", watcher_stop_method },
+	{ NULL, NULL }
+};
+static udata_field_info watcher_getters[] = {
+	{ "samples", udata_field_get_counter, offsetof(watcher_t, samples) },
+	{ "dropped", udata_field_get_counter, offsetof(watcher_t, dropped) },
+	{ NULL, NULL }
+};
+static udata_field_info watcher_setters[] = {
+	{ NULL, NULL }
+};
+
+int register_watcher(lua_State *L)
+{
+	UDATA_REGISTER_TYPE_WITH_FIELDS(watcher, WATCHER_T)
+}
\ No newline at end of file
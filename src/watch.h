@@ -0,0 +1,58 @@
+#ifndef MEMREADER_WATCH_H
+#define MEMREADER_WATCH_H
+
+#include "memreader.h"
+#include "process.h"
+#include "platform.h"
+#include "struct.h"
+#include "threadpool.h"
+
+#define WATCHER_T MEMREADER_METATABLE(watcher)
+
+#define WATCH_DEFAULT_INTERVAL 1000
+#define WATCH_DEFAULT_CAPACITY 1024
+
+// One value or struct that's sampled
+typedef struct {
+	LPCVOID address;
+	value_type type;
+	struct_t* schema; // NULL for a single value of type
+	SIZE_T size; // bytes read
+	SIZE_T offset; // of its data within a record
+} watch_item_t;
+
+/**
+A sampler thread that reads a fixed set of items every interval and pushes
+the results into a single-producer/single-consumer ring buffer of records,
+which watcher:poll() drains on the Lua thread. The sampler only writes head
+and the consumer only writes tail, so neither side takes a lock. When the
+ring is full, samples are dropped (and counted) rather than overwriting
+records that haven't been polled yet.
+
+A record is the sample's timestamp (uint64_t), one byte per item telling
+whether it could be read, then the data of every item.
+*/
+typedef struct {
+	process_t* process;
+	int refsRef; // a table keeping the process and struct schemas alive
+	watch_item_t* items;
+	int itemCount;
+	read_request_t* requests; // only used by the sampler
+	uint64_t interval; // microseconds
+	unsigned char* ring;
+	SIZE_T recordSize;
+	SIZE_T capacity; // in records, a power of two
+	SIZE_T head; // records written, only advanced by the sampler
+	SIZE_T tail; // records consumed, only advanced by poll
+	SIZE_T samples;
+	SIZE_T dropped;
+	volatile BOOL stopping;
+	pool_thread_t thread;
+} watcher_t;
+
+watcher_t* check_watcher(lua_State *L, int index);
+
+int process_watch(lua_State *L);
+int register_watcher(lua_State *L);
+
+#endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "window.h"
 
+#ifdef _WIN32
+
 window_t* push_window(lua_State *L)
 {
 	window_t *window = (window_t*)lua_newuserdata(L, sizeof(window_t));
@@ -36,4 +38,6 @@ static udata_field_info window_setters[] = {
 int register_window(lua_State *L)
 {
 	UDATA_REGISTER_TYPE_WITH_FIELDS(window, WINDOW_T)
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 #include "memreader.h"
 
+#ifdef _WIN32
+
 #define WINDOW_T MEMREADER_METATABLE(window)
 
 typedef struct {
@@ -15,4 +17,6 @@ void init_window(window_t * window, HWND handle, const TCHAR* title);
 int register_window(lua_State *L);
 window_t* push_window(lua_State *L);
 
+#endif
+
 #endif
\ No newline at end of file